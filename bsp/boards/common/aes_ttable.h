@@ -0,0 +1,47 @@
+/**
+\brief Definitions for the 32-bit T-table AES implementation
+*/
+#ifndef __AES_TTABLE_H__
+#define __AES_TTABLE_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+//=========================== define ==========================================
+
+/**
+\brief Number of expanded keys kept, 180 bytes of RAM each. Can be overwritten
+   in board_info.h.
+
+IEEE802.15.4 security uses one key for beacons and one for data frames, so two
+entries mean the key schedule is only computed again when a key changes.
+*/
+#ifndef AES_TTABLE_KEYCACHE_SIZE
+#define AES_TTABLE_KEYCACHE_SIZE     2
+#endif
+
+//=========================== typedef =========================================
+
+typedef struct {
+   bool     used;
+   uint8_t  key[16];
+   uint32_t roundKeys[44];
+} aes_ttable_key_t;
+
+//=========================== module variables ================================
+
+typedef struct {
+   aes_ttable_key_t keys[AES_TTABLE_KEYCACHE_SIZE];
+   uint8_t          nextVictim;
+} aes_ttable_vars_t;
+
+//=========================== prototypes ======================================
+
+owerror_t aes_ttable_enc(uint8_t buffer[16], uint8_t key[16]);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* __AES_TTABLE_H__ */
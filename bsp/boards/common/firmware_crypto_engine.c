@@ -12,6 +12,7 @@
 #include "aes_ctr.h"
 #include "aes_cbc.h"
 #include "aes_ecb.h"
+#include "aes_ttable.h"
 
 static owerror_t init(void) {
    return E_SUCCESS;
@@ -23,7 +24,11 @@ const struct crypto_engine firmware_crypto_engine = {
    aes_ccms_dec,
    aes_cbc_enc_raw,
    aes_ctr_enc_raw,
+#if FIRMWARE_AES_IMPLEMENTATION==FIRMWARE_AES_TTABLE
+   aes_ttable_enc,
+#else
    aes_ecb_enc,
+#endif
    init,
 };
 /*---------------------------------------------------------------------------*/
@@ -13,6 +13,25 @@ extern "C" {
 
 #include "crypto_engine.h"
 
+//=========================== define ==========================================
+
+/**
+\brief Which software AES block cipher the engine uses. Can be overwritten in
+   board_info.h.
+
+- #FIRMWARE_AES_BYTEWISE: aes_ecb.c, byte-wise rounds and the key schedule is
+  computed for every block. Smallest in ROM and RAM.
+- #FIRMWARE_AES_TTABLE:   aes_ttable.c, 32-bit table rounds and the key
+  schedule is cached. Takes 1kB of ROM for the table and 180 bytes of RAM per
+  cached key.
+*/
+#define FIRMWARE_AES_BYTEWISE        0
+#define FIRMWARE_AES_TTABLE          1
+
+#ifndef FIRMWARE_AES_IMPLEMENTATION
+#define FIRMWARE_AES_IMPLEMENTATION  FIRMWARE_AES_TTABLE
+#endif
+
 //=========================== module variables ================================
 
 extern const struct crypto_engine firmware_crypto_engine;   
@@ -21,8 +21,12 @@
 #include "processIE_obj.h"
 #include "sixtop_obj.h"
 #include "schedule_obj.h"
+#include "otf_obj.h"
+#include "iphc_obj.h"
+#include "frag_obj.h"
 #include "icmpv6echo_obj.h"
 #include "icmpv6rpl_obj.h"
+#include "forwarding_obj.h"
 #include "opencoap_obj.h"
 #include "opentcp_obj.h"
 #include "idmanager_obj.h"
@@ -219,10 +223,14 @@ struct OpenMote {
    opencoap_vars_t      opencoap_vars;
    tcp_vars_t           tcp_vars;
    // l3
+   forwarding_vars_t    forwarding_vars;
+   iphc_vars_t          iphc_vars;
+   frag_vars_t          frag_vars;
    // l2b
    sixtop_vars_t        sixtop_vars;
    neighbors_vars_t     neighbors_vars;
    schedule_vars_t      schedule_vars;
+   otf_vars_t           otf_vars;
    // l2a
    adaptive_sync_vars_t adaptive_sync_vars;
    ieee802154_security_vars_t ieee802154_security_vars;
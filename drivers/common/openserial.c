@@ -20,6 +20,9 @@
 #include "openhdlc.h"
 #include "schedule.h"
 #include "icmpv6rpl.h"
+#include "forwarding.h"
+#include "frag.h"
+#include "iphc.h"
 
 
 //=========================== variables =======================================
@@ -360,6 +363,18 @@ void openserial_startOutput() {
          if (debugPrint_kaPeriod()==TRUE) {
             break;
          }
+      case STATUS_ROUTECACHE:
+         if (debugPrint_routeCache()==TRUE) {
+            break;
+         }
+      case STATUS_PARENTSELECTION:
+         if (debugPrint_parentSelection()==TRUE) {
+            break;
+         }
+      case STATUS_FRAG:
+         if (debugPrint_frag()==TRUE) {
+            break;
+         }
       default:
          DISABLE_INTERRUPTS();
          openserial_vars.debugPrintCounter=0;
@@ -497,8 +512,8 @@ void openserial_goldenImageCommands(void){
    commandId  = openserial_vars.inputBuf[3];
    commandLen = openserial_vars.inputBuf[4];
    
-   if (commandLen>3) {
-       // the max command Len is 2, except ping commands
+   if (commandLen>3 && commandId!=COMMAND_SET_6LOWPAN_CONTEXT) {
+       // the max command Len is 2, except ping and 6LoWPAN context commands
        return;
    } else {
        if (commandLen == 1) {
@@ -536,6 +551,18 @@ void openserial_goldenImageCommands(void){
        case COMMAND_SET_RTPERIOD: // two bytes, in mili-seconds
            routetable_setRTPeriod(comandParam_16);
            break;
+       case COMMAND_SET_6LOWPAN_CONTEXT: // context identifier, then the 8-byte prefix (none to remove it)
+           if (idmanager_getIsDAGroot()==FALSE) {
+               // the other motes learn the contexts from the DIOs
+               openserial_printError(COMPONENT_OPENSERIAL,ERR_BRIDGE_MISMATCH,
+                                     (errorparameter_t)2,
+                                     (errorparameter_t)0);
+           } else if (commandLen == 1+8) {
+               iphc_setContext(openserial_vars.inputBuf[5],&(openserial_vars.inputBuf[6]));
+           } else {
+               iphc_setContext(openserial_vars.inputBuf[5],NULL);
+           }
+           break;
        case COMMAND_SET_DAGRANK: // two bytes
            neighbors_setMyDAGrank(comandParam_16);
            break;
@@ -77,6 +77,7 @@ enum {
    COMMAND_SET_6PRESPONSE_STATUS = 15,
    COMMAND_MAX                   = 16,
    COMMAND_SET_RTPERIOD          = 17,
+   COMMAND_SET_6LOWPAN_CONTEXT   = 18,
 };
 
 //=========================== module variables ================================
@@ -4,6 +4,10 @@
 This driver uses a single hardware timer, which it virtualizes to support
 at most MAX_NUM_TIMERS timers.
 
+The running timers are kept in a binary min-heap, ordered by the time at which
+they elapse. Starting or stopping a timer costs O(log n), and the timer to
+program the hardware timer with is always at the top of the heap.
+
 \author Xavi Vilajosana <xvilajosana@eecs.berkeley.edu>, March 2012.
  */
 
@@ -21,7 +25,15 @@ opentimers_vars_t opentimers_vars;
 
 //=========================== prototypes ======================================
 
-void opentimers_timer_callback(void);
+void     opentimers_timer_callback(void);
+uint32_t opentimers_toTicks(uint32_t duration, time_type_t timetype);
+void     opentimers_enqueue(opentimer_id_t id);
+void     opentimers_dequeue(opentimer_id_t id);
+void     opentimers_siftUp(uint8_t index);
+void     opentimers_siftDown(uint8_t index);
+opentimer_id_t opentimers_popExpired(uint32_t elapsed);
+void     opentimers_callExpired(opentimer_id_t expired);
+void     opentimers_scheduleNext(void);
 
 //=========================== public ==========================================
 
@@ -35,13 +47,19 @@ void opentimers_init(){
 
    // initialize local variables
    opentimers_vars.running=FALSE;
+   opentimers_vars.insideCallback=FALSE;
+   opentimers_vars.numQueued=0;
+   opentimers_vars.currentTime=0;
    for (i=0;i<MAX_NUM_TIMERS;i++) {
       opentimers_vars.timersBuf[i].period_ticks       = 0;
       opentimers_vars.timersBuf[i].ticks_remaining    = 0;
+      opentimers_vars.timersBuf[i].deadline           = 0;
       opentimers_vars.timersBuf[i].type               = TIMER_ONESHOT;
       opentimers_vars.timersBuf[i].isrunning          = FALSE;
+      opentimers_vars.timersBuf[i].isallocated        = FALSE;
       opentimers_vars.timersBuf[i].callback           = NULL;
-      opentimers_vars.timersBuf[i].hasExpired         = FALSE;
+      opentimers_vars.timersBuf[i].heapIndex          = OPENTIMERS_NOT_QUEUED;
+      opentimers_vars.timersBuf[i].nextExpired        = TOO_MANY_TIMERS_ERROR;
    }
 
    // set callback for bsp_timers module
@@ -55,7 +73,7 @@ The timer works as follows:
 - currentTimeout is the number of ticks before the next timer expires.
 - if a new timer is inserted, we check that it is not earlier than the soonest
 - if it is earliest, replace it
-- if not, insert it in the list
+- if not, insert it in the heap
 
 \param duration Number milli-seconds after which the timer will fire.
 \param type     Type of timer:
@@ -73,96 +91,66 @@ The timer works as follows:
 opentimer_id_t opentimers_start(uint32_t duration, timer_type_t type, time_type_t timetype, opentimers_cbt callback) {
 
    uint8_t  id;
+   INTERRUPT_DECLARATION();
+   
+   // the heap is also modified from the hardware timer interrupt
+   DISABLE_INTERRUPTS();
 
    // find an unused timer
-   for (id=0; id<MAX_NUM_TIMERS && opentimers_vars.timersBuf[id].isrunning==TRUE; id++);
+   for (id=0; id<MAX_NUM_TIMERS; id++) {
+      if (
+            opentimers_vars.timersBuf[id].isrunning==FALSE &&
+            opentimers_vars.timersBuf[id].isallocated==FALSE
+         ) {
+         break;
+      }
+   }
 
    if (id<MAX_NUM_TIMERS) {
       // we found an unused timer
 
-      // register the timer
-      if (timetype==TIME_MS) {
-         opentimers_vars.timersBuf[id].period_ticks      = duration*PORT_TICS_PER_MS;
-         opentimers_vars.timersBuf[id].wraps_remaining   = (duration*PORT_TICS_PER_MS/MAX_TICKS_IN_SINGLE_CLOCK);//65535=maxValue of uint16_t
-      } else if (timetype==TIME_TICS) {
-         opentimers_vars.timersBuf[id].period_ticks      = duration;
-         opentimers_vars.timersBuf[id].wraps_remaining   = (duration/MAX_TICKS_IN_SINGLE_CLOCK);//65535=maxValue of uint16_t  
-      } else {
-         while (1); //error
+      // it might have been stopped, while still queued
+      if (opentimers_vars.timersBuf[id].heapIndex!=OPENTIMERS_NOT_QUEUED) {
+         opentimers_dequeue(id);
       }
-      //if the number of ticks falls below a 16bit value, use it, otherwise set to max 16bit value
-      if(opentimers_vars.timersBuf[id].wraps_remaining==0){
-         if (timetype==TIME_MS){ 
-            opentimers_vars.timersBuf[id].ticks_remaining   = duration*PORT_TICS_PER_MS;
-         } else if (timetype==TIME_TICS) {
-            opentimers_vars.timersBuf[id].ticks_remaining   = duration;
-         } else {
-            // this should never happpen!
-   
-            // we can not print from within the drivers. Instead:
-            // blink the error LED
-            leds_error_blink();
-            // reset the board
-            board_reset();
-         }
-      }else{
-         opentimers_vars.timersBuf[id].ticks_remaining = MAX_TICKS_IN_SINGLE_CLOCK;
-      }                                                   
+      
+      // register the timer
+      opentimers_vars.timersBuf[id].period_ticks      = opentimers_toTicks(duration,timetype);
+      opentimers_vars.timersBuf[id].ticks_remaining   = opentimers_vars.timersBuf[id].period_ticks;
       opentimers_vars.timersBuf[id].type              = type;
       opentimers_vars.timersBuf[id].isrunning         = TRUE;
       opentimers_vars.timersBuf[id].callback          = callback;
-      opentimers_vars.timersBuf[id].hasExpired        = FALSE;
 
-      // re-schedule the running timer, if needed
-      if (
-            (opentimers_vars.running==FALSE)
-            ||
-            (opentimers_vars.timersBuf[id].ticks_remaining < opentimers_vars.currentTimeout)
-      ) {  
-         opentimers_vars.currentTimeout            = opentimers_vars.timersBuf[id].ticks_remaining;
-         if (opentimers_vars.running==FALSE) {
-            bsp_timer_reset();
-         }
-         bsp_timer_scheduleIn(opentimers_vars.timersBuf[id].ticks_remaining);
-      }
-
-      opentimers_vars.running                         = TRUE;
+      // insert in the heap, re-schedule the running timer if needed
+      opentimers_enqueue(id);
 
    } else {
+      ENABLE_INTERRUPTS();
       return TOO_MANY_TIMERS_ERROR;
    }
 
+   ENABLE_INTERRUPTS();
    return id;
 }
 
 /**
 \brief Replace the period of a running timer.
+
+If the timer is running, it elapses after the new period.
  */
 void  opentimers_setPeriod(opentimer_id_t id,time_type_t timetype,uint32_t newDuration) {
-   if        (timetype==TIME_MS) {
-      opentimers_vars.timersBuf[id].period_ticks      = newDuration*PORT_TICS_PER_MS;
-      opentimers_vars.timersBuf[id].wraps_remaining   = (newDuration*PORT_TICS_PER_MS/MAX_TICKS_IN_SINGLE_CLOCK);//65535=maxValue of uint16_t
-   } else if (timetype==TIME_TICS) {
-      opentimers_vars.timersBuf[id].period_ticks      = newDuration;
-      opentimers_vars.timersBuf[id].wraps_remaining   = (newDuration/MAX_TICKS_IN_SINGLE_CLOCK);//65535=maxValue of uint16_t
-   } else {
-      // this should never happpen!
-      
-      // we can not print from within the drivers. Instead:
-      // blink the error LED
-      leds_error_blink();
-      // reset the board
-      board_reset();
-   }
-   if(opentimers_vars.timersBuf[id].wraps_remaining==0) {
-      if        (timetype==TIME_MS){
-         opentimers_vars.timersBuf[id].ticks_remaining   = newDuration*PORT_TICS_PER_MS;
-      } else if (timetype==TIME_TICS){
-         opentimers_vars.timersBuf[id].ticks_remaining   = newDuration;
-      }
-   } else {
-      opentimers_vars.timersBuf[id].ticks_remaining = MAX_TICKS_IN_SINGLE_CLOCK;
+   INTERRUPT_DECLARATION();
+   
+   DISABLE_INTERRUPTS();
+   opentimers_vars.timersBuf[id].period_ticks         = opentimers_toTicks(newDuration,timetype);
+   opentimers_vars.timersBuf[id].ticks_remaining      = opentimers_vars.timersBuf[id].period_ticks;
+   
+   // move it in the heap, if queued
+   if (opentimers_vars.timersBuf[id].heapIndex!=OPENTIMERS_NOT_QUEUED) {
+      opentimers_dequeue(id);
+      opentimers_enqueue(id);
    }
+   ENABLE_INTERRUPTS();
 }
 
 /**
@@ -172,7 +160,17 @@ Sets the timer to "not running". the system recovers even if this was the next
 timer to expire.
  */
 void opentimers_stop(opentimer_id_t id) {
+   INTERRUPT_DECLARATION();
+   
+   DISABLE_INTERRUPTS();
    opentimers_vars.timersBuf[id].isrunning=FALSE;
+   
+   // remember how long it still had to run, for opentimers_restart()
+   if (opentimers_vars.timersBuf[id].heapIndex!=OPENTIMERS_NOT_QUEUED) {
+      opentimers_vars.timersBuf[id].ticks_remaining = opentimers_vars.timersBuf[id].deadline-opentimers_vars.currentTime;
+      opentimers_dequeue(id);
+   }
+   ENABLE_INTERRUPTS();
 }
 
 /**
@@ -181,9 +179,102 @@ void opentimers_stop(opentimer_id_t id) {
 Sets the timer to " running".
  */
 void opentimers_restart(opentimer_id_t id) {
-   opentimers_vars.timersBuf[id].isrunning=TRUE;
+   INTERRUPT_DECLARATION();
+   
+   DISABLE_INTERRUPTS();
+   if (opentimers_vars.timersBuf[id].isrunning==FALSE) {
+      // not already running, or a one-shot having its callback called
+      opentimers_vars.timersBuf[id].isrunning=TRUE;
+      opentimers_enqueue(id);
+   }
+   ENABLE_INTERRUPTS();
+}
+
+/**
+\brief Account for the time the hardware timer was stopped.
+
+\param sleepTime Number of ticks the board slept for.
+ */
+void opentimers_sleepTimeCompesation(uint16_t sleepTime)
+{
+   opentimer_id_t   expired;
+   
+   //step 1. move the timers which expired during the sleep out of the heap
+   expired = opentimers_popExpired(sleepTime);
+   opentimers_vars.currentTime += sleepTime;
+   
+   // step 2. call callbacks of expired timers
+   opentimers_vars.insideCallback = TRUE;
+   opentimers_callExpired(expired);
+   opentimers_vars.insideCallback = FALSE;
+   
+   // step 3. schedule next timeout
+   opentimers_scheduleNext();
+}
+
+//===== tickers
+
+/**
+\brief Create a ticker.
+
+A ticker lets a module time out several entries (transactions, reassembly
+buffers, ...) with a single timer. Each entry counts down a number of ticks,
+from the task pushed by the callback, and the timer only fires while one of
+them is counting.
+
+The timer of the ticker is allocated once and never released, so that
+opentimers_start() does not hand it out while the ticker is not ticking.
+
+\param[out] ticker   The ticker to create.
+\param[in]  tickMs   The period of the ticks, in ms.
+\param[in]  callback Called at every tick, in interrupt mode.
+ */
+void opentimers_tickerInit(opentimers_ticker_t* ticker, uint32_t tickMs, opentimers_cbt callback) {
+   ticker->tickMs    = tickMs;
+   ticker->id        = opentimers_start(
+      tickMs,
+      TIMER_ONESHOT,
+      TIME_MS,
+      callback
+   );
+   if (ticker->id!=TOO_MANY_TIMERS_ERROR) {
+      opentimers_vars.timersBuf[ticker->id].isallocated = TRUE;
+   }
+   // nothing to time out at the first tick, which stops the ticker
+   ticker->isTicking = TRUE;
+}
+
+/**
+\brief Have a ticker tick, when an entry starts counting down.
+
+If it is already ticking, the next tick may be about to fire: an entry which
+has to last at least N ticks should count down N+1 of them.
+ */
+void opentimers_tickerStart(opentimers_ticker_t* ticker) {
+   if (ticker->isTicking==TRUE || ticker->id==TOO_MANY_TIMERS_ERROR) {
+      return;
+   }
+   opentimers_setPeriod(ticker->id,TIME_MS,ticker->tickMs);
+   opentimers_restart(ticker->id);
+   ticker->isTicking = TRUE;
 }
 
+/**
+\brief Handle the end of a tick.
+
+Called by the task handling each tick, once the entries have counted down.
+
+\param[in] ticker    The ticker which ticked.
+\param[in] isOngoing Whether an entry is still counting down.
+ */
+void opentimers_tickerContinue(opentimers_ticker_t* ticker, bool isOngoing) {
+   if (isOngoing==FALSE) {
+      ticker->isTicking = FALSE;
+      return;
+   }
+   opentimers_setPeriod(ticker->id,TIME_MS,ticker->tickMs);
+   opentimers_restart(ticker->id);
+}
 
 //=========================== private =========================================
 
@@ -197,164 +288,263 @@ corresponding callback(s), and restarts the hardware timer with the next timer
 to expire.
  */
 void opentimers_timer_callback() {
-   
-   opentimer_id_t   id;
-   PORT_TIMER_WIDTH min_timeout;
-   bool             found;
-    
-   // step 1. Identify expired timers
-   for(id=0; id<MAX_NUM_TIMERS; id++) {
-      if (opentimers_vars.timersBuf[id].isrunning==TRUE) {
-
-         if(opentimers_vars.currentTimeout >= opentimers_vars.timersBuf[id].ticks_remaining) {
-            // this timer has expired
-            //check to see if we have completed the whole timer, or we're just wrapping around the max 16bit value
-            if(opentimers_vars.timersBuf[id].wraps_remaining == 0){
-               // declare as so
-               opentimers_vars.timersBuf[id].hasExpired  = TRUE;
-            }else{
-               opentimers_vars.timersBuf[id].wraps_remaining--;
-               if(opentimers_vars.timersBuf[id].wraps_remaining == 0){
-                  //if we have fully wrapped around, then set the remainring ticks to the modulus of the total ticks and the max clock value
-                  opentimers_vars.timersBuf[id].ticks_remaining = (opentimers_vars.timersBuf[id].period_ticks) % MAX_TICKS_IN_SINGLE_CLOCK;
-               }else{
-                  opentimers_vars.timersBuf[id].ticks_remaining = MAX_TICKS_IN_SINGLE_CLOCK;
-               }
-            }
-         } else {
-            // this timer is not expired
-
-            // update its counter
-            opentimers_vars.timersBuf[id].ticks_remaining -= opentimers_vars.currentTimeout;
-         }   
-      }
-   }
+   opentimer_id_t   expired;
+
+   // step 1. Identify expired timers, at the top of the heap
+   opentimers_vars.currentTime += opentimers_vars.currentTimeout;
+   expired = opentimers_popExpired(0);
 
    // step 2. call callbacks of expired timers
-   for(id=0; id<MAX_NUM_TIMERS; id++) {
-      if (opentimers_vars.timersBuf[id].hasExpired==TRUE){
-
-         // call the callback
-         opentimers_vars.timersBuf[id].callback(id);
-         opentimers_vars.timersBuf[id].hasExpired     = FALSE;
-
-         // reload the timer, if applicable
-         if (opentimers_vars.timersBuf[id].type==TIMER_PERIODIC) {
-            opentimers_vars.timersBuf[id].wraps_remaining   = (opentimers_vars.timersBuf[id].period_ticks/MAX_TICKS_IN_SINGLE_CLOCK);//65535=maxValue of uint16_t
-            //if the number of ticks falls below a 16bit value, use it, otherwise set to max 16bit value
-            if(opentimers_vars.timersBuf[id].wraps_remaining==0)                                                
-               opentimers_vars.timersBuf[id].ticks_remaining   = opentimers_vars.timersBuf[id].period_ticks;
-            else
-               opentimers_vars.timersBuf[id].ticks_remaining = MAX_TICKS_IN_SINGLE_CLOCK;
-
-         } else {
-            opentimers_vars.timersBuf[id].isrunning   = FALSE;
-         }
-      }
+   opentimers_vars.insideCallback = TRUE;
+   opentimers_callExpired(expired);
+   opentimers_vars.insideCallback = FALSE;
+   
+   // step 3. schedule next timeout
+   opentimers_scheduleNext();
+}
 
+/**
+\brief Convert a duration into clock ticks.
+ */
+uint32_t opentimers_toTicks(uint32_t duration, time_type_t timetype) {
+   if        (timetype==TIME_MS) {
+      return duration*PORT_TICS_PER_MS;
+   } else if (timetype==TIME_TICS) {
+      return duration;
    }
+   
+   // this should never happpen!
+   
+   // we can not print from within the drivers. Instead:
+   // blink the error LED
+   leds_error_blink();
+   // reset the board
+   board_reset();
+   return 0;
+}
 
-   // step 3. find the minimum remaining timeout among running timers
-   found = FALSE;
-   for(id=0;id<MAX_NUM_TIMERS;id++) {
-      if (
-            opentimers_vars.timersBuf[id].isrunning==TRUE &&
-            (
-                  found==FALSE
-                  ||
-                  opentimers_vars.timersBuf[id].ticks_remaining < min_timeout
-            )
-      ) {
-         min_timeout    = opentimers_vars.timersBuf[id].ticks_remaining;
-         found          = TRUE;
+/**
+\brief Insert a running timer in the heap.
+
+It elapses ticks_remaining ticks after the last hardware timer compare. If it
+is the first to elapse, the hardware timer is re-scheduled.
+ */
+void opentimers_enqueue(opentimer_id_t id) {
+   PORT_TIMER_WIDTH timeout;
+   
+   opentimers_vars.timersBuf[id].deadline             = opentimers_vars.currentTime+opentimers_vars.timersBuf[id].ticks_remaining;
+   opentimers_vars.timersBuf[id].heapIndex            = opentimers_vars.numQueued;
+   opentimers_vars.heap[opentimers_vars.numQueued]    = id;
+   opentimers_vars.numQueued++;
+   opentimers_siftUp(opentimers_vars.timersBuf[id].heapIndex);
+   
+   if (opentimers_vars.insideCallback==TRUE) {
+      // the hardware timer is re-scheduled after the callbacks
+      return;
+   }
+   
+   // longer timers wrap around the max clock value
+   if (opentimers_vars.timersBuf[id].ticks_remaining>MAX_TICKS_IN_SINGLE_CLOCK) {
+      timeout = MAX_TICKS_IN_SINGLE_CLOCK;
+   } else {
+      timeout = (PORT_TIMER_WIDTH)opentimers_vars.timersBuf[id].ticks_remaining;
+   }
+   
+   // re-schedule the running timer, if needed
+   if (
+         (opentimers_vars.running==FALSE)
+         ||
+         (timeout < opentimers_vars.currentTimeout)
+   ) {
+      opentimers_vars.currentTimeout            = timeout;
+      if (opentimers_vars.running==FALSE) {
+         bsp_timer_reset();
       }
+      bsp_timer_scheduleIn(timeout);
    }
+   
+   opentimers_vars.running                      = TRUE;
+}
 
-   // step 4. schedule next timeout
-   if (found==TRUE) {
-      // at least one timer pending
-      opentimers_vars.currentTimeout = min_timeout;
-      bsp_timer_scheduleIn(opentimers_vars.currentTimeout);
-   } else {
-      // no more timers pending
-      opentimers_vars.running = FALSE;
+/**
+\brief Remove a timer from the heap.
+ */
+void opentimers_dequeue(opentimer_id_t id) {
+   uint8_t        index;
+   opentimer_id_t last;
+   
+   index = opentimers_vars.timersBuf[id].heapIndex;
+   opentimers_vars.timersBuf[id].heapIndex = OPENTIMERS_NOT_QUEUED;
+   opentimers_vars.numQueued--;
+   if (index==opentimers_vars.numQueued) {
+      // it was the last one
+      return;
    }
+   
+   // move the last one in its place
+   last = opentimers_vars.heap[opentimers_vars.numQueued];
+   opentimers_vars.heap[index]               = last;
+   opentimers_vars.timersBuf[last].heapIndex = index;
+   opentimers_siftUp(index);
+   opentimers_siftDown(opentimers_vars.timersBuf[last].heapIndex);
 }
 
-void opentimers_sleepTimeCompesation(uint16_t sleepTime)
-{
-   opentimer_id_t   id;
-   PORT_TIMER_WIDTH min_timeout;
-   bool             found;
+/**
+\brief Move a heap entry up, until its parent elapses no later than it.
+
+Deadlines are compared relative to currentTime, which no queued timer is
+behind of.
+ */
+void opentimers_siftUp(uint8_t index) {
+   opentimer_id_t id;
+   uint8_t        parent;
+   uint32_t       remaining;
    
-   //step 1. reCount the ticks_remain after waking up from sleep
-   for(id=0; id<MAX_NUM_TIMERS; id++)
-   {
-     if (opentimers_vars.timersBuf[id].isrunning==TRUE) 
-     {
-       if(opentimers_vars.timersBuf[id].ticks_remaining > sleepTime)
-       {
-         opentimers_vars.timersBuf[id].ticks_remaining -= sleepTime;
-       }
-       else
-       {
-         if(opentimers_vars.timersBuf[id].wraps_remaining > 0)
-         {
-           opentimers_vars.timersBuf[id].wraps_remaining--;
-           opentimers_vars.timersBuf[id].ticks_remaining += (MAX_TICKS_IN_SINGLE_CLOCK - sleepTime);
-         }
-         else
-         {
-           opentimers_vars.timersBuf[id].hasExpired  = TRUE;
-         }
-       }
-     }
+   id        = opentimers_vars.heap[index];
+   remaining = opentimers_vars.timersBuf[id].deadline-opentimers_vars.currentTime;
+   while (index>0) {
+      parent = (index-1)/2;
+      if (opentimers_vars.timersBuf[opentimers_vars.heap[parent]].deadline-opentimers_vars.currentTime<=remaining) {
+         break;
+      }
+      opentimers_vars.heap[index]                                     = opentimers_vars.heap[parent];
+      opentimers_vars.timersBuf[opentimers_vars.heap[index]].heapIndex = index;
+      index = parent;
    }
+   opentimers_vars.heap[index]              = id;
+   opentimers_vars.timersBuf[id].heapIndex  = index;
+}
+
+/**
+\brief Move a heap entry down, until its children elapse no earlier than it.
+ */
+void opentimers_siftDown(uint8_t index) {
+   opentimer_id_t id;
+   uint8_t        child;
+   uint32_t       remaining;
    
-   // step 2. call callbacks of expired timers
-   for(id=0; id<MAX_NUM_TIMERS; id++) {
-      if (opentimers_vars.timersBuf[id].hasExpired==TRUE){
-
-         // call the callback
-         opentimers_vars.timersBuf[id].callback(id);
-         opentimers_vars.timersBuf[id].hasExpired     = FALSE;
-
-         // reload the timer, if applicable
-         if (opentimers_vars.timersBuf[id].type==TIMER_PERIODIC) {
-            opentimers_vars.timersBuf[id].wraps_remaining   = (opentimers_vars.timersBuf[id].period_ticks/MAX_TICKS_IN_SINGLE_CLOCK);//65535=maxValue of uint16_t
-            //if the number of ticks falls below a 16bit value, use it, otherwise set to max 16bit value
-            if(opentimers_vars.timersBuf[id].wraps_remaining==0)                                                
-               opentimers_vars.timersBuf[id].ticks_remaining   = opentimers_vars.timersBuf[id].period_ticks;
-            else
-               opentimers_vars.timersBuf[id].ticks_remaining = MAX_TICKS_IN_SINGLE_CLOCK;
-
-         } else {
-            opentimers_vars.timersBuf[id].isrunning   = FALSE;
-         }
+   id        = opentimers_vars.heap[index];
+   remaining = opentimers_vars.timersBuf[id].deadline-opentimers_vars.currentTime;
+   while (2*index+1<opentimers_vars.numQueued) {
+      // pick the child which elapses first
+      child = 2*index+1;
+      if (
+            child+1<opentimers_vars.numQueued &&
+            opentimers_vars.timersBuf[opentimers_vars.heap[child+1]].deadline-opentimers_vars.currentTime <
+            opentimers_vars.timersBuf[opentimers_vars.heap[child]].deadline-opentimers_vars.currentTime
+         ) {
+         child++;
+      }
+      if (remaining<=opentimers_vars.timersBuf[opentimers_vars.heap[child]].deadline-opentimers_vars.currentTime) {
+         break;
       }
+      opentimers_vars.heap[index]                                     = opentimers_vars.heap[child];
+      opentimers_vars.timersBuf[opentimers_vars.heap[index]].heapIndex = index;
+      index = child;
+   }
+   opentimers_vars.heap[index]              = id;
+   opentimers_vars.timersBuf[id].heapIndex  = index;
+}
 
+/**
+\brief Move the timers elapsing within some ticks from the heap into the
+   expired list.
+
+The timers in the expired list, chained by nextExpired, keep running until
+their callback has been called.
+
+\param elapsed Number of ticks elapsed since currentTime.
+
+\returns The first timer of the expired list, TOO_MANY_TIMERS_ERROR if none.
+ */
+opentimer_id_t opentimers_popExpired(uint32_t elapsed) {
+   opentimer_id_t first;
+   opentimer_id_t id;
+   opentimer_id_t last;
+   
+   first = TOO_MANY_TIMERS_ERROR;
+   last  = TOO_MANY_TIMERS_ERROR;
+   while (
+         opentimers_vars.numQueued>0 &&
+         opentimers_vars.timersBuf[opentimers_vars.heap[0]].deadline-opentimers_vars.currentTime<=elapsed
+      ) {
+      id = opentimers_vars.heap[0];
+      opentimers_dequeue(id);
+      
+      // append to the expired list, keeping the order they elapse in
+      opentimers_vars.timersBuf[id].nextExpired = TOO_MANY_TIMERS_ERROR;
+      if (last==TOO_MANY_TIMERS_ERROR) {
+         first = id;
+      } else {
+         opentimers_vars.timersBuf[last].nextExpired = id;
+      }
+      last = id;
    }
+   return first;
+}
+
+/**
+\brief Call the callbacks of the expired timers, and reload the periodic ones.
+
+\param expired The first timer of the expired list.
+ */
+void opentimers_callExpired(opentimer_id_t expired) {
+   opentimer_id_t id;
    
-   // step 3. find the minimum remaining timeout among running timers
-   found = FALSE;
-   for(id=0;id<MAX_NUM_TIMERS;id++) {
+   while (expired!=TOO_MANY_TIMERS_ERROR) {
+      id      = expired;
+      expired = opentimers_vars.timersBuf[id].nextExpired;
+      opentimers_vars.timersBuf[id].nextExpired = TOO_MANY_TIMERS_ERROR;
+      
       if (
-            opentimers_vars.timersBuf[id].isrunning==TRUE &&
-            (
-                  found==FALSE
-                  ||
-                  opentimers_vars.timersBuf[id].ticks_remaining < min_timeout
-            )
-      ) {
-         min_timeout    = opentimers_vars.timersBuf[id].ticks_remaining;
-         found          = TRUE;
+            opentimers_vars.timersBuf[id].isrunning==FALSE ||
+            opentimers_vars.timersBuf[id].heapIndex!=OPENTIMERS_NOT_QUEUED
+         ) {
+         // stopped (and possibly started again) by a previous callback
+         continue;
+      }
+      
+      // a one-shot is over, its callback may restart() it for a whole period
+      if (opentimers_vars.timersBuf[id].type==TIMER_ONESHOT) {
+         opentimers_vars.timersBuf[id].ticks_remaining = opentimers_vars.timersBuf[id].period_ticks;
+         opentimers_vars.timersBuf[id].isrunning       = FALSE;
+      }
+      
+      // call the callback
+      opentimers_vars.timersBuf[id].callback(id);
+      
+      if (opentimers_vars.timersBuf[id].heapIndex!=OPENTIMERS_NOT_QUEUED) {
+         // the callback restarted it
+         continue;
+      }
+      
+      // reload the periodic timer, unless the callback stopped it
+      if (
+            opentimers_vars.timersBuf[id].type==TIMER_PERIODIC &&
+            opentimers_vars.timersBuf[id].isrunning==TRUE
+         ) {
+         opentimers_vars.timersBuf[id].ticks_remaining = opentimers_vars.timersBuf[id].period_ticks;
+         opentimers_enqueue(id);
       }
    }
+}
 
-   // step 4. schedule next timeout
-   if (found==TRUE) {
+/**
+\brief Schedule the hardware timer for the first timer to elapse.
+ */
+void opentimers_scheduleNext() {
+   uint32_t remaining;
+
+   if (opentimers_vars.numQueued>0) {
       // at least one timer pending
-      opentimers_vars.currentTimeout = min_timeout;
+      remaining = opentimers_vars.timersBuf[opentimers_vars.heap[0]].deadline-opentimers_vars.currentTime;
+
+      // longer timers wrap around the max clock value
+      if (remaining>MAX_TICKS_IN_SINGLE_CLOCK) {
+         opentimers_vars.currentTimeout = MAX_TICKS_IN_SINGLE_CLOCK;
+      } else {
+         opentimers_vars.currentTimeout = (PORT_TIMER_WIDTH)remaining;
+      }
       bsp_timer_scheduleIn(opentimers_vars.currentTimeout);
    } else {
       // no more timers pending
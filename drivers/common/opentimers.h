@@ -18,13 +18,21 @@
 
 //=========================== define ==========================================
 
-/// Maximum number of timers that can run concurrently
-#define MAX_NUM_TIMERS            10
+/**
+\brief Maximum number of timers that can run concurrently.
+
+At most 254. Can be overwritten in board_info.h.
+*/
+#ifndef MAX_NUM_TIMERS
+#define MAX_NUM_TIMERS            16
+#endif
 
 #define MAX_TICKS_IN_SINGLE_CLOCK ((PORT_TIMER_WIDTH)0xFFFFFFFF)
 
 #define TOO_MANY_TIMERS_ERROR     255
 
+#define OPENTIMERS_NOT_QUEUED     0xff // heapIndex of a timer not in the heap
+
 #define opentimer_id_t uint8_t
 
 typedef void (*opentimers_cbt)(opentimer_id_t id);
@@ -44,20 +52,35 @@ typedef enum {
 
 typedef struct {
    uint32_t             period_ticks;       // total number of clock ticks
-   PORT_TIMER_WIDTH     ticks_remaining;    // ticks remaining before elapses
-   uint16_t             wraps_remaining;    // the clock register is 16 bit, and can't count beyond 32k...
-                                            // so period_ticks = wraps_remaining*(32k or uint16_t)
+   uint32_t             ticks_remaining;    // ticks remaining before elapses, counted from when it is queued
+   uint32_t             deadline;           // when queued, opentimers_vars.currentTime at which it elapses
    timer_type_t         type;               // periodic or one-shot
    bool                 isrunning;          // is running?
+   bool                 isallocated;        // kept for good by a ticker, even when not running
    opentimers_cbt       callback;           // function to call when elapses
-   bool                 hasExpired;         // whether the callback has to be called
+   uint8_t              heapIndex;          // position in opentimers_vars.heap, OPENTIMERS_NOT_QUEUED if not in it
+   opentimer_id_t       nextExpired;        // next timer whose callback has to be called
 } opentimers_t;
 
+/**
+\brief A one-shot timer re-armed every tick while its module has something to
+   time out, see opentimers_tickerStart().
+*/
+typedef struct {
+   opentimer_id_t       id;
+   uint32_t             tickMs;             // period of the ticks, in ms
+   bool                 isTicking;          // re-armed, or its last tick not handled yet
+} opentimers_ticker_t;
+
 //=========================== module variables ================================
 
 typedef struct {
    opentimers_t         timersBuf[MAX_NUM_TIMERS];
+   opentimer_id_t       heap[MAX_NUM_TIMERS];// queued timers, binary min-heap on deadline
+   uint8_t              numQueued;      // number of timers in the heap
    bool                 running;
+   bool                 insideCallback; // hardware timer gets rescheduled once the callbacks are done
+   uint32_t             currentTime;    // time of the last hardware timer compare, in ticks
    PORT_TIMER_WIDTH     currentTimeout; // current timeout, in ticks
 } opentimers_vars_t;
 
@@ -73,6 +96,10 @@ void           opentimers_stop(opentimer_id_t id);
 void           opentimers_restart(opentimer_id_t id);
 
 void           opentimers_sleepTimeCompesation(uint16_t sleepTime);
+// tickers
+void           opentimers_tickerInit(opentimers_ticker_t* ticker, uint32_t tickMs, opentimers_cbt callback);
+void           opentimers_tickerStart(opentimers_ticker_t* ticker);
+void           opentimers_tickerContinue(opentimers_ticker_t* ticker, bool isOngoing);
 
 /**
 \}
@@ -49,6 +49,15 @@ static const uint8_t infoStackName[] = "OpenWSN ";
 #define LENGTH_ADDR64b  8
 #define LENGTH_ADDR128b 16
 
+// sizes of the packet buffers of OpenQueueEntry_t
+#define PACKETBUFFER_LARGE_SIZE   (1+1+125+2+1) // 1B spi address, 1B length, 125B data, 2B CRC, 1B LQI
+#ifndef PACKETBUFFER_SMALL_SIZE
+#define PACKETBUFFER_SMALL_SIZE   64            // can be overwritten in board_info.h
+#endif
+#ifndef PACKETBUFFER_DATAGRAM_SIZE
+#define PACKETBUFFER_DATAGRAM_SIZE 255          // IPv6 datagrams sent in several fragments, can be overwritten in board_info.h, max. 255
+#endif
+
 
 enum {
    E_SUCCESS                           = 0,
@@ -118,7 +127,10 @@ enum {
    STATUS_QUEUE                        =  8,
    STATUS_NEIGHBORS                    =  9,
    STATUS_KAPERIOD                     = 10,
-   STATUS_MAX                          = 11,
+   STATUS_ROUTECACHE                   = 11,
+   STATUS_PARENTSELECTION              = 12,
+   STATUS_FRAG                         = 13,
+   STATUS_MAX                          = 14,
 };
 
 //component identifiers
@@ -177,6 +189,7 @@ enum {
    COMPONENT_UINJECT                   = 0x24,
    COMPONENT_RRT                       = 0x25,
    COMPONENT_SECURITY                  = 0x26,
+   COMPONENT_FRAG                      = 0x27,
 };
 
 /**
@@ -255,6 +268,16 @@ enum {
    ERR_SIXTOP_RETURNCODE               = 0x3c, // sixtop return code {0} at sixtop state {1}
    ERR_SIXTOP_COUNT                    = 0x3d, // there are {0} cells to request mote
    ERR_SIXTOP_LIST                     = 0x3e, // the cells reserved to request mote contains slot {0} and slot {1}
+   ERR_UNKNOWN_PACKET_BUFFER           = 0x3f, // unknown packet buffer handed over to component {0}
+   ERR_UNKNOWN_SLOTFRAME               = 0x40, // unknown slotframe handle {0}
+   ERR_SLOTFRAME_REFUSED               = 0x41, // slotframe {0} of length {1} could not be added
+   ERR_STALE_PACKET                    = 0x42, // packet created by component {0} dropped after {1} slots in the queue
+   ERR_NEIGHBOR_QUEUE_FULL             = 0x43, // packet created by component {0} dropped, {1} packets already queued to its next hop
+   ERR_FRAG_TOO_LARGE                  = 0x44, // datagram of {0} bytes can not be fragmented or reassembled (code location {1})
+   ERR_FRAG_REASSEMBLY                 = 0x45, // reassembly of datagram with tag {0} aborted (code location {1})
+   ERR_FRAG_FORWARD                    = 0x46, // fragment of datagram with tag {0} can not be relayed (code location {1})
+   ERR_6LOWPAN_UNKNOWN_CONTEXT         = 0x47, // unknown 6LoWPAN context {0} (code location {1})
+   ERR_COAP_NOT_ACKNOWLEDGED           = 0x48, // confirmable CoAP message {0} not acknowledged after {1} retransmissions
 };
 
 //=========================== typedef =========================================
@@ -337,7 +360,8 @@ typedef struct {
    uint8_t       l1_lqi;                         // LQI of received packet
    bool          l1_crc;                         // did received packet pass CRC check?
    //the packet
-   uint8_t       packet[1+1+125+2+1];            // 1B spi address, 1B length, 125B data, 2B CRC, 1B LQI
+   uint8_t*      packet;                         // buffer of packetSize bytes: 1B spi address, 1B length, data, 2B CRC, 1B LQI
+   uint8_t       packetSize;                     // PACKETBUFFER_LARGE_SIZE, PACKETBUFFER_SMALL_SIZE or PACKETBUFFER_DATAGRAM_SIZE
 } OpenQueueEntry_t;
 
 //=========================== variables =======================================
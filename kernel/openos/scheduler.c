@@ -7,6 +7,7 @@
 #include "opendefs.h"
 #include "scheduler.h"
 #include "board.h"
+#include "bsp_timer.h"
 #include "debugpins.h"
 #include "leds.h"
 
@@ -15,42 +16,48 @@
 scheduler_vars_t scheduler_vars;
 scheduler_dbg_t  scheduler_dbg;
 
+#ifdef SCHEDULER_BUCKET_QUEUE
+// index of the lowest bit set in a nibble (0x0 never looked up)
+static const uint8_t scheduler_lowestBitInNibble[16] = {
+   0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0
+};
+#endif
+
 //=========================== prototypes ======================================
 
-void consumeTask(uint8_t taskId);
+bool scheduler_popTask(taskList_item_t* task);
 
 //=========================== public ==========================================
 
 void scheduler_init() {   
+#ifdef SCHEDULER_BUCKET_QUEUE
+   uint8_t i;
+#endif
    
    // initialization module variables
    memset(&scheduler_vars,0,sizeof(scheduler_vars_t));
    memset(&scheduler_dbg,0,sizeof(scheduler_dbg_t));
    
+#ifdef SCHEDULER_BUCKET_QUEUE
+   // chain all task containers into the free list
+   for (i=0;i<TASK_LIST_DEPTH-1;i++) {
+      scheduler_vars.taskBuf[i].next = &scheduler_vars.taskBuf[i+1];
+   }
+   scheduler_vars.freeList        = &scheduler_vars.taskBuf[0];
+#endif
+   
    // enable the scheduler's interrupt so SW can wake up the scheduler
    SCHEDULER_ENABLE_INTERRUPT();
 }
 
 void scheduler_start() {
-   taskList_item_t* pThisTask;
+   taskList_item_t thisTask;
    while (1) {
-      while(scheduler_vars.task_list!=NULL) {
-         // there is still at least one task in the linked-list of tasks
-         
-         // the task to execute is the one at the head of the queue
-         pThisTask                = scheduler_vars.task_list;
-         
-         // shift the queue by one task
-         scheduler_vars.task_list = pThisTask->next;
+      while (scheduler_popTask(&thisTask)==TRUE) {
+         // there is still at least one task in the queue
          
          // execute the current task
-         pThisTask->cb();
-         
-         // free up this task container
-         pThisTask->cb            = NULL;
-         pThisTask->prio          = TASKPRIO_NONE;
-         pThisTask->next          = NULL;
-         scheduler_dbg.numTasksCur--;
+         thisTask.cb();
       }
       debugpins_task_clr();
       board_sleep();
@@ -60,11 +67,21 @@ void scheduler_start() {
 
  void scheduler_push_task(task_cbt cb, task_prio_t prio) {
    taskList_item_t*  taskContainer;
+#ifndef SCHEDULER_BUCKET_QUEUE
    taskList_item_t** taskListWalker;
+#endif
+   PORT_TIMER_WIDTH  irqOffStart;
+   PORT_TIMER_WIDTH  irqOffDuration;
    INTERRUPT_DECLARATION();
    
    DISABLE_INTERRUPTS();
+   irqOffStart = bsp_timer_get_currentValue();
    
+#ifdef SCHEDULER_BUCKET_QUEUE
+   // take a task container from the free list
+   taskContainer = scheduler_vars.freeList;
+   if (taskContainer==NULL) {
+#else
    // find an empty task container
    taskContainer = &scheduler_vars.taskBuf[0];
    while (taskContainer->cb!=NULL &&
@@ -72,6 +89,7 @@ void scheduler_start() {
       taskContainer++;
    }
    if (taskContainer>&scheduler_vars.taskBuf[TASK_LIST_DEPTH-1]) {
+#endif
       // task list has overflown. This should never happpen!
    
       // we can not print from within the kernel. Instead:
@@ -84,6 +102,19 @@ void scheduler_start() {
    taskContainer->cb              = cb;
    taskContainer->prio            = prio;
    
+#ifdef SCHEDULER_BUCKET_QUEUE
+   scheduler_vars.freeList        = taskContainer->next;
+   
+   // append at the tail of the bucket of that priority
+   taskContainer->next            = NULL;
+   if (scheduler_vars.bucketHead[prio]==NULL) {
+      scheduler_vars.bucketHead[prio]           = taskContainer;
+      scheduler_vars.bucketBitmap              |= (1<<prio);
+   } else {
+      scheduler_vars.bucketTail[prio]->next     = taskContainer;
+   }
+   scheduler_vars.bucketTail[prio]              = taskContainer;
+#else
    // find position in queue
    taskListWalker                 = &scheduler_vars.task_list;
    while (*taskListWalker!=NULL &&
@@ -93,13 +124,95 @@ void scheduler_start() {
    // insert at that position
    taskContainer->next            = *taskListWalker;
    *taskListWalker                = taskContainer;
+#endif
    // maintain debug stats
    scheduler_dbg.numTasksCur++;
    if (scheduler_dbg.numTasksCur>scheduler_dbg.numTasksMax) {
       scheduler_dbg.numTasksMax   = scheduler_dbg.numTasksCur;
    }
+   irqOffDuration = bsp_timer_get_currentValue()-irqOffStart;
+   if (irqOffDuration>scheduler_dbg.maxIrqOffPush) {
+      scheduler_dbg.maxIrqOffPush = irqOffDuration;
+   }
    
    ENABLE_INTERRUPTS();
 }
 
 //=========================== private =========================================
+
+/**
+\brief Dequeue the highest priority task.
+
+The task is copied into the caller's container and its queue container is
+released right away, so tasks pushed while it executes can reuse it.
+
+\param[out] task Where to copy the dequeued task.
+
+\returns TRUE if a task was dequeued, FALSE if there is no task to run.
+*/
+bool scheduler_popTask(taskList_item_t* task) {
+   taskList_item_t*  pThisTask;
+#ifdef SCHEDULER_BUCKET_QUEUE
+   uint16_t          bitmap;
+   uint8_t           prio;
+#endif
+   PORT_TIMER_WIDTH  irqOffStart;
+   PORT_TIMER_WIDTH  irqOffDuration;
+   INTERRUPT_DECLARATION();
+   
+   DISABLE_INTERRUPTS();
+   irqOffStart = bsp_timer_get_currentValue();
+   
+#ifdef SCHEDULER_BUCKET_QUEUE
+   pThisTask = NULL;
+   bitmap    = scheduler_vars.bucketBitmap;
+   if (bitmap!=0) {
+      // find the lowest non-empty priority, one nibble at a time
+      prio = 0;
+      while ((bitmap & 0x0f)==0) {
+         bitmap >>= 4;
+         prio    += 4;
+      }
+      prio += scheduler_lowestBitInNibble[bitmap & 0x0f];
+      
+      // remove the task at the head of that bucket
+      pThisTask                             = scheduler_vars.bucketHead[prio];
+      scheduler_vars.bucketHead[prio]       = pThisTask->next;
+      if (scheduler_vars.bucketHead[prio]==NULL) {
+         scheduler_vars.bucketTail[prio]    = NULL;
+         scheduler_vars.bucketBitmap       &= ~(1<<prio);
+      }
+      
+      // copy the task out and give its container back to the free list
+      *task                                 = *pThisTask;
+      pThisTask->cb                         = NULL;
+      pThisTask->prio                       = TASKPRIO_NONE;
+      pThisTask->next                       = scheduler_vars.freeList;
+      scheduler_vars.freeList               = pThisTask;
+      scheduler_dbg.numTasksCur--;
+   }
+#else
+   // the task to execute is the one at the head of the queue
+   pThisTask = scheduler_vars.task_list;
+   if (pThisTask!=NULL) {
+      // shift the queue by one task
+      scheduler_vars.task_list              = pThisTask->next;
+      
+      // copy the task out and free up its container
+      *task                                 = *pThisTask;
+      pThisTask->cb                         = NULL;
+      pThisTask->prio                       = TASKPRIO_NONE;
+      pThisTask->next                       = NULL;
+      scheduler_dbg.numTasksCur--;
+   }
+#endif
+   
+   irqOffDuration = bsp_timer_get_currentValue()-irqOffStart;
+   if (irqOffDuration>scheduler_dbg.maxIrqOffPop) {
+      scheduler_dbg.maxIrqOffPop = irqOffDuration;
+   }
+   
+   ENABLE_INTERRUPTS();
+   
+   return (pThisTask!=NULL);
+}
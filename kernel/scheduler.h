@@ -24,15 +24,21 @@ typedef enum {
    TASKPRIO_COAP                  = 0x06,
    TASKPRIO_ADAPTIVE_SYNC         = 0x07, 
    TASKPRIO_OTF                   = 0x08,
+   TASKPRIO_FRAG                  = 0x09,
    // tasks trigger by other interrupts
-   TASKPRIO_BUTTON                = 0x09,
-   TASKPRIO_SIXTOP_TIMEOUT        = 0x0a,
-   TASKPRIO_SNIFFER               = 0x0b,
-   TASKPRIO_MAX                   = 0x0c,
+   TASKPRIO_BUTTON                = 0x0a,
+   TASKPRIO_SIXTOP_TIMEOUT        = 0x0b,
+   TASKPRIO_SNIFFER               = 0x0c,
+   TASKPRIO_MAX                   = 0x0d,
 } task_prio_t;
 
 #define TASK_LIST_DEPTH           10
 
+// The task queue is either a single linked-list sorted by priority (default),
+// or, when SCHEDULER_BUCKET_QUEUE is defined (scons option bucketscheduler=1),
+// one FIFO per priority level plus a bitmap of non-empty levels. The latter
+// pushes and pops in constant time, i.e. with a bounded interrupts-off window.
+
 //=========================== typedef =========================================
 
 typedef void (*task_cbt)(void);
@@ -47,7 +53,14 @@ typedef struct task_llist_t {
 
 typedef struct {
    taskList_item_t                taskBuf[TASK_LIST_DEPTH];
+#ifdef SCHEDULER_BUCKET_QUEUE
+   taskList_item_t*               freeList;                  // unused task containers
+   taskList_item_t*               bucketHead[TASKPRIO_MAX];  // oldest task of each priority
+   taskList_item_t*               bucketTail[TASKPRIO_MAX];  // newest task of each priority
+   uint16_t                       bucketBitmap;              // bit n set iff bucket n not empty
+#else
    taskList_item_t*               task_list;
+#endif
    uint8_t                        numTasksCur;
    uint8_t                        numTasksMax;
 } scheduler_vars_t;
@@ -55,6 +68,8 @@ typedef struct {
 typedef struct {
    uint8_t                        numTasksCur;
    uint8_t                        numTasksMax;
+   PORT_TIMER_WIDTH               maxIrqOffPush;  // longest interrupts-off time in scheduler_push_task(), in ticks
+   PORT_TIMER_WIDTH               maxIrqOffPop;   // longest interrupts-off time when dequeuing a task, in ticks
 } scheduler_dbg_t;
 
 //=========================== prototypes ======================================
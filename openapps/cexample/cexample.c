@@ -97,7 +97,10 @@ void cexample_task_cb() {
    avg = sum/N_avg;
    
    // create a CoAP RD packet
-   pkt = openqueue_getFreePacketBuffer(COMPONENT_CEXAMPLE);
+   pkt = opencoap_getFreePacketBuffer(
+      COMPONENT_CEXAMPLE,
+      1+(sizeof(cexample_path0)-1)+2+1+PAYLOADLEN
+   );
    if (pkt==NULL) {
       openserial_printError(
          COMPONENT_CEXAMPLE,
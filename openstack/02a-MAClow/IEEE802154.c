@@ -182,6 +182,15 @@ void ieee802154_prependHeader(OpenQueueEntry_t* msg,
    *((uint8_t*)(msg->payload)) = temp_8b;
 }
 
+/**
+\brief Set the frame pending bit of a frame which header is already prepended.
+
+\param[in,out] msg The frame, its payload starting with the frame control field.
+*/
+void ieee802154_setFramePending(OpenQueueEntry_t* msg) {
+   *((uint8_t*)(msg->payload)) |= IEEE154_PENDING_YES_FRAMEPENDING << IEEE154_FCF_FRAME_PENDING;
+}
+
 /**
 \brief Retreieve the IEEE802.15.4 MAC header from a (just received) packet.
 
@@ -93,6 +93,7 @@ void     updateStats(PORT_SIGNED_INT_WIDTH timeCorrection);
 uint8_t  calculateFrequency(uint8_t channelOffset);
 void     changeState(ieee154e_state_t newstate);
 void     endSlot(void);
+bool     ieee154e_canBurst(void);
 bool     debugPrint_asn(void);
 bool     debugPrint_isSync(void);
 // interrupts
@@ -554,7 +555,7 @@ port_INLINE void activity_synchronize_endOfFrame(PORT_RADIOTIMER_WIDTH capturedT
       ieee154e_vars.dataReceived->payload = &(ieee154e_vars.dataReceived->packet[FIRST_FRAME_BYTE]);
       radio_getReceivedFrame(       ieee154e_vars.dataReceived->payload,
                                    &ieee154e_vars.dataReceived->length,
-                             sizeof(ieee154e_vars.dataReceived->packet),
+                             ieee154e_vars.dataReceived->packetSize,
                                    &ieee154e_vars.dataReceived->l1_rssi,
                                    &ieee154e_vars.dataReceived->l1_lqi,
                                    &ieee154e_vars.dataReceived->l1_crc);
@@ -833,6 +834,7 @@ port_INLINE void activity_ti1ORri1() {
    sync_IE_ht  sync_IE;
    bool        changeToRX=FALSE;
    bool        couldSendEB=FALSE;
+   bool        isBurstSlot;
    uint16_t    numOfSleepSlots;     
 
    // increment ASN (do this first so debug pins are in sync)
@@ -844,6 +846,11 @@ port_INLINE void activity_ti1ORri1() {
       debugpins_frame_toggle();
    }
    
+   // whether the cell of the previous slot continues in this one
+   isBurstSlot                  = ieee154e_vars.isBurstNext;
+   ieee154e_vars.isBurstNext    = FALSE;
+   ieee154e_vars.framePending   = FALSE;
+   
    // desynchronize if needed
    if (idmanager_getIsDAGroot()==FALSE) {
       ieee154e_vars.deSyncTimeout--;
@@ -886,8 +893,16 @@ port_INLINE void activity_ti1ORri1() {
       return;
    }
    
+   if (isBurstSlot==TRUE) {
+      // the schedule still points at the cell being extended, unless that
+      // cell was removed meanwhile
+      schedule_getNeighbor(&neighbor);
+      isBurstSlot = packetfunctions_sameAddress(&neighbor,&(ieee154e_vars.burstNeighbor));
+   }
+   
    if (ieee154e_vars.slotOffset==ieee154e_vars.nextActiveSlotOffset) {
       // this is the next active slot
+      ieee154e_vars.burstLength = 0;
       
       // advance the schedule
       schedule_advanceSlot();
@@ -898,7 +913,7 @@ port_INLINE void activity_ti1ORri1() {
           if (ieee154e_vars.nextActiveSlotOffset>ieee154e_vars.slotOffset) {
               numOfSleepSlots = ieee154e_vars.nextActiveSlotOffset-ieee154e_vars.slotOffset;
           } else {
-              numOfSleepSlots = schedule_getFrameLength()+ieee154e_vars.nextActiveSlotOffset-ieee154e_vars.slotOffset; 
+              numOfSleepSlots = schedule_getHyperframeLength()+ieee154e_vars.nextActiveSlotOffset-ieee154e_vars.slotOffset; 
           }
           
           radio_setTimerPeriod(TsSlotDuration*(numOfSleepSlots));
@@ -908,6 +923,9 @@ port_INLINE void activity_ti1ORri1() {
              incrementAsnOffset();
           }
       }
+   } else if (isBurstSlot==TRUE) {
+      // this idle slot extends the cell of the previous slot
+      ieee154e_vars.burstLength++;
    } else {
       // this is NOT the next active slot, abort
       // stop using serial
@@ -950,7 +968,7 @@ port_INLINE void activity_ti1ORri1() {
             // change state
             changeState(S_TXDATAOFFSET);
             // change owner
-            ieee154e_vars.dataToSend->owner = COMPONENT_IEEE802154E;
+            openqueue_changeOwner(ieee154e_vars.dataToSend,COMPONENT_IEEE802154E);
             if (couldSendEB==TRUE) {        // I will be sending an EB
                //copy synch IE  -- should be Little endian???
                // fill in the ASN field of the EB
@@ -960,6 +978,16 @@ port_INLINE void activity_ti1ORri1() {
             }
             // record that I attempt to transmit this packet
             ieee154e_vars.dataToSend->l2_numTxAttempts++;
+            // announce the next frame queued for that neighbor (this one is
+            // no longer counted, the MAC owns it), if it can follow in the
+            // next slot
+            if (
+                  cellType==CELLTYPE_TX                       &&
+                  ieee154e_canBurst()==TRUE                   &&
+                  openqueue_getNumPacketsTo(&neighbor)>0
+               ) {
+               ieee154e_vars.framePending = TRUE;
+            }
             // arm tt1
             radiotimer_schedule(DURATION_tt1);
             break;
@@ -998,7 +1026,7 @@ port_INLINE void activity_ti1ORri1() {
              if (ieee154e_vars.nextActiveSlotOffset>ieee154e_vars.slotOffset) {
                  numOfSleepSlots = ieee154e_vars.nextActiveSlotOffset-ieee154e_vars.slotOffset+NUMSERIALRX-1;
              } else {
-                 numOfSleepSlots = schedule_getFrameLength()+ieee154e_vars.nextActiveSlotOffset-ieee154e_vars.slotOffset+NUMSERIALRX-1; 
+                 numOfSleepSlots = schedule_getHyperframeLength()+ieee154e_vars.nextActiveSlotOffset-ieee154e_vars.slotOffset+NUMSERIALRX-1; 
              }
              
              radio_setTimerPeriod(TsSlotDuration*(numOfSleepSlots));
@@ -1036,7 +1064,15 @@ port_INLINE void activity_ti2() {
    changeState(S_TXDATAPREPARE);
 
    // make a local copy of the frame
+   ieee154e_vars.localCopyForTransmission.packet     = &ieee154e_vars.localCopyPacket[0];
+   ieee154e_vars.localCopyForTransmission.packetSize = PACKETBUFFER_LARGE_SIZE;
    packetfunctions_duplicatePacket(&ieee154e_vars.localCopyForTransmission, ieee154e_vars.dataToSend);
+   
+   // set the frame pending bit in the local copy only, a retransmission in a
+   // later cell might not be able to announce a next frame
+   if (ieee154e_vars.framePending==TRUE) {
+      ieee802154_setFramePending(&ieee154e_vars.localCopyForTransmission);
+   }
 
    // check if packet needs to be encrypted/authenticated before transmission 
    if (ieee154e_vars.localCopyForTransmission.l2_securityLevel != IEEE154_ASH_SLF_TYPE_NOSEC) { // security enabled
@@ -1221,7 +1257,7 @@ port_INLINE void activity_tie5() {
       notif_sendDone(ieee154e_vars.dataToSend,E_FAIL);
    } else {
       // return packet to the virtual COMPONENT_SIXTOP_TO_IEEE802154E component
-      ieee154e_vars.dataToSend->owner = COMPONENT_SIXTOP_TO_IEEE802154E;
+      openqueue_changeOwner(ieee154e_vars.dataToSend,COMPONENT_SIXTOP_TO_IEEE802154E);
    }
    
    // reset local variable
@@ -1298,7 +1334,7 @@ port_INLINE void activity_ti9(PORT_RADIOTIMER_WIDTH capturedTime) {
       ieee154e_vars.ackReceived->payload = &(ieee154e_vars.ackReceived->packet[FIRST_FRAME_BYTE]);
       radio_getReceivedFrame(       ieee154e_vars.ackReceived->payload,
                                    &ieee154e_vars.ackReceived->length,
-                             sizeof(ieee154e_vars.ackReceived->packet),
+                             ieee154e_vars.ackReceived->packetSize,
                                    &ieee154e_vars.ackReceived->l1_rssi,
                                    &ieee154e_vars.ackReceived->l1_lqi,
                                    &ieee154e_vars.ackReceived->l1_crc);
@@ -1359,6 +1395,12 @@ port_INLINE void activity_ti9(PORT_RADIOTIMER_WIDTH capturedTime) {
          synchronizeAck(ieee802514_header.timeCorrection);
       }
       
+      // the neighbor keeps listening for my next frame in the next slot
+      if (ieee154e_vars.framePending==TRUE && ieee802514_header.framePending==TRUE) {
+         ieee154e_vars.isBurstNext = TRUE;
+         schedule_getNeighbor(&(ieee154e_vars.burstNeighbor));
+      }
+      
       // inform schedule of successful transmission
       schedule_indicateTx(&ieee154e_vars.asn,TRUE);
       
@@ -1460,6 +1502,7 @@ port_INLINE void activity_rie3() {
 port_INLINE void activity_ri5(PORT_RADIOTIMER_WIDTH capturedTime) {
    ieee802154_header_iht ieee802514_header;
    uint16_t lenIE=0;
+   open_addr_t neighbor;
    
    // change state
    changeState(S_TXACKOFFSET);
@@ -1502,7 +1545,7 @@ port_INLINE void activity_ri5(PORT_RADIOTIMER_WIDTH capturedTime) {
       ieee154e_vars.dataReceived->payload = &(ieee154e_vars.dataReceived->packet[FIRST_FRAME_BYTE]);
       radio_getReceivedFrame(       ieee154e_vars.dataReceived->payload,
                                    &ieee154e_vars.dataReceived->length,
-                             sizeof(ieee154e_vars.dataReceived->packet),
+                             ieee154e_vars.dataReceived->packetSize,
                                    &ieee154e_vars.dataReceived->l1_rssi,
                                    &ieee154e_vars.dataReceived->l1_lqi,
                                    &ieee154e_vars.dataReceived->l1_crc);
@@ -1578,6 +1621,18 @@ port_INLINE void activity_ri5(PORT_RADIOTIMER_WIDTH capturedTime) {
       
       // check if ack requested
       if (ieee802514_header.ackRequested==1 && ieee154e_vars.isAckEnabled == TRUE) {
+         // keep listening in the next slot if the neighbor of this cell has
+         // another frame for me
+         if (
+               ieee802514_header.framePending==TRUE     &&
+               schedule_getType()==CELLTYPE_RX          &&
+               ieee154e_canBurst()==TRUE
+            ) {
+            schedule_getNeighbor(&neighbor);
+            if (packetfunctions_sameAddress(&neighbor,&(ieee154e_vars.dataReceived->l2_nextORpreviousHop))) {
+               ieee154e_vars.framePending = TRUE;
+            }
+         }
          // arm rt5
          radiotimer_schedule(DURATION_rt5);
       } else {
@@ -1613,8 +1668,8 @@ port_INLINE void activity_ri6() {
    // change state
    changeState(S_TXACKPREPARE);
    
-   // get a buffer to put the ack to send in
-   ieee154e_vars.ackToSend = openqueue_getFreePacketBuffer(COMPONENT_IEEE802154E);
+   // get a buffer to put the ack to send in (only carries the time correction IE)
+   ieee154e_vars.ackToSend = openqueue_getFreePacketBufferForLength(COMPONENT_IEEE802154E,IEEE802154E_ACK_IE_LEN);
    if (ieee154e_vars.ackToSend==NULL) {
       // log the error
       openserial_printError(COMPONENT_IEEE802154E,ERR_NO_FREE_PACKET_BUFFER,
@@ -1654,6 +1709,11 @@ port_INLINE void activity_ri6() {
                             &(ieee154e_vars.dataReceived->l2_nextORpreviousHop)
                             );
    
+   // tell the sender I keep listening in the next slot
+   if (ieee154e_vars.framePending==TRUE) {
+      ieee802154_setFramePending(ieee154e_vars.ackToSend);
+   }
+   
    // if security is enabled, encrypt directly in OpenQueue as there are no retransmissions for ACKs
    if (ieee154e_vars.ackToSend->l2_securityLevel != IEEE154_ASH_SLF_TYPE_NOSEC) {
       if (IEEE802154_SECURITY.outgoingFrame(ieee154e_vars.ackToSend) != E_SUCCESS) {
@@ -1768,6 +1828,12 @@ port_INLINE void activity_ri9(PORT_RADIOTIMER_WIDTH capturedTime) {
    // clear local variable
    ieee154e_vars.dataReceived = NULL;
    
+   // listen for the next frame of the sender in the next slot
+   if (ieee154e_vars.framePending==TRUE) {
+      ieee154e_vars.isBurstNext = TRUE;
+      schedule_getNeighbor(&(ieee154e_vars.burstNeighbor));
+   }
+   
    // official end of Rx slot
    endSlot();
 }
@@ -1848,9 +1914,15 @@ port_INLINE void incrementAsnOffset() {
    }
    
    // increment the offsets
-   frameLength = schedule_getFrameLength();
+   frameLength = schedule_getHyperframeLength();
    if (frameLength == 0) {
       ieee154e_vars.slotOffset++;
+   } else if (frameLength != ieee154e_vars.hyperframeLength) {
+      // a slotframe was added or removed: the slot offset in the new
+      // hyperframe follows from the ASN
+      ieee154e_syncSlotOffset();
+      schedule_syncSlotOffset((ieee154e_vars.slotOffset+frameLength-1)%frameLength);
+      ieee154e_vars.nextActiveSlotOffset = schedule_getNextActiveSlotOffset();
    } else {
       ieee154e_vars.slotOffset  = (ieee154e_vars.slotOffset+1)%frameLength;
    }
@@ -1928,7 +2000,7 @@ port_INLINE void ieee154e_syncSlotOffset() {
    frameLength_t frameLength;
    uint32_t slotOffset;
    
-   frameLength = schedule_getFrameLength();
+   frameLength = schedule_getHyperframeLength();
    
    // determine the current slotOffset
    slotOffset = ieee154e_vars.asn.byte4;
@@ -1941,6 +2013,7 @@ port_INLINE void ieee154e_syncSlotOffset() {
    slotOffset = slotOffset % frameLength;
    
    ieee154e_vars.slotOffset       = (slotOffset_t) slotOffset;
+   ieee154e_vars.hyperframeLength = frameLength;
 }
 
 void ieee154e_setIsAckEnabled(bool isEnabled){
@@ -2086,6 +2159,7 @@ void changeIsSync(bool newIsSync) {
    } else {
       leds_sync_off();
       schedule_resetBackoff();
+      ieee154e_vars.isBurstNext = FALSE;
    }
 }
 
@@ -2098,7 +2172,7 @@ void notif_sendDone(OpenQueueEntry_t* packetSent, owerror_t error) {
    memcpy(&packetSent->l2_asn,&ieee154e_vars.asn,sizeof(asn_t));
    // associate this packet with the virtual component
    // COMPONENT_IEEE802154E_TO_RES so RES can knows it's for it
-   packetSent->owner              = COMPONENT_IEEE802154E_TO_SIXTOP;
+   openqueue_changeOwner(packetSent,COMPONENT_IEEE802154E_TO_SIXTOP);
    // post RES's sendDone task
    scheduler_push_task(task_sixtopNotifSendDone,TASKPRIO_SIXTOP_NOTIF_TXDONE);
    // wake up the scheduler
@@ -2112,7 +2186,7 @@ void notif_receive(OpenQueueEntry_t* packetReceived) {
    schedule_indicateRx(&packetReceived->l2_asn);
    // associate this packet with the virtual component
    // COMPONENT_IEEE802154E_TO_SIXTOP so sixtop can knows it's for it
-   packetReceived->owner          = COMPONENT_IEEE802154E_TO_SIXTOP;
+   openqueue_changeOwner(packetReceived,COMPONENT_IEEE802154E_TO_SIXTOP);
 #ifdef GOLDEN_IMAGE_ROOT
 //   openserial_printInfo(COMPONENT_IEEE802154E,ERR_PACKET_SYNC,
 //                   (errorparameter_t)packetReceived->l2_asn.bytes0and1,
@@ -2225,6 +2299,31 @@ void changeState(ieee154e_state_t newstate) {
    }
 }
 
+/**
+\brief Indicate whether the cell of this slot can be extended into the next slot.
+
+A cell is extended by at most MAXBURSTSLOTS slots, and only into slots which
+are idle in my schedule. A mote skipping its idle slots does not wake up for
+them, so never extends a cell.
+
+\returns TRUE if the cell can be extended, FALSE otherwise.
+*/
+bool ieee154e_canBurst() {
+   frameLength_t frameLength;
+   
+   if (idmanager_getIsSlotSkip()==TRUE && idmanager_getIsDAGroot()==FALSE) {
+      return FALSE;
+   }
+   if (ieee154e_vars.burstLength>=MAXBURSTSLOTS) {
+      return FALSE;
+   }
+   frameLength = schedule_getHyperframeLength();
+   if (frameLength==0) {
+      return FALSE;
+   }
+   return ((ieee154e_vars.slotOffset+1)%frameLength)!=ieee154e_vars.nextActiveSlotOffset;
+}
+
 /**
 \brief Housekeeping tasks to do at the end of each slot.
 
@@ -2281,7 +2380,7 @@ void endSlot() {
          notif_sendDone(ieee154e_vars.dataToSend,E_FAIL);
       } else {
          // return packet to the virtual COMPONENT_SIXTOP_TO_IEEE802154E component
-         ieee154e_vars.dataToSend->owner = COMPONENT_SIXTOP_TO_IEEE802154E;
+         openqueue_changeOwner(ieee154e_vars.dataToSend,COMPONENT_SIXTOP_TO_IEEE802154E);
       }
       
       // reset local variable
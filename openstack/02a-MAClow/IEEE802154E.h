@@ -34,6 +34,13 @@ static const uint8_t chTemplate_default[] = {
 #define LENGTH_IEEE154_MAX         128 // max length of a valid radio packet  
 #define DUTY_CYCLE_WINDOW_LIMIT    (0xFFFFFFFF>>1) // limit of the dutycycle window
 
+// max number of idle slots a dedicated cell is extended into, to send the
+// frames queued for its neighbor back-to-back. Can be overwritten in
+// board_info.h.
+#ifndef MAXBURSTSLOTS
+#define MAXBURSTSLOTS                3
+#endif
+
 //15.4e information elements related
 #define IEEE802154E_PAYLOAD_DESC_LEN_SHIFT                 0x04
 #define IEEE802154E_PAYLOAD_DESC_GROUP_ID_MLME             (1<<11)
@@ -85,6 +92,7 @@ static const uint8_t chTemplate_default[] = {
 
 #define IEEE802154E_MLME_IE_GROUPID                        0x01
 #define IEEE802154E_ACK_NACK_TIMECORRECTION_ELEMENTID      0x1E
+#define IEEE802154E_ACK_IE_LEN                             (2+2) // header IE descriptor + time correction, carried by ACKs
 
 /**
 When a packet is received, it is written inside the OpenQueueEntry_t->packet
@@ -220,9 +228,11 @@ typedef struct {
    asn_t                     asn;                     // current absolute slot number
    slotOffset_t              slotOffset;              // current slot offset
    slotOffset_t              nextActiveSlotOffset;    // next active slot offset
+   frameLength_t             hyperframeLength;        // hyperframe length the slot offset is counted in
    PORT_RADIOTIMER_WIDTH     deSyncTimeout;           // how many slots left before looses sync
    bool                      isSync;                  // TRUE iff mote is synchronized to network
    OpenQueueEntry_t          localCopyForTransmission;// copy of the frame used for current TX
+   uint8_t                   localCopyPacket[PACKETBUFFER_LARGE_SIZE];// buffer of localCopyForTransmission
    // as shown on the chronogram
    ieee154e_state_t          state;                   // state of the FSM
    OpenQueueEntry_t*         dataToSend;              // pointer to the data to send
@@ -250,6 +260,11 @@ typedef struct {
    bool                      isSecurityEnabled;       // whether security is applied
    // time correction
    int16_t                   timeCorrection;          // store the timeCorrection, prepend and retrieve it inside of frame header
+   // burst
+   bool                      framePending;            // TRUE iff the frame (or ACK) sent in this slot has the frame pending bit set
+   bool                      isBurstNext;             // TRUE iff the current cell continues in the next slot
+   uint8_t                   burstLength;             // number of slots the current cell has been extended by
+   open_addr_t               burstNeighbor;           // neighbor of the cell being extended
    
    uint16_t                  slotDuration;            // 
 } ieee154e_vars_t;
@@ -54,6 +54,18 @@ m_keyDescriptor* IEEE802154_security_keyDescriptorLookup(uint8_t      KeyIdMode,
                                                          open_addr_t* panID,
                                                          uint8_t      frameType);
 
+m_keyDescriptor* IEEE802154_security_incomingPolicyChecking(OpenQueueEntry_t* msg);
+
+m_securityContext* IEEE802154_security_contextLookup(OpenQueueEntry_t* msg,
+                                                     bool              outgoing);
+
+void IEEE802154_security_contextStore(OpenQueueEntry_t* msg,
+                                      bool              outgoing,
+                                      m_keyDescriptor*  keyDescriptor);
+
+uint8_t IEEE802154_security_contextIndex(OpenQueueEntry_t* msg,
+                                         bool              outgoing);
+
 //=========================== admin ===========================================
 
 /**
@@ -181,6 +193,11 @@ void IEEE802154_security_init(void) {
 
    ieee802154_security_vars.MacDeviceTable.DeviceDescriptorEntry[1].deviceAddress = ieee802154_security_vars.m_macDefaultKeySource;
    ieee802154_security_vars.MacKeyTable.KeyDescriptorElement[1].DeviceTable = &ieee802154_security_vars.MacDeviceTable;
+   
+   //the tables changed, forget what was resolved from them
+   memset(&ieee802154_security_vars.contexts[0],
+          0,
+          sizeof(ieee802154_security_vars.contexts));
 }
 
 //=========================== public ==========================================
@@ -282,10 +299,9 @@ void IEEE802154_security_prependAuxiliarySecurityHeader(OpenQueueEntry_t* msg){
 owerror_t IEEE802154_security_outgoingFrameSecurity(OpenQueueEntry_t*   msg){
    uint8_t frameCounterSuppression;
    m_keyDescriptor* keyDescriptor;
+   m_securityContext* context;
    uint8_t i;
-   uint8_t j;
    uint8_t nonce[13];
-   uint8_t key[16];
    owerror_t outStatus;
    uint8_t* a;
    uint8_t len_a;
@@ -295,23 +311,27 @@ owerror_t IEEE802154_security_outgoingFrameSecurity(OpenQueueEntry_t*   msg){
    //the frame counter is carried in the frame, otherwise 1;
    frameCounterSuppression = IEEE154_ASH_FRAMECOUNTER_SUPPRESSED;
 
-   //search for a key
-   keyDescriptor = IEEE802154_security_keyDescriptorLookup(msg->l2_keyIdMode,
-                                                           &msg->l2_keySource,
-                                                           msg->l2_keyIndex,
-                                                           &msg->l2_keySource,
-                                                           (idmanager_getMyID(ADDR_PANID)),
-                                                           msg->l2_frameType);
-
-   if (keyDescriptor==NULL){//key not found
-      openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
-                           (errorparameter_t)msg->l2_frameType,
-                           (errorparameter_t)1);
-      return E_FAIL;
-   }
+   //the key is known if we already sent this kind of frame to that neighbor
+   context = IEEE802154_security_contextLookup(msg,TRUE);
+   if (context!=NULL){
+      keyDescriptor = context->keyDescriptor;
+   } else {
+      //search for a key
+      keyDescriptor = IEEE802154_security_keyDescriptorLookup(msg->l2_keyIdMode,
+                                                              &msg->l2_keySource,
+                                                              msg->l2_keyIndex,
+                                                              &msg->l2_keySource,
+                                                              (idmanager_getMyID(ADDR_PANID)),
+                                                              msg->l2_frameType);
+
+      if (keyDescriptor==NULL){//key not found
+         openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
+                              (errorparameter_t)msg->l2_frameType,
+                              (errorparameter_t)1);
+         return E_FAIL;
+      }
 
-   for (j=0;j<16;j++){
-      key[j] = keyDescriptor->key[j];
+      IEEE802154_security_contextStore(msg,TRUE,keyDescriptor);
    }
 
    uint8_t vectASN[5];
@@ -328,7 +348,6 @@ owerror_t IEEE802154_security_outgoingFrameSecurity(OpenQueueEntry_t*   msg){
    } //otherwise the frame counter is not in the frame
 
    //nonce creation
-   memset(&nonce[0], 0, 13);
    //first 8 bytes of the nonce are always the source address of the frame
    memcpy(&nonce[0],idmanager_getMyID(ADDR_64B)->addr_64b,8);
 
@@ -384,7 +403,7 @@ owerror_t IEEE802154_security_outgoingFrameSecurity(OpenQueueEntry_t*   msg){
                                           &len_m,
                                           nonce,
                                           2, // L=2 in 15.4 std
-                                          key,
+                                          keyDescriptor->key,
                                           msg->l2_authenticationLength);
 
    //verify that no errors occurred
@@ -506,9 +525,8 @@ void IEEE802154_security_retrieveAuxiliarySecurityHeader(OpenQueueEntry_t*
 */
 owerror_t IEEE802154_security_incomingFrame(OpenQueueEntry_t* msg){
    
-   m_deviceDescriptor*        deviceDescriptor;
    m_keyDescriptor*           keyDescriptor;
-   m_securityLevelDescriptor* securityLevelDescriptor;
+   m_securityContext*         context;
    uint8_t nonce[13];
    uint8_t i;
    uint8_t myASN[5];
@@ -518,69 +536,19 @@ owerror_t IEEE802154_security_incomingFrame(OpenQueueEntry_t* msg){
    uint8_t* c;
    uint8_t len_c;
 
-   //key descriptor lookup procedure
-   keyDescriptor = IEEE802154_security_keyDescriptorLookup(msg->l2_keyIdMode,
-                                                          &msg->l2_keySource,
-                                                          msg->l2_keyIndex,
-                                                          &msg->l2_keySource,
-                                                          idmanager_getMyID(ADDR_PANID),
-                                                          msg->l2_frameType);
-
-   if (keyDescriptor==NULL){//can't find the key
-      openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
-                           (errorparameter_t)msg->l2_frameType,
-                           (errorparameter_t)6);
-      return E_FAIL;
-   }
-
-   //device descriptor lookup
-   deviceDescriptor = IEEE802154_security_deviceDescriptorLookup(&msg->l2_keySource,
-                                                                idmanager_getMyID(ADDR_PANID),
-                                                                keyDescriptor);
-
-   if (deviceDescriptor==NULL){//can't find the device in the list of authorized neighbors
-      openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
-                           (errorparameter_t)msg->l2_frameType,
-                           (errorparameter_t)7);
-      return E_FAIL;
-   }
-
-   //Security Level Descriptorlookup
-   securityLevelDescriptor = IEEE802154_security_securityLevelDescriptorLookup(msg->l2_frameType,
-                                                                              msg->commandFrameIdentifier);
-
-   if (securityLevelDescriptor == NULL){//can't find the frame type in the list of allowed frame types
-      openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
-                           (errorparameter_t)msg->l2_frameType,
-                           (errorparameter_t)8);
-      return E_FAIL;
-   }
-
-   //incoming security level checking
-   outStatus = IEEE802154_security_incomingSecurityLevelChecking(securityLevelDescriptor,
-                                                                 msg->l2_securityLevel,
-                                                                 deviceDescriptor->Exempt);
-
-   if(outStatus == FALSE) {//security level not allowed according to local security policies
-      openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
-                           (errorparameter_t)msg->l2_frameType,
-                           (errorparameter_t)9);
-      return E_FAIL;
-   }
-
-   //incoming key usage policy checking
-   outStatus = IEEE802154_security_incomingKeyUsagePolicyChecking(keyDescriptor,
-                                                                  msg->l2_frameType,
-                                                                  0);
-   if(outStatus == FALSE){// improper use of the key, according to local security policies
-     openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
-                          (errorparameter_t)msg->l2_frameType,
-                          (errorparameter_t)10);
-     return E_FAIL;
+   //the checks already passed if we received this kind of frame from that neighbor
+   context = IEEE802154_security_contextLookup(msg,FALSE);
+   if (context!=NULL){
+      keyDescriptor = context->keyDescriptor;
+   } else {
+      keyDescriptor = IEEE802154_security_incomingPolicyChecking(msg);
+      if (keyDescriptor==NULL){
+         return E_FAIL;
+      }
+      IEEE802154_security_contextStore(msg,FALSE,keyDescriptor);
    }
 
    //create nonce
-   memset(&nonce[0], 0, 13);
    //first 8 bytes of the nonce are always the source address of the frame
    memcpy(&nonce[0],msg->l2_nextORpreviousHop.addr_64b,8);
 
@@ -900,6 +868,179 @@ m_keyDescriptor* IEEE802154_security_keyDescriptorLookup(uint8_t      KeyIdMode,
    return NULL;
 }
 
+/**
+\brief Look up the key of an incoming frame and check it against the local
+       security policies.
+
+\returns The key descriptor, or NULL if the frame must be dropped.
+*/
+m_keyDescriptor* IEEE802154_security_incomingPolicyChecking(OpenQueueEntry_t* msg){
+   m_deviceDescriptor*        deviceDescriptor;
+   m_keyDescriptor*           keyDescriptor;
+   m_securityLevelDescriptor* securityLevelDescriptor;
+   bool                       outStatus;
+   
+   //key descriptor lookup procedure
+   keyDescriptor = IEEE802154_security_keyDescriptorLookup(msg->l2_keyIdMode,
+                                                          &msg->l2_keySource,
+                                                          msg->l2_keyIndex,
+                                                          &msg->l2_keySource,
+                                                          idmanager_getMyID(ADDR_PANID),
+                                                          msg->l2_frameType);
+   
+   if (keyDescriptor==NULL){//can't find the key
+      openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
+                           (errorparameter_t)msg->l2_frameType,
+                           (errorparameter_t)6);
+      return NULL;
+   }
+   
+   //device descriptor lookup
+   deviceDescriptor = IEEE802154_security_deviceDescriptorLookup(&msg->l2_keySource,
+                                                                idmanager_getMyID(ADDR_PANID),
+                                                                keyDescriptor);
+   
+   if (deviceDescriptor==NULL){//can't find the device in the list of authorized neighbors
+      openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
+                           (errorparameter_t)msg->l2_frameType,
+                           (errorparameter_t)7);
+      return NULL;
+   }
+   
+   //Security Level Descriptorlookup
+   securityLevelDescriptor = IEEE802154_security_securityLevelDescriptorLookup(msg->l2_frameType,
+                                                                              msg->commandFrameIdentifier);
+   
+   if (securityLevelDescriptor == NULL){//can't find the frame type in the list of allowed frame types
+      openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
+                           (errorparameter_t)msg->l2_frameType,
+                           (errorparameter_t)8);
+      return NULL;
+   }
+   
+   //incoming security level checking
+   outStatus = IEEE802154_security_incomingSecurityLevelChecking(securityLevelDescriptor,
+                                                                 msg->l2_securityLevel,
+                                                                 deviceDescriptor->Exempt);
+   
+   if(outStatus == FALSE) {//security level not allowed according to local security policies
+      openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
+                           (errorparameter_t)msg->l2_frameType,
+                           (errorparameter_t)9);
+      return NULL;
+   }
+   
+   //incoming key usage policy checking
+   outStatus = IEEE802154_security_incomingKeyUsagePolicyChecking(keyDescriptor,
+                                                                  msg->l2_frameType,
+                                                                  0);
+   if(outStatus == FALSE){// improper use of the key, according to local security policies
+     openserial_printError(COMPONENT_SECURITY,ERR_SECURITY,
+                          (errorparameter_t)msg->l2_frameType,
+                          (errorparameter_t)10);
+     return NULL;
+   }
+   
+   return keyDescriptor;
+}
+
+/**
+\brief Find the security context of a frame.
+
+Contexts are direct-mapped on the neighbor address, the frame type and the
+direction, so this is a single comparison. A context is only used if every
+input of the lookups and checks it replaces is the same.
+
+\returns The context, or NULL if there is none for that frame.
+*/
+m_securityContext* IEEE802154_security_contextLookup(OpenQueueEntry_t* msg,
+                                                     bool              outgoing){
+   m_securityContext* context;
+   open_addr_t*       panId;
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   context = &ieee802154_security_vars.contexts[IEEE802154_security_contextIndex(msg,outgoing)];
+   panId   = idmanager_getMyID(ADDR_PANID);
+   
+   if (
+         context->keyDescriptor!=NULL                                                    &&
+         context->outgoing==outgoing                                                     &&
+         context->frameType==msg->l2_frameType                                           &&
+         context->commandFrameIdentifier==msg->commandFrameIdentifier                    &&
+         context->securityLevel==msg->l2_securityLevel                                   &&
+         context->keyIdMode==msg->l2_keyIdMode                                           &&
+         context->keyIndex==msg->l2_keyIndex                                             &&
+         context->panId[0]==panId->panid[0]                                              &&
+         context->panId[1]==panId->panid[1]                                              &&
+         packetfunctions_sameAddress(&context->neighbor,&msg->l2_nextORpreviousHop)      &&
+         packetfunctions_sameAddress(&context->keySource,&msg->l2_keySource)
+      ){
+      ENABLE_INTERRUPTS();
+      return context;
+   }
+   
+   ENABLE_INTERRUPTS();
+   return NULL;
+}
+
+/**
+\brief Remember what was resolved for a frame, replacing the context that was
+       in its place.
+*/
+void IEEE802154_security_contextStore(OpenQueueEntry_t* msg,
+                                      bool              outgoing,
+                                      m_keyDescriptor*  keyDescriptor){
+   m_securityContext* context;
+   open_addr_t*       panId;
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   context = &ieee802154_security_vars.contexts[IEEE802154_security_contextIndex(msg,outgoing)];
+   panId   = idmanager_getMyID(ADDR_PANID);
+   
+   context->keyDescriptor          = keyDescriptor;
+   context->outgoing               = outgoing;
+   context->frameType              = msg->l2_frameType;
+   context->commandFrameIdentifier = msg->commandFrameIdentifier;
+   context->securityLevel          = msg->l2_securityLevel;
+   context->keyIdMode              = msg->l2_keyIdMode;
+   context->keyIndex               = msg->l2_keyIndex;
+   context->panId[0]               = panId->panid[0];
+   context->panId[1]               = panId->panid[1];
+   memcpy(&context->neighbor,&msg->l2_nextORpreviousHop,sizeof(open_addr_t));
+   memcpy(&context->keySource,&msg->l2_keySource,sizeof(open_addr_t));
+   
+   ENABLE_INTERRUPTS();
+}
+
+/**
+\brief Index of the context slot of a frame.
+*/
+uint8_t IEEE802154_security_contextIndex(OpenQueueEntry_t* msg,
+                                         bool              outgoing){
+   uint8_t  lastByte;
+   uint16_t index;
+   
+   switch (msg->l2_nextORpreviousHop.type){
+      case ADDR_16B:
+         lastByte = msg->l2_nextORpreviousHop.addr_16b[1];
+         break;
+      case ADDR_64B:
+         lastByte = msg->l2_nextORpreviousHop.addr_64b[7];
+         break;
+      default:
+         lastByte = 0;
+         break;
+   }
+   
+   index  = lastByte;
+   index  = (index<<2) | (msg->l2_frameType & 0x03);
+   index  = (index<<1) | (outgoing==TRUE);
+   
+   return (uint8_t)(index % IEEE802154_SECURITY_NUMCONTEXTS);
+}
+
 /*
  * Store in the array the reference value 
  */
@@ -26,6 +26,17 @@
 
 #define MAXNUMKEYS           MAXNUMNEIGHBORS+1
 
+/**
+\brief Number of cached security contexts. Can be overwritten in board_info.h.
+
+A context holds what was resolved for a given neighbor, direction and frame
+type, so the key descriptor lookups and policy checks are done once instead of
+for every frame.
+*/
+#ifndef IEEE802154_SECURITY_NUMCONTEXTS
+#define IEEE802154_SECURITY_NUMCONTEXTS    MAXNUMNEIGHBORS
+#endif
+
 //=========================== typedef =========================================
 
 typedef struct{//identifier of the device which is using the key
@@ -75,6 +86,19 @@ typedef struct{
    m_securityLevelDescriptor SecurityDescriptorEntry[5];
 } m_macSecurityLevelTable;
 
+typedef struct{//what was resolved for the frames exchanged with a neighbor
+   m_keyDescriptor* keyDescriptor;          //NULL if the context is unused
+   open_addr_t      neighbor;               //destination of outgoing frames, source of incoming ones
+   bool             outgoing;
+   uint8_t          frameType;
+   uint8_t          commandFrameIdentifier;
+   uint8_t          securityLevel;
+   uint8_t          keyIdMode;
+   uint8_t          keyIndex;
+   open_addr_t      keySource;
+   uint8_t          panId[2];
+} m_securityContext;
+
 //=========================== variables =======================================
 
 typedef struct{
@@ -89,6 +113,7 @@ typedef struct{
    m_macSecurityLevelTable MacSecurityLevelTable;
    uint8_t                 Key_1[16];
    uint8_t                 Key_2[16];
+   m_securityContext       contexts[IEEE802154_SECURITY_NUMCONTEXTS];
 } ieee802154_security_vars_t;
 
 extern const struct ieee802154_security_driver IEEE802154_security;
@@ -0,0 +1,87 @@
+#include "opendefs.h"
+#include "linkestimator.h"
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+//=========================== public ==========================================
+
+/**
+\brief Forget everything known about a link.
+
+\param[in] estimate The estimate of that link.
+*/
+void linkestimator_reset(linkEstimate_t* estimate) {
+   estimate->etx      = LINKESTIMATOR_ETX_NONE;
+   estimate->numTx    = 0;
+   estimate->numTxACK = 0;
+}
+
+/**
+\brief Indicate a packet was sent over a link.
+
+Transmission attempts are counted over a window of LINKESTIMATOR_WINDOW
+attempts. At the end of each window, the ETX measured over that window is
+averaged into the estimate (EWMA). The first sample is taken as soon as a
+transmission is acknowledged, so a new link gets an estimate right away.
+
+\param[in] estimate          The estimate of that link.
+\param[in] numTxAttempts     Number of transmission attempts of that packet.
+\param[in] was_finally_acked TRUE iff the last attempt was acknowledged.
+*/
+void linkestimator_indicateTx(linkEstimate_t* estimate,
+                              uint8_t         numTxAttempts,
+                              bool            was_finally_acked) {
+   uint16_t sample;
+   
+   estimate->numTx += numTxAttempts;
+   if (was_finally_acked==TRUE) {
+      estimate->numTxACK++;
+   }
+   
+   if (
+         estimate->numTx<LINKESTIMATOR_WINDOW &&
+         (estimate->etx!=LINKESTIMATOR_ETX_NONE || estimate->numTxACK==0)
+      ) {
+      // window not over yet
+      return;
+   }
+   
+   // ETX measured over this window
+   if (estimate->numTxACK==0) {
+      sample = LINKESTIMATOR_ETX_MAX;
+   } else {
+      sample = ((uint16_t)estimate->numTx*LINKESTIMATOR_ETX_ONE)/estimate->numTxACK;
+      if (sample>LINKESTIMATOR_ETX_MAX) {
+         sample = LINKESTIMATOR_ETX_MAX;
+      }
+   }
+   
+   // average it in
+   if (estimate->etx==LINKESTIMATOR_ETX_NONE) {
+      estimate->etx = sample;
+   } else {
+      estimate->etx = (uint16_t)(
+         ((uint32_t)estimate->etx*LINKESTIMATOR_HISTORY + (uint32_t)sample*(8-LINKESTIMATOR_HISTORY))/8
+      );
+   }
+   
+   // start a new window
+   estimate->numTx    = 0;
+   estimate->numTxACK = 0;
+}
+
+/**
+\brief Retrieve the expected number of transmissions over a link.
+
+\param[in] estimate The estimate of that link.
+
+\returns The ETX of that link, in 1/LINKESTIMATOR_ETX_ONE units, or
+   LINKESTIMATOR_ETX_NONE if no packet was acknowledged over it yet.
+*/
+uint16_t linkestimator_getEtx(linkEstimate_t* estimate) {
+   return estimate->etx;
+}
+
+//=========================== private =========================================
@@ -0,0 +1,63 @@
+#ifndef __LINKESTIMATOR_H
+#define __LINKESTIMATOR_H
+
+/**
+\addtogroup MAChigh
+\{
+\addtogroup linkestimator
+\{
+*/
+
+#include "opendefs.h"
+
+//=========================== define ==========================================
+
+/**
+\brief ETX of a link on which every transmission is acknowledged.
+
+ETX values are fixed point, in 1/LINKESTIMATOR_ETX_ONE units.
+*/
+#define LINKESTIMATOR_ETX_ONE        128
+/**
+\brief ETX of a link on which no transmission of a window was acknowledged.
+*/
+#define LINKESTIMATOR_ETX_MAX        (16*LINKESTIMATOR_ETX_ONE)
+#define LINKESTIMATOR_ETX_NONE       0
+
+// number of transmission attempts averaged into one ETX sample. Can be
+// overwritten in board_info.h.
+#ifndef LINKESTIMATOR_WINDOW
+#define LINKESTIMATOR_WINDOW         4
+#endif
+// weight of the previous estimate when a sample is averaged in, out of 8. Can
+// be overwritten in board_info.h.
+#ifndef LINKESTIMATOR_HISTORY
+#define LINKESTIMATOR_HISTORY        6
+#endif
+
+//=========================== typedef =========================================
+
+typedef struct {
+   uint16_t        etx;            // LINKESTIMATOR_ETX_NONE until the first sample
+   uint8_t         numTx;          // transmission attempts in the current window
+   uint8_t         numTxACK;       // acknowledged transmissions in the current window
+} linkEstimate_t;
+
+//=========================== module variables ================================
+
+//=========================== prototypes ======================================
+
+void          linkestimator_reset(linkEstimate_t* estimate);
+void          linkestimator_indicateTx(
+   linkEstimate_t*      estimate,
+   uint8_t              numTxAttempts,
+   bool                 was_finally_acked
+);
+uint16_t      linkestimator_getEtx(linkEstimate_t* estimate);
+
+/**
+\}
+\}
+*/
+
+#endif
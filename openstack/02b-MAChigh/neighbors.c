@@ -5,6 +5,7 @@
 #include "idmanager.h"
 #include "openserial.h"
 #include "IEEE802154E.h"
+#include "forwarding.h"
 
 //=========================== variables =======================================
 
@@ -19,12 +20,14 @@ void registerNewNeighbor(
         bool         joinPrioPresent,
         uint8_t      joinPrio
      );
-bool isNeighbor(open_addr_t* neighbor);
 void removeNeighbor(uint8_t neighborIndex);
-bool isThisRowMatching(
-        open_addr_t* address,
-        uint8_t      rowNumber
-     );
+uint8_t neighbors_hash(uint8_t* addr_64b);
+void neighbors_linkRow(neighborHandle_t handle);
+void neighbors_unlinkRow(neighborHandle_t handle);
+dagrank_t neighbors_computePathCost(neighborHandle_t handle);
+void neighbors_updatePathCost(neighborHandle_t handle);
+void neighbors_selectParents(void);
+void neighbors_applyParents(void);
 
 //=========================== public ==========================================
 
@@ -32,9 +35,16 @@ bool isThisRowMatching(
 \brief Initializes this module.
 */
 void neighbors_init() {
+   uint8_t i;
    
    // clear module variables
    memset(&neighbors_vars,0,sizeof(neighbors_vars_t));
+   memset(neighbors_vars.buckets,NEIGHBOR_NONE,sizeof(neighbors_vars.buckets));
+   for (i=0;i<MAXNUMNEIGHBORS;i++) {
+      neighbors_vars.pathCost[i] = MAXDAGRANK;
+   }
+   neighbors_vars.bestParent   = NEIGHBOR_NONE;
+   neighbors_vars.secondParent = NEIGHBOR_NONE;
    
    // set myDAGrank
    if (idmanager_getIsDAGroot()==TRUE) {
@@ -115,6 +125,7 @@ bool neighbors_getPreferredParentEui64(open_addr_t* addressToWrite) {
       neighbors_vars.neighbors[minRankIdx].parentPreference       = MAXPREFERENCE;
       neighbors_vars.neighbors[minRankIdx].stableNeighbor         = TRUE;
       neighbors_vars.neighbors[minRankIdx].switchStabilityCounter = 0;
+      forwarding_flushRouteCache();
       // return its address
       memcpy(addressToWrite,&(neighbors_vars.neighbors[minRankIdx].addr_64b),sizeof(open_addr_t));
       addressToWrite->type=ADDR_64B;
@@ -178,6 +189,36 @@ open_addr_t* neighbors_getKANeighbor(uint16_t kaPeriod) {
    }
 }
 
+/**
+\brief Find the row of some neighbor in the neighbor table.
+
+Neighbors are indexed by a hash of their EUI64, so this does not scan the
+table.
+
+\param[in] address The EUI64 address of the neighbor.
+
+\returns The neighbor's handle, NEIGHBOR_NONE if it is not in the table.
+*/
+neighborHandle_t neighbors_getHandle(open_addr_t* address) {
+   neighborHandle_t handle;
+   
+   if (address->type!=ADDR_64B) {
+      openserial_printCritical(COMPONENT_NEIGHBORS,ERR_WRONG_ADDR_TYPE,
+                            (errorparameter_t)address->type,
+                            (errorparameter_t)3);
+      return NEIGHBOR_NONE;
+   }
+   
+   handle = neighbors_vars.buckets[neighbors_hash(address->addr_64b)];
+   while (handle!=NEIGHBOR_NONE) {
+      if (memcmp(neighbors_vars.neighbors[handle].addr_64b.addr_64b,address->addr_64b,LENGTH_ADDR64b)==0) {
+         break;
+      }
+      handle = neighbors_vars.nextInBucket[handle];
+   }
+   return handle;
+}
+
 //===== interrogators
 
 /**
@@ -188,7 +229,7 @@ open_addr_t* neighbors_getKANeighbor(uint16_t kaPeriod) {
 \returns TRUE if that neighbor is stable, FALSE otherwise.
 */
 bool neighbors_isStableNeighbor(open_addr_t* address) {
-   uint8_t     i;
+   neighborHandle_t handle;
    open_addr_t temp_addr_64b;
    open_addr_t temp_prefix;
    bool        returnVal;
@@ -208,12 +249,10 @@ bool neighbors_isStableNeighbor(open_addr_t* address) {
          return returnVal;
    }
    
-   // iterate through neighbor table
-   for (i=0;i<MAXNUMNEIGHBORS;i++) {
-      if (isThisRowMatching(&temp_addr_64b,i) && neighbors_vars.neighbors[i].stableNeighbor==TRUE) {
-         returnVal  = TRUE;
-         break;
-      }
+   // look the neighbor up
+   handle = neighbors_getHandle(&temp_addr_64b);
+   if (handle!=NEIGHBOR_NONE && neighbors_vars.neighbors[handle].stableNeighbor==TRUE) {
+      returnVal  = TRUE;
    }
    
    return returnVal;
@@ -227,7 +266,7 @@ bool neighbors_isStableNeighbor(open_addr_t* address) {
 \returns TRUE if that neighbor is preferred, FALSE otherwise.
 */
 bool neighbors_isPreferredParent(open_addr_t* address) {
-   uint8_t i;
+   neighborHandle_t handle;
    bool    returnVal;
    
    INTERRUPT_DECLARATION();
@@ -236,12 +275,10 @@ bool neighbors_isPreferredParent(open_addr_t* address) {
    // by default, not preferred
    returnVal = FALSE;
    
-   // iterate through neighbor table
-   for (i=0;i<MAXNUMNEIGHBORS;i++) {
-      if (isThisRowMatching(address,i) && neighbors_vars.neighbors[i].parentPreference==MAXPREFERENCE) {
-         returnVal  = TRUE;
-         break;
-      }
+   // look the neighbor up
+   handle = neighbors_getHandle(address);
+   if (handle!=NEIGHBOR_NONE && neighbors_vars.neighbors[handle].parentPreference==MAXPREFERENCE) {
+      returnVal  = TRUE;
    }
    
    ENABLE_INTERRUPTS();
@@ -317,51 +354,49 @@ void neighbors_indicateRx(open_addr_t* l2_src,
                           asn_t*       asnTs,
                           bool         joinPrioPresent,
                           uint8_t      joinPrio) {
-   uint8_t i;
+   neighborHandle_t i;
    bool    newNeighbor;
    
    // update existing neighbor
    newNeighbor = TRUE;
-   for (i=0;i<MAXNUMNEIGHBORS;i++) {
-      if (isThisRowMatching(l2_src,i)) {
-         
-         // this is not a new neighbor
-         newNeighbor = FALSE;
-         
-         // update numRx, rssi, asn
-         neighbors_vars.neighbors[i].numRx++;
-         neighbors_vars.neighbors[i].rssi=rssi;
-         memcpy(&neighbors_vars.neighbors[i].asn,asnTs,sizeof(asn_t));
-         //update jp
-         if (joinPrioPresent==TRUE){
-            neighbors_vars.neighbors[i].joinPrio=joinPrio;
-         }
-         
-         // update stableNeighbor, switchStabilityCounter
-         if (neighbors_vars.neighbors[i].stableNeighbor==FALSE) {
-            if (neighbors_vars.neighbors[i].rssi>BADNEIGHBORMAXRSSI) {
-               neighbors_vars.neighbors[i].switchStabilityCounter++;
-               if (neighbors_vars.neighbors[i].switchStabilityCounter>=SWITCHSTABILITYTHRESHOLD) {
-                  neighbors_vars.neighbors[i].switchStabilityCounter=0;
-                  neighbors_vars.neighbors[i].stableNeighbor=TRUE;
-               }
-            } else {
+   i = neighbors_getHandle(l2_src);
+   if (i!=NEIGHBOR_NONE) {
+      
+      // this is not a new neighbor
+      newNeighbor = FALSE;
+      
+      // update numRx, rssi, asn
+      neighbors_vars.neighbors[i].numRx++;
+      neighbors_vars.neighbors[i].rssi=rssi;
+      memcpy(&neighbors_vars.neighbors[i].asn,asnTs,sizeof(asn_t));
+      //update jp
+      if (joinPrioPresent==TRUE){
+         neighbors_vars.neighbors[i].joinPrio=joinPrio;
+      }
+      
+      // update stableNeighbor, switchStabilityCounter
+      if (neighbors_vars.neighbors[i].stableNeighbor==FALSE) {
+         if (neighbors_vars.neighbors[i].rssi>BADNEIGHBORMAXRSSI) {
+            neighbors_vars.neighbors[i].switchStabilityCounter++;
+            if (neighbors_vars.neighbors[i].switchStabilityCounter>=SWITCHSTABILITYTHRESHOLD) {
                neighbors_vars.neighbors[i].switchStabilityCounter=0;
+               neighbors_vars.neighbors[i].stableNeighbor=TRUE;
+               forwarding_flushRouteCache();
             }
-         } else if (neighbors_vars.neighbors[i].stableNeighbor==TRUE) {
-            if (neighbors_vars.neighbors[i].rssi<GOODNEIGHBORMINRSSI) {
-               neighbors_vars.neighbors[i].switchStabilityCounter++;
-               if (neighbors_vars.neighbors[i].switchStabilityCounter>=SWITCHSTABILITYTHRESHOLD) {
-                  neighbors_vars.neighbors[i].switchStabilityCounter=0;
-                   neighbors_vars.neighbors[i].stableNeighbor=FALSE;
-               }
-            } else {
+         } else {
+            neighbors_vars.neighbors[i].switchStabilityCounter=0;
+         }
+      } else if (neighbors_vars.neighbors[i].stableNeighbor==TRUE) {
+         if (neighbors_vars.neighbors[i].rssi<GOODNEIGHBORMINRSSI) {
+            neighbors_vars.neighbors[i].switchStabilityCounter++;
+            if (neighbors_vars.neighbors[i].switchStabilityCounter>=SWITCHSTABILITYTHRESHOLD) {
                neighbors_vars.neighbors[i].switchStabilityCounter=0;
+               neighbors_vars.neighbors[i].stableNeighbor=FALSE;
+               forwarding_flushRouteCache();
             }
+         } else {
+            neighbors_vars.neighbors[i].switchStabilityCounter=0;
          }
-         
-         // stop looping
-         break;
       }
    }
    
@@ -382,6 +417,9 @@ The fields which are updated are:
 - numTxACK
 - asn
 
+The ETX of the link to that neighbor, and the path cost through it, are
+updated accordingly. numTx and numTxACK are only kept as statistics.
+
 \param[in] l2_dest MAC destination address of the packet, i.e. the neighbor
    who I just sent the packet to.
 \param[in] numTxAttempts Number of transmission attempts to this neighbor.
@@ -393,31 +431,32 @@ void neighbors_indicateTx(open_addr_t* l2_dest,
                           uint8_t      numTxAttempts,
                           bool         was_finally_acked,
                           asn_t*       asnTs) {
-   uint8_t i;
+   neighborHandle_t i;
    // don't run through this function if packet was sent to broadcast address
    if (packetfunctions_isBroadcastMulticast(l2_dest)==TRUE) {
       return;
    }
    
-   // loop through neighbor table
-   for (i=0;i<MAXNUMNEIGHBORS;i++) {
-      if (isThisRowMatching(l2_dest,i)) {
-         // handle roll-over case
-        
-          if (neighbors_vars.neighbors[i].numTx>(0xff-numTxAttempts)) {
-              neighbors_vars.neighbors[i].numWraps++; //counting the number of times that tx wraps.
-              neighbors_vars.neighbors[i].numTx/=2;
-              neighbors_vars.neighbors[i].numTxACK/=2;
-           }
-         // update statistics
-        neighbors_vars.neighbors[i].numTx += numTxAttempts; 
-        
-        if (was_finally_acked==TRUE) {
-            neighbors_vars.neighbors[i].numTxACK++;
-            memcpy(&neighbors_vars.neighbors[i].asn,asnTs,sizeof(asn_t));
-        }
-        break;
+   // look the neighbor up
+   i = neighbors_getHandle(l2_dest);
+   if (i!=NEIGHBOR_NONE) {
+      // handle roll-over case
+      if (neighbors_vars.neighbors[i].numTx>(0xff-numTxAttempts)) {
+         neighbors_vars.neighbors[i].numWraps++; //counting the number of times that tx wraps.
+         neighbors_vars.neighbors[i].numTx/=2;
+         neighbors_vars.neighbors[i].numTxACK/=2;
+      }
+      // update statistics
+      neighbors_vars.neighbors[i].numTx += numTxAttempts; 
+      
+      if (was_finally_acked==TRUE) {
+         neighbors_vars.neighbors[i].numTxACK++;
+         memcpy(&neighbors_vars.neighbors[i].asn,asnTs,sizeof(asn_t));
       }
+      
+      // the link cost to that neighbor changed
+      linkestimator_indicateTx(&neighbors_vars.linkEstimates[i],numTxAttempts,was_finally_acked);
+      neighbors_updatePathCost(i);
    }
 }
 
@@ -434,7 +473,7 @@ The fields which are updated are:
    header.
 */
 void neighbors_indicateRxDIO(OpenQueueEntry_t* msg) {
-   uint8_t          i;
+   neighborHandle_t i;
    uint8_t          temp_8b;
   
    // take ownership over the packet
@@ -445,27 +484,23 @@ void neighbors_indicateRxDIO(OpenQueueEntry_t* msg) {
    // retrieve rank
    temp_8b            = *(msg->payload+2);
    neighbors_vars.dio->rank = (temp_8b << 8) + *(msg->payload+3);
-   if (isNeighbor(&(msg->l2_nextORpreviousHop))==TRUE) {
-      for (i=0;i<MAXNUMNEIGHBORS;i++) {
-         if (isThisRowMatching(&(msg->l2_nextORpreviousHop),i)) {
-            if (
-                  neighbors_vars.dio->rank > neighbors_vars.neighbors[i].DAGrank &&
-                  neighbors_vars.dio->rank - neighbors_vars.neighbors[i].DAGrank >(DEFAULTLINKCOST*2*MINHOPRANKINCREASE)
-               ) {
-                // the new DAGrank looks suspiciously high, only increment a bit
-                neighbors_vars.neighbors[i].DAGrank += (DEFAULTLINKCOST*2*MINHOPRANKINCREASE);
-                openserial_printError(COMPONENT_NEIGHBORS,ERR_LARGE_DAGRANK,
+   i = neighbors_getHandle(&(msg->l2_nextORpreviousHop));
+   if (i!=NEIGHBOR_NONE) {
+      if (
+            neighbors_vars.dio->rank > neighbors_vars.neighbors[i].DAGrank &&
+            neighbors_vars.dio->rank - neighbors_vars.neighbors[i].DAGrank >(DEFAULTLINKCOST*2*MINHOPRANKINCREASE)
+         ) {
+         // the new DAGrank looks suspiciously high, only increment a bit
+         neighbors_vars.neighbors[i].DAGrank += (DEFAULTLINKCOST*2*MINHOPRANKINCREASE);
+         openserial_printError(COMPONENT_NEIGHBORS,ERR_LARGE_DAGRANK,
                                (errorparameter_t)neighbors_vars.dio->rank,
                                (errorparameter_t)neighbors_vars.neighbors[i].DAGrank);
-            } else {
-               neighbors_vars.neighbors[i].DAGrank = neighbors_vars.dio->rank;
-            }
-            break;
-         }
+      } else {
+         neighbors_vars.neighbors[i].DAGrank = neighbors_vars.dio->rank;
       }
-   } 
-   // update my routing information
-   neighbors_updateMyDAGrankAndNeighborPreference(); 
+      // update my routing information
+      neighbors_updatePathCost(i);
+   }
 }
 
 //===== write addresses
@@ -498,19 +533,15 @@ void neighbors_setMyDAGrank(dagrank_t rank){
 /**
 \brief Update my DAG rank and neighbor preference.
 
-Call this function whenever some data is changed that could cause this mote's
-routing decisions to change. Examples are:
-- I received a DIO which updated by neighbor table. If this DIO indicated a
-  very low DAGrank, I may want to change by routing parent.
+Recomputes the path cost through every neighbor, then picks my preferred
+parent from scratch. Call this function only when the cached path costs cannot
+be trusted anymore. Examples are:
+- I lost my preferred parent.
 - I became a DAGroot, so my DAGrank should be 0.
+Changes to a single neighbor go through neighbors_updatePathCost() instead.
 */
 void neighbors_updateMyDAGrankAndNeighborPreference() {
-   uint8_t   i;
-   uint16_t  rankIncrease;
-   uint32_t  tentativeDAGrank; // 32-bit since is used to sum
-   uint8_t   prefParentIdx;
-   bool      prefParentFound;
-   uint32_t  rankIncreaseIntermediary; // stores intermediary results of rankIncrease calculation
+   neighborHandle_t i;
    
    // if I'm a DAGroot, my DAGrank is always MINHOPRANKINCREASE
    if ((idmanager_getIsDAGroot())==TRUE) {
@@ -519,48 +550,19 @@ void neighbors_updateMyDAGrankAndNeighborPreference() {
        return;
    }
    
-   // reset my DAG rank to max value. May be lowered below.
-   neighbors_vars.myDAGrank  = MAXDAGRANK;
-   
-   // by default, I haven't found a preferred parent
-   prefParentFound           = FALSE;
-   prefParentIdx             = 0;
+   neighbors_vars.parentSelectionStats.numFullRecomputes++;
    
-   // loop through neighbor table, update myDAGrank
+   // recompute the path cost through each neighbor
    for (i=0;i<MAXNUMNEIGHBORS;i++) {
       if (neighbors_vars.neighbors[i].used==TRUE) {
-         
-         // reset parent preference
-         neighbors_vars.neighbors[i].parentPreference=0;
-         
-         // calculate link cost to this neighbor
-         if (neighbors_vars.neighbors[i].numTxACK==0) {
-            rankIncrease = DEFAULTLINKCOST*2*MINHOPRANKINCREASE;
-         } else {
-            //6TiSCH minimal draft using OF0 for rank computation
-            rankIncreaseIntermediary = (((uint32_t)neighbors_vars.neighbors[i].numTx) << 10);
-            rankIncreaseIntermediary = (rankIncreaseIntermediary * 2 * MINHOPRANKINCREASE) / ((uint32_t)neighbors_vars.neighbors[i].numTxACK);
-            rankIncrease = (uint16_t)(rankIncreaseIntermediary >> 10);
-         }
-         
-         // cast the uint16_t summands to avoid an overflow if DAGrank == 0xFFFF (MAXDAGRANK)
-         tentativeDAGrank = (uint32_t)neighbors_vars.neighbors[i].DAGrank + (uint32_t)rankIncrease;
-         if ( tentativeDAGrank<neighbors_vars.myDAGrank &&
-              tentativeDAGrank<MAXDAGRANK) {
-            // found better parent, lower my DAGrank
-            neighbors_vars.myDAGrank   = tentativeDAGrank;
-            prefParentFound            = TRUE;
-            prefParentIdx              = i;
-         }
+         neighbors_vars.pathCost[i] = neighbors_computePathCost(i);
+      } else {
+         neighbors_vars.pathCost[i] = MAXDAGRANK;
       }
-   } 
-   
-   // update preferred parent
-   if (prefParentFound) {
-      neighbors_vars.neighbors[prefParentIdx].parentPreference       = MAXPREFERENCE;
-      neighbors_vars.neighbors[prefParentIdx].stableNeighbor         = TRUE;
-      neighbors_vars.neighbors[prefParentIdx].switchStabilityCounter = 0;
    }
+   
+   neighbors_selectParents();
+   neighbors_applyParents();
 }
 
 //===== maintenance
@@ -598,6 +600,20 @@ bool debugPrint_neighbors() {
    return TRUE;
 }
 
+/**
+\brief Trigger this module to print parent selection counters, over serial.
+
+\returns TRUE if this function printed something, FALSE otherwise.
+*/
+bool debugPrint_parentSelection() {
+   openserial_printStatus(
+      STATUS_PARENTSELECTION,
+      (uint8_t*)&neighbors_vars.parentSelectionStats,
+      sizeof(neighbors_parentSelectionStats_t)
+   );
+   return TRUE;
+}
+
 //=========================== private =========================================
 
 void registerNewNeighbor(open_addr_t* address,
@@ -615,7 +631,7 @@ void registerNewNeighbor(open_addr_t* address,
       return;
    }
    // add this neighbor
-   if (isNeighbor(address)==FALSE) {
+   if (neighbors_getHandle(address)==NEIGHBOR_NONE) {
       i=0;
       while(i<MAXNUMNEIGHBORS) {
          if (neighbors_vars.neighbors[i].used==FALSE) {
@@ -633,6 +649,8 @@ void registerNewNeighbor(open_addr_t* address,
             neighbors_vars.neighbors[i].numTx                  = 0;
             neighbors_vars.neighbors[i].numTxACK               = 0;
             memcpy(&neighbors_vars.neighbors[i].asn,asnTimestamp,sizeof(asn_t));
+            linkestimator_reset(&neighbors_vars.linkEstimates[i]);
+            neighbors_vars.pathCost[i]                         = MAXDAGRANK;
             //update jp
             if (joinPrioPresent==TRUE){
                neighbors_vars.neighbors[i].joinPrio=joinPrio;
@@ -649,6 +667,10 @@ void registerNewNeighbor(open_addr_t* address,
             if (iHaveAPreferedParent==FALSE && idmanager_getIsDAGroot()==FALSE) {      
                neighbors_vars.neighbors[i].parentPreference     = MAXPREFERENCE;
             }
+            // index it by address
+            neighbors_linkRow(i);
+            // packets to that neighbor no longer go through my parent
+            forwarding_flushRouteCache();
             break;
          }
          i++;
@@ -662,17 +684,9 @@ void registerNewNeighbor(open_addr_t* address,
    }
 }
 
-bool isNeighbor(open_addr_t* neighbor) {
-   uint8_t i=0;
-   for (i=0;i<MAXNUMNEIGHBORS;i++) {
-      if (isThisRowMatching(neighbor,i)) {
-         return TRUE;
-      }
-   }
-   return FALSE;
-}
-
 void removeNeighbor(uint8_t neighborIndex) {
+   forwarding_flushRouteCache();
+   neighbors_unlinkRow(neighborIndex);
    neighbors_vars.neighbors[neighborIndex].used                      = FALSE;
    neighbors_vars.neighbors[neighborIndex].parentPreference          = 0;
    neighbors_vars.neighbors[neighborIndex].stableNeighbor            = FALSE;
@@ -688,19 +702,232 @@ void removeNeighbor(uint8_t neighborIndex) {
    neighbors_vars.neighbors[neighborIndex].asn.bytes0and1            = 0;
    neighbors_vars.neighbors[neighborIndex].asn.bytes2and3            = 0;
    neighbors_vars.neighbors[neighborIndex].asn.byte4                 = 0;
+   linkestimator_reset(&neighbors_vars.linkEstimates[neighborIndex]);
+   neighbors_vars.pathCost[neighborIndex]                            = MAXDAGRANK;
+   
+   if (neighborIndex==neighbors_vars.bestParent) {
+      // I lost my preferred parent, start over
+      neighbors_updateMyDAGrankAndNeighborPreference();
+   } else if (neighborIndex==neighbors_vars.secondParent) {
+      // pick another backup parent
+      neighbors_vars.parentSelectionStats.numParentScans++;
+      neighbors_selectParents();
+   }
+}
+
+/**
+\brief Update the path cost through a single neighbor.
+
+Call this function whenever the DAGrank of a neighbor, or the link cost to it,
+changes. The best and second-best parents are kept up to date from the cached
+path costs, and all of them are only scanned when the best or second-best
+parent gets worse.
+
+\param[in] handle The row of that neighbor in the neighbor table.
+*/
+void neighbors_updatePathCost(neighborHandle_t handle) {
+   dagrank_t oldCost;
+   dagrank_t newCost;
+   
+   // if I'm a DAGroot, my DAGrank does not depend on my neighbors
+   if (idmanager_getIsDAGroot()==TRUE) {
+      return;
+   }
+   
+   neighbors_vars.parentSelectionStats.numCostUpdates++;
+   
+   oldCost                          = neighbors_vars.pathCost[handle];
+   newCost                          = neighbors_computePathCost(handle);
+   neighbors_vars.pathCost[handle]  = newCost;
+   
+   if (handle==neighbors_vars.bestParent) {
+      // my parent may now be worse than my backup parent, or unusable
+      if (
+            newCost>oldCost &&
+            (
+               newCost==MAXDAGRANK ||
+               (
+                  neighbors_vars.secondParent!=NEIGHBOR_NONE &&
+                  neighbors_vars.pathCost[neighbors_vars.secondParent]<newCost
+               )
+            )
+         ) {
+         neighbors_vars.parentSelectionStats.numParentScans++;
+         neighbors_selectParents();
+      }
+   } else if (handle==neighbors_vars.secondParent) {
+      if (newCost<neighbors_vars.pathCost[neighbors_vars.bestParent]) {
+         // my backup parent became better than my parent
+         neighbors_vars.secondParent  = neighbors_vars.bestParent;
+         neighbors_vars.bestParent    = handle;
+      } else if (newCost>oldCost) {
+         // some other neighbor may now be a better backup parent
+         neighbors_vars.parentSelectionStats.numParentScans++;
+         neighbors_selectParents();
+      }
+   } else if (newCost<MAXDAGRANK) {
+      if (
+            neighbors_vars.bestParent==NEIGHBOR_NONE ||
+            newCost<neighbors_vars.pathCost[neighbors_vars.bestParent]
+         ) {
+         neighbors_vars.secondParent  = neighbors_vars.bestParent;
+         neighbors_vars.bestParent    = handle;
+      } else if (
+            neighbors_vars.secondParent==NEIGHBOR_NONE ||
+            newCost<neighbors_vars.pathCost[neighbors_vars.secondParent]
+         ) {
+         neighbors_vars.secondParent  = handle;
+      }
+   }
+   
+   neighbors_applyParents();
+}
+
+/**
+\brief Pick the best and second-best parents from the cached path costs.
+*/
+void neighbors_selectParents() {
+   neighborHandle_t i;
+   
+   neighbors_vars.bestParent   = NEIGHBOR_NONE;
+   neighbors_vars.secondParent = NEIGHBOR_NONE;
+   
+   for (i=0;i<MAXNUMNEIGHBORS;i++) {
+      if (
+            neighbors_vars.neighbors[i].used==FALSE ||
+            neighbors_vars.pathCost[i]==MAXDAGRANK
+         ) {
+         continue;
+      }
+      if (
+            neighbors_vars.bestParent==NEIGHBOR_NONE ||
+            neighbors_vars.pathCost[i]<neighbors_vars.pathCost[neighbors_vars.bestParent]
+         ) {
+         neighbors_vars.secondParent  = neighbors_vars.bestParent;
+         neighbors_vars.bestParent    = i;
+      } else if (
+            neighbors_vars.secondParent==NEIGHBOR_NONE ||
+            neighbors_vars.pathCost[i]<neighbors_vars.pathCost[neighbors_vars.secondParent]
+         ) {
+         neighbors_vars.secondParent  = i;
+      }
+   }
+}
+
+/**
+\brief Derive my DAGrank and neighbor preference from the best parent.
+*/
+void neighbors_applyParents() {
+   neighborHandle_t i;
+   neighborHandle_t best;
+   bool             parentChanged;
+   
+   best          = neighbors_vars.bestParent;
+   parentChanged = FALSE;
+   
+   if (best==NEIGHBOR_NONE) {
+      neighbors_vars.myDAGrank = MAXDAGRANK;
+   } else {
+      neighbors_vars.myDAGrank = neighbors_vars.pathCost[best];
+   }
+   
+   // move the preference over if the parent changed
+   if (best==NEIGHBOR_NONE || neighbors_vars.neighbors[best].parentPreference!=MAXPREFERENCE) {
+      for (i=0;i<MAXNUMNEIGHBORS;i++) {
+         if (neighbors_vars.neighbors[i].parentPreference!=0) {
+            neighbors_vars.neighbors[i].parentPreference = 0;
+            parentChanged = TRUE;
+         }
+      }
+      if (best!=NEIGHBOR_NONE) {
+         neighbors_vars.neighbors[best].parentPreference = MAXPREFERENCE;
+         parentChanged = TRUE;
+      }
+   }
+   
+   if (best!=NEIGHBOR_NONE) {
+      neighbors_vars.neighbors[best].stableNeighbor         = TRUE;
+      neighbors_vars.neighbors[best].switchStabilityCounter = 0;
+   }
+   
+   // packets to remote destinations now go through the new parent
+   if (parentChanged==TRUE) {
+      neighbors_vars.parentSelectionStats.numParentChanges++;
+      forwarding_flushRouteCache();
+   }
 }
 
 //=========================== helpers =========================================
 
-bool isThisRowMatching(open_addr_t* address, uint8_t rowNumber) {
-   switch (address->type) {
-      case ADDR_64B:
-         return neighbors_vars.neighbors[rowNumber].used &&
-                packetfunctions_sameAddress(address,&neighbors_vars.neighbors[rowNumber].addr_64b);
-      default:
-         openserial_printCritical(COMPONENT_NEIGHBORS,ERR_WRONG_ADDR_TYPE,
-                               (errorparameter_t)address->type,
-                               (errorparameter_t)3);
-         return FALSE;
+/**
+\brief Compute my DAGrank if some neighbor were my parent.
+
+\param[in] handle The row of that neighbor in the neighbor table.
+
+\returns That DAGrank, MAXDAGRANK if that neighbor can not be my parent.
+*/
+dagrank_t neighbors_computePathCost(neighborHandle_t handle) {
+   uint16_t  rankIncrease;
+   uint16_t  etx;
+   uint32_t  tentativeDAGrank; // 32-bit since is used to sum
+   
+   // calculate link cost to this neighbor
+   etx = linkestimator_getEtx(&neighbors_vars.linkEstimates[handle]);
+   if (etx==LINKESTIMATOR_ETX_NONE) {
+      rankIncrease = DEFAULTLINKCOST*2*MINHOPRANKINCREASE;
+   } else {
+      //6TiSCH minimal draft using OF0 for rank computation
+      rankIncrease = (uint16_t)(((uint32_t)etx*2*MINHOPRANKINCREASE)/LINKESTIMATOR_ETX_ONE);
+   }
+   
+   // cast the uint16_t summands to avoid an overflow if DAGrank == 0xFFFF (MAXDAGRANK)
+   tentativeDAGrank = (uint32_t)neighbors_vars.neighbors[handle].DAGrank + (uint32_t)rankIncrease;
+   if (tentativeDAGrank>=MAXDAGRANK) {
+      return MAXDAGRANK;
+   }
+   return (dagrank_t)tentativeDAGrank;
+}
+
+/**
+\brief Hash an EUI64 into a bucket of the address index.
+
+The last bytes are the ones which differ between motes of a deployment.
+*/
+uint8_t neighbors_hash(uint8_t* addr_64b) {
+   return (addr_64b[7] ^ (addr_64b[6]<<3) ^ (addr_64b[5]>>2)) & (NEIGHBORS_HASH_SIZE-1);
+}
+
+/**
+\brief Add a row at the head of the bucket of its address.
+*/
+void neighbors_linkRow(neighborHandle_t handle) {
+   uint8_t bucket;
+   INTERRUPT_DECLARATION();
+   
+   bucket = neighbors_hash(neighbors_vars.neighbors[handle].addr_64b.addr_64b);
+   
+   DISABLE_INTERRUPTS();
+   neighbors_vars.nextInBucket[handle] = neighbors_vars.buckets[bucket];
+   neighbors_vars.buckets[bucket]      = handle;
+   ENABLE_INTERRUPTS();
+}
+
+/**
+\brief Remove a row from the bucket of its address.
+*/
+void neighbors_unlinkRow(neighborHandle_t handle) {
+   neighborHandle_t* walker;
+   INTERRUPT_DECLARATION();
+   
+   DISABLE_INTERRUPTS();
+   walker = &neighbors_vars.buckets[neighbors_hash(neighbors_vars.neighbors[handle].addr_64b.addr_64b)];
+   while (*walker!=NEIGHBOR_NONE) {
+      if (*walker==handle) {
+         *walker = neighbors_vars.nextInBucket[handle];
+         break;
+      }
+      walker = &neighbors_vars.nextInBucket[*walker];
    }
+   neighbors_vars.nextInBucket[handle] = NEIGHBOR_NONE;
+   ENABLE_INTERRUPTS();
 }
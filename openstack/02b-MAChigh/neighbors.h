@@ -9,10 +9,20 @@
 */
 #include "opendefs.h"
 #include "icmpv6rpl.h"
+#include "linkestimator.h"
 
 //=========================== define ==========================================
 
+// can be overwritten in board_info.h, at most 0xfe
+#ifndef MAXNUMNEIGHBORS
 #define MAXNUMNEIGHBORS           10
+#endif
+// number of buckets of the address index, a power of 2. Can be overwritten in
+// board_info.h.
+#ifndef NEIGHBORS_HASH_SIZE
+#define NEIGHBORS_HASH_SIZE       16
+#endif
+#define NEIGHBOR_NONE             0xff
 #define MAXPREFERENCE             2
 #define BADNEIGHBORMAXRSSI        -80 //dBm
 #define GOODNEIGHBORMINRSSI       -90 //dBm
@@ -25,6 +35,14 @@
 
 //=========================== typedef =========================================
 
+/**
+\brief Handle of a neighbor, i.e. its row in the neighbor table.
+
+It does not change as long as the neighbor stays in the table, and can be
+passed to the functions taking an index.
+*/
+typedef uint8_t neighborHandle_t;
+
 BEGIN_PACK
 typedef struct {
    bool             used;
@@ -50,6 +68,18 @@ typedef struct {
 } debugNeighborEntry_t;
 END_PACK
 
+/**
+\brief Counters of the work done selecting the preferred parent.
+*/
+BEGIN_PACK
+typedef struct {
+   uint16_t        numCostUpdates;       // path cost updated for a single neighbor
+   uint16_t        numParentScans;       // parents picked again from the cached path costs
+   uint16_t        numFullRecomputes;    // path cost recomputed for all neighbors
+   uint16_t        numParentChanges;
+} neighbors_parentSelectionStats_t;
+END_PACK
+
 BEGIN_PACK
 typedef struct {
    uint8_t         last_addr_byte;   // last byte of the neighbor's address
@@ -64,6 +94,13 @@ END_PACK
    
 typedef struct {
    neighborRow_t        neighbors[MAXNUMNEIGHBORS];
+   neighborHandle_t     buckets[NEIGHBORS_HASH_SIZE];   // first row of each hash bucket
+   neighborHandle_t     nextInBucket[MAXNUMNEIGHBORS];  // next row in the same bucket
+   linkEstimate_t       linkEstimates[MAXNUMNEIGHBORS]; // ETX of the link to each neighbor
+   dagrank_t            pathCost[MAXNUMNEIGHBORS];      // my DAGrank through each neighbor
+   neighborHandle_t     bestParent;
+   neighborHandle_t     secondParent;
+   neighbors_parentSelectionStats_t parentSelectionStats;
    dagrank_t            myDAGrank;
    uint8_t              debugRow;
    icmpv6rpl_dio_ht*    dio; //keep it global to be able to debug correctly.
@@ -78,6 +115,7 @@ dagrank_t     neighbors_getMyDAGrank(void);
 uint8_t       neighbors_getNumNeighbors(void);
 bool          neighbors_getPreferredParentEui64(open_addr_t* addressToWrite);
 open_addr_t*  neighbors_getKANeighbor(uint16_t kaPeriod);
+neighborHandle_t neighbors_getHandle(open_addr_t* address);
 // setters
 void          neighbors_setMyDAGrank(dagrank_t rank);
 
@@ -111,6 +149,7 @@ void          neighbors_updateMyDAGrankAndNeighborPreference(void);
 void          neighbors_removeOld(void);
 // debug
 bool          debugPrint_neighbors(void);
+bool          debugPrint_parentSelection(void);
 
 /**
 \}
@@ -2,18 +2,39 @@
 #include "otf.h"
 #include "neighbors.h"
 #include "sixtop.h"
+#include "schedule.h"
+#include "openqueue.h"
+#include "IEEE802154E.h"
+#include "idmanager.h"
+#include "openrandom.h"
+#include "packetfunctions.h"
 #include "scheduler.h"
 
 //=========================== variables =======================================
 
+otf_vars_t otf_vars;
+
 //=========================== prototypes ======================================
 
 void otf_addCell_task(void);
 void otf_removeCell_task(void);
+void otf_timer_cb(opentimer_id_t id);
+void otf_housekeeping_task(void);
+void otf_request(uint8_t code, open_addr_t* neighbor, uint8_t numCells);
 
 //=========================== public ==========================================
 
 void otf_init(void) {
+   memset(&otf_vars,0,sizeof(otf_vars_t));
+   
+   // spread the measurements of neighboring motes apart
+   otf_vars.periodHousekeeping = OTF_HOUSEKEEPING_PERIOD_MS+(openrandom_get16b()&0xff);
+   otf_vars.timerId            = opentimers_start(
+      otf_vars.periodHousekeeping,
+      TIMER_PERIODIC,
+      TIME_MS,
+      otf_timer_cb
+   );
 }
 
 void otf_notif_addedCell(void) {
@@ -36,13 +57,7 @@ void otf_addCell_task(void) {
       return;
    }
    
-   sixtop_setHandler(SIX_HANDLER_OTF);
-   // call sixtop
-   sixtop_request(
-      IANA_6TOP_CMD_ADD,
-      &neighbor,
-      1
-   );
+   otf_request(IANA_6TOP_CMD_ADD,&neighbor,1);
 }
 
 void otf_removeCell_task(void) {
@@ -55,11 +70,123 @@ void otf_removeCell_task(void) {
       return;
    }
    
+   otf_request(IANA_6TOP_CMD_DELETE,&neighbor,1);
+}
+
+void otf_timer_cb(opentimer_id_t id) {
+   scheduler_push_task(otf_housekeeping_task,TASKPRIO_OTF);
+}
+
+/**
+\brief Match the cells to my parent to the traffic I send it.
+
+Over each housekeeping period, the usage of my dedicated TX cells to my parent
+is measured, and the number of packets queued to it is averaged. Cells are
+added when the cells are busy or packets pile up. A cell is removed when the
+queue is empty and the remaining cells would still be lightly used. The gap
+between OTF_USAGE_HIGH and OTF_USAGE_LOW keeps the schedule from oscillating.
+*/
+void otf_housekeeping_task(void) {
+   open_addr_t          parent;
+   uint16_t             numCells;
+   uint16_t             numTx;
+   uint8_t              numQueued;
+   uint32_t             numSlotframes;
+   uint32_t             numCellsRequired;
+   uint8_t              numCellsToAdd;
+   
+   if (ieee154e_isSynch()==FALSE || idmanager_getIsDAGroot()==TRUE) {
+      return;
+   }
+   if (neighbors_getPreferredParentEui64(&parent)==FALSE) {
+      return;
+   }
+   
+   numCells  = schedule_getTxUsage(&parent,&numTx);
+   numQueued = openqueue_getNumPacketsTo(&parent);
+   
+   // the measurements so far were about another parent
+   if (packetfunctions_sameAddress(&parent,&otf_vars.parent)==FALSE) {
+      memcpy(&otf_vars.parent,&parent,sizeof(open_addr_t));
+      otf_vars.avgQueue = 0;
+      return;
+   }
+   otf_vars.avgQueue = (otf_vars.avgQueue+numQueued*OTF_QUEUE_SCALE)/2;
+   
+   // number of slotframes in a housekeeping period
+   numSlotframes = ((uint32_t)otf_vars.periodHousekeeping*PORT_TICS_PER_MS)/
+                   ((uint32_t)schedule_getFrameLength()*ieee154e_getSlotDuration());
+   if (numSlotframes==0) {
+      numSlotframes = 1;
+   }
+   
+   if (
+         numCells<OTF_MAXCELLS &&
+         (
+            otf_vars.avgQueue>=OTF_QUEUE_HIGH*OTF_QUEUE_SCALE ||
+#if OTF_MINCELLS>0
+            numCells<OTF_MINCELLS ||
+#endif
+            (
+               numCells>0 &&
+               (uint32_t)numTx*100>=(uint32_t)numCells*numSlotframes*OTF_USAGE_HIGH
+            )
+         )
+      ) {
+      // enough cells to carry this period's traffic and the backlog below OTF_USAGE_HIGH
+      numCellsRequired = ((uint32_t)numTx+otf_vars.avgQueue/OTF_QUEUE_SCALE)*100;
+      numCellsRequired = (numCellsRequired+numSlotframes*OTF_USAGE_HIGH-1)/(numSlotframes*OTF_USAGE_HIGH);
+#if OTF_MINCELLS>0
+      if (numCellsRequired<OTF_MINCELLS) {
+         numCellsRequired = OTF_MINCELLS;
+      }
+#endif
+      if (numCellsRequired>OTF_MAXCELLS) {
+         numCellsRequired = OTF_MAXCELLS;
+      }
+      if (numCellsRequired>(uint32_t)numCells+OTF_MAXCELLS_PER_REQUEST) {
+         numCellsToAdd = OTF_MAXCELLS_PER_REQUEST;
+      } else if (numCellsRequired>numCells) {
+         numCellsToAdd = (uint8_t)(numCellsRequired-numCells);
+      } else {
+         numCellsToAdd = 1;
+      }
+      otf_request(IANA_6TOP_CMD_ADD,&parent,numCellsToAdd);
+   } else if (
+         numCells>OTF_MINCELLS &&
+         numQueued==0 &&
+         otf_vars.avgQueue<OTF_QUEUE_SCALE &&
+         (uint32_t)numTx*100<=(uint32_t)(numCells-1)*numSlotframes*OTF_USAGE_LOW
+      ) {
+      // one cell less would do
+      otf_request(IANA_6TOP_CMD_DELETE,&parent,1);
+   }
+}
+
+/**
+\brief Start a 6P transaction, unless one is ongoing with that neighbor.
+*/
+void otf_request(uint8_t code, open_addr_t* neighbor, uint8_t numCells) {
+   if (sixtop_isIdle(neighbor)==FALSE) {
+      return;
+   }
+   
    sixtop_setHandler(SIX_HANDLER_OTF);
    // call sixtop
-   sixtop_request(
-      IANA_6TOP_CMD_DELETE,
-      &neighbor,
-      1
-   );
-}
\ No newline at end of file
+   if (
+         sixtop_request(
+            code,
+            neighbor,
+            numCells
+         )==E_FAIL
+      ) {
+      // sixtop could not start the transaction
+      sixtop_setHandler(SIX_HANDLER_NONE);
+      return;
+   }
+   if (code==IANA_6TOP_CMD_ADD) {
+      otf_vars.numAddRequests++;
+   } else {
+      otf_vars.numDeleteRequests++;
+   }
+}
@@ -9,13 +9,55 @@
 */
 
 #include "opendefs.h"
+#include "opentimers.h"
 
 //=========================== define ==========================================
 
+// the following can be overwritten in board_info.h
+
+// period of the traffic measurements, in ms
+#ifndef OTF_HOUSEKEEPING_PERIOD_MS
+#define OTF_HOUSEKEEPING_PERIOD_MS  4000
+#endif
+// cells to my parent are added above this usage, in percent
+#ifndef OTF_USAGE_HIGH
+#define OTF_USAGE_HIGH              75
+#endif
+// a cell to my parent is removed if the other ones stay below this usage, in percent
+#ifndef OTF_USAGE_LOW
+#define OTF_USAGE_LOW               40
+#endif
+// cells to my parent are added above this average number of queued packets
+#ifndef OTF_QUEUE_HIGH
+#define OTF_QUEUE_HIGH              2
+#endif
+// bounds on the number of cells to my parent
+#ifndef OTF_MINCELLS
+#define OTF_MINCELLS                0
+#endif
+#ifndef OTF_MAXCELLS
+#define OTF_MAXCELLS                8
+#endif
+// at most that many cells are added by one 6P transaction
+#ifndef OTF_MAXCELLS_PER_REQUEST
+#define OTF_MAXCELLS_PER_REQUEST    2
+#endif
+
+#define OTF_QUEUE_SCALE             8  // avgQueue is in 1/OTF_QUEUE_SCALE packets
+
 //=========================== typedef =========================================
 
 //=========================== module variables ================================
 
+typedef struct {
+   opentimer_id_t       timerId;
+   uint16_t             periodHousekeeping;      // in ms
+   open_addr_t          parent;                  // parent the measurements are about
+   uint16_t             avgQueue;                // packets queued to that parent, averaged
+   uint16_t             numAddRequests;
+   uint16_t             numDeleteRequests;
+} otf_vars_t;
+
 //=========================== prototypes ======================================
 
 // admin
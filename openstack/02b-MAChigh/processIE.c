@@ -443,7 +443,7 @@ port_INLINE void processIE_retrieve_sixCelllist(
     uint8_t i=0;
     uint8_t localptr = ptr;
     uint8_t len = length;
-    while(len>0){
+    while(len>=4 && i<SCHEDULEIEMAXNUMCELLS){
         cellList[i].tsNum     = *((uint8_t*)(pkt->payload)+localptr);
         cellList[i].tsNum    |= (*((uint8_t*)(pkt->payload)+localptr+1))<<8;
         cellList[i].choffset  = *((uint8_t*)(pkt->payload)+localptr+2);
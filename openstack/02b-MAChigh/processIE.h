@@ -5,8 +5,14 @@
 
 //=========================== define ==========================================
 
-// maximum of cells in a Schedule IE
-#define SCHEDULEIEMAXNUMCELLS 3
+// maximum of cells in a Schedule IE, can be overwritten in board_info.h
+#ifndef SCHEDULEIEMAXNUMCELLS
+#define SCHEDULEIEMAXNUMCELLS 8
+#endif
+
+// maximum length of the IEs of a 6P message: header termination IE, payload IE
+// header, sub-ID, version/code, SFID, numCells, container and cell list
+#define SIXTOP_IE_MAXLEN      (2+2+1+1+1+1+1+4*SCHEDULEIEMAXNUMCELLS)
 
 // subIE shift
 #define MLME_IE_SUBID_SHIFT            8
@@ -13,6 +13,27 @@ schedule_vars_t schedule_vars;
 //=========================== prototypes ======================================
 
 void schedule_resetEntry(scheduleEntry_t* pScheduleEntry);
+owerror_t schedule_addCell(
+   uint8_t              slotframe,
+   slotOffset_t         slotOffset,
+   cellType_t           type,
+   bool                 shared,
+   channelOffset_t      channelOffset,
+   open_addr_t*         neighbor
+);
+owerror_t schedule_removeCell(uint8_t slotframe, slotOffset_t slotOffset, open_addr_t* neighbor);
+scheduleEntry_t* schedule_findEntry(uint8_t slotframe, slotOffset_t slotOffset, open_addr_t* neighbor);
+bool schedule_findPreviousBusySlot(uint8_t slotframe, slotOffset_t slotOffset, slotOffset_t* previous);
+uint8_t schedule_neighborBucket(open_addr_t* neighbor);
+void schedule_unlinkFromBuckets(scheduleEntry_t* slotContainer);
+uint8_t schedule_slotframeIndex(uint8_t slotframeHandle);
+uint32_t schedule_computeHyperframeLength(void);
+void schedule_setHyperframeLength(frameLength_t hyperframeLength);
+bool schedule_syncCursor(uint8_t slotframe);
+frameLength_t schedule_findNextActiveSlot(
+   scheduleEntry_t**    nextCell,
+   frameLength_t*       numSlots
+);
 
 //=========================== public ==========================================
 
@@ -33,6 +54,11 @@ void schedule_init() {
    for (running_slotOffset=0;running_slotOffset<MAXACTIVESLOTS;running_slotOffset++) {
       schedule_resetEntry(&schedule_vars.scheduleBuf[running_slotOffset]);
    }
+   // chain all entries into the free list
+   for (running_slotOffset=0;running_slotOffset<MAXACTIVESLOTS-1;running_slotOffset++) {
+      schedule_vars.scheduleBuf[running_slotOffset].next = &schedule_vars.scheduleBuf[running_slotOffset+1];
+   }
+   schedule_vars.freeList = &schedule_vars.scheduleBuf[0];
    schedule_vars.backoffExponent = MINBE-1;
    schedule_vars.maxActiveSlots = MAXACTIVESLOTS;
    
@@ -65,7 +91,7 @@ void schedule_startDAGroot() {
    
    start_slotOffset = SCHEDULE_MINIMAL_6TISCH_SLOTOFFSET;
    // set frame length, handle and number (default 1 by now)
-   if (schedule_vars.frameLength == 0) {
+   if (schedule_vars.slotframes[0].length == 0) {
        // slotframe length is not set, set it to default length
        schedule_setFrameLength(SLOTFRAME_LENGTH);
    } else {
@@ -169,17 +195,41 @@ bool debugPrint_backoff() {
 /**
 \brief Set frame length.
 
+This is the length of the default slotframe. If the hyperframe gets too long
+for the other slotframes, they are removed.
+
 \param newFrameLength The new frame length.
 */
 void schedule_setFrameLength(frameLength_t newFrameLength) {
+   uint8_t  i;
+   uint32_t hyperframeLength;
    
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    
-   schedule_vars.frameLength = newFrameLength;
+   schedule_vars.slotframes[0].length = newFrameLength;
    if (newFrameLength <= MAXACTIVESLOTS) {
       schedule_vars.maxActiveSlots = newFrameLength;
    }
+   hyperframeLength = schedule_computeHyperframeLength();
+   ENABLE_INTERRUPTS();
+   
+   if (hyperframeLength>0xffff) {
+      openserial_printError(
+         COMPONENT_SCHEDULE,ERR_SCHEDULE_OVERFLOWN,
+         (errorparameter_t)2,
+         (errorparameter_t)newFrameLength
+      );
+      for (i=1;i<SCHEDULE_MAXSLOTFRAMES;i++) {
+         if (schedule_vars.slotframes[i].length!=0) {
+            schedule_removeSlotframe(schedule_vars.slotframes[i].handle);
+         }
+      }
+      hyperframeLength = newFrameLength;
+   }
+   
+   DISABLE_INTERRUPTS();
+   schedule_setHyperframeLength((frameLength_t)hyperframeLength);
    ENABLE_INTERRUPTS();
 }
 
@@ -193,7 +243,7 @@ void schedule_setFrameHandle(uint8_t frameHandle) {
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    
-   schedule_vars.frameHandle = frameHandle;
+   schedule_vars.slotframes[0].handle = frameHandle;
    
    ENABLE_INTERRUPTS();
 }
@@ -213,6 +263,116 @@ void schedule_setFrameNumber(uint8_t frameNumber) {
    ENABLE_INTERRUPTS();
 }
 
+/**
+\brief Add a slotframe, next to the default one.
+
+Its cells are added with schedule_addActiveSlotToSlotframe(). The slotframes
+repeat within a hyperframe, the least common multiple of their lengths, which
+must fit in a frameLength_t.
+
+\param slotframeHandle The handle of the new slotframe. When cells of several
+   slotframes fall in the same slot, the one with the lowest handle is used.
+\param length          The length of the new slotframe, in slots, at most
+   SCHEDULE_MAXFRAMELENGTH.
+
+\returns E_SUCCESS when the slotframe was added, E_FAIL otherwise.
+*/
+owerror_t schedule_addSlotframe(uint8_t slotframeHandle, frameLength_t length) {
+   uint8_t  i;
+   uint32_t hyperframeLength;
+   
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   // find an unused slotframe, making sure that handle is not in use
+   i = SCHEDULE_MAXSLOTFRAMES;
+   if (
+         length!=0                                         &&
+         length<=SCHEDULE_MAXFRAMELENGTH                   &&
+         schedule_slotframeIndex(slotframeHandle)==SCHEDULE_MAXSLOTFRAMES
+      ) {
+      for (i=1;i<SCHEDULE_MAXSLOTFRAMES;i++) {
+         if (schedule_vars.slotframes[i].length==0) {
+            break;
+         }
+      }
+   }
+   if (i<SCHEDULE_MAXSLOTFRAMES) {
+      schedule_vars.slotframes[i].length = length;
+      hyperframeLength = schedule_computeHyperframeLength();
+      if (hyperframeLength>0xffff) {
+         // would not fit in a frameLength_t
+         schedule_vars.slotframes[i].length = 0;
+         i = SCHEDULE_MAXSLOTFRAMES;
+      }
+   }
+   if (i==SCHEDULE_MAXSLOTFRAMES) {
+      ENABLE_INTERRUPTS();
+      openserial_printError(
+         COMPONENT_SCHEDULE,ERR_SLOTFRAME_REFUSED,
+         (errorparameter_t)slotframeHandle,
+         (errorparameter_t)length
+      );
+      return E_FAIL;
+   }
+   
+   schedule_vars.slotframes[i].handle = slotframeHandle;
+   schedule_vars.slotframes[i].cursor = NULL;
+   memset(&schedule_vars.slotframes[i].busySlots[0],0,sizeof(schedule_vars.slotframes[i].busySlots));
+   schedule_setHyperframeLength((frameLength_t)hyperframeLength);
+   
+   ENABLE_INTERRUPTS();
+   return E_SUCCESS;
+}
+
+/**
+\brief Remove a slotframe and all its cells.
+
+The default slotframe can not be removed.
+
+\param slotframeHandle The handle of the slotframe to remove.
+
+\returns E_SUCCESS when the slotframe was removed, E_FAIL otherwise.
+*/
+owerror_t schedule_removeSlotframe(uint8_t slotframeHandle) {
+   uint8_t      slotframe;
+   uint8_t      i;
+   
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   slotframe = schedule_slotframeIndex(slotframeHandle);
+   if (slotframe==0 || slotframe==SCHEDULE_MAXSLOTFRAMES) {
+      ENABLE_INTERRUPTS();
+      openserial_printError(
+         COMPONENT_SCHEDULE,ERR_UNKNOWN_SLOTFRAME,
+         (errorparameter_t)slotframeHandle,
+         (errorparameter_t)0
+      );
+      return E_FAIL;
+   }
+   
+   // remove its cells (an identical cell might be removed first)
+   for (i=0;i<MAXACTIVESLOTS;i++) {
+      while (
+            schedule_vars.scheduleBuf[i].type!=CELLTYPE_OFF &&
+            schedule_vars.scheduleBuf[i].slotframe==slotframe
+         ) {
+         schedule_removeCell(
+            slotframe,
+            schedule_vars.scheduleBuf[i].slotOffset,
+            &(schedule_vars.scheduleBuf[i].neighbor)
+         );
+      }
+   }
+   
+   schedule_vars.slotframes[slotframe].length = 0;
+   schedule_setHyperframeLength((frameLength_t)schedule_computeHyperframeLength());
+   
+   ENABLE_INTERRUPTS();
+   return E_SUCCESS;
+}
+
 /**
 \brief Get the information of a specific slot.
 
@@ -227,19 +387,14 @@ void  schedule_getSlotInfo(
 ){
    
    scheduleEntry_t* slotContainer;
-  
-   // find an empty schedule entry container
-   slotContainer = &schedule_vars.scheduleBuf[0];
-   while (slotContainer<=&schedule_vars.scheduleBuf[schedule_vars.maxActiveSlots-1]) {
-       //check that this entry for that neighbour and timeslot is not already scheduled.
-       if (packetfunctions_sameAddress(neighbor,&(slotContainer->neighbor))&& (slotContainer->slotOffset==slotOffset)){
-               //it exists so this is an update.
-               info->link_type                 = slotContainer->type;
-               info->shared                    =slotContainer->shared;
-               info->channelOffset             = slotContainer->channelOffset;
-               return; //as this is an update. No need to re-insert as it is in the same position on the list.
-        }
-        slotContainer++;
+   
+   // look for the entry for that neighbour and timeslot
+   slotContainer = schedule_findEntry(0,slotOffset,neighbor);
+   if (slotContainer!=NULL) {
+      info->link_type                 = slotContainer->type;
+      info->shared                    = slotContainer->shared;
+      info->channelOffset             = slotContainer->channelOffset;
+      return;
    }
    //return cell type off.
    info->link_type                 = CELLTYPE_OFF;
@@ -257,7 +412,7 @@ uint16_t  schedule_getMaxActiveSlots() {
 }
 
 /**
-\brief Add a new active slot into the schedule.
+\brief Add a new active slot into the default slotframe.
 
 \param slotOffset       The slotoffset of the new slot
 \param type             The type of the cell
@@ -273,250 +428,239 @@ owerror_t schedule_addActiveSlot(
       channelOffset_t channelOffset,
       open_addr_t*    neighbor
    ) {
-   scheduleEntry_t* slotContainer;
-   scheduleEntry_t* previousSlotWalker;
-   scheduleEntry_t* nextSlotWalker;
+   return schedule_addCell(0,slotOffset,type,shared,channelOffset,neighbor);
+}
+
+/**
+\brief Add a new active slot into a slotframe.
+
+\param slotframeHandle  The handle of the slotframe.
+\param slotOffset       The slotoffset of the new slot
+\param type             The type of the cell
+\param shared           Whether this cell is shared (TRUE) or not (FALSE).
+\param channelOffset    The channelOffset of the new slot
+\param neighbor         The neighbor associated with this cell (all 0's if
+   none)
+*/
+owerror_t schedule_addActiveSlotToSlotframe(
+      uint8_t         slotframeHandle,
+      slotOffset_t    slotOffset,
+      cellType_t      type,
+      bool            shared,
+      channelOffset_t channelOffset,
+      open_addr_t*    neighbor
+   ) {
+   uint8_t slotframe;
    
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
+   slotframe = schedule_slotframeIndex(slotframeHandle);
+   ENABLE_INTERRUPTS();
    
-   // find an empty schedule entry container
-   slotContainer = &schedule_vars.scheduleBuf[0];
-   while (
-         slotContainer->type!=CELLTYPE_OFF &&
-         slotContainer<=&schedule_vars.scheduleBuf[schedule_vars.maxActiveSlots-1]
-      ) {
-      slotContainer++;
-   }
-   
-   // abort it schedule overflow
-   if (slotContainer>&schedule_vars.scheduleBuf[schedule_vars.maxActiveSlots-1]) {
-      ENABLE_INTERRUPTS();
-      openserial_printCritical(
-         COMPONENT_SCHEDULE,ERR_SCHEDULE_OVERFLOWN,
-         (errorparameter_t)0,
+   if (slotframe==SCHEDULE_MAXSLOTFRAMES) {
+      openserial_printError(
+         COMPONENT_SCHEDULE,ERR_UNKNOWN_SLOTFRAME,
+         (errorparameter_t)slotframeHandle,
          (errorparameter_t)0
       );
       return E_FAIL;
    }
-   
-   // fill that schedule entry with parameters passed
-   slotContainer->slotOffset                = slotOffset;
-   slotContainer->type                      = type;
-   slotContainer->shared                    = shared;
-   slotContainer->channelOffset             = channelOffset;
-   memcpy(&slotContainer->neighbor,neighbor,sizeof(open_addr_t));
-   
-   // insert in circular list
-   if (schedule_vars.currentScheduleEntry==NULL) {
-      // this is the first active slot added
-      
-      // the next slot of this slot is this slot
-      slotContainer->next                   = slotContainer;
-      
-      // current slot points to this slot
-      schedule_vars.currentScheduleEntry    = slotContainer;
-   } else  {
-      // this is NOT the first active slot added
-      
-      // find position in schedule
-      previousSlotWalker                    = schedule_vars.currentScheduleEntry;
-      while (1) {
-         nextSlotWalker                     = previousSlotWalker->next;
-         if (
-               (
-                     (previousSlotWalker->slotOffset <  slotContainer->slotOffset) &&
-                     (slotContainer->slotOffset <  nextSlotWalker->slotOffset)
-               )
-               ||
-               (
-                     (previousSlotWalker->slotOffset <  slotContainer->slotOffset) &&
-                     (nextSlotWalker->slotOffset <= previousSlotWalker->slotOffset)
-               )
-               ||
-               (
-                     (slotContainer->slotOffset <  nextSlotWalker->slotOffset) &&
-                     (nextSlotWalker->slotOffset <= previousSlotWalker->slotOffset)
-               )
-         ) {
-            break;
-         }
-         previousSlotWalker                 = nextSlotWalker;
-      }
-      // insert between previousSlotWalker and nextSlotWalker
-      previousSlotWalker->next              = slotContainer;
-      slotContainer->next                   = nextSlotWalker;
-   }
-   
-   ENABLE_INTERRUPTS();
-   return E_SUCCESS;
+   return schedule_addCell(slotframe,slotOffset,type,shared,channelOffset,neighbor);
 }
 
 /**
-\brief Remove an active slot from the schedule.
+\brief Remove an active slot from the default slotframe.
 
 \param slotOffset       The slotoffset of the slot to remove.
 \param neighbor         The neighbor associated with this cell (all 0's if
    none)
 */
 owerror_t schedule_removeActiveSlot(slotOffset_t slotOffset, open_addr_t* neighbor) {
-   scheduleEntry_t* slotContainer;
-   scheduleEntry_t* previousSlotWalker;
+   return schedule_removeCell(0,slotOffset,neighbor);
+}
+
+/**
+\brief Remove an active slot from a slotframe.
+
+\param slotframeHandle  The handle of the slotframe.
+\param slotOffset       The slotoffset of the slot to remove.
+\param neighbor         The neighbor associated with this cell (all 0's if
+   none)
+*/
+owerror_t schedule_removeActiveSlotFromSlotframe(
+      uint8_t         slotframeHandle,
+      slotOffset_t    slotOffset,
+      open_addr_t*    neighbor
+   ) {
+   uint8_t slotframe;
    
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
+   slotframe = schedule_slotframeIndex(slotframeHandle);
+   ENABLE_INTERRUPTS();
    
-   // find the schedule entry
-   slotContainer = &schedule_vars.scheduleBuf[0];
-   while (slotContainer<=&schedule_vars.scheduleBuf[schedule_vars.maxActiveSlots-1]) {
-      if (
-            slotContainer->slotOffset==slotOffset
-            &&
-            packetfunctions_sameAddress(neighbor,&(slotContainer->neighbor))
-            ){
-         break;
-      }
-      slotContainer++;
-   }
-   
-   // abort it could not find
-   if (slotContainer>&schedule_vars.scheduleBuf[schedule_vars.maxActiveSlots-1]) {
-      ENABLE_INTERRUPTS();
-      openserial_printCritical(
-         COMPONENT_SCHEDULE,ERR_FREEING_ERROR,
-         (errorparameter_t)0,
+   if (slotframe==SCHEDULE_MAXSLOTFRAMES) {
+      openserial_printError(
+         COMPONENT_SCHEDULE,ERR_UNKNOWN_SLOTFRAME,
+         (errorparameter_t)slotframeHandle,
          (errorparameter_t)0
       );
       return E_FAIL;
    }
-   
-   // remove from linked list
-   if (slotContainer->next==slotContainer) {
-      // this is the last active slot
-      
-      // the next slot of this slot is NULL
-      slotContainer->next                   = NULL;
-      
-      // current slot points to this slot
-      schedule_vars.currentScheduleEntry    = NULL;
-   } else  {
-      // this is NOT the last active slot
-      
-      // find the previous in the schedule
-      previousSlotWalker                    = schedule_vars.currentScheduleEntry;
-      
-      while (1) {
-         if (previousSlotWalker->next==slotContainer){
-            break;
-         }
-         previousSlotWalker                 = previousSlotWalker->next;
-      }
-      
-      // remove this element from the linked list, i.e. have the previous slot
-      // "jump" to slotContainer's next
-      previousSlotWalker->next              = slotContainer->next;
-      
-      // update current slot if points to slot I just removed
-      if (schedule_vars.currentScheduleEntry==slotContainer) {
-         schedule_vars.currentScheduleEntry = slotContainer->next;
-      }
-   }
-   
-   // reset removed schedule entry
-   schedule_resetEntry(slotContainer);
-   
-   ENABLE_INTERRUPTS();
-   
-   return E_SUCCESS;
+   return schedule_removeCell(slotframe,slotOffset,neighbor);
 }
 
 bool schedule_isSlotOffsetAvailable(uint16_t slotOffset){
-   
-   scheduleEntry_t* scheduleWalker;
+   bool returnVal;
    
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    
-   scheduleWalker = schedule_vars.currentScheduleEntry;
-   do {
-      if(slotOffset == scheduleWalker->slotOffset){
-          ENABLE_INTERRUPTS();
-          return FALSE;
-      }
-      scheduleWalker = scheduleWalker->next;
-   }while(scheduleWalker!=schedule_vars.currentScheduleEntry);
+   if (slotOffset>=SCHEDULE_MAXFRAMELENGTH) {
+      // can not be scheduled
+      returnVal = FALSE;
+   } else {
+      returnVal = ((schedule_vars.slotframes[0].busySlots[slotOffset/8] & (1<<(slotOffset%8)))==0);
+   }
    
    ENABLE_INTERRUPTS();
    
-   return TRUE;
+   return returnVal;
 }
 
+/**
+\brief Find the cell with the highest ETX.
+
+Only cells used for over MIN_NUMTX_FOR_PDR transmissions, with an ETX above
+ETX_THRESHOLD, are considered.
+
+\returns That cell, NULL if there is none.
+*/
 scheduleEntry_t* schedule_statistic_poorLinkQuality(){
    scheduleEntry_t* scheduleWalker;
+   scheduleEntry_t* worstEntry;
+   uint16_t         worstEtx;
+   uint16_t         etx;
    
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    
-   scheduleWalker = schedule_vars.currentScheduleEntry;
-   do {
+   worstEntry = NULL;
+   worstEtx   = ETX_THRESHOLD;
+   
+   // look at the cells of all slotframes
+   for (scheduleWalker=&schedule_vars.scheduleBuf[0];scheduleWalker<=&schedule_vars.scheduleBuf[MAXACTIVESLOTS-1];scheduleWalker++) {
       if(
-         scheduleWalker->numTx > MIN_NUMTX_FOR_PDR                     &&\
-         PDR_THRESHOLD > 100*scheduleWalker->numTxACK/scheduleWalker->numTx
+         scheduleWalker->type == CELLTYPE_OFF                          ||\
+         scheduleWalker->numTx <= MIN_NUMTX_FOR_PDR
       ){
-         break;
+         continue;
+      }
+      etx = linkestimator_getEtx(&scheduleWalker->linkEstimate);
+      if (etx>worstEtx) {
+         worstEntry = scheduleWalker;
+         worstEtx   = etx;
       }
-      scheduleWalker = scheduleWalker->next;
-   }while(scheduleWalker!=schedule_vars.currentScheduleEntry);
-   
-   if (scheduleWalker == schedule_vars.currentScheduleEntry){
-       ENABLE_INTERRUPTS();
-       return NULL;
-   } else {
-       ENABLE_INTERRUPTS();
-       return scheduleWalker;
    }
+   
+   ENABLE_INTERRUPTS();
+   return worstEntry;
 }
 
 uint16_t  schedule_getCellsCounts(uint8_t frameID,cellType_t type, open_addr_t* neighbor){
     uint16_t         count = 0;
+    uint8_t          slotframe;
     scheduleEntry_t* scheduleWalker;
    
     INTERRUPT_DECLARATION();
     DISABLE_INTERRUPTS();
     
-    if (frameID != SCHEDULE_MINIMAL_6TISCH_DEFAULT_SLOTFRAME_HANDLE){
+    slotframe = schedule_slotframeIndex(frameID);
+    if (slotframe==SCHEDULE_MAXSLOTFRAMES){
         ENABLE_INTERRUPTS();
         return 0;
     }
    
-    scheduleWalker = schedule_vars.currentScheduleEntry;
-    do {
+    // only walk the entries in the bucket of that neighbor
+    scheduleWalker = schedule_vars.neighborBucket[schedule_neighborBucket(neighbor)];
+    while (scheduleWalker!=NULL) {
        if(
+          scheduleWalker->slotframe == slotframe                            &&
           packetfunctions_sameAddress(&(scheduleWalker->neighbor),neighbor) &&
           type == scheduleWalker->type
        ){
            count++;
        }
-       scheduleWalker = scheduleWalker->next;
-    }while(scheduleWalker!=schedule_vars.currentScheduleEntry);
+       scheduleWalker = scheduleWalker->neighborNext;
+    }
    
     ENABLE_INTERRUPTS();
     return count;
 }
+
+/**
+\brief Retrieve how much the dedicated TX cells to a neighbor are used.
+
+The transmissions are counted from the previous call to this function.
+
+\param[in]  neighbor The neighbor those cells are to.
+\param[out] numTx    The number of transmissions over those cells.
+
+\returns The number of dedicated TX cells to that neighbor, in all slotframes.
+*/
+uint16_t schedule_getTxUsage(open_addr_t* neighbor, uint16_t* numTx) {
+   uint16_t         numCells;
+   scheduleEntry_t* scheduleWalker;
+   
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   numCells = 0;
+   *numTx   = 0;
+   
+   // only walk the entries in the bucket of that neighbor
+   scheduleWalker = schedule_vars.neighborBucket[schedule_neighborBucket(neighbor)];
+   while (scheduleWalker!=NULL) {
+      if(
+         scheduleWalker->type   == CELLTYPE_TX                             &&
+         scheduleWalker->shared == FALSE                                   &&
+         packetfunctions_sameAddress(&(scheduleWalker->neighbor),neighbor)
+      ){
+         numCells++;
+         *numTx                      += scheduleWalker->numTxRecent;
+         scheduleWalker->numTxRecent  = 0;
+      }
+      scheduleWalker = scheduleWalker->neighborNext;
+   }
+   
+   ENABLE_INTERRUPTS();
+   return numCells;
+}
 void schedule_removeAllCells(
     uint8_t        slotframeID,
     open_addr_t*   previousHop
     ){
-    uint8_t i;
+    uint8_t          slotframe;
+    scheduleEntry_t* scheduleWalker;
+    scheduleEntry_t* nextWalker;
+    
+    slotframe = schedule_slotframeIndex(slotframeID);
     
-    // remove all entries in schedule with previousHop address
-    for(i=0;i<MAXACTIVESLOTS;i++){
-        if (packetfunctions_sameAddress(&(schedule_vars.scheduleBuf[i].neighbor),previousHop)){
-           schedule_removeActiveSlot(
-              schedule_vars.scheduleBuf[i].slotOffset,
+    // remove all entries in that slotframe with previousHop address
+    scheduleWalker = schedule_vars.neighborBucket[schedule_neighborBucket(previousHop)];
+    while (scheduleWalker!=NULL) {
+        nextWalker = scheduleWalker->neighborNext;
+        if (
+            scheduleWalker->slotframe==slotframe &&
+            packetfunctions_sameAddress(&(scheduleWalker->neighbor),previousHop)
+        ){
+           schedule_removeCell(
+              slotframe,
+              scheduleWalker->slotOffset,
               previousHop
            );
         }
+        scheduleWalker = nextWalker;
     }
 }
 
@@ -524,15 +668,72 @@ scheduleEntry_t* schedule_getCurrentScheduleEntry(){
     return schedule_vars.currentScheduleEntry;
 }
 
+/**
+\brief Get a cell of a slotframe.
+
+The cells of a slotframe are linked in a circular list, sorted by slot offset,
+through their next field.
+
+\returns One of the cells of that slotframe, NULL if it has none.
+*/
+scheduleEntry_t* schedule_getSlotframeEntry(uint8_t slotframeHandle){
+    uint8_t          slotframe;
+    scheduleEntry_t* returnVal;
+    
+    INTERRUPT_DECLARATION();
+    DISABLE_INTERRUPTS();
+    
+    returnVal = NULL;
+    slotframe = schedule_slotframeIndex(slotframeHandle);
+    if (slotframe!=SCHEDULE_MAXSLOTFRAMES) {
+        returnVal = schedule_vars.slotframes[slotframe].cursor;
+    }
+    
+    ENABLE_INTERRUPTS();
+    return returnVal;
+}
+
 //=== from IEEE802154E: reading the schedule and updating statistics
 
+/**
+\brief Set the current slot.
+
+\param targetSlotOffset The current slot, in the hyperframe.
+*/
 void schedule_syncSlotOffset(slotOffset_t targetSlotOffset) {
+   scheduleSlotframe_t* slotframe;
+   scheduleEntry_t*     winner;
+   uint8_t              i;
    
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    
-   while (schedule_vars.currentScheduleEntry->slotOffset!=targetSlotOffset) {
-      schedule_advanceSlot();
+   if (schedule_vars.hyperframeLength!=0) {
+      targetSlotOffset %= schedule_vars.hyperframeLength;
+   }
+   schedule_vars.hyperSlotOffset = targetSlotOffset;
+   
+   // in each slotframe, move the cursor to the last cell at or before that slot
+   winner = NULL;
+   for (i=0;i<SCHEDULE_MAXSLOTFRAMES;i++) {
+      slotframe = &schedule_vars.slotframes[i];
+      
+      // the slotframe with the lowest handle wins the current slot
+      if (
+            schedule_syncCursor(i)==TRUE &&
+            (
+               winner==NULL ||
+               slotframe->handle<schedule_vars.slotframes[winner->slotframe].handle
+            )
+         ) {
+         winner = slotframe->cursor;
+      }
+   }
+   if (winner==NULL) {
+      winner = schedule_vars.slotframes[0].cursor;
+   }
+   if (winner!=NULL) {
+      schedule_vars.currentScheduleEntry = winner;
    }
    
    ENABLE_INTERRUPTS();
@@ -540,27 +741,67 @@ void schedule_syncSlotOffset(slotOffset_t targetSlotOffset) {
 
 /**
 \brief advance to next active slot
+
+That is the closest next cell over all slotframes. When several slotframes
+have a cell in that slot, the cell of the slotframe with the lowest handle
+becomes the current one.
 */
 void schedule_advanceSlot() {
+   scheduleEntry_t* nextCell[SCHEDULE_MAXSLOTFRAMES];
+   frameLength_t    numSlots[SCHEDULE_MAXSLOTFRAMES];
+   frameLength_t    minNumSlots;
+   scheduleEntry_t* winner;
+   uint8_t          i;
    
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    
-   schedule_vars.currentScheduleEntry = schedule_vars.currentScheduleEntry->next;
+   minNumSlots = schedule_findNextActiveSlot(nextCell,numSlots);
+   if (minNumSlots==0) {
+      // nothing scheduled
+      ENABLE_INTERRUPTS();
+      return;
+   }
+   
+   schedule_vars.hyperSlotOffset = (schedule_vars.hyperSlotOffset+minNumSlots)%schedule_vars.hyperframeLength;
+   
+   winner = NULL;
+   for (i=0;i<SCHEDULE_MAXSLOTFRAMES;i++) {
+      if (numSlots[i]!=minNumSlots) {
+         continue;
+      }
+      // this slotframe has a cell in the new slot
+      schedule_vars.slotframes[i].cursor = nextCell[i];
+      if (
+            winner==NULL ||
+            schedule_vars.slotframes[i].handle<schedule_vars.slotframes[winner->slotframe].handle
+         ) {
+         winner = nextCell[i];
+      }
+   }
+   schedule_vars.currentScheduleEntry = winner;
    
    ENABLE_INTERRUPTS();
 }
 
 /**
-\brief return slotOffset of next active slot
+\brief return slotOffset of next active slot, in the hyperframe
 */
 slotOffset_t schedule_getNextActiveSlotOffset() {
-   slotOffset_t res;   
+   scheduleEntry_t* nextCell[SCHEDULE_MAXSLOTFRAMES];
+   frameLength_t    numSlots[SCHEDULE_MAXSLOTFRAMES];
+   frameLength_t    minNumSlots;
+   slotOffset_t     res;   
    
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    
-   res = ((scheduleEntry_t*)(schedule_vars.currentScheduleEntry->next))->slotOffset;
+   minNumSlots = schedule_findNextActiveSlot(nextCell,numSlots);
+   if (minNumSlots==0) {
+      res = schedule_vars.hyperSlotOffset;
+   } else {
+      res = (schedule_vars.hyperSlotOffset+minNumSlots)%schedule_vars.hyperframeLength;
+   }
    
    ENABLE_INTERRUPTS();
    
@@ -578,7 +819,28 @@ frameLength_t schedule_getFrameLength() {
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    
-   returnVal = schedule_vars.frameLength;
+   returnVal = schedule_vars.slotframes[0].length;
+   
+   ENABLE_INTERRUPTS();
+   
+   return returnVal;
+}
+
+/**
+\brief Get the hyperframe length.
+
+The slot offset the MAC layer keeps track of is counted in the hyperframe,
+after which the schedule of all slotframes repeats.
+
+\returns The hyperframe length, 0 if no slotframe length is known.
+*/
+frameLength_t schedule_getHyperframeLength() {
+   frameLength_t returnVal;
+   
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   returnVal = schedule_vars.hyperframeLength;
    
    ENABLE_INTERRUPTS();
    
@@ -596,7 +858,7 @@ uint8_t schedule_getFrameHandle() {
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    
-   returnVal = schedule_vars.frameHandle;
+   returnVal = schedule_vars.slotframes[0].handle;
    
    ENABLE_INTERRUPTS();
    
@@ -764,6 +1026,10 @@ void schedule_indicateTx(asn_t* asnTimestamp, bool succesfullTx) {
    if (succesfullTx==TRUE) {
       schedule_vars.currentScheduleEntry->numTxACK++;
    }
+   linkestimator_indicateTx(&schedule_vars.currentScheduleEntry->linkEstimate,1,succesfullTx);
+   if (schedule_vars.currentScheduleEntry->numTxRecent<0xff) {
+      schedule_vars.currentScheduleEntry->numTxRecent++;
+   }
 
    // update last used timestamp
    memcpy(&schedule_vars.currentScheduleEntry->lastUsedAsn, asnTimestamp, sizeof(asn_t));
@@ -794,6 +1060,7 @@ void schedule_indicateTx(asn_t* asnTimestamp, bool succesfullTx) {
 \pre This function assumes interrupts are already disabled.
 */
 void schedule_resetEntry(scheduleEntry_t* e) {
+   e->slotframe              = 0;
    e->slotOffset             = 0;
    e->type                   = CELLTYPE_OFF;
    e->shared                 = FALSE;
@@ -805,8 +1072,509 @@ void schedule_resetEntry(scheduleEntry_t* e) {
    e->numRx                  = 0;
    e->numTx                  = 0;
    e->numTxACK               = 0;
+   linkestimator_reset(&e->linkEstimate);
+   e->numTxRecent            = 0;
    e->lastUsedAsn.bytes0and1 = 0;
    e->lastUsedAsn.bytes2and3 = 0;
    e->lastUsedAsn.byte4      = 0;
    e->next                   = NULL;
+   e->prev                   = NULL;
+   e->slotNext               = NULL;
+   e->neighborNext           = NULL;
+}
+
+/**
+\brief Add a cell to a slotframe.
+
+\param slotframe The index of the slotframe in schedule_vars.slotframes.
+
+See schedule_addActiveSlot() for the other parameters.
+*/
+owerror_t schedule_addCell(
+      uint8_t         slotframe,
+      slotOffset_t    slotOffset,
+      cellType_t      type,
+      bool            shared,
+      channelOffset_t channelOffset,
+      open_addr_t*    neighbor
+   ) {
+   scheduleSlotframe_t* slotframeEntry;
+   scheduleEntry_t*     slotContainer;
+   scheduleEntry_t*     previousSlotWalker;
+   scheduleEntry_t*     nextSlotWalker;
+   slotOffset_t         previousSlotOffset;
+   slotOffset_t         localSlotOffset;
+   uint8_t              bucket;
+   
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   slotframeEntry = &schedule_vars.slotframes[slotframe];
+   
+   // abort if the slot offset does not fit in the busy slots bitmap, or is
+   // beyond the slotframe, where the cell would never be active (the length of
+   // the default slotframe is not known before synchronizing)
+   if (
+         slotOffset>=SCHEDULE_MAXFRAMELENGTH ||
+         (slotframeEntry->length>0 && slotOffset>=slotframeEntry->length)
+      ) {
+      ENABLE_INTERRUPTS();
+      openserial_printCritical(
+         COMPONENT_SCHEDULE,ERR_SCHEDULE_OVERFLOWN,
+         (errorparameter_t)1,
+         (errorparameter_t)slotOffset
+      );
+      return E_FAIL;
+   }
+   
+   // take an empty schedule entry container from the free list
+   slotContainer = schedule_vars.freeList;
+   
+   // abort it schedule overflow
+   if (slotContainer==NULL || schedule_vars.numActiveSlots>=schedule_vars.maxActiveSlots) {
+      ENABLE_INTERRUPTS();
+      openserial_printCritical(
+         COMPONENT_SCHEDULE,ERR_SCHEDULE_OVERFLOWN,
+         (errorparameter_t)0,
+         (errorparameter_t)0
+      );
+      return E_FAIL;
+   }
+   schedule_vars.freeList                   = slotContainer->next;
+   schedule_vars.numActiveSlots++;
+   
+   // fill that schedule entry with parameters passed
+   slotContainer->slotframe                 = slotframe;
+   slotContainer->slotOffset                = slotOffset;
+   slotContainer->type                      = type;
+   slotContainer->shared                    = shared;
+   slotContainer->channelOffset             = channelOffset;
+   memcpy(&slotContainer->neighbor,neighbor,sizeof(open_addr_t));
+   
+   // insert in the circular list of that slotframe
+   if (slotframeEntry->cursor==NULL) {
+      // this is the first active slot added to this slotframe
+      
+      // the next slot of this slot is this slot
+      slotContainer->next                   = slotContainer;
+      slotContainer->prev                   = slotContainer;
+      
+      // the slotframe cursor points to this slot
+      slotframeEntry->cursor                = slotContainer;
+   } else  {
+      // this is NOT the first active slot added to this slotframe
+      
+      // find position in schedule: right after the last entry at the closest
+      // busy slot offset before this one (possibly this very slot offset)
+      if ((slotframeEntry->busySlots[slotOffset/8] & (1<<(slotOffset%8)))!=0) {
+         previousSlotOffset                 = slotOffset;
+      } else {
+         schedule_findPreviousBusySlot(slotframe,slotOffset,&previousSlotOffset);
+      }
+      nextSlotWalker                        = schedule_findEntry(slotframe,previousSlotOffset,NULL);
+      previousSlotWalker                    = nextSlotWalker;
+      while (
+            previousSlotWalker->next!=nextSlotWalker &&
+            ((scheduleEntry_t*)(previousSlotWalker->next))->slotOffset==previousSlotOffset
+         ) {
+         previousSlotWalker                 = previousSlotWalker->next;
+      }
+      nextSlotWalker                        = previousSlotWalker->next;
+      
+      // insert between previousSlotWalker and nextSlotWalker
+      previousSlotWalker->next              = slotContainer;
+      nextSlotWalker->prev                  = slotContainer;
+      slotContainer->prev                   = previousSlotWalker;
+      slotContainer->next                   = nextSlotWalker;
+      
+      // the cursor is the last cell at or before the current slot, which
+      // might now be this one
+      if (slotframeEntry->length!=0) {
+         localSlotOffset                    = schedule_vars.hyperSlotOffset % slotframeEntry->length;
+         if (
+               (localSlotOffset+slotframeEntry->length-slotOffset)%slotframeEntry->length <
+               (localSlotOffset+slotframeEntry->length-slotframeEntry->cursor->slotOffset)%slotframeEntry->length
+            ) {
+            slotframeEntry->cursor          = slotContainer;
+         }
+      }
+   }
+   
+   // current slot points to this slot if there was none
+   if (schedule_vars.currentScheduleEntry==NULL) {
+      schedule_vars.currentScheduleEntry    = slotContainer;
+   }
+   
+   // index by slot offset and by neighbor
+   bucket                                   = slotOffset & (SCHEDULE_NUMSLOTBUCKETS-1);
+   slotContainer->slotNext                  = schedule_vars.slotBucket[bucket];
+   schedule_vars.slotBucket[bucket]         = slotContainer;
+   bucket                                   = schedule_neighborBucket(neighbor);
+   slotContainer->neighborNext              = schedule_vars.neighborBucket[bucket];
+   schedule_vars.neighborBucket[bucket]     = slotContainer;
+   slotframeEntry->busySlots[slotOffset/8] |= (1<<(slotOffset%8));
+   
+   ENABLE_INTERRUPTS();
+   return E_SUCCESS;
+}
+
+/**
+\brief Remove a cell from a slotframe.
+
+\param slotframe The index of the slotframe in schedule_vars.slotframes.
+
+See schedule_removeActiveSlot() for the other parameters.
+*/
+owerror_t schedule_removeCell(uint8_t slotframe, slotOffset_t slotOffset, open_addr_t* neighbor) {
+   scheduleSlotframe_t* slotframeEntry;
+   scheduleEntry_t*     slotContainer;
+   uint8_t              i;
+   
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   slotframeEntry = &schedule_vars.slotframes[slotframe];
+   
+   // find the schedule entry
+   slotContainer = schedule_findEntry(slotframe,slotOffset,neighbor);
+   
+   // abort it could not find
+   if (slotContainer==NULL) {
+      ENABLE_INTERRUPTS();
+      openserial_printCritical(
+         COMPONENT_SCHEDULE,ERR_FREEING_ERROR,
+         (errorparameter_t)0,
+         (errorparameter_t)0
+      );
+      return E_FAIL;
+   }
+   
+   // remove from linked list
+   if (slotContainer->next==slotContainer) {
+      // this is the last active slot of this slotframe
+      
+      // the next slot of this slot is NULL
+      slotContainer->next                   = NULL;
+      
+      // the slotframe has no cell left
+      slotframeEntry->cursor                = NULL;
+   } else  {
+      // this is NOT the last active slot of this slotframe
+      
+      // remove this element from the linked list, i.e. have the previous slot
+      // "jump" to slotContainer's next
+      ((scheduleEntry_t*)(slotContainer->prev))->next = slotContainer->next;
+      ((scheduleEntry_t*)(slotContainer->next))->prev = slotContainer->prev;
+      
+      // update the cursor if points to slot I just removed, staying at that
+      // slot offset if another cell is scheduled there
+      if (slotframeEntry->cursor==slotContainer) {
+         if (((scheduleEntry_t*)(slotContainer->next))->slotOffset==slotContainer->slotOffset) {
+            slotframeEntry->cursor          = slotContainer->next;
+         } else {
+            slotframeEntry->cursor          = slotContainer->prev;
+         }
+      }
+   }
+   
+   // update current slot if points to slot I just removed
+   if (schedule_vars.currentScheduleEntry==slotContainer) {
+      schedule_vars.currentScheduleEntry    = slotframeEntry->cursor;
+      for (i=0;i<SCHEDULE_MAXSLOTFRAMES && schedule_vars.currentScheduleEntry==NULL;i++) {
+         schedule_vars.currentScheduleEntry = schedule_vars.slotframes[i].cursor;
+      }
+   }
+   
+   // remove from the indexes
+   schedule_unlinkFromBuckets(slotContainer);
+   
+   // reset removed schedule entry and give it back to the free list
+   schedule_resetEntry(slotContainer);
+   slotContainer->next                      = schedule_vars.freeList;
+   schedule_vars.freeList                   = slotContainer;
+   schedule_vars.numActiveSlots--;
+   
+   ENABLE_INTERRUPTS();
+   
+   return E_SUCCESS;
+}
+
+/**
+\brief Find the entry at a slot offset, in the slot offset bucket.
+
+\param slotframe  The index of the slotframe of the entry.
+\param slotOffset The slot offset of the entry.
+\param neighbor   The neighbor of the entry, NULL to match any neighbor.
+
+\returns The entry, or NULL if there is none.
+
+\pre This function assumes interrupts are already disabled.
+*/
+scheduleEntry_t* schedule_findEntry(uint8_t slotframe, slotOffset_t slotOffset, open_addr_t* neighbor) {
+   scheduleEntry_t* scheduleWalker;
+   
+   scheduleWalker = schedule_vars.slotBucket[slotOffset & (SCHEDULE_NUMSLOTBUCKETS-1)];
+   while (scheduleWalker!=NULL) {
+      if (
+            scheduleWalker->slotOffset==slotOffset &&
+            scheduleWalker->slotframe==slotframe   &&
+            (
+               neighbor==NULL ||
+               packetfunctions_sameAddress(neighbor,&(scheduleWalker->neighbor))
+            )
+         ) {
+         return scheduleWalker;
+      }
+      scheduleWalker = scheduleWalker->slotNext;
+   }
+   return NULL;
+}
+
+/**
+\brief Find the closest busy slot offset before a given one, wrapping around.
+
+Walks the busy slots bitmap backwards, skipping empty bytes at once.
+
+\param slotframe     The index of the slotframe.
+\param slotOffset    The slot offset to start from (excluded).
+\param[out] previous The busy slot offset found.
+
+\returns TRUE if a busy slot offset was found, FALSE if there is none (other
+   than slotOffset).
+
+\pre This function assumes interrupts are already disabled.
+*/
+bool schedule_findPreviousBusySlot(uint8_t slotframe, slotOffset_t slotOffset, slotOffset_t* previous) {
+   uint8_t*     busySlots;
+   slotOffset_t i;
+   
+   busySlots = &schedule_vars.slotframes[slotframe].busySlots[0];
+   
+   i = slotOffset;
+   while (1) {
+      // step back one slot offset, wrapping around
+      if (i==0) {
+         i = SCHEDULE_MAXFRAMELENGTH;
+      }
+      i--;
+      if (i==slotOffset) {
+         return FALSE;
+      }
+      if (
+            (i%8)==7                                &&
+            busySlots[i/8]==0                       &&
+            (i/8)!=(slotOffset/8)
+         ) {
+         // nothing busy in that byte, jump to its first slot offset
+         i -= 7;
+         continue;
+      }
+      if ((busySlots[i/8] & (1<<(i%8)))!=0) {
+         *previous = i;
+         return TRUE;
+      }
+   }
+}
+
+/**
+\brief Get the bucket of the entries of a neighbor.
+
+Entries of neighbors which are not 64-bit addresses (anycast, none) all go to
+the first bucket.
+*/
+uint8_t schedule_neighborBucket(open_addr_t* neighbor) {
+   if (neighbor->type!=ADDR_64B) {
+      return 0;
+   }
+   return neighbor->addr_64b[7] & (SCHEDULE_NUMNEIGHBORBUCKETS-1);
+}
+
+/**
+\brief Remove an entry from the slot offset and neighbor buckets.
+
+Also clears its slot offset in the busy slots bitmap, unless another entry
+is scheduled at the same slot offset.
+
+\pre This function assumes interrupts are already disabled.
+*/
+void schedule_unlinkFromBuckets(scheduleEntry_t* slotContainer) {
+   scheduleEntry_t** walker;
+   
+   walker = &schedule_vars.slotBucket[slotContainer->slotOffset & (SCHEDULE_NUMSLOTBUCKETS-1)];
+   while (*walker!=NULL) {
+      if (*walker==slotContainer) {
+         *walker = slotContainer->slotNext;
+         break;
+      }
+      walker = (scheduleEntry_t**)&((*walker)->slotNext);
+   }
+   
+   walker = &schedule_vars.neighborBucket[schedule_neighborBucket(&(slotContainer->neighbor))];
+   while (*walker!=NULL) {
+      if (*walker==slotContainer) {
+         *walker = slotContainer->neighborNext;
+         break;
+      }
+      walker = (scheduleEntry_t**)&((*walker)->neighborNext);
+   }
+   
+   if (schedule_findEntry(slotContainer->slotframe,slotContainer->slotOffset,NULL)==NULL) {
+      schedule_vars.slotframes[slotContainer->slotframe].busySlots[slotContainer->slotOffset/8] &= \
+         ~(1<<(slotContainer->slotOffset%8));
+   }
+}
+
+/**
+\brief Get the index of a slotframe in schedule_vars.slotframes.
+
+\returns The index, or SCHEDULE_MAXSLOTFRAMES if there is no slotframe with
+   that handle.
+*/
+uint8_t schedule_slotframeIndex(uint8_t slotframeHandle) {
+   uint8_t i;
+   
+   for (i=0;i<SCHEDULE_MAXSLOTFRAMES;i++) {
+      if (
+            (i==0 || schedule_vars.slotframes[i].length!=0) &&
+            schedule_vars.slotframes[i].handle==slotframeHandle
+         ) {
+         return i;
+      }
+   }
+   return SCHEDULE_MAXSLOTFRAMES;
+}
+
+/**
+\brief Compute the least common multiple of the known slotframe lengths.
+
+\returns The hyperframe length, 0 if no slotframe length is known.
+*/
+uint32_t schedule_computeHyperframeLength() {
+   uint32_t hyperframeLength;
+   uint32_t a;
+   uint32_t b;
+   uint32_t t;
+   uint8_t  i;
+   
+   hyperframeLength = 0;
+   for (i=0;i<SCHEDULE_MAXSLOTFRAMES;i++) {
+      if (schedule_vars.slotframes[i].length==0) {
+         continue;
+      }
+      if (hyperframeLength==0) {
+         hyperframeLength = schedule_vars.slotframes[i].length;
+         continue;
+      }
+      // greatest common divisor, then least common multiple
+      a = hyperframeLength;
+      b = schedule_vars.slotframes[i].length;
+      while (b!=0) {
+         t = a%b;
+         a = b;
+         b = t;
+      }
+      hyperframeLength = (hyperframeLength/a)*schedule_vars.slotframes[i].length;
+   }
+   return hyperframeLength;
+}
+
+/**
+\brief Switch to a new hyperframe length.
+
+The MAC layer notices the change and re-synchronizes the current slot.
+
+\pre This function assumes interrupts are already disabled.
+*/
+void schedule_setHyperframeLength(frameLength_t hyperframeLength) {
+   uint8_t i;
+   
+   schedule_vars.hyperframeLength = hyperframeLength;
+   if (hyperframeLength!=0) {
+      schedule_vars.hyperSlotOffset %= hyperframeLength;
+   }
+   
+   // the slot in each slotframe might have changed
+   for (i=0;i<SCHEDULE_MAXSLOTFRAMES;i++) {
+      schedule_syncCursor(i);
+   }
+}
+
+/**
+\brief Move the cursor of a slotframe to its last cell at or before the
+   current slot.
+
+\param slotframe The index of the slotframe in schedule_vars.slotframes.
+
+\returns TRUE if that slotframe has a cell at the current slot, FALSE otherwise.
+
+\pre This function assumes interrupts are already disabled.
+*/
+bool schedule_syncCursor(uint8_t slotframe) {
+   scheduleSlotframe_t* slotframeEntry;
+   slotOffset_t         localSlotOffset;
+   slotOffset_t         cursorSlotOffset;
+   
+   slotframeEntry = &schedule_vars.slotframes[slotframe];
+   if (slotframeEntry->cursor==NULL || slotframeEntry->length==0) {
+      return FALSE;
+   }
+   
+   localSlotOffset  = schedule_vars.hyperSlotOffset % slotframeEntry->length;
+   cursorSlotOffset = localSlotOffset;
+   if ((slotframeEntry->busySlots[localSlotOffset/8] & (1<<(localSlotOffset%8)))==0) {
+      schedule_findPreviousBusySlot(slotframe,localSlotOffset,&cursorSlotOffset);
+   }
+   slotframeEntry->cursor = schedule_findEntry(slotframe,cursorSlotOffset,NULL);
+   
+   return (cursorSlotOffset==localSlotOffset);
+}
+
+/**
+\brief Find the closest next cell, over all slotframes.
+
+\param[out] nextCell For each slotframe, its first cell after the current
+   slot.
+\param[out] numSlots For each slotframe, the number of slots from the current
+   slot to that cell, 0 if the slotframe has no cell or no length.
+
+\returns The smallest non-zero entry of numSlots, 0 if there is none.
+
+\pre This function assumes interrupts are already disabled.
+*/
+frameLength_t schedule_findNextActiveSlot(
+      scheduleEntry_t**    nextCell,
+      frameLength_t*       numSlots
+   ) {
+   scheduleSlotframe_t* slotframe;
+   scheduleEntry_t*     cell;
+   slotOffset_t         localSlotOffset;
+   frameLength_t        minNumSlots;
+   uint8_t              i;
+   
+   minNumSlots = 0;
+   for (i=0;i<SCHEDULE_MAXSLOTFRAMES;i++) {
+      slotframe   = &schedule_vars.slotframes[i];
+      numSlots[i] = 0;
+      if (slotframe->cursor==NULL || slotframe->length==0) {
+         continue;
+      }
+      
+      // the cursor is the last cell at or before the current slot, so its
+      // next cell at another slot offset is the first after the current slot
+      cell = slotframe->cursor->next;
+      while (cell!=slotframe->cursor && cell->slotOffset==slotframe->cursor->slotOffset) {
+         cell = cell->next;
+      }
+      localSlotOffset = schedule_vars.hyperSlotOffset % slotframe->length;
+      numSlots[i]     = (cell->slotOffset+slotframe->length-localSlotOffset)%slotframe->length;
+      if (numSlots[i]==0) {
+         numSlots[i]  = slotframe->length;
+      }
+      nextCell[i]     = cell;
+      
+      if (minNumSlots==0 || numSlots[i]<minNumSlots) {
+         minNumSlots  = numSlots[i];
+      }
+   }
+   return minNumSlots;
 }
@@ -9,6 +9,7 @@
 */
 
 #include "opendefs.h"
+#include "linkestimator.h"
 
 //=========================== define ==========================================
 
@@ -19,6 +20,30 @@ The superframe repears over time and can be arbitrarly long.
 */
 #define SLOTFRAME_LENGTH    11 //should be 101
 
+/**
+\brief The maximum length of the superframe, in slots.
+
+Sizes the bitmap of busy slot offsets, so slot offsets past it can not be
+scheduled. Can be overwritten in board_info.h.
+*/
+#ifndef SCHEDULE_MAXFRAMELENGTH
+#define SCHEDULE_MAXFRAMELENGTH      101
+#endif
+
+/**
+\brief The maximum number of slotframes, including the default one.
+
+When cells of several slotframes fall in the same slot, the cell of the
+slotframe with the lowest handle is used, as in IEEE802.15.4. Can be
+overwritten in board_info.h.
+*/
+#ifndef SCHEDULE_MAXSLOTFRAMES
+#define SCHEDULE_MAXSLOTFRAMES       3
+#endif
+
+#define SCHEDULE_NUMSLOTBUCKETS      16 // hash buckets of the entries, by slot offset, must be a power of 2
+#define SCHEDULE_NUMNEIGHBORBUCKETS  8  // hash buckets of the entries, by neighbor, must be a power of 2
+
 //draft-ietf-6tisch-minimal-06
 #define SCHEDULE_MINIMAL_6TISCH_ACTIVE_CELLS                      1
 #define SCHEDULE_MINIMAL_6TISCH_SLOTOFFSET                        0
@@ -37,9 +62,11 @@ schedule is represented, in RAM, by a table. There is one row per active slot
 in that table; a slot is "active" when it is not of type CELLTYPE_OFF.
 
 Set this number to the exact number of active slots you are planning on having
-in your schedule, so not to waste RAM.
+in your schedule, so not to waste RAM. Can be overwritten in board_info.h.
 */
+#ifndef MAXACTIVESLOTS
 #define MAXACTIVESLOTS       (SCHEDULE_MINIMAL_6TISCH_ACTIVE_CELLS+NUMSERIALRX+NUMSLOTSOFF)
+#endif
 
 /**
 \brief Minimum backoff exponent.
@@ -62,6 +89,8 @@ See MINBE for an explanation of backoff.
 */
 #define PDR_THRESHOLD      80 // 80 means 80%
 #define MIN_NUMTX_FOR_PDR  50 // don't calculate PDR when numTx is lower than this value 
+// the ETX of a cell with a PDR of PDR_THRESHOLD
+#define ETX_THRESHOLD      (LINKESTIMATOR_ETX_ONE*100/PDR_THRESHOLD)
 
 //=========================== typedef =========================================
 
@@ -80,6 +109,7 @@ typedef enum {
 
 typedef struct {
    slotOffset_t    slotOffset;
+   uint8_t         slotframe;            // index in schedule_vars.slotframes
    cellType_t      type;
    bool            shared;
    uint8_t         channelOffset;
@@ -87,8 +117,13 @@ typedef struct {
    uint8_t         numRx;
    uint8_t         numTx;
    uint8_t         numTxACK;
+   linkEstimate_t  linkEstimate;
+   uint8_t         numTxRecent;          // transmissions since the last schedule_getTxUsage()
    asn_t           lastUsedAsn;
-   void*           next;
+   void*           next;                 // next active slot (circular, sorted by slot offset)
+   void*           prev;                 // previous active slot
+   void*           slotNext;             // next entry in the same slot offset bucket
+   void*           neighborNext;         // next entry in the same neighbor bucket
 } scheduleEntry_t;
 
 BEGIN_PACK
@@ -114,14 +149,26 @@ typedef struct {
   channelOffset_t  channelOffset;
 }slotinfo_element_t;
 
+typedef struct {
+   uint8_t          handle;
+   frameLength_t    length;                                     // in slots, 0 if unused (or not known yet for the default slotframe)
+   scheduleEntry_t* cursor;                                     // last cell at or before the current slot (cyclically), NULL if no cell
+   uint8_t          busySlots[(SCHEDULE_MAXFRAMELENGTH+7)/8];   // bit set iff a cell is scheduled at that slot offset
+} scheduleSlotframe_t;
+
 //=========================== variables =======================================
 
 typedef struct {
    scheduleEntry_t  scheduleBuf[MAXACTIVESLOTS];
    scheduleEntry_t* currentScheduleEntry;
-   frameLength_t    frameLength;
+   scheduleEntry_t* freeList;                                   // unused entries, chained by next
+   scheduleEntry_t* slotBucket[SCHEDULE_NUMSLOTBUCKETS];        // entries, by slot offset
+   scheduleEntry_t* neighborBucket[SCHEDULE_NUMNEIGHBORBUCKETS];// entries, by neighbor
+   frameLength_t    numActiveSlots;                             // entries not in the free list
+   scheduleSlotframe_t slotframes[SCHEDULE_MAXSLOTFRAMES];      // the first one is the default slotframe
+   frameLength_t    hyperframeLength;                           // least common multiple of the slotframe lengths
+   slotOffset_t     hyperSlotOffset;                            // current slot, in the hyperframe
    frameLength_t    maxActiveSlots;
-   uint8_t          frameHandle;
    uint8_t          frameNumber;
    uint8_t          backoffExponent;
    uint8_t          backoff;
@@ -140,6 +187,8 @@ bool               debugPrint_backoff(void);
 void               schedule_setFrameLength(frameLength_t newFrameLength);
 void               schedule_setFrameHandle(uint8_t frameHandle);
 void               schedule_setFrameNumber(uint8_t frameNumber);
+owerror_t          schedule_addSlotframe(uint8_t slotframeHandle, frameLength_t length);
+owerror_t          schedule_removeSlotframe(uint8_t slotframeHandle);
 owerror_t          schedule_addActiveSlot(
    slotOffset_t         slotOffset,
    cellType_t           type,
@@ -148,6 +197,15 @@ owerror_t          schedule_addActiveSlot(
    open_addr_t*         neighbor
 );
 
+owerror_t          schedule_addActiveSlotToSlotframe(
+   uint8_t              slotframeHandle,
+   slotOffset_t         slotOffset,
+   cellType_t           type,
+   bool                 shared,
+   uint8_t              channelOffset,
+   open_addr_t*         neighbor
+);
+
 void               schedule_getSlotInfo(
    slotOffset_t         slotOffset,                      
    open_addr_t*         neighbor,
@@ -160,25 +218,36 @@ owerror_t          schedule_removeActiveSlot(
    slotOffset_t         slotOffset,
    open_addr_t*         neighbor
 );
+owerror_t          schedule_removeActiveSlotFromSlotframe(
+   uint8_t              slotframeHandle,
+   slotOffset_t         slotOffset,
+   open_addr_t*         neighbor
+);
 bool               schedule_isSlotOffsetAvailable(uint16_t slotOffset);
-// return the slot info which has a poor quality
+// return the cell with the poorest quality, if it is poor enough to be relocated
 scheduleEntry_t*  schedule_statistic_poorLinkQuality(void);
 uint16_t          schedule_getCellsCounts(
     uint8_t frameID,
     cellType_t type,
     open_addr_t* neighbor
 );
+uint16_t          schedule_getTxUsage(
+   open_addr_t*   neighbor,
+   uint16_t*      numTx
+);
 void              schedule_removeAllCells(
    uint8_t        slotframeID,
    open_addr_t*   previousHop
 );
 scheduleEntry_t*  schedule_getCurrentScheduleEntry();
+scheduleEntry_t*  schedule_getSlotframeEntry(uint8_t slotframeHandle);
 
 // from IEEE802154E
 void               schedule_syncSlotOffset(slotOffset_t targetSlotOffset);
 void               schedule_advanceSlot(void);
 slotOffset_t       schedule_getNextActiveSlotOffset(void);
 frameLength_t      schedule_getFrameLength(void);
+frameLength_t      schedule_getHyperframeLength(void);
 uint8_t            schedule_getFrameHandle(void);
 uint8_t            schedule_getFrameNumber(void);
 cellType_t         schedule_getType(void);
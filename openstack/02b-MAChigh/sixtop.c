@@ -101,10 +101,30 @@ bool sixtop_areAvailableCellsToBeRemoved(
     cellInfo_ht* cellList,
     open_addr_t* neighbor
 );
+sixtop_transaction_t* sixtop_getTransaction(
+   open_addr_t*         neighbor
+);
+sixtop_transaction_t* sixtop_newTransaction(
+   open_addr_t*         neighbor
+);
+void          sixtop_endTransaction(
+   sixtop_transaction_t* transaction
+);
+void          sixtop_armTimeout(
+   sixtop_transaction_t* transaction
+);
+void          sixtop_reserveCells(
+   sixtop_transaction_t* transaction,
+   cellInfo_ht*         cellList
+);
+bool          sixtop_isSlotOffsetReserved(
+   uint16_t             slotOffset
+);
 
 //=========================== public ==========================================
 
 void sixtop_init() {
+   uint8_t i;
    
    sixtop_vars.periodMaintenance  = 872 +(openrandom_get16b()&0xff);
    sixtop_vars.busySendingKA      = FALSE;
@@ -114,6 +134,10 @@ void sixtop_init() {
    sixtop_vars.kaPeriod           = MAXKAPERIOD;
    sixtop_vars.ebPeriod           = EBPERIOD;
    sixtop_vars.isResponseEnabled  = TRUE;
+   sixtop_vars.handler            = SIX_HANDLER_NONE;
+   for (i=0;i<SIXTOP_MAXTRANSACTIONS;i++) {
+      sixtop_endTransaction(&(sixtop_vars.transactions[i]));
+   }
    
    sixtop_vars.maintenanceTimerId = opentimers_start(
       sixtop_vars.periodMaintenance,
@@ -122,10 +146,9 @@ void sixtop_init() {
       sixtop_maintenance_timer_cb
    );
    
-   sixtop_vars.timeoutTimerId     = opentimers_start(
-      SIX2SIX_TIMEOUT_MS,
-      TIMER_ONESHOT,
-      TIME_MS,
+   opentimers_tickerInit(
+      &sixtop_vars.timeoutTicker,
+      SIX2SIX_TIMEOUT_TICK_MS,
       sixtop_timeout_timer_cb
    );
 }
@@ -150,50 +173,89 @@ void sixtop_setHandler(six2six_handler_t handler) {
     sixtop_vars.handler = handler;
 }
 
+/**
+\brief Indicate whether a 6P transaction can be started with a neighbor.
+
+\param[in] neighbor The neighbor to negotiate cells with.
+
+\returns TRUE if no 6P transaction is ongoing with that neighbor and a
+   transaction entry is free, FALSE otherwise.
+*/
+bool sixtop_isIdle(open_addr_t* neighbor) {
+    uint8_t i;
+    bool    isFree;
+    
+    isFree = FALSE;
+    for (i=0;i<SIXTOP_MAXTRANSACTIONS;i++){
+        if (sixtop_vars.transactions[i].state==SIX_IDLE){
+            isFree = TRUE;
+        } else {
+            if (packetfunctions_sameAddress(&(sixtop_vars.transactions[i].neighbor),neighbor)){
+                return FALSE;
+            }
+        }
+    }
+    return isFree;
+}
+
 //======= scheduling
 
-void sixtop_request(uint8_t code, open_addr_t* neighbor, uint8_t numCells){
-    OpenQueueEntry_t* pkt;
-    uint8_t           len;
-    uint8_t           container;
-    uint8_t           frameID;
-    cellInfo_ht       cellList[SCHEDULEIEMAXNUMCELLS];
+/**
+\brief Start a 6P transaction with a neighbor.
+
+Transactions with different neighbors run in parallel. The candidate cells
+offered in an ADD request are reserved until the transaction ends, so they are
+not offered to, or accepted from, another neighbor meanwhile.
+
+The handler set by sixtop_setHandler() is used by this request only.
+
+\returns E_SUCCESS if the request was sent, E_FAIL otherwise.
+*/
+owerror_t sixtop_request(uint8_t code, open_addr_t* neighbor, uint8_t numCells){
+    OpenQueueEntry_t*     pkt;
+    uint8_t               len;
+    uint8_t               container;
+    uint8_t               frameID;
+    cellInfo_ht           cellList[SCHEDULEIEMAXNUMCELLS];
+    sixtop_transaction_t* transaction;
    
     memset(cellList,0,sizeof(cellList));
    
     // filter parameters
-    if(sixtop_vars.six2six_state!=SIX_IDLE){
-        return;
-    }
     if (neighbor==NULL){
-        return;
+        return E_FAIL;
     }
    
     if (sixtop_vars.handler == SIX_HANDLER_NONE) {
         // sxitop handler must not be NONE
-        return;
+        return E_FAIL;
+    }
+    
+    // one transaction at a time with a given neighbor
+    transaction = sixtop_newTransaction(neighbor);
+    if (transaction==NULL){
+        return E_FAIL;
     }
    
     // generate candidate cell list
+    frameID = schedule_getFrameHandle();
     if (code == IANA_6TOP_CMD_ADD){
         if (sixtop_candidateAddCellList(&frameID,cellList,numCells)==FALSE){
-              return;
-        } else{
-            // container to be define by SF, currently equals to frameID
-            container  = frameID;
+            sixtop_endTransaction(transaction);
+            return E_FAIL;
         }
     }
     if (code == IANA_6TOP_CMD_DELETE){
         if (sixtop_candidateRemoveCellList(&frameID,cellList,neighbor,numCells)==FALSE){
-              return;
-        } else{
-            // container to be define by SF, currently equals to frameID
-            container  = frameID;
+            sixtop_endTransaction(transaction);
+            return E_FAIL;
         }
     }
+    // container to be define by SF, currently equals to frameID
+    container  = frameID;
     
     // get a free packet buffer
-    pkt = openqueue_getFreePacketBuffer(COMPONENT_SIXTOP_RES);
+    pkt = openqueue_getFreePacketBufferForLength(COMPONENT_SIXTOP_RES,SIXTOP_IE_MAXLEN);
     if (pkt==NULL) {
         openserial_printError(
             COMPONENT_SIXTOP_RES,
@@ -201,11 +263,17 @@ void sixtop_request(uint8_t code, open_addr_t* neighbor, uint8_t numCells){
             (errorparameter_t)0,
             (errorparameter_t)0
         );
-        return;
+        sixtop_endTransaction(transaction);
+        return E_FAIL;
     }
    
-    // update state
-    sixtop_vars.six2six_state  = SIX_SENDING_REQUEST;
+    // the handler is consumed by this transaction
+    transaction->handler = sixtop_vars.handler;
+    transaction->command = code;
+    sixtop_vars.handler  = SIX_HANDLER_NONE;
+    if (code == IANA_6TOP_CMD_ADD){
+        sixtop_reserveCells(transaction,cellList);
+    }
    
     // take ownership
     pkt->creator = COMPONENT_SIXTOP_RES;
@@ -215,7 +283,7 @@ void sixtop_request(uint8_t code, open_addr_t* neighbor, uint8_t numCells){
    
     // create packet
     len  = 0;
-    if (code == IANA_6TOP_CMD_ADD || IANA_6TOP_CMD_DELETE){
+    if (code == IANA_6TOP_CMD_ADD || code == IANA_6TOP_CMD_DELETE){
         len += processIE_prepend_sixCelllist(pkt,cellList);
         // reserve space for container
         packetfunctions_reserveHeaderSize(pkt,sizeof(uint8_t));
@@ -244,64 +312,66 @@ void sixtop_request(uint8_t code, open_addr_t* neighbor, uint8_t numCells){
    
     // send packet
     sixtop_send(pkt);
+    transaction->pkt = pkt;
     
     //update states
     switch(code){
     case IANA_6TOP_CMD_ADD:
-        sixtop_vars.six2six_state = SIX_WAIT_ADDREQUEST_SENDDONE;
+        transaction->state = SIX_WAIT_ADDREQUEST_SENDDONE;
         break;
     case IANA_6TOP_CMD_DELETE:
-        sixtop_vars.six2six_state = SIX_WAIT_DELETEREQUEST_SENDDONE;
+        transaction->state = SIX_WAIT_DELETEREQUEST_SENDDONE;
         break;
     case IANA_6TOP_CMD_COUNT:
-        sixtop_vars.six2six_state = SIX_WAIT_COUNTREQUEST_SENDDONE;
+        transaction->state = SIX_WAIT_COUNTREQUEST_SENDDONE;
         break;
     case IANA_6TOP_CMD_LIST:
-        sixtop_vars.six2six_state = SIX_WAIT_LISTREQUEST_SENDDONE;
+        transaction->state = SIX_WAIT_LISTREQUEST_SENDDONE;
         break;
     case IANA_6TOP_CMD_CLEAR:
-        sixtop_vars.six2six_state = SIX_WAIT_CLEARREQUEST_SENDDONE;
+        transaction->state = SIX_WAIT_CLEARREQUEST_SENDDONE;
         break;
     }
    
     // arm timeout
-    opentimers_setPeriod(
-        sixtop_vars.timeoutTimerId,
-        TIME_MS,
-        SIX2SIX_TIMEOUT_MS
-    );
-    opentimers_restart(sixtop_vars.timeoutTimerId);
+    sixtop_armTimeout(transaction);
+    
+    return E_SUCCESS;
 }
 
-void sixtop_addORremoveCellByInfo(uint8_t code,open_addr_t* neighbor,cellInfo_ht* cellInfo){
-    OpenQueueEntry_t* pkt;
-    uint8_t           len;
-    uint8_t           frameID;
-    uint8_t           container;
-    cellInfo_ht       cellList[SCHEDULEIEMAXNUMCELLS];
+owerror_t sixtop_addORremoveCellByInfo(uint8_t code,open_addr_t* neighbor,cellInfo_ht* cellInfo){
+    OpenQueueEntry_t*     pkt;
+    uint8_t               len;
+    uint8_t               frameID;
+    uint8_t               container;
+    cellInfo_ht           cellList[SCHEDULEIEMAXNUMCELLS];
+    sixtop_transaction_t* transaction;
    
     memset(cellList,0,sizeof(cellList));
    
     // filter parameters
-    if (sixtop_vars.six2six_state!=SIX_IDLE){
-        return;
-    }
     if (neighbor==NULL){
-        return;
+        return E_FAIL;
     }
     if (sixtop_vars.handler == SIX_HANDLER_NONE) {
         // sixtop handler must not be NONE
-        return;
+        return E_FAIL;
+    }
+    
+    // one transaction at a time with a given neighbor
+    transaction = sixtop_newTransaction(neighbor);
+    if (transaction==NULL){
+        return E_FAIL;
     }
    
     // set cell list (only first one is to be removed)
     frameID        = SCHEDULE_MINIMAL_6TISCH_DEFAULT_SLOTFRAME_HANDLE;
     container      = frameID;
-    memcpy(&(cellList[0]),cellInfo,sizeof(cellList));
+    memcpy(&(cellList[0]),cellInfo,sizeof(cellInfo_ht));
    
    
     // get a free packet buffer
-    pkt = openqueue_getFreePacketBuffer(COMPONENT_SIXTOP_RES);
+    pkt = openqueue_getFreePacketBufferForLength(COMPONENT_SIXTOP_RES,SIXTOP_IE_MAXLEN);
     if(pkt==NULL) {
         openserial_printError(
             COMPONENT_SIXTOP_RES,
@@ -309,11 +379,17 @@ void sixtop_addORremoveCellByInfo(uint8_t code,open_addr_t* neighbor,cellInfo_ht
             (errorparameter_t)0,
             (errorparameter_t)0
         );
-        return;
+        sixtop_endTransaction(transaction);
+        return E_FAIL;
     }
    
-    // update state
-    sixtop_vars.six2six_state = SIX_SENDING_REQUEST;
+    // the handler is consumed by this transaction
+    transaction->handler = sixtop_vars.handler;
+    transaction->command = code;
+    sixtop_vars.handler  = SIX_HANDLER_NONE;
+    if (code == IANA_6TOP_CMD_ADD){
+        sixtop_reserveCells(transaction,cellList);
+    }
    
     // declare ownership over that packet
     pkt->creator = COMPONENT_SIXTOP_RES;
@@ -343,24 +419,22 @@ void sixtop_addORremoveCellByInfo(uint8_t code,open_addr_t* neighbor,cellInfo_ht
    
     // send packet
     sixtop_send(pkt);
+    transaction->pkt = pkt;
    
     //update states
     switch(code){
     case IANA_6TOP_CMD_ADD:
-        sixtop_vars.six2six_state = SIX_WAIT_ADDREQUEST_SENDDONE;
+        transaction->state = SIX_WAIT_ADDREQUEST_SENDDONE;
         break;
     case IANA_6TOP_CMD_DELETE:
-        sixtop_vars.six2six_state = SIX_WAIT_DELETEREQUEST_SENDDONE;
+        transaction->state = SIX_WAIT_DELETEREQUEST_SENDDONE;
         break;
     }
    
-   // arm timeout
-   opentimers_setPeriod(
-      sixtop_vars.timeoutTimerId,
-      TIME_MS,
-      SIX2SIX_TIMEOUT_MS
-   );
-   opentimers_restart(sixtop_vars.timeoutTimerId);
+    // arm timeout
+    sixtop_armTimeout(transaction);
+    
+    return E_SUCCESS;
 }
 
 //======= maintaning 
@@ -373,7 +447,10 @@ void sixtop_maintaining(uint16_t slotOffset,open_addr_t* neighbor){
         linkInfo.choffset    = info.channelOffset;
         linkInfo.linkoptions = info.link_type;
         sixtop_vars.handler  = SIX_HANDLER_MAINTAIN;
-        sixtop_addORremoveCellByInfo(IANA_6TOP_CMD_DELETE,neighbor, &linkInfo);
+        if (sixtop_addORremoveCellByInfo(IANA_6TOP_CMD_DELETE,neighbor, &linkInfo)==E_FAIL) {
+            // no request sent, do not block the following ones
+            sixtop_vars.handler = SIX_HANDLER_NONE;
+        }
     } else {
         //should log this error
         
@@ -394,6 +471,17 @@ owerror_t sixtop_send(OpenQueueEntry_t *msg) {
    msg->l2_securityLevel   = IEEE802154_SECURITY_LEVEL;
    msg->l2_keyIdMode       = IEEE802154_SECURITY_KEYIDMODE; 
    msg->l2_keyIndex        = IEEE802154_SECURITY_K2_KEY_INDEX;
+   
+   // do not let a single next hop take all the buffers
+   if (openqueue_sixtopCanEnqueue(msg)==FALSE) {
+      openserial_printError(
+         COMPONENT_SIXTOP,
+         ERR_NEIGHBOR_QUEUE_FULL,
+         (errorparameter_t)msg->creator,
+         (errorparameter_t)OPENQUEUE_MAXPERNEIGHBOR
+      );
+      return E_FAIL;
+   }
 
    if (msg->l2_payloadIEpresent == FALSE) {
       return sixtop_send_internal(
@@ -426,10 +514,13 @@ void task_sixtopNotifSendDone() {
    }
    
    // take ownership
-   msg->owner = COMPONENT_SIXTOP;
+   openqueue_changeOwner(msg,COMPONENT_SIXTOP);
    
-   // update neighbor statistics
-   if (msg->l2_sendDoneError==E_SUCCESS) {
+   // update neighbor statistics, unless the packet was dropped from the queue
+   // before the MAC tried to send it
+   if (msg->l2_numTxAttempts==0) {
+      // nothing to record
+   } else if (msg->l2_sendDoneError==E_SUCCESS) {
       neighbors_indicateTx(
          &(msg->l2_nextORpreviousHop),
          msg->l2_numTxAttempts,
@@ -499,7 +590,7 @@ void task_sixtopNotifReceive() {
     }
    
     // take ownership
-    msg->owner = COMPONENT_SIXTOP;
+    openqueue_changeOwner(msg,COMPONENT_SIXTOP);
    
     // process the header IEs
     lenIE=0;
@@ -645,7 +736,7 @@ owerror_t sixtop_send_internal(
                             &(msg->l2_nextORpreviousHop)
                             );
    // change owner to IEEE802154E fetches it from queue
-   msg->owner  = COMPONENT_SIXTOP_TO_IEEE802154E;
+   openqueue_changeOwner(msg,COMPONENT_SIXTOP_TO_IEEE802154E);
    return E_SUCCESS;
 }
 
@@ -667,10 +758,20 @@ void sixtop_timeout_timer_cb(opentimer_id_t id) {
 This function is called in task context by the scheduler after the RES timer
 has fired. This timer is set to fire every second, on average.
 
-The body of this function executes one of the MAC management task.
+The body of this function drops the stale packets from the queue, then executes
+one of the MAC management task.
 */
 void timer_sixtop_management_fired(void) {
    scheduleEntry_t* entry;
+   uint8_t          numStale;
+   
+   // give the packets which waited too long for the MAC back to their creator
+   numStale = openqueue_sixtopDropStale();
+   while (numStale>0) {
+      task_sixtopNotifSendDone();
+      numStale--;
+   }
+   
    sixtop_vars.mgtTaskCounter = (sixtop_vars.mgtTaskCounter+1)%sixtop_vars.ebPeriod;
    
    switch (sixtop_vars.mgtTaskCounter) {
@@ -814,7 +915,7 @@ port_INLINE void sixtop_sendKA() {
    // if I get here, I will send a KA
    
    // get a free packet buffer
-   kaPkt = openqueue_getFreePacketBuffer(COMPONENT_SIXTOP);
+   kaPkt = openqueue_getFreePacketBufferForLength(COMPONENT_SIXTOP,0);
    if (kaPkt==NULL) {
       openserial_printError(COMPONENT_SIXTOP,ERR_NO_FREE_PACKET_BUFFER,
                             (errorparameter_t)1,
@@ -850,44 +951,79 @@ port_INLINE void sixtop_sendKA() {
 //======= six2six task
 
 void timer_sixtop_six2six_timeout_fired(void) {
-   // timeout timer fired, reset the state of sixtop to idle
-   sixtop_vars.six2six_state = SIX_IDLE;
-   sixtop_vars.handler = SIX_HANDLER_NONE;
-   opentimers_stop(sixtop_vars.timeoutTimerId);
+   uint8_t i;
+   bool    isOngoing;
+   
+   // abort the transactions which have not completed in time
+   isOngoing = FALSE;
+   for (i=0;i<SIXTOP_MAXTRANSACTIONS;i++){
+      if (sixtop_vars.transactions[i].state==SIX_IDLE){
+         continue;
+      }
+      if (sixtop_vars.transactions[i].timeoutTicks>0){
+         sixtop_vars.transactions[i].timeoutTicks--;
+      }
+      if (sixtop_vars.transactions[i].timeoutTicks==0){
+         sixtop_endTransaction(&(sixtop_vars.transactions[i]));
+      } else {
+         isOngoing = TRUE;
+      }
+   }
+   
+   opentimers_tickerContinue(&sixtop_vars.timeoutTicker,isOngoing);
 }
 
 void sixtop_six2six_sendDone(OpenQueueEntry_t* msg, owerror_t error){
    uint8_t i,numOfCells;
    uint8_t* ptr;
    cellInfo_ht cellList[SCHEDULEIEMAXNUMCELLS];
+   sixtop_transaction_t* transaction;
    
    memset(cellList,0,SCHEDULEIEMAXNUMCELLS*sizeof(cellInfo_ht));
   
    ptr = msg->l2_sixtop_cellObjects;
    numOfCells = msg->l2_sixtop_numOfCells;
    msg->owner = COMPONENT_SIXTOP_RES;
+   
+   // find the transaction this packet belongs to
+   transaction = NULL;
+   for (i=0;i<SIXTOP_MAXTRANSACTIONS;i++){
+      if (
+         sixtop_vars.transactions[i].state!=SIX_IDLE &&
+         sixtop_vars.transactions[i].pkt==msg
+      ){
+         transaction = &(sixtop_vars.transactions[i]);
+         break;
+      }
+   }
+   if (transaction==NULL){
+      // BUSY response, or the transaction has already ended
+      openqueue_freePacketBuffer(msg);
+      return;
+   }
+   transaction->pkt = NULL;
   
    if(error == E_FAIL) {
-      sixtop_vars.six2six_state = SIX_IDLE;
+      sixtop_endTransaction(transaction);
       openqueue_freePacketBuffer(msg);
       return;
    }
 
-    switch (sixtop_vars.six2six_state) {
+    switch (transaction->state) {
     case SIX_WAIT_ADDREQUEST_SENDDONE:
-        sixtop_vars.six2six_state = SIX_WAIT_ADDRESPONSE;
+        transaction->state = SIX_WAIT_ADDRESPONSE;
         break;
     case SIX_WAIT_DELETEREQUEST_SENDDONE:
-        sixtop_vars.six2six_state = SIX_WAIT_DELETERESPONSE;
+        transaction->state = SIX_WAIT_DELETERESPONSE;
         break;
     case SIX_WAIT_LISTREQUEST_SENDDONE:
-        sixtop_vars.six2six_state = SIX_WAIT_LISTRESPONSE;
+        transaction->state = SIX_WAIT_LISTRESPONSE;
         break;
     case SIX_WAIT_COUNTREQUEST_SENDDONE:
-        sixtop_vars.six2six_state = SIX_WAIT_COUNTRESPONSE;
+        transaction->state = SIX_WAIT_COUNTRESPONSE;
         break;
     case SIX_WAIT_CLEARREQUEST_SENDDONE:
-        sixtop_vars.six2six_state = SIX_WAIT_CLEARRESPONSE;
+        transaction->state = SIX_WAIT_CLEARRESPONSE;
         break;
     case SIX_WAIT_RESPONSE_SENDDONE:
         if (msg->l2_sixtop_returnCode == IANA_6TOP_RC_SUCCESS && error == E_SUCCESS){
@@ -912,7 +1048,7 @@ void sixtop_six2six_sendDone(OpenQueueEntry_t* msg, owerror_t error){
                               msg->l2_sixtop_frameID,
                               cellList,
                               &(msg->l2_nextORpreviousHop),
-                              sixtop_vars.six2six_state);
+                              transaction->state);
                     } else {
                           sixtop_removeCellsByState(
                               msg->l2_sixtop_frameID,
@@ -929,23 +1065,11 @@ void sixtop_six2six_sendDone(OpenQueueEntry_t* msg, owerror_t error){
             }
         }
         
-        sixtop_vars.six2six_state = SIX_IDLE;
-        sixtop_vars.handler = SIX_HANDLER_NONE;
-        opentimers_stop(sixtop_vars.timeoutTimerId);
-       
-        if (sixtop_vars.handler == SIX_HANDLER_MAINTAIN){
-            sixtop_request(
-                IANA_6TOP_CMD_DELETE,
-                &(msg->l2_nextORpreviousHop),
-                1
-            );
-            sixtop_request(IANA_6TOP_CMD_ADD,&(msg->l2_nextORpreviousHop),1);
-            sixtop_vars.handler = SIX_HANDLER_NONE;
-        }
+        sixtop_endTransaction(transaction);
         break;
     default:
         //log error
-        sixtop_vars.six2six_state = SIX_IDLE;
+        sixtop_endTransaction(transaction);
         break;
     }
   
@@ -1073,196 +1197,228 @@ void sixtop_notifyReceiveCommand(
     uint8_t           length,
     OpenQueueEntry_t* pkt
 ){
-    uint8_t           code;
-    uint8_t           frameID;
-    uint8_t           numOfCells;
-    uint16_t          count;
-    cellInfo_ht       cellList[SCHEDULEIEMAXNUMCELLS];
-    OpenQueueEntry_t* response_pkt;
-    uint8_t           len = 0;
-    uint8_t           container;
+    uint8_t               code;
+    uint8_t               frameID;
+    uint8_t               numOfCells;
+    uint16_t              count;
+    cellInfo_ht           cellList[SCHEDULEIEMAXNUMCELLS];
+    OpenQueueEntry_t*     response_pkt;
+    uint8_t               len = 0;
+    uint8_t               container;
+    sixtop_transaction_t* transaction;
+    six2six_handler_t     handler;
     
     memset(cellList,0,sizeof(cellList));
     
-    // get a free packet buffer
-    response_pkt = openqueue_getFreePacketBuffer(COMPONENT_SIXTOP_RES);
-    if (response_pkt==NULL) {
-        openserial_printError(
-            COMPONENT_SIXTOP_RES,
-            ERR_NO_FREE_PACKET_BUFFER,
-            (errorparameter_t)0,
-            (errorparameter_t)0
-        );
+    //===== if the version or sfID are correct
+    if (version != IANA_6TOP_6P_VERSION || sfId != SFID_SF0){
+        // drop the message
         return;
     }
-   
-    // take ownership
-    response_pkt->creator = COMPONENT_SIXTOP_RES;
-    response_pkt->owner   = COMPONENT_SIXTOP_RES;
     
-    memcpy(&(response_pkt->l2_nextORpreviousHop),
-           &(pkt->l2_nextORpreviousHop),
-           sizeof(open_addr_t)
-    );
-    
-    //===== if the version or sfID are correct
-    if (version != IANA_6TOP_6P_VERSION || sfId != SFID_SF0){
-        if (version != IANA_6TOP_6P_VERSION){
-            code = IANA_6TOP_RC_VER_ERR;
-        } else {
-            code = IANA_6TOP_RC_SFID_ERR;
+    //====== the version and sfID are correct
+    //------ if this is a command
+    if (
+        commandIdORcode == IANA_6TOP_CMD_ADD    ||
+        commandIdORcode == IANA_6TOP_CMD_DELETE ||
+        commandIdORcode == IANA_6TOP_CMD_COUNT  ||
+        commandIdORcode == IANA_6TOP_CMD_LIST   ||
+        commandIdORcode == IANA_6TOP_CMD_CLEAR
+    ){
+        // get a free packet buffer
+        response_pkt = openqueue_getFreePacketBufferForLength(COMPONENT_SIXTOP_RES,SIXTOP_IE_MAXLEN);
+        if (response_pkt==NULL) {
+            openserial_printError(
+                COMPONENT_SIXTOP_RES,
+                ERR_NO_FREE_PACKET_BUFFER,
+                (errorparameter_t)0,
+                (errorparameter_t)0
+            );
+            return;
         }
-    } else {
-        //====== the version and sfID are correct
-        //------ if this is a command
-        if (
-            commandIdORcode == IANA_6TOP_CMD_ADD    ||
-            commandIdORcode == IANA_6TOP_CMD_DELETE ||
-            commandIdORcode == IANA_6TOP_CMD_COUNT  ||
-            commandIdORcode == IANA_6TOP_CMD_LIST   ||
-            commandIdORcode == IANA_6TOP_CMD_CLEAR
-        ){
-            // if I am already in a 6top transactions
-            if (sixtop_vars.six2six_state != SIX_IDLE){
-                code = IANA_6TOP_RC_ERR;
-            } else {
-                sixtop_vars.six2six_state = SIX_REQUEST_RECEIVED;
-
-                switch(commandIdORcode){
-                case IANA_6TOP_CMD_ADD: 
-                case IANA_6TOP_CMD_DELETE:
-                    numOfCells = *((uint8_t*)(pkt->payload)+ptr);
-                    container  = *((uint8_t*)(pkt->payload)+ptr+1);
-                    frameID = container;
-                    processIE_retrieve_sixCelllist(pkt,ptr+2,length-2,cellList);
-                    if (
-                        (
-                          commandIdORcode == IANA_6TOP_CMD_ADD &&
-                          sixtop_areAvailableCellsToBeScheduled(frameID,numOfCells,cellList)
-                        ) ||
-                       (
-                          commandIdORcode == IANA_6TOP_CMD_DELETE &&
-                          sixtop_areAvailableCellsToBeRemoved(frameID,numOfCells,cellList,&(pkt->l2_nextORpreviousHop))
-                       )
-                    ){
-                        code = IANA_6TOP_RC_SUCCESS;
-                        len += processIE_prepend_sixCelllist(response_pkt,cellList);
-                    } else {
-                        code = IANA_6TOP_RC_RESET;
-                    }
-                    break;
-                case IANA_6TOP_CMD_COUNT:
-                    container  = *((uint8_t*)(pkt->payload)+ptr);
-                    frameID = container;
-                    count = schedule_getCellsCounts(frameID,
-                                                    CELLTYPE_RX,
-                                                    &(pkt->l2_nextORpreviousHop));
-                    code = IANA_6TOP_RC_SUCCESS;
-                    packetfunctions_reserveHeaderSize(response_pkt,2);
-                    response_pkt->payload[0] = count      & 0xFF;
-                    response_pkt->payload[1] = (count>>8) & 0xFF;
-                    len = 2;
-                    break;
-                case IANA_6TOP_CMD_LIST:
-                    container  = *((uint8_t*)(pkt->payload)+ptr);
-                    frameID = container;
-                    numOfCells = sixtop_getCelllist(frameID,
-                                         &(pkt->l2_nextORpreviousHop),
-                                         cellList);
+       
+        // take ownership
+        response_pkt->creator = COMPONENT_SIXTOP_RES;
+        response_pkt->owner   = COMPONENT_SIXTOP_RES;
+        
+        memcpy(&(response_pkt->l2_nextORpreviousHop),
+               &(pkt->l2_nextORpreviousHop),
+               sizeof(open_addr_t)
+        );
+        
+        frameID     = schedule_getFrameHandle();
+        
+        // if I am already in a 6top transaction with that neighbor, or in
+        // too many transactions
+        transaction = sixtop_newTransaction(&(pkt->l2_nextORpreviousHop));
+        if (transaction==NULL){
+            code = IANA_6TOP_RC_BUSY;
+        } else {
+            transaction->state   = SIX_REQUEST_RECEIVED;
+            transaction->command = commandIdORcode;
+            
+            switch(commandIdORcode){
+            case IANA_6TOP_CMD_ADD: 
+            case IANA_6TOP_CMD_DELETE:
+                numOfCells = *((uint8_t*)(pkt->payload)+ptr);
+                container  = *((uint8_t*)(pkt->payload)+ptr+1);
+                frameID = container;
+                processIE_retrieve_sixCelllist(pkt,ptr+2,length-2,cellList);
+                if (
+                    (
+                      commandIdORcode == IANA_6TOP_CMD_ADD &&
+                      sixtop_areAvailableCellsToBeScheduled(frameID,numOfCells,cellList)
+                    ) ||
+                   (
+                      commandIdORcode == IANA_6TOP_CMD_DELETE &&
+                      sixtop_areAvailableCellsToBeRemoved(frameID,numOfCells,cellList,&(pkt->l2_nextORpreviousHop))
+                   )
+                ){
                     code = IANA_6TOP_RC_SUCCESS;
-                    if (numOfCells>0){
-                        len += processIE_prepend_sixCelllist(response_pkt,cellList);
+                    len += processIE_prepend_sixCelllist(response_pkt,cellList);
+                    if (commandIdORcode == IANA_6TOP_CMD_ADD){
+                        // until the response is sent
+                        sixtop_reserveCells(transaction,cellList);
                     }
-                    break;
-                case IANA_6TOP_CMD_CLEAR:
-                    container  = *((uint8_t*)(pkt->payload)+ptr);
-                    frameID = container;
-                    schedule_removeAllCells(frameID,
-                                            &(pkt->l2_nextORpreviousHop));
-                    code = IANA_6TOP_RC_SUCCESS;
-                    break;
+                } else {
+                    code = IANA_6TOP_RC_RESET;
                 }
+                break;
+            case IANA_6TOP_CMD_COUNT:
+                container  = *((uint8_t*)(pkt->payload)+ptr);
+                frameID = container;
+                count = schedule_getCellsCounts(frameID,
+                                                CELLTYPE_RX,
+                                                &(pkt->l2_nextORpreviousHop));
+                code = IANA_6TOP_RC_SUCCESS;
+                packetfunctions_reserveHeaderSize(response_pkt,2);
+                response_pkt->payload[0] = count      & 0xFF;
+                response_pkt->payload[1] = (count>>8) & 0xFF;
+                len = 2;
+                break;
+            case IANA_6TOP_CMD_LIST:
+                container  = *((uint8_t*)(pkt->payload)+ptr);
+                frameID = container;
+                numOfCells = sixtop_getCelllist(frameID,
+                                     &(pkt->l2_nextORpreviousHop),
+                                     cellList);
+                code = IANA_6TOP_RC_SUCCESS;
+                if (numOfCells>0){
+                    len += processIE_prepend_sixCelllist(response_pkt,cellList);
+                }
+                break;
+            case IANA_6TOP_CMD_CLEAR:
+                container  = *((uint8_t*)(pkt->payload)+ptr);
+                frameID = container;
+                schedule_removeAllCells(frameID,
+                                        &(pkt->l2_nextORpreviousHop));
+                code = IANA_6TOP_RC_SUCCESS;
+                break;
             }
-            response_pkt->l2_sixtop_requestCommand = commandIdORcode;
-            response_pkt->l2_sixtop_frameID        = frameID;
-            
-            len += processIE_prepend_sixGeneralMessage(response_pkt,code);
-            len += processIE_prepend_sixSubID(response_pkt);
-            processIE_prepend_sixtopIE(response_pkt,len);
-            // indicate IEs present
-            response_pkt->l2_payloadIEpresent = TRUE;
-            if (sixtop_vars.isResponseEnabled){
-                // send packet
-                sixtop_send(response_pkt);
-            }
+        }
+        response_pkt->l2_sixtop_requestCommand = commandIdORcode;
+        response_pkt->l2_sixtop_frameID        = frameID;
+        
+        len += processIE_prepend_sixGeneralMessage(response_pkt,code);
+        len += processIE_prepend_sixSubID(response_pkt);
+        processIE_prepend_sixtopIE(response_pkt,len);
+        // indicate IEs present
+        response_pkt->l2_payloadIEpresent = TRUE;
+        if (sixtop_vars.isResponseEnabled){
+            // send packet
+            sixtop_send(response_pkt);
+        } else {
+            openqueue_freePacketBuffer(response_pkt);
+            response_pkt = NULL;
+        }
+        if (transaction!=NULL){
             // update state
-            sixtop_vars.six2six_state = SIX_WAIT_RESPONSE_SENDDONE;
+            transaction->state = SIX_WAIT_RESPONSE_SENDDONE;
+            transaction->pkt   = response_pkt;
             // arm timeout
-            opentimers_setPeriod(
-                sixtop_vars.timeoutTimerId,
-                TIME_MS,
-                SIX2SIX_TIMEOUT_MS
-            );
-            opentimers_restart(sixtop_vars.timeoutTimerId);
-        } else {
-            //------ if this is a return code
-            // if the code is SUCCESS
-            if (commandIdORcode==IANA_6TOP_RC_SUCCESS){
-                switch(sixtop_vars.six2six_state){
-                case SIX_WAIT_ADDRESPONSE:
-                case SIX_WAIT_DELETERESPONSE:
-                    processIE_retrieve_sixCelllist(pkt,ptr,length,cellList);
-                    // always default frameID
-                    frameID = SCHEDULE_MINIMAL_6TISCH_DEFAULT_SLOTFRAME_HANDLE;
-                    if (sixtop_vars.six2six_state == SIX_WAIT_ADDRESPONSE){
-                        sixtop_addCellsByState(frameID,
-                                              cellList,
-                                              &(pkt->l2_nextORpreviousHop),
-                                              sixtop_vars.six2six_state
-                        );
-                    } else {
-                        sixtop_removeCellsByState(
-                              frameID,
-                              cellList,
-                              &(pkt->l2_nextORpreviousHop));
-                    }
-                    break;
-                case SIX_WAIT_COUNTRESPONSE:
-                    count  = *((uint8_t*)(pkt->payload)+ptr);
-                    ptr += 1;
-                    count |= (*((uint8_t*)(pkt->payload)+ptr))<<8;
+            sixtop_armTimeout(transaction);
+        }
+    } else {
+        //------ if this is a return code
+        // find the request it answers, the response can be received before
+        // the sendDone of the request is handled
+        transaction = sixtop_getTransaction(&(pkt->l2_nextORpreviousHop));
+        if (
+            transaction==NULL                                ||
+            transaction->state==SIX_REQUEST_RECEIVED         ||
+            transaction->state==SIX_WAIT_RESPONSE_SENDDONE
+        ){
+            // no request of mine is waiting for this response
+            return;
+        }
+        // if the code is SUCCESS
+        if (commandIdORcode==IANA_6TOP_RC_SUCCESS){
+            switch(transaction->command){
+            case IANA_6TOP_CMD_ADD:
+            case IANA_6TOP_CMD_DELETE:
+                processIE_retrieve_sixCelllist(pkt,ptr,length,cellList);
+                // always default frameID
+                frameID = SCHEDULE_MINIMAL_6TISCH_DEFAULT_SLOTFRAME_HANDLE;
+                if (transaction->command == IANA_6TOP_CMD_ADD){
+                    sixtop_addCellsByState(frameID,
+                                          cellList,
+                                          &(pkt->l2_nextORpreviousHop),
+                                          SIX_WAIT_ADDRESPONSE
+                    );
+                } else {
+                    sixtop_removeCellsByState(
+                          frameID,
+                          cellList,
+                          &(pkt->l2_nextORpreviousHop));
+                }
+                break;
+            case IANA_6TOP_CMD_COUNT:
+                count  = *((uint8_t*)(pkt->payload)+ptr);
+                ptr += 1;
+                count |= (*((uint8_t*)(pkt->payload)+ptr))<<8;
 #ifdef GOLDEN_IMAGE_ROOT
-                openserial_printInfo(COMPONENT_SIXTOP,ERR_SIXTOP_COUNT,
-                           (errorparameter_t)count,
-                           (errorparameter_t)sixtop_vars.six2six_state);
+            openserial_printInfo(COMPONENT_SIXTOP,ERR_SIXTOP_COUNT,
+                       (errorparameter_t)count,
+                       (errorparameter_t)transaction->state);
 #endif
-                    break;
-                case SIX_WAIT_LISTRESPONSE:
-                    processIE_retrieve_sixCelllist(pkt,ptr,length,cellList);
+                break;
+            case IANA_6TOP_CMD_LIST:
+                processIE_retrieve_sixCelllist(pkt,ptr,length,cellList);
 #ifdef GOLDEN_IMAGE_ROOT
-                // print out first two cells in the list
-                openserial_printInfo(COMPONENT_SIXTOP,ERR_SIXTOP_LIST,
-                           (errorparameter_t)cellList[0].tsNum,
-                           (errorparameter_t)cellList[1].tsNum);
+            // print out first two cells in the list
+            openserial_printInfo(COMPONENT_SIXTOP,ERR_SIXTOP_LIST,
+                       (errorparameter_t)cellList[0].tsNum,
+                       (errorparameter_t)cellList[1].tsNum);
 #endif
-                    break;
-                case SIX_WAIT_CLEARRESPONSE:
-                  
-                    break;
-                default:
-                    code = IANA_6TOP_RC_ERR;
-                }
-            } else {
-                // TBD...
+                break;
+            case IANA_6TOP_CMD_CLEAR:
+              
+                break;
+            default:
+                break;
             }
+        } else {
+            // TBD...
+        }
 #ifdef GOLDEN_IMAGE_ROOT
-           openserial_printInfo(COMPONENT_SIXTOP,ERR_SIXTOP_RETURNCODE,
-                           (errorparameter_t)commandIdORcode,
-                           (errorparameter_t)sixtop_vars.six2six_state);
+       openserial_printInfo(COMPONENT_SIXTOP,ERR_SIXTOP_RETURNCODE,
+                       (errorparameter_t)commandIdORcode,
+                       (errorparameter_t)transaction->state);
 #endif
-            sixtop_vars.six2six_state = SIX_IDLE;
-            sixtop_vars.handler = SIX_HANDLER_NONE;
-            opentimers_stop(sixtop_vars.timeoutTimerId);
+        handler = transaction->handler;
+        code    = transaction->command;
+        sixtop_endTransaction(transaction);
+        
+        // a cell being relocated was removed, add one in its place
+        if (
+            handler==SIX_HANDLER_MAINTAIN        &&
+            code==IANA_6TOP_CMD_DELETE           &&
+            commandIdORcode==IANA_6TOP_RC_SUCCESS
+        ){
+            sixtop_vars.handler = SIX_HANDLER_MAINTAIN;
+            if (sixtop_request(IANA_6TOP_CMD_ADD,&(pkt->l2_nextORpreviousHop),1)==E_FAIL){
+                sixtop_vars.handler = SIX_HANDLER_NONE;
+            }
         }
     }
 }
@@ -1279,14 +1435,13 @@ uint8_t sixtop_getCelllist(
     INTERRUPT_DECLARATION();
     DISABLE_INTERRUPTS();
     
-    if (frameID != SCHEDULE_MINIMAL_6TISCH_DEFAULT_SLOTFRAME_HANDLE){
+    memset(cellList,0,SCHEDULEIEMAXNUMCELLS*sizeof(cellInfo_ht));
+   
+    scheduleWalker = schedule_getSlotframeEntry(frameID);
+    if (scheduleWalker==NULL){
         ENABLE_INTERRUPTS();
         return 0;
     }
-    
-    memset(cellList,0,SCHEDULEIEMAXNUMCELLS*sizeof(cellInfo_ht));
-   
-    scheduleWalker = schedule_getCurrentScheduleEntry();
     currentEntry   = scheduleWalker;
     do {
        if(packetfunctions_sameAddress(&(scheduleWalker->neighbor),neighbor)){
@@ -1311,19 +1466,44 @@ bool sixtop_candidateAddCellList(
    ){
    frameLength_t i;
    uint8_t counter;
+   uint8_t j;
    uint8_t numCandCells;
+   uint8_t maxCandCells;
    
    *frameID = schedule_getFrameHandle();
    
+   if (schedule_getFrameLength()==0) {
+      return FALSE;
+   }
+   
+   // offer a few more cells than required, so the neighbor can choose
+   maxCandCells = requiredCells+SIXTOP_EXTRACANDIDATES;
+   if (maxCandCells>SCHEDULEIEMAXNUMCELLS) {
+      maxCandCells = SCHEDULEIEMAXNUMCELLS;
+   }
+   
    numCandCells=0;
-   for(counter=0;counter<SCHEDULEIEMAXNUMCELLS;counter++){
+   for(counter=0;counter<4*SCHEDULEIEMAXNUMCELLS && numCandCells<maxCandCells;counter++){
       i = openrandom_get16b()%schedule_getFrameLength();
-      if(schedule_isSlotOffsetAvailable(i)==TRUE){
-         cellList[numCandCells].tsNum       = i;
-         cellList[numCandCells].choffset    = 0;
-         cellList[numCandCells].linkoptions = CELLTYPE_TX;
-         numCandCells++;
+      if(
+         schedule_isSlotOffsetAvailable(i)==FALSE ||
+         sixtop_isSlotOffsetReserved(i)==TRUE
+      ){
+         continue;
       }
+      // do not offer the same cell twice
+      for (j=0;j<numCandCells;j++){
+         if (cellList[j].tsNum==i){
+            break;
+         }
+      }
+      if (j<numCandCells){
+         continue;
+      }
+      cellList[numCandCells].tsNum       = i;
+      cellList[numCandCells].choffset    = 0;
+      cellList[numCandCells].linkoptions = CELLTYPE_TX;
+      numCandCells++;
    }
    
    if (numCandCells<requiredCells) {
@@ -1448,7 +1628,11 @@ bool sixtop_areAvailableCellsToBeScheduled(
       available = FALSE;
    } else {
       do {
-         if(schedule_isSlotOffsetAvailable(cellList[i].tsNum) == TRUE){
+         if(
+            cellList[i].linkoptions != CELLTYPE_OFF                     &&
+            schedule_isSlotOffsetAvailable(cellList[i].tsNum) == TRUE    &&
+            sixtop_isSlotOffsetReserved(cellList[i].tsNum) == FALSE
+         ){
             bw--;
          } else {
             cellList[i].linkoptions = CELLTYPE_OFF;
@@ -1518,3 +1702,111 @@ bool sixtop_areAvailableCellsToBeRemoved(
    
    return available;
 }
+
+/**
+\brief Find the ongoing 6P transaction with a neighbor.
+
+\returns The transaction, NULL if none is ongoing with that neighbor.
+*/
+sixtop_transaction_t* sixtop_getTransaction(open_addr_t* neighbor){
+   uint8_t i;
+   
+   for (i=0;i<SIXTOP_MAXTRANSACTIONS;i++){
+      if (
+         sixtop_vars.transactions[i].state!=SIX_IDLE &&
+         packetfunctions_sameAddress(&(sixtop_vars.transactions[i].neighbor),neighbor)
+      ){
+         return &(sixtop_vars.transactions[i]);
+      }
+   }
+   return NULL;
+}
+
+/**
+\brief Start a 6P transaction with a neighbor.
+
+\returns The new transaction, NULL if a transaction is already ongoing with
+   that neighbor or if all transaction entries are in use.
+*/
+sixtop_transaction_t* sixtop_newTransaction(open_addr_t* neighbor){
+   uint8_t               i;
+   sixtop_transaction_t* transaction;
+   
+   if (sixtop_getTransaction(neighbor)!=NULL){
+      return NULL;
+   }
+   
+   transaction = NULL;
+   for (i=0;i<SIXTOP_MAXTRANSACTIONS;i++){
+      if (sixtop_vars.transactions[i].state==SIX_IDLE){
+         transaction = &(sixtop_vars.transactions[i]);
+         break;
+      }
+   }
+   if (transaction==NULL){
+      return NULL;
+   }
+   
+   memset(transaction,0,sizeof(sixtop_transaction_t));
+   memcpy(&(transaction->neighbor),neighbor,sizeof(open_addr_t));
+   transaction->state   = SIX_SENDING_REQUEST;
+   transaction->handler = SIX_HANDLER_NONE;
+   return transaction;
+}
+
+/**
+\brief End a 6P transaction, releasing the cells it reserved.
+*/
+void sixtop_endTransaction(sixtop_transaction_t* transaction){
+   memset(transaction,0,sizeof(sixtop_transaction_t));
+   transaction->state   = SIX_IDLE;
+   transaction->handler = SIX_HANDLER_NONE;
+}
+
+/**
+\brief Give a 6P transaction SIX2SIX_TIMEOUT_MS to complete.
+
+Counted from when the request is sent, or the response on the side of the
+neighbor answering it.
+*/
+void sixtop_armTimeout(sixtop_transaction_t* transaction){
+   transaction->timeoutTicks = SIX2SIX_TIMEOUT_MS/SIX2SIX_TIMEOUT_TICK_MS+1;
+   opentimers_tickerStart(&sixtop_vars.timeoutTicker);
+}
+
+/**
+\brief Reserve the cells of a list for a 6P transaction.
+
+Cells marked CELLTYPE_OFF are not reserved.
+*/
+void sixtop_reserveCells(sixtop_transaction_t* transaction, cellInfo_ht* cellList){
+   uint8_t i;
+   
+   transaction->numReserved = 0;
+   for (i=0;i<SCHEDULEIEMAXNUMCELLS;i++){
+      if (cellList[i].linkoptions != CELLTYPE_OFF){
+         transaction->reserved[transaction->numReserved] = cellList[i].tsNum;
+         transaction->numReserved++;
+      }
+   }
+}
+
+/**
+\brief Indicate whether a slot offset is reserved by an ongoing 6P transaction.
+*/
+bool sixtop_isSlotOffsetReserved(uint16_t slotOffset){
+   uint8_t i;
+   uint8_t j;
+   
+   for (i=0;i<SIXTOP_MAXTRANSACTIONS;i++){
+      if (sixtop_vars.transactions[i].state==SIX_IDLE){
+         continue;
+      }
+      for (j=0;j<sixtop_vars.transactions[i].numReserved;j++){
+         if (sixtop_vars.transactions[i].reserved[j]==slotOffset){
+            return TRUE;
+         }
+      }
+   }
+   return FALSE;
+}
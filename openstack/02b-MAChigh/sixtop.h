@@ -72,8 +72,29 @@ typedef enum {
 //=========================== typedef =========================================
 
 #define SIX2SIX_TIMEOUT_MS 4000
+#define SIX2SIX_TIMEOUT_TICK_MS 500 // granularity of the transaction timeouts
 #define SIXTOP_MINIMAL_EBPERIOD 5 // minist period of sending EB
 
+// number of 6P transactions, with different neighbors, which can be ongoing at
+// the same time. Can be overwritten in board_info.h.
+#ifndef SIXTOP_MAXTRANSACTIONS
+#define SIXTOP_MAXTRANSACTIONS  3
+#endif
+// candidate cells offered on top of the ones requested, so the neighbor can
+// pick cells which are free on its side
+#define SIXTOP_EXTRACANDIDATES  2
+
+typedef struct {
+   six2six_state_t      state;                   // SIX_IDLE when this entry is not used
+   six2six_handler_t    handler;
+   uint8_t              command;                 // command of the request
+   open_addr_t          neighbor;
+   OpenQueueEntry_t*    pkt;                     // request or response being sent, NULL once sent
+   uint8_t              timeoutTicks;            // SIX2SIX_TIMEOUT_TICK_MS ticks before the transaction is aborted
+   uint8_t              numReserved;
+   uint16_t             reserved[SCHEDULEIEMAXNUMCELLS]; // slot offsets offered (or accepted) in this transaction
+} sixtop_transaction_t;
+
 //=========================== module variables ================================
 
 typedef struct {
@@ -83,12 +104,12 @@ typedef struct {
    uint8_t              dsn;                     // current data sequence number
    uint8_t              mgtTaskCounter;          // counter to determine what management task to do
    opentimer_id_t       maintenanceTimerId;
-   opentimer_id_t       timeoutTimerId;          // TimeOut timer id
+   opentimers_ticker_t  timeoutTicker;           // TimeOut ticker, for all transactions
    uint16_t             kaPeriod;                // period of sending KA
    uint16_t             ebPeriod;                // period of sending EB
-   six2six_state_t      six2six_state;
+   sixtop_transaction_t transactions[SIXTOP_MAXTRANSACTIONS];
    uint8_t              commandID;
-   six2six_handler_t    handler;
+   six2six_handler_t    handler;                 // handler of the next request
    bool                 isResponseEnabled;
 } sixtop_vars_t;
 
@@ -99,9 +120,10 @@ void      sixtop_init(void);
 void      sixtop_setKaPeriod(uint16_t kaPeriod);
 void      sixtop_setEBPeriod(uint8_t ebPeriod);
 void      sixtop_setHandler(six2six_handler_t handler);
+bool      sixtop_isIdle(open_addr_t* neighbor);
 // scheduling
-void      sixtop_request(uint8_t code, open_addr_t* neighbor, uint8_t numCells);
-void      sixtop_addORremoveCellByInfo(uint8_t code,open_addr_t*  neighbor,cellInfo_ht* cellInfo);
+owerror_t sixtop_request(uint8_t code, open_addr_t* neighbor, uint8_t numCells);
+owerror_t sixtop_addORremoveCellByInfo(uint8_t code,open_addr_t*  neighbor,cellInfo_ht* cellInfo);
 // maintaining
 void      sixtop_maintaining(uint16_t slotOffset,open_addr_t* neighbor);
 // from upper layer
@@ -0,0 +1,747 @@
+#include "opendefs.h"
+#include "frag.h"
+#include "iphc.h"
+#include "sixtop.h"
+#include "openqueue.h"
+#include "openserial.h"
+#include "packetfunctions.h"
+#include "scheduler.h"
+#include "ieee802154_security_driver.h"
+
+//=========================== define ==========================================
+
+// largest MAC payload of a 127-byte frame, after the CRC, MAC header and security overhead
+#define FRAG_MAXFRAMEPAYLOAD  (127-2-OPENQUEUE_MAXMACHEADER_LEN-(IEEE802154_SECURITY_TOTAL_OVERHEAD))
+
+//=========================== variables =======================================
+
+frag_vars_t frag_vars;
+
+//=========================== prototypes ======================================
+
+void               frag_sendFragments(frag_send_t* s);
+void               frag_endSend(frag_send_t* s);
+owerror_t          frag_forwardFirstFragment(OpenQueueEntry_t* msg);
+void               frag_forwardFragment(frag_forward_t* f, OpenQueueEntry_t* msg, uint16_t size);
+frag_forward_t*    frag_getForward(open_addr_t* sender, uint16_t tag);
+void               frag_endForward(frag_forward_t* f);
+frag_reassembly_t* frag_getReassembly(open_addr_t* sender, uint16_t tag);
+void               frag_endReassembly(frag_reassembly_t* r);
+void               frag_armTimeout(uint8_t* timeoutTicks);
+void               frag_timer_cb(opentimer_id_t id);
+void               frag_timeout_task(void);
+
+//=========================== public ==========================================
+
+void frag_init(void) {
+   memset(&frag_vars,0,sizeof(frag_vars_t));
+   
+   opentimers_tickerInit(&frag_vars.timeoutTicker,FRAG_TIMEOUT_TICK_MS,frag_timer_cb);
+}
+
+/**
+\brief Trigger this module to print status information, over serial.
+
+debugPrint_* functions are used by the openserial module to continuously print
+status information about several modules in the OpenWSN stack.
+
+\returns TRUE if this function printed something, FALSE otherwise.
+*/
+bool debugPrint_frag() {
+   openserial_printStatus(
+      STATUS_FRAG,
+      (uint8_t*)&frag_vars.stats,
+      sizeof(frag_stats_t)
+   );
+   return TRUE;
+}
+
+//======= from upper layer
+
+/**
+\brief Send a compressed IPv6 datagram, in several fragments if needed.
+
+A datagram which fits in a frame is handed to sixtop as is. Otherwise it is cut
+into a FRAG1 fragment, carrying all the 6LoWPAN headers, and FRAGN fragments
+(RFC4944). Each fragment is copied into a buffer of its own: the datagram
+itself is never queued to the MAC, and is returned through iphc_sendDone() once
+all of its fragments have been sent.
+
+At most FRAG_MAXINFLIGHT fragments are queued at once, the next ones follow as
+they are sent.
+
+The first fragment of a datagram being relayed is sent on as a fragment, see
+frag_receive().
+
+\param[in] msg The datagram, its payload starting at the 6LoWPAN dispatch.
+
+\returns E_SUCCESS if the datagram (or its first fragments) was queued.
+\returns E_FAIL otherwise, the datagram then still belongs to the caller.
+*/
+owerror_t frag_send(OpenQueueEntry_t *msg) {
+   frag_send_t* s;
+   uint8_t      headerLength;
+   uint16_t     uncompressedLength;
+   uint8_t      i;
+   
+   // first fragment of a datagram being relayed
+   if (frag_isFirstFragment(msg)==TRUE) {
+      frag_vars.firstFragment.msg = NULL;
+      return frag_forwardFirstFragment(msg);
+   }
+   
+   // fits in a frame
+   if (msg->length<=FRAG_MAXFRAMEPAYLOAD && msg->packetSize<=PACKETBUFFER_LARGE_SIZE) {
+      return sixtop_send(msg);
+   }
+   
+   // find a free send context
+   s = NULL;
+   for (i=0;i<FRAG_NUMSEND;i++) {
+      if (frag_vars.send[i].datagram==NULL) {
+         s = &frag_vars.send[i];
+         break;
+      }
+   }
+   if (s==NULL) {
+      openserial_printError(
+         COMPONENT_FRAG,
+         ERR_FRAG_TOO_LARGE,
+         (errorparameter_t)msg->length,
+         (errorparameter_t)0
+      );
+      return E_FAIL;
+   }
+   
+   // offsets count bytes of the uncompressed datagram
+   headerLength = iphc_getHeaderLength(msg->payload,msg->length,&uncompressedLength);
+   if (
+      uncompressedLength<headerLength                                   ||
+      msg->length+uncompressedLength-headerLength>FRAG_DATAGRAMSIZE_MAX ||
+      headerLength>FRAG_MAXFRAMEPAYLOAD-FRAG1_HEADER_LEN-7
+   ) {
+      openserial_printError(
+         COMPONENT_FRAG,
+         ERR_FRAG_TOO_LARGE,
+         (errorparameter_t)msg->length,
+         (errorparameter_t)1
+      );
+      return E_FAIL;
+   }
+   
+   memset(s,0,sizeof(frag_send_t));
+   s->datagram = msg;
+   s->tag      = frag_vars.tag++;
+   s->delta    = uncompressedLength-headerLength;
+   s->size     = msg->length+s->delta;
+   s->error    = E_SUCCESS;
+   msg->owner  = COMPONENT_FRAG;
+   
+   frag_sendFragments(s);
+   
+   if (s->numInFlight==0) {
+      // not even the first fragment could be queued
+      frag_endSend(s);
+      return E_FAIL;
+   }
+   return E_SUCCESS;
+}
+
+/**
+\brief A fragment has been sent, or has failed to be.
+
+The datagram fails as soon as one of its fragments fails. It is returned to
+iphc once none of its fragments is queued anymore.
+*/
+void frag_sendDone(OpenQueueEntry_t* msg, owerror_t error) {
+   frag_send_t*      s;
+   OpenQueueEntry_t* datagram;
+   owerror_t         datagramError;
+   uint8_t           i;
+   uint8_t           j;
+   
+   // find the datagram this fragment belongs to
+   s = NULL;
+   for (i=0;i<FRAG_NUMSEND && s==NULL;i++) {
+      if (frag_vars.send[i].datagram==NULL) {
+         continue;
+      }
+      for (j=0;j<FRAG_MAXINFLIGHT;j++) {
+         if (frag_vars.send[i].inFlight[j]==msg) {
+            s                 = &frag_vars.send[i];
+            s->inFlight[j]    = NULL;
+            s->numInFlight--;
+            break;
+         }
+      }
+   }
+   openqueue_freePacketBuffer(msg);
+   if (s==NULL) {
+      openserial_printError(
+         COMPONENT_FRAG,
+         ERR_UNEXPECTED_SENDDONE,
+         (errorparameter_t)0,
+         (errorparameter_t)0
+      );
+      return;
+   }
+   
+   if (error!=E_SUCCESS) {
+      s->error = E_FAIL;
+   } else if (s->error==E_SUCCESS) {
+      frag_sendFragments(s);
+   }
+   
+   if (s->numInFlight>0) {
+      return;
+   }
+   
+   // no fragment queued anymore, the datagram is done
+   datagram      = s->datagram;
+   datagramError = s->error;
+   if (s->sent<datagram->length) {
+      datagramError = E_FAIL;
+   }
+   frag_endSend(s);
+   iphc_sendDone(datagram,datagramError);
+}
+
+//======= from lower layer
+
+/**
+\brief Receive a FRAG1 or FRAGN fragment.
+
+The FRAG1 fragment goes through iphc_receive() and forwarding_receive(), which
+look at the headers it carries:
+- when the datagram is relayed, the fragment is sent on to the next hop, which
+  is remembered for the tag of the datagram. The FRAGN fragments which follow
+  are sent to that next hop as soon as they are received, without waiting for
+  the whole datagram.
+- otherwise, iphc calls frag_reassemble() and the datagram is reassembled in a
+  buffer taken from openqueue, sized for the datagram. The complete datagram is
+  passed to iphc_receive().
+
+Fragments are expected in order, which is how this stack sends them: the queue
+to a neighbor is served first-in first-out, and a fragment is retransmitted
+before the next one leaves. A fragment received twice is ignored, a missing one
+aborts the reassembly.
+
+\note The fragment offsets count the headers compressed with LOWPAN_NHC with
+   their uncompressed length, see iphc_getHeaderLength().
+
+\param[in] msg The fragment, its payload starting at the fragment header.
+*/
+void frag_receive(OpenQueueEntry_t *msg) {
+   frag_reassembly_t* r;
+   frag_forward_t*    f;
+   OpenQueueEntry_t*  datagram;
+   uint8_t            dispatch;
+   uint16_t           size;
+   uint16_t           tag;
+   uint16_t           offset;
+   uint8_t            headerLength;
+   uint16_t           uncompressedLength;
+   
+   msg->owner = COMPONENT_FRAG;
+   frag_vars.stats.numFragReceived++;
+   
+   dispatch = *((uint8_t*)(msg->payload)) & FRAG_DISPATCH_MASK;
+   if (
+      (dispatch==FRAG_DISPATCH_FRAG1 && msg->length<=FRAG1_HEADER_LEN) ||
+      (dispatch==FRAG_DISPATCH_FRAGN && msg->length<=FRAGN_HEADER_LEN)
+   ) {
+      frag_vars.stats.numFragDropped++;
+      openqueue_freePacketBuffer(msg);
+      return;
+   }
+   
+   // parse the fragment header
+   size   = ((uint16_t)(msg->payload[0] & FRAG_SIZE_MASK)<<8) | msg->payload[1];
+   tag    = ((uint16_t)msg->payload[2]<<8) | msg->payload[3];
+   r      = frag_getReassembly(&(msg->l2_nextORpreviousHop),tag);
+   f      = frag_getForward(&(msg->l2_nextORpreviousHop),tag);
+   
+   if (dispatch==FRAG_DISPATCH_FRAG1) {
+      packetfunctions_tossHeader(msg,FRAG1_HEADER_LEN);
+      
+      if (f!=NULL) {
+         // already relayed
+         frag_vars.stats.numFragDropped++;
+         openqueue_freePacketBuffer(msg);
+         return;
+      }
+      
+      // the sender starts over
+      if (r!=NULL) {
+         frag_endReassembly(r);
+      }
+      
+      headerLength = iphc_getHeaderLength(msg->payload,msg->length,&uncompressedLength);
+      if (uncompressedLength<headerLength || size<uncompressedLength-headerLength) {
+         frag_vars.stats.numFragDropped++;
+         openserial_printError(
+            COMPONENT_FRAG,
+            ERR_FRAG_REASSEMBLY,
+            (errorparameter_t)tag,
+            (errorparameter_t)0
+         );
+         openqueue_freePacketBuffer(msg);
+         return;
+      }
+      
+      // the whole datagram is in this fragment
+      if (msg->length+uncompressedLength-headerLength>=size) {
+         frag_vars.stats.numReassembled++;
+         iphc_receive(msg);
+         return;
+      }
+      
+      // iphc relays the fragment, or hands it back through frag_reassemble()
+      frag_vars.firstFragment.msg                = msg;
+      frag_vars.firstFragment.tag                = tag;
+      frag_vars.firstFragment.size               = size;
+      frag_vars.firstFragment.uncompressedLength = uncompressedLength;
+      frag_vars.firstFragment.delta              = uncompressedLength-headerLength;
+      memcpy(&(frag_vars.firstFragment.sender),&(msg->l2_nextORpreviousHop),sizeof(open_addr_t));
+      iphc_receive(msg);
+      frag_vars.firstFragment.msg                = NULL;
+      return;
+   }
+   
+   // FRAGN of a datagram being relayed
+   if (f!=NULL) {
+      frag_forwardFragment(f,msg,size);
+      return;
+   }
+   
+   // FRAGN of a datagram being reassembled
+   offset = (uint16_t)msg->payload[4]*8;
+   packetfunctions_tossHeader(msg,FRAGN_HEADER_LEN);
+   
+   if (r==NULL || offset<r->nextOffset) {
+      // FRAG1 missed, or a retransmitted fragment
+      frag_vars.stats.numFragDropped++;
+      openqueue_freePacketBuffer(msg);
+      return;
+   }
+   if (
+      r->size!=size                             ||
+      offset>r->nextOffset                      ||
+      offset-r->delta+msg->length>r->datagram->length
+   ) {
+      // inconsistent with the fragments received so far
+      frag_vars.stats.numFragDropped++;
+      openserial_printError(
+         COMPONENT_FRAG,
+         ERR_FRAG_REASSEMBLY,
+         (errorparameter_t)tag,
+         (errorparameter_t)1
+      );
+      frag_endReassembly(r);
+      openqueue_freePacketBuffer(msg);
+      return;
+   }
+   
+   memcpy(&(r->datagram->payload[offset-r->delta]),msg->payload,msg->length);
+   r->nextOffset += msg->length;
+   openqueue_freePacketBuffer(msg);
+   
+   if (r->nextOffset<r->size) {
+      return;
+   }
+   
+   // the datagram is complete
+   datagram    = r->datagram;
+   r->datagram = NULL;
+   frag_vars.stats.numReassembled++;
+   iphc_receive(datagram);
+}
+
+/**
+\brief Whether a packet is the first fragment of a datagram being received.
+*/
+bool frag_isFirstFragment(OpenQueueEntry_t *msg) {
+   return (msg!=NULL && msg==frag_vars.firstFragment.msg);
+}
+
+/**
+\brief Reassemble the datagram a first fragment belongs to.
+
+Called by iphc when the datagram is not relayed by this mote.
+
+\param[in] msg The first fragment, its payload starting after the fragment
+   header.
+*/
+void frag_reassemble(OpenQueueEntry_t *msg) {
+   frag_reassembly_t* r;
+   OpenQueueEntry_t*  datagram;
+   uint8_t*           packet;
+   uint8_t*           payload;
+   uint8_t            packetSize;
+   uint16_t           compressedSize;
+   uint8_t            i;
+   
+   msg->owner                  = COMPONENT_FRAG;
+   frag_vars.firstFragment.msg = NULL;
+   compressedSize              = frag_vars.firstFragment.size-frag_vars.firstFragment.delta;
+   
+   // find a free reassembly context
+   r = NULL;
+   for (i=0;i<FRAG_NUMREASSEMBLY;i++) {
+      if (frag_vars.reassembly[i].datagram==NULL) {
+         r = &frag_vars.reassembly[i];
+         break;
+      }
+   }
+   
+   // get a buffer for the whole datagram
+   datagram = NULL;
+   if (r!=NULL && compressedSize<=0xff) {
+      datagram = openqueue_getFreePacketBufferForLength(COMPONENT_FRAG,(uint8_t)compressedSize);
+   }
+   if (datagram==NULL) {
+      frag_vars.stats.numFragDropped++;
+      openserial_printError(
+         COMPONENT_FRAG,
+         ERR_FRAG_TOO_LARGE,
+         (errorparameter_t)frag_vars.firstFragment.size,
+         (errorparameter_t)2
+      );
+      openqueue_freePacketBuffer(msg);
+      return;
+   }
+   
+   // the datagram inherits the metadata of its first fragment
+   packet               = datagram->packet;
+   payload              = datagram->payload;
+   packetSize           = datagram->packetSize;
+   memcpy(datagram,msg,sizeof(OpenQueueEntry_t));
+   datagram->packet     = packet;
+   datagram->payload    = payload;
+   datagram->packetSize = packetSize;
+   datagram->length     = 0;
+   datagram->owner      = COMPONENT_FRAG;
+   memcpy(&(datagram->l2_nextORpreviousHop),&(frag_vars.firstFragment.sender),sizeof(open_addr_t));
+   
+   packetfunctions_reserveHeaderSize(datagram,(uint8_t)compressedSize);
+   memcpy(datagram->payload,msg->payload,msg->length);
+   
+   memset(r,0,sizeof(frag_reassembly_t));
+   r->datagram          = datagram;
+   memcpy(&(r->sender),&(frag_vars.firstFragment.sender),sizeof(open_addr_t));
+   r->tag               = frag_vars.firstFragment.tag;
+   r->size              = frag_vars.firstFragment.size;
+   r->delta             = frag_vars.firstFragment.delta;
+   r->nextOffset        = msg->length+r->delta;
+   frag_armTimeout(&(r->timeoutTicks));
+   
+   openqueue_freePacketBuffer(msg);
+}
+
+//=========================== private =========================================
+
+/**
+\brief Queue the next fragments of a datagram, up to FRAG_MAXINFLIGHT.
+
+The FRAG1 fragment carries the 6LoWPAN headers. Except for the last one, each
+fragment ends on a multiple of 8 bytes of the uncompressed datagram, so the
+next one's offset can be written.
+*/
+void frag_sendFragments(frag_send_t* s) {
+   OpenQueueEntry_t* fragment;
+   uint8_t           remaining;
+   uint8_t           chunk;
+   uint8_t           dispatch;
+   uint8_t           i;
+   
+   while (s->sent<s->datagram->length && s->numInFlight<FRAG_MAXINFLIGHT) {
+      remaining = s->datagram->length-s->sent;
+      
+      // size this fragment
+      if (s->sent==0 && s->datagram->length<=FRAG_MAXFRAMEPAYLOAD) {
+         // fits in a frame, only the buffer is too large for the MAC
+         chunk    = remaining;
+         dispatch = 0;
+      } else if (s->sent==0) {
+         chunk    = ((s->delta+FRAG_MAXFRAMEPAYLOAD-FRAG1_HEADER_LEN) & ~0x07)-s->delta;
+         dispatch = FRAG_DISPATCH_FRAG1;
+      } else {
+         chunk    = (FRAG_MAXFRAMEPAYLOAD-FRAGN_HEADER_LEN) & ~0x07;
+         if (chunk>remaining) {
+            chunk = remaining;
+         }
+         dispatch = FRAG_DISPATCH_FRAGN;
+      }
+      
+      // copy the fragment into a buffer of its own
+      fragment = openqueue_getFreePacketBuffer(COMPONENT_FRAG);
+      if (fragment==NULL) {
+         openserial_printError(
+            COMPONENT_FRAG,
+            ERR_NO_FREE_PACKET_BUFFER,
+            (errorparameter_t)0,
+            (errorparameter_t)0
+         );
+         break;
+      }
+      fragment->owner = COMPONENT_FRAG;
+      memcpy(&(fragment->l2_nextORpreviousHop),&(s->datagram->l2_nextORpreviousHop),sizeof(open_addr_t));
+      packetfunctions_reserveHeaderSize(fragment,chunk);
+      memcpy(fragment->payload,&(s->datagram->payload[s->sent]),chunk);
+      
+      // fragment header
+      if (dispatch==FRAG_DISPATCH_FRAGN) {
+         packetfunctions_reserveHeaderSize(fragment,sizeof(uint8_t));
+         fragment->payload[0] = (uint8_t)((s->sent+s->delta)/8);
+      }
+      if (dispatch!=0) {
+         packetfunctions_reserveHeaderSize(fragment,FRAG1_HEADER_LEN);
+         fragment->payload[0] = dispatch | ((uint8_t)(s->size>>8) & FRAG_SIZE_MASK);
+         fragment->payload[1] = (uint8_t)(s->size & 0x00ff);
+         fragment->payload[2] = (uint8_t)(s->tag>>8);
+         fragment->payload[3] = (uint8_t)(s->tag & 0x00ff);
+      }
+      
+      if (sixtop_send(fragment)==E_FAIL) {
+         openqueue_freePacketBuffer(fragment);
+         break;
+      }
+      for (i=0;i<FRAG_MAXINFLIGHT;i++) {
+         if (s->inFlight[i]==NULL) {
+            s->inFlight[i] = fragment;
+            break;
+         }
+      }
+      s->numInFlight++;
+      s->sent += chunk;
+      frag_vars.stats.numFragSent++;
+   }
+}
+
+void frag_endSend(frag_send_t* s) {
+   memset(s,0,sizeof(frag_send_t));
+}
+
+/**
+\brief Relay the first fragment of a datagram.
+
+iphc has rewritten its headers for the next hop. The next hop is remembered
+for the tag of the datagram, so the FRAGN fragments which follow are relayed
+by frag_forwardFragment().
+
+The datagram gets a tag of this mote. Its size and offsets change by the
+difference in uncompressed header length, always a multiple of 8 bytes, e.g.
+when an address is consumed from the source routing header.
+*/
+owerror_t frag_forwardFirstFragment(OpenQueueEntry_t* msg) {
+   frag_forward_t* f;
+   uint8_t         headerLength;
+   uint16_t        uncompressedLength;
+   int16_t         shift;
+   uint16_t        size;
+   uint8_t         i;
+   
+   // find a free forwarding entry
+   f = NULL;
+   for (i=0;i<FRAG_NUMFORWARD;i++) {
+      if (frag_vars.forward[i].used==FALSE) {
+         f = &frag_vars.forward[i];
+         break;
+      }
+   }
+   
+   headerLength = iphc_getHeaderLength(msg->payload,msg->length,&uncompressedLength);
+   shift        = (int16_t)uncompressedLength-(int16_t)frag_vars.firstFragment.uncompressedLength;
+   size         = frag_vars.firstFragment.size+shift;
+   if (
+      f==NULL                                             ||
+      (shift & 0x07)!=0                                   ||
+      size>FRAG_DATAGRAMSIZE_MAX                          ||
+      uncompressedLength<headerLength                     ||
+      msg->length>FRAG_MAXFRAMEPAYLOAD-FRAG1_HEADER_LEN
+   ) {
+      openserial_printError(
+         COMPONENT_FRAG,
+         ERR_FRAG_FORWARD,
+         (errorparameter_t)frag_vars.firstFragment.tag,
+         (errorparameter_t)0
+      );
+      return E_FAIL;
+   }
+   
+   memset(f,0,sizeof(frag_forward_t));
+   memcpy(&(f->sender),&(frag_vars.firstFragment.sender),sizeof(open_addr_t));
+   memcpy(&(f->nextHop),&(msg->l2_nextORpreviousHop),sizeof(open_addr_t));
+   f->tag     = frag_vars.firstFragment.tag;
+   f->size    = frag_vars.firstFragment.size;
+   f->outTag  = frag_vars.tag++;
+   f->shift   = shift;
+   
+   packetfunctions_reserveHeaderSize(msg,FRAG1_HEADER_LEN);
+   msg->payload[0] = FRAG_DISPATCH_FRAG1 | ((uint8_t)(size>>8) & FRAG_SIZE_MASK);
+   msg->payload[1] = (uint8_t)(size & 0x00ff);
+   msg->payload[2] = (uint8_t)(f->outTag>>8);
+   msg->payload[3] = (uint8_t)(f->outTag & 0x00ff);
+   
+   if (sixtop_send(msg)==E_FAIL) {
+      return E_FAIL;
+   }
+   f->used = TRUE;
+   frag_armTimeout(&(f->timeoutTicks));
+   frag_vars.stats.numFragForwarded++;
+   return E_SUCCESS;
+}
+
+/**
+\brief Relay a FRAGN fragment to the next hop of its datagram.
+
+The fragment header is rewritten in place, the buffer is sent as is.
+
+\param[in] f    The forwarding entry of the datagram.
+\param[in] msg  The fragment, its payload starting at the fragment header.
+\param[in] size The datagram_size field of the fragment.
+*/
+void frag_forwardFragment(frag_forward_t* f, OpenQueueEntry_t* msg, uint16_t size) {
+   uint16_t offset;
+   uint16_t outSize;
+   bool     isLast;
+   
+   offset  = (uint16_t)msg->payload[4]*8;
+   outSize = size+f->shift;
+   isLast  = (offset+msg->length-FRAGN_HEADER_LEN>=f->size);
+   if (size!=f->size) {
+      frag_vars.stats.numFragDropped++;
+      openserial_printError(
+         COMPONENT_FRAG,
+         ERR_FRAG_FORWARD,
+         (errorparameter_t)f->tag,
+         (errorparameter_t)1
+      );
+      frag_endForward(f);
+      openqueue_freePacketBuffer(msg);
+      return;
+   }
+   
+   msg->payload[0] = FRAG_DISPATCH_FRAGN | ((uint8_t)(outSize>>8) & FRAG_SIZE_MASK);
+   msg->payload[1] = (uint8_t)(outSize & 0x00ff);
+   msg->payload[2] = (uint8_t)(f->outTag>>8);
+   msg->payload[3] = (uint8_t)(f->outTag & 0x00ff);
+   msg->payload[4] = (uint8_t)((offset+f->shift)/8);
+   
+   // relayed like any packet, forwarding_sendDone() frees it
+   msg->creator    = COMPONENT_FORWARDING;
+   memcpy(&(msg->l2_nextORpreviousHop),&(f->nextHop),sizeof(open_addr_t));
+   if (sixtop_send(msg)==E_FAIL) {
+      // the datagram can not make it anymore
+      frag_vars.stats.numFragDropped++;
+      frag_endForward(f);
+      openqueue_freePacketBuffer(msg);
+      return;
+   }
+   frag_vars.stats.numFragForwarded++;
+   
+   if (isLast==TRUE) {
+      frag_endForward(f);
+   }
+}
+
+frag_forward_t* frag_getForward(open_addr_t* sender, uint16_t tag) {
+   uint8_t i;
+   
+   for (i=0;i<FRAG_NUMFORWARD;i++) {
+      if (
+         frag_vars.forward[i].used==TRUE                                          &&
+         frag_vars.forward[i].tag==tag                                            &&
+         packetfunctions_sameAddress(&(frag_vars.forward[i].sender),sender)==TRUE
+      ) {
+         return &frag_vars.forward[i];
+      }
+   }
+   return NULL;
+}
+
+void frag_endForward(frag_forward_t* f) {
+   memset(f,0,sizeof(frag_forward_t));
+}
+
+frag_reassembly_t* frag_getReassembly(open_addr_t* sender, uint16_t tag) {
+   uint8_t i;
+   
+   for (i=0;i<FRAG_NUMREASSEMBLY;i++) {
+      if (
+         frag_vars.reassembly[i].datagram!=NULL                                   &&
+         frag_vars.reassembly[i].tag==tag                                         &&
+         packetfunctions_sameAddress(&(frag_vars.reassembly[i].sender),sender)==TRUE
+      ) {
+         return &frag_vars.reassembly[i];
+      }
+   }
+   return NULL;
+}
+
+void frag_endReassembly(frag_reassembly_t* r) {
+   if (r->datagram!=NULL) {
+      openqueue_freePacketBuffer(r->datagram);
+   }
+   memset(r,0,sizeof(frag_reassembly_t));
+}
+
+/**
+\brief Give a datagram FRAG_REASSEMBLY_TIMEOUT_S to be reassembled or relayed.
+
+Counted from its first fragment, in ticks of frag_vars.timeoutTicker.
+*/
+void frag_armTimeout(uint8_t* timeoutTicks) {
+   *timeoutTicks = FRAG_REASSEMBLY_TIMEOUT_S*1000/FRAG_TIMEOUT_TICK_MS+1;
+   opentimers_tickerStart(&frag_vars.timeoutTicker);
+}
+
+void frag_timer_cb(opentimer_id_t id) {
+   scheduler_push_task(frag_timeout_task,TASKPRIO_FRAG);
+}
+
+void frag_timeout_task(void) {
+   uint8_t i;
+   bool    isOngoing;
+   
+   // discard the datagrams which have not been reassembled in time
+   isOngoing = FALSE;
+   for (i=0;i<FRAG_NUMREASSEMBLY;i++) {
+      if (frag_vars.reassembly[i].datagram==NULL) {
+         continue;
+      }
+      if (frag_vars.reassembly[i].timeoutTicks>0) {
+         frag_vars.reassembly[i].timeoutTicks--;
+      }
+      if (frag_vars.reassembly[i].timeoutTicks==0) {
+         frag_vars.stats.numTimeouts++;
+         openserial_printError(
+            COMPONENT_FRAG,
+            ERR_FRAG_REASSEMBLY,
+            (errorparameter_t)frag_vars.reassembly[i].tag,
+            (errorparameter_t)2
+         );
+         frag_endReassembly(&frag_vars.reassembly[i]);
+      } else {
+         isOngoing = TRUE;
+      }
+   }
+   
+   // forget the next hop of the datagrams whose last fragment never came
+   for (i=0;i<FRAG_NUMFORWARD;i++) {
+      if (frag_vars.forward[i].used==FALSE) {
+         continue;
+      }
+      if (frag_vars.forward[i].timeoutTicks>0) {
+         frag_vars.forward[i].timeoutTicks--;
+      }
+      if (frag_vars.forward[i].timeoutTicks==0) {
+         frag_vars.stats.numTimeouts++;
+         frag_endForward(&frag_vars.forward[i]);
+      } else {
+         isOngoing = TRUE;
+      }
+   }
+   
+   opentimers_tickerContinue(&frag_vars.timeoutTicker,isOngoing);
+}
@@ -0,0 +1,136 @@
+#ifndef __FRAG_H
+#define __FRAG_H
+
+/**
+\addtogroup LoWPAN
+\{
+\addtogroup FRAG
+\{
+*/
+
+#include "opendefs.h"
+#include "opentimers.h"
+
+//=========================== define ==========================================
+
+// the following can be overwritten in board_info.h
+
+// number of datagrams being reassembled at once
+#ifndef FRAG_NUMREASSEMBLY
+#define FRAG_NUMREASSEMBLY          2
+#endif
+// number of datagrams being fragmented at once
+#ifndef FRAG_NUMSEND
+#define FRAG_NUMSEND                2
+#endif
+// number of datagrams being relayed fragment by fragment at once
+#ifndef FRAG_NUMFORWARD
+#define FRAG_NUMFORWARD             4
+#endif
+// fragments of a datagram queued to sixtop at the same time
+#ifndef FRAG_MAXINFLIGHT
+#define FRAG_MAXINFLIGHT            3
+#endif
+// a datagram not reassembled or relayed within that time is discarded (RFC4944 allows up to 60s)
+#ifndef FRAG_REASSEMBLY_TIMEOUT_S
+#define FRAG_REASSEMBLY_TIMEOUT_S   10
+#endif
+
+#define FRAG_TIMEOUT_TICK_MS        1000
+#define FRAG1_HEADER_LEN            4
+#define FRAGN_HEADER_LEN            5
+#define FRAG_DATAGRAMSIZE_MAX       2047 // 11-bit datagram_size field
+
+enum FRAG_enums {
+   FRAG_DISPATCH_MASK               = 0xf8,  // b1111 1000
+   FRAG_DISPATCH_FRAG1              = 0xc0,  // b1100 0xxx
+   FRAG_DISPATCH_FRAGN              = 0xe0,  // b1110 0xxx
+   FRAG_SIZE_MASK                   = 0x07,  // 3 MSBs of datagram_size
+};
+
+//=========================== typedef =========================================
+
+typedef struct {
+   OpenQueueEntry_t*    datagram;                // NULL when the context is free
+   open_addr_t          sender;
+   uint16_t             tag;
+   uint16_t             size;                    // datagram_size, uncompressed
+   uint16_t             delta;                   // uncompressed minus compressed header length
+   uint16_t             nextOffset;              // uncompressed offset of the next fragment
+   uint8_t              timeoutTicks;
+} frag_reassembly_t;
+
+typedef struct {
+   OpenQueueEntry_t*    datagram;                // NULL when the context is free
+   uint16_t             tag;
+   uint16_t             size;                    // datagram_size, uncompressed
+   uint16_t             delta;                   // uncompressed minus compressed header length
+   uint8_t              sent;                    // bytes of the (compressed) datagram handed to sixtop
+   uint8_t              numInFlight;
+   OpenQueueEntry_t*    inFlight[FRAG_MAXINFLIGHT];
+   owerror_t            error;
+} frag_send_t;
+
+typedef struct {
+   bool                 used;
+   open_addr_t          sender;                  // previous hop
+   uint16_t             tag;                     // tag given by the previous hop
+   uint16_t             size;                    // datagram_size, as received
+   open_addr_t          nextHop;
+   uint16_t             outTag;                  // tag given by this mote
+   int16_t              shift;                   // change of datagram_size and offsets
+   uint8_t              timeoutTicks;
+} frag_forward_t;
+
+typedef struct {
+   OpenQueueEntry_t*    msg;                     // NULL when no first fragment is being received
+   open_addr_t          sender;
+   uint16_t             tag;
+   uint16_t             size;                    // datagram_size
+   uint16_t             uncompressedLength;      // of the 6LoWPAN headers
+   uint16_t             delta;                   // uncompressed minus compressed header length
+} frag_firstFragment_t;
+
+BEGIN_PACK
+typedef struct {
+   uint16_t             numFragSent;
+   uint16_t             numFragReceived;
+   uint16_t             numFragForwarded;
+   uint16_t             numFragDropped;
+   uint16_t             numReassembled;
+   uint16_t             numTimeouts;
+} frag_stats_t;
+END_PACK
+
+//=========================== module variables ================================
+
+typedef struct {
+   frag_reassembly_t    reassembly[FRAG_NUMREASSEMBLY];
+   frag_send_t          send[FRAG_NUMSEND];
+   frag_forward_t       forward[FRAG_NUMFORWARD];
+   frag_firstFragment_t firstFragment;           // FRAG1 handed to iphc_receive()
+   uint16_t             tag;                     // tag of the next datagram fragmented
+   opentimers_ticker_t  timeoutTicker;           // for all reassembly contexts and forwarding entries
+   frag_stats_t         stats;
+} frag_vars_t;
+
+//=========================== prototypes ======================================
+
+// admin
+void          frag_init(void);
+bool          debugPrint_frag(void);
+// from upper layer
+owerror_t     frag_send(OpenQueueEntry_t *msg);
+void          frag_sendDone(OpenQueueEntry_t* msg, owerror_t error);
+// from lower layer
+void          frag_receive(OpenQueueEntry_t *msg);
+// from iphc
+bool          frag_isFirstFragment(OpenQueueEntry_t *msg);
+void          frag_reassemble(OpenQueueEntry_t *msg);
+
+/**
+\}
+\}
+*/
+
+#endif
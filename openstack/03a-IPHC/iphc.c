@@ -3,7 +3,9 @@
 #include "packetfunctions.h"
 #include "idmanager.h"
 #include "openserial.h"
+#include "openqueue.h"
 #include "sixtop.h"
+#include "frag.h"
 #include "forwarding.h"
 #include "neighbors.h"
 #include "openbridge.h"
@@ -11,20 +13,18 @@
 
 //=========================== variables =======================================
 
-static const uint8_t dagroot[]   = {0x03,
-   0xbb, 0xbb, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0b
-}; 
+iphc_vars_t iphc_vars;
 
 //=========================== prototypes ======================================
 
 //===== IPv6 header
-void iphc_retrieveIPv6Header(
+owerror_t iphc_retrieveIPv6Header(
    OpenQueueEntry_t* msg, 
    ipv6_header_iht* ipv6_outer_header,
    ipv6_header_iht* ipv6_inner_header,
    uint8_t*         page_length
 );
-uint8_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
+owerror_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
    open_addr_t*         temp_addr_64b,
    uint8_t*             dispatch,
    uint8_t*             tf,
@@ -37,7 +37,16 @@ uint8_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
    ipv6_header_iht*     ipv6_header,
    uint8_t              previousLen);
 
+//===== 6LoRH
+void iphc_getRootAddress(open_addr_t* root);
+uint8_t iphc_retrieveEncapsulatorAddress(
+   uint8_t*             address,
+   uint8_t              ipinip_length,
+   open_addr_t*         src
+);
+
 //===== IPv6 hop-by-hop header
+uint8_t iphc_getIPv6HopByHopHeaderLength(rpl_option_ht* rpl_option);
 void iphc_prependIPv6HopByHopHeader(
    OpenQueueEntry_t*    msg,
    uint8_t              nextheader,
@@ -51,6 +60,7 @@ uint8_t iphc_retrieveIPv6HopByHopHeader(
 //=========================== public ==========================================
 
 void      iphc_init() {
+    memset(&iphc_vars,0,sizeof(iphc_vars_t));
 }
 
 // send from upper layer: I need to add 6LoWPAN header
@@ -60,7 +70,7 @@ owerror_t iphc_sendFromForwarding(
     ipv6_header_iht*  ipv6_inner_header,
     rpl_option_ht*    rpl_option,
     uint32_t*         flow_label,
-    uint8_t*          rh3_copy,
+    uint8_t*          rh3,
     uint8_t           rh3_length,
     uint8_t           fw_SendOrfw_Rcv
     ) {
@@ -68,7 +78,11 @@ owerror_t iphc_sendFromForwarding(
     open_addr_t  temp_dest_mac64b; 
     open_addr_t  temp_src_prefix;
     open_addr_t  temp_src_mac64b;
-    uint8_t      sam;
+    open_addr_t* encapsulator;
+    open_addr_t  root;
+    uint8_t      ipinip_length;
+    uint8_t      rpi_length;
+    uint8_t*     rh3_dest;
     // take ownership over the packet
     msg->owner = COMPONENT_IPHC;
    
@@ -113,82 +127,83 @@ owerror_t iphc_sendFromForwarding(
     packetfunctions_ip128bToMac64b(&(msg->l3_destinationAdd),&temp_dest_prefix,&temp_dest_mac64b);
     //xv poipoi -- get the src prefix as well
     packetfunctions_ip128bToMac64b(&(msg->l3_sourceAdd),&temp_src_prefix,&temp_src_mac64b);
-    //XV -poipoi we want to check if the source address prefix is the same as destination prefix
-    if (packetfunctions_sameAddress(&temp_dest_prefix,&temp_src_prefix)) {
-        sam = IPHC_SAM_64B;    // no ipinip 6loRH if in the same prefix
-    } else {
-        //not the same prefix. so the packet travels to another network
-        //check if this is a source routing pkt. in case it is then the DAM is elided as it is in the SrcRouting header.
-        if (packetfunctions_isBroadcastMulticast(&(msg->l3_destinationAdd))==FALSE){
-            // ip in ip will be presented
-            sam = IPHC_SAM_128B;
-        } else {
-            // this is DIO, source address elided, multicast bit is set
-            sam = IPHC_SAM_ELIDED;
-        }
-    }
-
     //IPinIP 6LoRH will be added at here if necessary.
+    ipinip_length = 0;
+    encapsulator  = NULL;
     if (packetfunctions_sameAddress(&temp_dest_prefix,&temp_src_prefix)){
         // same network, IPinIP is elided
     } else {
         if (packetfunctions_isBroadcastMulticast(&(msg->l3_destinationAdd))==FALSE){
-            if (
-                (
-                  ipv6_outer_header->src.type == ADDR_NONE &&
-                  packetfunctions_sameAddress(&(msg->l3_sourceAdd),(open_addr_t*)dagroot)
-                ) || 
-                (
-                  ipv6_outer_header->src.type != ADDR_NONE &&
-                  packetfunctions_sameAddress(&(ipv6_outer_header->src),(open_addr_t*)dagroot)  
-                 )
-            ){
-                // hop limit
-                packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
-                *((uint8_t*)(msg->payload)) = ipv6_outer_header->hop_limit;
-                // type
-                packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
-                *((uint8_t*)(msg->payload)) = IPECAP_6LOTH_TYPE;
-                // length 
-                packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
-                *((uint8_t*)(msg->payload)) = ELECTIVE_6LoRH | 1;
+            if (ipv6_outer_header->src.type == ADDR_NONE) {
+                encapsulator = &(msg->l3_sourceAdd);
+            } else {
+                encapsulator = &(ipv6_outer_header->src);
             }
-            else {
-                if (sam == IPHC_SAM_128B){
-                    // encapsulate address
-                    packetfunctions_writeAddress(msg, &(msg->l3_sourceAdd),OW_BIG_ENDIAN);
-                    // hoplim
-                    packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
-                    *((uint8_t*)(msg->payload)) = ipv6_outer_header->hop_limit;
-                    // type
-                    packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
-                    *((uint8_t*)(msg->payload)) = IPECAP_6LOTH_TYPE;
-                    // length
-                    packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
-                    *((uint8_t*)(msg->payload)) = ELECTIVE_6LoRH | 17;
-                }
+            // the encapsulator address is compressed against the root
+            iphc_getRootAddress(&root);
+            if (packetfunctions_sameAddress(encapsulator,&root)) {
+                // length, type and hop limit, source elided
+                ipinip_length = 3;
+            } else {
+                // length, type, hop limit and compressed encapsulator address
+                ipinip_length = 3+RH3_6LOTH_ADDR_LEN(iphc_get6LoRHAddressType(encapsulator,&root));
             }
         } else {
             // this is DIO, no IPinIP either
         }
     }
     
-        //prepend Option hop by hop header except when src routing and dst is not 0xffff
-        //-- this is a little trick as src routing is using an option header set to 0x00
-        if (
-            rpl_option->optionType==RPL_HOPBYHOP_HEADER_OPTION_TYPE && 
-            packetfunctions_isBroadcastMulticast(&(msg->l3_destinationAdd))==FALSE
-        ){
-            //printf ("** IPHC -- RPL_HOPBYHOP_HEADER_OPTION_TYPE\n");      
-            iphc_prependIPv6HopByHopHeader(msg, msg->l4_protocol, rpl_option);
+    //prepend Option hop by hop header except when src routing and dst is not 0xffff
+    //-- this is a little trick as src routing is using an option header set to 0x00
+    rpi_length = 0;
+    if (
+        rpl_option->optionType==RPL_HOPBYHOP_HEADER_OPTION_TYPE && 
+        packetfunctions_isBroadcastMulticast(&(msg->l3_destinationAdd))==FALSE
+    ){
+        rpi_length = iphc_getIPv6HopByHopHeaderLength(rpl_option);
+    }
+    
+    // RH3s are still in the packet, right in front of the headers forwarding
+    // tossed. The headers prepended below may be longer and overwrite them,
+    // so move them to their final place first.
+    if (rh3_length > 0){
+        //printf ("** IPHC -- rh3_length > 0\n");
+        rh3_dest = msg->payload - ipinip_length - rpi_length - rh3_length;
+        if (rh3_dest < (uint8_t*)(msg->packet)) {
+            openserial_printCritical(COMPONENT_IPHC,ERR_HEADER_TOO_LONG,
+                                  (errorparameter_t)1,
+                                  (errorparameter_t)rh3_length);
+            return E_FAIL;
         }
-
-        // copy RH3s back if length > 0
-        if (rh3_length > 0){
-            //printf ("** IPHC -- rh3_length > 0\n");
-            packetfunctions_reserveHeaderSize(msg,rh3_length);
-            memcpy(&msg->payload[0],&rh3_copy[0],rh3_length);
-        } 
+        memmove(rh3_dest,rh3,rh3_length);
+    }
+    
+    if (ipinip_length > 0) {
+        // compressed encapsulator address, its last bytes
+        if (ipinip_length > 3) {
+            packetfunctions_reserveHeaderSize(msg,ipinip_length-3);
+            memcpy(msg->payload,&(encapsulator->addr_128b[16-(ipinip_length-3)]),ipinip_length-3);
+        }
+        // hop limit
+        packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
+        *((uint8_t*)(msg->payload)) = ipv6_outer_header->hop_limit;
+        // type
+        packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
+        *((uint8_t*)(msg->payload)) = IPECAP_6LOTH_TYPE;
+        // length, hop limit and address
+        packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
+        *((uint8_t*)(msg->payload)) = ELECTIVE_6LoRH | (ipinip_length-2);
+    }
+    
+    if (rpi_length > 0){
+        //printf ("** IPHC -- RPL_HOPBYHOP_HEADER_OPTION_TYPE\n");      
+        iphc_prependIPv6HopByHopHeader(msg, msg->l4_protocol, rpl_option);
+    }
+    
+    // the RH3s already sit in front of the headers
+    if (rh3_length > 0){
+        packetfunctions_reserveHeaderSize(msg,rh3_length);
+    }
         // if there are 6LoRH in the packet, add page dispatch no.1
         if (
             (*((uint8_t*)(msg->payload)) & FORMAT_6LORH_MASK) == CRITICAL_6LORH ||
@@ -199,7 +214,8 @@ owerror_t iphc_sendFromForwarding(
             *((uint8_t*)(msg->payload)) = PAGE_DISPATCH_NO_1;
         }
        
-    return sixtop_send(msg);
+    // frag hands it to sixtop, in several fragments if needed
+    return frag_send(msg);
 }
 
 //send from bridge: 6LoWPAN header already added by OpenLBR, send as is
@@ -212,12 +228,14 @@ owerror_t iphc_sendFromBridge(OpenQueueEntry_t *msg) {
                             (errorparameter_t)0);
       return E_FAIL;
    }
-   return sixtop_send(msg);
+   return frag_send(msg);
 }
 
 void iphc_sendDone(OpenQueueEntry_t* msg, owerror_t error) {
    msg->owner = COMPONENT_IPHC;
-   if (msg->creator==COMPONENT_OPENBRIDGE) {
+   if (msg->creator==COMPONENT_FRAG) {
+      frag_sendDone(msg,error);
+   } else if (msg->creator==COMPONENT_OPENBRIDGE) {
       openbridge_sendDone(msg,error);
    } else {
       forwarding_sendDone(msg,error);
@@ -232,13 +250,45 @@ void iphc_receive(OpenQueueEntry_t* msg) {
     uint8_t              rpi_length;
     
     msg->owner      = COMPONENT_IPHC;
+    
+    // fragments are reassembled first, the datagram comes back here once complete
+    if (
+        msg->length>0 &&
+        (
+            (*((uint8_t*)(msg->payload)) & FRAG_DISPATCH_MASK) == FRAG_DISPATCH_FRAG1 ||
+            (*((uint8_t*)(msg->payload)) & FRAG_DISPATCH_MASK) == FRAG_DISPATCH_FRAGN
+        )
+    ) {
+        frag_receive(msg);
+        return;
+    }
    
     memset(&ipv6_outer_header,0,sizeof(ipv6_header_iht));
     memset(&ipv6_inner_header,0,sizeof(ipv6_header_iht));
     memset(&rpl_option,0,sizeof(rpl_option_ht));
     
     // then regular header
-    iphc_retrieveIPv6Header(msg,&ipv6_outer_header,&ipv6_inner_header,&page_length);
+    if (iphc_retrieveIPv6Header(msg,&ipv6_outer_header,&ipv6_inner_header,&page_length)==E_FAIL) {
+        // the addresses can not be decoded, drop the packet
+        openqueue_freePacketBuffer(msg);
+        return;
+    }
+    
+    // the first fragment of a datagram only goes further when it is relayed,
+    // frag reassembles the datagram otherwise
+    if (
+        frag_isFirstFragment(msg)==TRUE &&
+        (
+            (
+                idmanager_getIsDAGroot()==TRUE &&
+                packetfunctions_isBroadcastMulticast(&(ipv6_inner_header.dest))==FALSE
+            ) ||
+            forwarding_isForMe(&ipv6_outer_header,&ipv6_inner_header)==TRUE
+        )
+    ) {
+        frag_reassemble(msg);
+        return;
+    }
     
     //printf("** IPHC -- Recieving PACKET \n");
     // if the address is broadcast address, the ipv6 header is the inner header
@@ -279,6 +329,334 @@ void iphc_receive(OpenQueueEntry_t* msg) {
    }
 }
 
+/**
+\brief Measure the 6LoWPAN headers at the start of a datagram.
+
+Walks the page dispatch, the 6LoRHs and the IPHC header the same way
+iphc_retrieveIPv6Header() does, without decoding them. frag uses it to convert
+offsets in the compressed datagram it carries into offsets in the uncompressed
+IPv6 datagram, which is what the fragment headers count in.
+
+Next headers compressed with LOWPAN_NHC (the UDP header and IPv6 extension
+headers) are measured as well, and count with their uncompressed length as
+RFC4944 and RFC6282 require. An IPv6 header encapsulated with LOWPAN_NHC is
+not supported and counts as payload.
+
+\param[in]  header             The start of the datagram.
+\param[in]  length             The number of bytes available from header.
+\param[out] uncompressedLength The length of the same headers once uncompressed.
+
+\returns The length of the compressed headers.
+*/
+uint8_t iphc_getHeaderLength(uint8_t* header, uint8_t length, uint16_t* uncompressedLength) {
+    uint8_t  len;
+    uint8_t  page;
+    uint8_t  lorh_type;
+    uint8_t  size;
+    bool     rh3Present;
+    uint8_t  iphc0;
+    uint8_t  iphc1;
+    bool     nhc;
+    
+    len                 = 0;
+    page                = 0;
+    rh3Present          = FALSE;
+    *uncompressedLength = 0;
+    
+    // paging number
+    if (len<length && (header[len]&PAGE_DISPATCH_TAG) == PAGE_DISPATCH_TAG){
+        page = header[len]&PAGE_DISPATCH_NUM;
+        len += 1;
+    }
+    if (page==1){
+        // critical 6LoRHs: RH3s and RPI
+        while (len+1<length && (header[len]&FORMAT_6LORH_MASK) == CRITICAL_6LORH){
+            lorh_type = header[len+1];
+            if (lorh_type<=RH3_6LOTH_TYPE_4){
+                // all RH3 6LoRHs make up a single RH3 of 16-byte addresses
+                if (rh3Present==FALSE){
+                    *uncompressedLength += 8;
+                    rh3Present           = TRUE;
+                }
+                size                 = (header[len] & RH3_6LOTH_SIZE_MASK)+1;
+                *uncompressedLength += 16*size;
+                len                 += 2+size*RH3_6LOTH_ADDR_LEN(lorh_type);
+            } else if (lorh_type==RPI_6LOTH_TYPE){
+                // hop-by-hop header holding the RPL option
+                *uncompressedLength += 8;
+                switch(header[len] & (I_FLAG | K_FLAG)){
+                case 0:
+                    len += 2+3;
+                    break;
+                case 1:
+                case 2:
+                    len += 2+2;
+                    break;
+                case 3:
+                    len += 2+1;
+                    break;
+                }
+            } else {
+                break;
+            }
+        }
+        // IP in IP 6LoRH, stands for the outer IPv6 header
+        if (
+            len+1<length                                         &&
+            (header[len]&FORMAT_6LORH_MASK) == ELECTIVE_6LoRH    &&
+            header[len+1] == IPINIP_TYPE_6LORH
+        ){
+            *uncompressedLength += 40;
+            len                 += 2+(header[len] & IPINIP_LEN_6LORH_MASK);
+        }
+    }
+    
+    // IPHC inner header
+    if (len<length && (header[len]&PAGE_DISPATCH_TAG) == PAGE_DISPATCH_TAG){
+        len += 1;
+    }
+    if (len+1>=length || ((header[len]>>IPHC_DISPATCH) & 0x07) != IPHC_DISPATCH_IPHC){
+        return len;
+    }
+    iphc0                = header[len];
+    iphc1                = header[len+1];
+    len                 += 2;
+    *uncompressedLength += 40;
+    if (((iphc1>>IPHC_CID) & 0x01) == IPHC_CID_YES){
+        len += 1;
+    }
+    switch ((iphc0>>IPHC_TF) & 0x03){
+    case IPHC_TF_4B:
+        len += 4;
+        break;
+    case IPHC_TF_3B:
+        len += 3;
+        break;
+    case IPHC_TF_1B:
+        len += 1;
+        break;
+    default:
+        break;
+    }
+    if (((iphc0>>IPHC_NH) & 0x01) == IPHC_NH_INLINE){
+        len += 1;
+    }
+    if (((iphc0>>IPHC_HLIM) & 0x03) == IPHC_HLIM_INLINE){
+        len += 1;
+    }
+    switch ((iphc1>>IPHC_SAM) & 0x03){
+    case IPHC_SAM_128B:
+        if (((iphc1>>IPHC_SAC) & 0x01) == IPHC_SAC_STATELESS){
+            len += 16;
+        }
+        break;
+    case IPHC_SAM_64B:
+        len += 8;
+        break;
+    case IPHC_SAM_16B:
+        len += 2;
+        break;
+    default:
+        break;
+    }
+    if (((iphc1>>IPHC_M) & 0x01) == IPHC_M_NO){
+        switch ((iphc1>>IPHC_DAM) & 0x03){
+        case IPHC_DAM_128B:
+            if (((iphc1>>IPHC_DAC) & 0x01) == IPHC_DAC_STATELESS){
+                len += 16;
+            }
+            break;
+        case IPHC_DAM_64B:
+            len += 8;
+            break;
+        case IPHC_DAM_16B:
+            len += 2;
+            break;
+        default:
+            break;
+        }
+    } else if (((iphc1>>IPHC_DAC) & 0x01) == IPHC_DAC_STATELESS){
+        switch ((iphc1>>IPHC_DAM) & 0x03){
+        case IPHC_DAM_128B:
+            len += 16;
+            break;
+        case IPHC_DAM_64B:
+            len += 6;
+            break;
+        case IPHC_DAM_16B:
+            len += 4;
+            break;
+        default:
+            len += 1;
+            break;
+        }
+    } else if (((iphc1>>IPHC_DAM) & 0x03) == IPHC_DAM_128B){
+        len += 6;
+    }
+    
+    // next headers compressed with LOWPAN_NHC
+    nhc = (((iphc0>>IPHC_NH) & 0x01) == IPHC_NH_COMPRESSED);
+    while (nhc==TRUE && len<length){
+        if ((header[len] & NHC_UDP_MASK) == NHC_UDP_ID){
+            // UDP header, always the last one
+            switch (header[len] & NHC_UDP_PORTS_MASK){
+            case NHC_UDP_PORTS_INLINE:
+                size = 4;
+                break;
+            case NHC_UDP_PORTS_16S_8D:
+                size = 3;
+                break;
+            case NHC_UDP_PORTS_8S_8D:
+                size = 2;
+                break;
+            default:
+                size = 1;
+                break;
+            }
+            if ((header[len] & NHC_UDP_C_MASK) == 0){
+                // checksum in-line
+                size += 2;
+            }
+            if ((uint16_t)len+1+size>length){
+                break;
+            }
+            *uncompressedLength += 8;
+            len                 += 1+size;
+            break;
+        }
+        if (
+            (header[len] & NHC_IPv6EXT_MASK) != NHC_IPv6EXT_ID ||
+            ((header[len] & NHC_EID_MASK)>>1) == NHC_EID_IPv6_VAL
+        ){
+            break;
+        }
+        // IPv6 extension header, padded to a multiple of 8 bytes once uncompressed
+        nhc  = ((header[len] & NHC_NH_MASK) == NHC_NH_COMPRESSED);
+        size = (nhc==TRUE) ? 1 : 2;
+        if (len+size>=length || (uint16_t)len+size+1+header[len+size]>length){
+            break;
+        }
+        *uncompressedLength += ((2+header[len+size]+7)/8)*8;
+        len                 += size+1+header[len+size];
+    }
+    return len;
+}
+
+/**
+\brief Set the prefix of a 6LoWPAN context.
+
+Context 0 is always the prefix of the mote, i.e. the one set on the DAG root
+and advertised in its DIOs, so it can not be set here. The other contexts are
+set through openserial on the DAG root, and learned from the DIOs of the
+preferred parent by the other motes.
+
+\param[in] cid    The context identifier, 1 to IPHC_NUMCONTEXTS-1.
+\param[in] prefix The 8-byte prefix, NULL to remove the context.
+
+\returns E_SUCCESS if the context was set, E_FAIL otherwise.
+*/
+owerror_t iphc_setContext(uint8_t cid, uint8_t* prefix) {
+    if (cid==0 || cid>=IPHC_NUMCONTEXTS || cid>=IPHC_MAXCONTEXTS) {
+        openserial_printError(COMPONENT_IPHC,ERR_6LOWPAN_UNKNOWN_CONTEXT,
+                            (errorparameter_t)cid,
+                            (errorparameter_t)0);
+        return E_FAIL;
+    }
+    if (prefix==NULL) {
+        memset(&(iphc_vars.contexts[cid]),0,sizeof(iphc_context_t));
+    } else {
+        iphc_vars.contexts[cid].used = TRUE;
+        memcpy(iphc_vars.contexts[cid].prefix,prefix,sizeof(iphc_vars.contexts[cid].prefix));
+    }
+    return E_SUCCESS;
+}
+
+/**
+\brief Find the 6LoWPAN context holding a prefix.
+
+\param[in] prefix The prefix, of type ADDR_PREFIX.
+
+\returns The context identifier, IPHC_CONTEXT_NONE if no context holds it.
+*/
+uint8_t iphc_getContextId(open_addr_t* prefix) {
+    open_addr_t contextPrefix;
+    uint8_t     cid;
+    
+    for (cid=0;cid<IPHC_NUMCONTEXTS && cid<IPHC_MAXCONTEXTS;cid++) {
+        if (
+            iphc_getContextPrefix(cid,&contextPrefix)==TRUE &&
+            packetfunctions_sameAddress(prefix,&contextPrefix)==TRUE
+        ) {
+            return cid;
+        }
+    }
+    return IPHC_CONTEXT_NONE;
+}
+
+/**
+\brief Retrieve the prefix of a 6LoWPAN context.
+
+\param[in]  cid    The context identifier.
+\param[out] prefix Where to write the prefix, left untouched if the context is unknown.
+
+\returns TRUE if the context is known, FALSE otherwise.
+*/
+bool iphc_getContextPrefix(uint8_t cid, open_addr_t* prefix) {
+    if (cid==0) {
+        memcpy(prefix,idmanager_getMyID(ADDR_PREFIX),sizeof(open_addr_t));
+        return TRUE;
+    }
+    if (cid>=IPHC_NUMCONTEXTS || iphc_vars.contexts[cid].used==FALSE) {
+        return FALSE;
+    }
+    memset(prefix,0,sizeof(open_addr_t));
+    prefix->type = ADDR_PREFIX;
+    memcpy(prefix->prefix,iphc_vars.contexts[cid].prefix,sizeof(iphc_vars.contexts[cid].prefix));
+    return TRUE;
+}
+
+/**
+\brief Pick how to compress an address in a 6LoRH.
+
+\param[in] address   The address to compress.
+\param[in] reference The compression reference: the previous address in the
+   RH3-6LoRHs, the root for the first one and the encapsulator address.
+
+\returns The smallest RH3-6LoRH type which carries all the bytes in which both
+   addresses differ.
+*/
+uint8_t iphc_get6LoRHAddressType(open_addr_t* address, open_addr_t* reference) {
+    uint8_t type;
+    
+    for (type=RH3_6LOTH_TYPE_0;type<RH3_6LOTH_TYPE_4;type++) {
+        if (memcmp(&(address->addr_128b[0]),&(reference->addr_128b[0]),16-RH3_6LOTH_ADDR_LEN(type))==0) {
+            return type;
+        }
+    }
+    return RH3_6LOTH_TYPE_4;
+}
+
+/**
+\brief Uncompress an address carried in a 6LoRH.
+
+\param[in]  compressed The last RH3_6LOTH_ADDR_LEN(type) bytes of the address.
+\param[in]  type       The RH3-6LoRH type the address is compressed with.
+\param[in]  reference  The compression reference.
+\param[out] address    Where to write the address, may be the reference.
+*/
+void iphc_uncompress6LoRHAddress(
+      uint8_t*          compressed,
+      uint8_t           type,
+      open_addr_t*      reference,
+      open_addr_t*      address
+   ) {
+    if (address != reference) {
+        memcpy(address,reference,sizeof(open_addr_t));
+    }
+    address->type = ADDR_128B;
+    memcpy(&(address->addr_128b[16-RH3_6LOTH_ADDR_LEN(type)]),compressed,RH3_6LOTH_ADDR_LEN(type));
+}
+
 //=========================== private =========================================
 
 //===== IPv6 header
@@ -295,6 +673,7 @@ owerror_t iphc_prependIPv6Header(
       uint8_t           hlim,
       uint8_t           value_hopLimit,
       bool              cid,
+      uint8_t           value_cid,
       bool              sac,
       uint8_t           sam,
       bool              m,
@@ -506,6 +885,12 @@ owerror_t iphc_prependIPv6Header(
          return E_FAIL;
    }
    
+   // context identifier extension
+   if (cid == IPHC_CID_YES) {
+      packetfunctions_reserveHeaderSize(msg,sizeof(uint8_t));
+      *((uint8_t*)(msg->payload)) = value_cid;
+   }
+   
    // header
    temp_8b    = 0;
    temp_8b   |= cid                    << IPHC_CID;
@@ -530,7 +915,7 @@ owerror_t iphc_prependIPv6Header(
 /**
 \brief Retrieve an IPv6 header from a message.
 */
-void iphc_retrieveIPv6Header(OpenQueueEntry_t* msg, ipv6_header_iht* ipv6_outer_header, ipv6_header_iht* ipv6_inner_header,uint8_t* page_length) {
+owerror_t iphc_retrieveIPv6Header(OpenQueueEntry_t* msg, ipv6_header_iht* ipv6_outer_header, ipv6_header_iht* ipv6_inner_header,uint8_t* page_length) {
     uint8_t         temp_8b;
     open_addr_t     temp_addr_16b;
     open_addr_t     temp_addr_64b;
@@ -576,15 +961,8 @@ void iphc_retrieveIPv6Header(OpenQueueEntry_t* msg, ipv6_header_iht* ipv6_outer_
         while ((temp_8b&FORMAT_6LORH_MASK) == CRITICAL_6LORH){
             lorh_type = *((uint8_t*)(msg->payload)+*page_length+extention_header_length+1);
             if(lorh_type<=RH3_6LOTH_TYPE_4){
-                if (rh3_index == MAXNUM_RH3){
-                    openserial_printError(
-                        COMPONENT_IPHC,
-                        ERR_6LOWPAN_UNSUPPORTED,
-                        (errorparameter_t)13,
-                        (errorparameter_t)(rh3_index)
-                    );
-                    return;
-                }
+                // consecutive RH3-6LoRHs of different sizes make up a single RH3,
+                // which starts at the first one
                 if (rh3_index==0){
                     if (ipv6_outer_header->hopByhop_option == NULL){
                         ipv6_outer_header->next_header = IANA_IPv6ROUTE;
@@ -593,25 +971,10 @@ void iphc_retrieveIPv6Header(OpenQueueEntry_t* msg, ipv6_header_iht* ipv6_outer_
                                     *page_length + \
                                     extention_header_length;
                 }
+                rh3_index++;
                 size = temp_8b & RH3_6LOTH_SIZE_MASK;
                 size += 1;
-                switch(lorh_type){
-                case 0:
-                    extention_header_length += 2+ 1*size;
-                    break;
-                case 1:
-                    extention_header_length += 2+ 2*size;
-                    break;
-                case 2:
-                    extention_header_length += 2+ 4*size;
-                    break;
-                case 3:
-                    extention_header_length += 2+ 8*size;
-                    break;
-                case 4:
-                    extention_header_length += 2+ 16*size;
-                    break;
-                }
+                extention_header_length += 2+RH3_6LOTH_ADDR_LEN(lorh_type)*size;
                 temp_8b = *(uint8_t*)((msg->payload) + \
                                *page_length + \
                                extention_header_length);
@@ -646,6 +1009,7 @@ void iphc_retrieveIPv6Header(OpenQueueEntry_t* msg, ipv6_header_iht* ipv6_outer_
                         (errorparameter_t)14,
                         (errorparameter_t)(lorh_type)
                    );
+                   return E_FAIL;
                }
            }
        }
@@ -668,37 +1032,13 @@ void iphc_retrieveIPv6Header(OpenQueueEntry_t* msg, ipv6_header_iht* ipv6_outer_
                   // update destination address if necessary after the processing
                   ipv6_outer_header->dest.type = ADDR_NONE;
                   memset(&(ipv6_outer_header->dest.addr_128b[0]),0,16);
-                  if (ipinip_length == 1){
-                      // source address is root
-                      memset(&(ipv6_outer_header->src),0,sizeof(open_addr_t));
-                      ipv6_outer_header->src.type = ADDR_128B;
-                      ipv6_outer_header->src.addr_128b[0]  = 0xbb;
-                      ipv6_outer_header->src.addr_128b[1]  = 0xbb;
-                      ipv6_outer_header->src.addr_128b[15] = 0x01;
-                      // destination address is the first address in RH3 6LoRH OR dest adress in IPHC
-                  } else{
-                      switch(ipinip_length-1){
-                      case 16:
-                           // this is source address 
-                           packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_outer_header->header_length+*page_length+extention_header_length)),ADDR_128B,&ipv6_outer_header->src,OW_BIG_ENDIAN);
-                           ipv6_outer_header->header_length += 16*sizeof(uint8_t);
-                           break;
-                      case 8:
-                           // this is source address 
-                           packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_outer_header->header_length+*page_length+extention_header_length)),ADDR_64B,&temp_addr_64b,OW_BIG_ENDIAN);
-                           ipv6_outer_header->header_length += 8*sizeof(uint8_t);
-                           packetfunctions_mac64bToIp128b(idmanager_getMyID(ADDR_PREFIX),&temp_addr_64b,&ipv6_outer_header->src);
-                           break;
-                      default:
-                           // do not support other length yet and destination address will be in RH3 or IPHC
-                           openserial_printError(
-                              COMPONENT_IPHC,
-                              ERR_6LOWPAN_UNSUPPORTED,
-                              (errorparameter_t)12,
-                              (errorparameter_t)(ipinip_length-1)
-                           );
-                      }
-                  }
+                  // source address, the root if elided
+                  // destination address is the first address in RH3 6LoRH OR dest adress in IPHC
+                  ipv6_outer_header->header_length += iphc_retrieveEncapsulatorAddress(
+                      (uint8_t*)(msg->payload+ipv6_outer_header->header_length+*page_length+extention_header_length),
+                      ipinip_length,
+                      &(ipv6_outer_header->src)
+                  );
               } else {
                   // don't defined yet
                   openserial_printError(
@@ -714,7 +1054,7 @@ void iphc_retrieveIPv6Header(OpenQueueEntry_t* msg, ipv6_header_iht* ipv6_outer_
           }
     }
     //======================= 4. IPHC inner header =============================
-    iphc_retrieveIphcHeader(
+    return iphc_retrieveIphcHeader(
         &temp_addr_16b, 
         &temp_addr_64b,
         &dispatch,
@@ -730,7 +1070,7 @@ void iphc_retrieveIPv6Header(OpenQueueEntry_t* msg, ipv6_header_iht* ipv6_outer_
     );
 }
 
-uint8_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
+owerror_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
     open_addr_t*         temp_addr_64b,
     uint8_t*             dispatch,
     uint8_t*             tf,
@@ -746,6 +1086,13 @@ uint8_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
     uint8_t page;
     uint8_t temp_8b;
     uint8_t ipinip_length;
+    bool    cid;
+    bool    sac;
+    bool    dac;
+    uint8_t sci;
+    uint8_t dci;
+    open_addr_t srcPrefix;
+    open_addr_t destPrefix;
     
     temp_8b = *((uint8_t*)(msg->payload)+ipv6_header->header_length+previousLen);
     
@@ -768,15 +1115,46 @@ uint8_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
         *hlim      = (temp_8b >> IPHC_HLIM)      & 0x03;   // 2b
         ipv6_header->header_length += sizeof(uint8_t);
         temp_8b    = *((uint8_t*)(msg->payload)+ipv6_header->header_length+previousLen);
-       // cid unused
-       // sac unused
+       cid        = (temp_8b >> IPHC_CID)       & 0x01;   // 1b
+       sac        = (temp_8b >> IPHC_SAC)       & 0x01;   // 1b
        *sam       = (temp_8b >> IPHC_SAM)       & 0x03;   // 2b
-       // m unused
        *m         = (temp_8b >> IPHC_M)         & 0x01;   // 1b
-       // dac unused
+       dac        = (temp_8b >> IPHC_DAC)       & 0x01;   // 1b
        *dam       = (temp_8b >> IPHC_DAM)       & 0x03;   // 2b
        ipv6_header->header_length += sizeof(uint8_t);
        
+       // context identifiers, context 0 when elided
+       sci        = 0;
+       dci        = 0;
+       if (cid == IPHC_CID_YES) {
+          temp_8b = *((uint8_t*)(msg->payload)+ipv6_header->header_length+previousLen);
+          sci     = (temp_8b >> 4)              & 0x0f;   // 4b
+          dci     = (temp_8b >> 0)              & 0x0f;   // 4b
+          ipv6_header->header_length += sizeof(uint8_t);
+       }
+       
+       // prefixes of the compressed addresses, stateless ones use the prefix of the mote
+       memcpy(&srcPrefix, idmanager_getMyID(ADDR_PREFIX),sizeof(open_addr_t));
+       memcpy(&destPrefix,idmanager_getMyID(ADDR_PREFIX),sizeof(open_addr_t));
+       if (sac == IPHC_SAC_STATEFUL && iphc_getContextPrefix(sci,&srcPrefix)==FALSE) {
+          openserial_printError(
+             COMPONENT_IPHC,
+             ERR_6LOWPAN_UNKNOWN_CONTEXT,
+             (errorparameter_t)sci,
+             (errorparameter_t)1
+          );
+          return E_FAIL;
+       }
+       if (*m == IPHC_M_NO && dac == IPHC_DAC_STATEFUL && iphc_getContextPrefix(dci,&destPrefix)==FALSE) {
+          openserial_printError(
+             COMPONENT_IPHC,
+             ERR_6LOWPAN_UNKNOWN_CONTEXT,
+             (errorparameter_t)dci,
+             (errorparameter_t)2
+          );
+          return E_FAIL;
+       }
+       
        // dispatch
        switch (*dispatch) {
           case IPHC_DISPATCH_IPHC:
@@ -874,20 +1252,26 @@ uint8_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
        // source address
        switch (*sam) {
           case IPHC_SAM_ELIDED:
-             packetfunctions_mac64bToIp128b(idmanager_getMyID(ADDR_PREFIX),&(msg->l2_nextORpreviousHop),&ipv6_header->src);
+             packetfunctions_mac64bToIp128b(&srcPrefix,&(msg->l2_nextORpreviousHop),&ipv6_header->src);
              break;
           case IPHC_SAM_16B:
              packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_header->header_length+previousLen)),ADDR_16B,temp_addr_16b,OW_BIG_ENDIAN);
              ipv6_header->header_length += 2*sizeof(uint8_t);
              packetfunctions_mac16bToMac64b(temp_addr_16b,temp_addr_64b);
-             packetfunctions_mac64bToIp128b(idmanager_getMyID(ADDR_PREFIX),temp_addr_64b,&ipv6_header->src);
+             packetfunctions_mac64bToIp128b(&srcPrefix,temp_addr_64b,&ipv6_header->src);
              break;
           case IPHC_SAM_64B:
              packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_header->header_length+previousLen)),ADDR_64B,temp_addr_64b,OW_BIG_ENDIAN);
              ipv6_header->header_length += 8*sizeof(uint8_t);
-             packetfunctions_mac64bToIp128b(idmanager_getMyID(ADDR_PREFIX),temp_addr_64b,&ipv6_header->src);
+             packetfunctions_mac64bToIp128b(&srcPrefix,temp_addr_64b,&ipv6_header->src);
              break;
           case IPHC_SAM_128B:
+             if (sac == IPHC_SAC_STATEFUL) {
+                // the unspecified address
+                memset(&(ipv6_header->src),0,sizeof(open_addr_t));
+                ipv6_header->src.type = ADDR_128B;
+                break;
+             }
              packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_header->header_length+previousLen)),ADDR_128B,&ipv6_header->src,OW_BIG_ENDIAN);
              ipv6_header->header_length += 16*sizeof(uint8_t);
              break;
@@ -931,20 +1315,30 @@ uint8_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
        } else {
            switch (*dam) {
               case IPHC_DAM_ELIDED:
-                 packetfunctions_mac64bToIp128b(idmanager_getMyID(ADDR_PREFIX),idmanager_getMyID(ADDR_64B),&(ipv6_header->dest));
+                 packetfunctions_mac64bToIp128b(&destPrefix,idmanager_getMyID(ADDR_64B),&(ipv6_header->dest));
                  break;
               case IPHC_DAM_16B:
                  packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_header->header_length+previousLen)),ADDR_16B,temp_addr_16b,OW_BIG_ENDIAN);
                  ipv6_header->header_length += 2*sizeof(uint8_t);
                  packetfunctions_mac16bToMac64b(temp_addr_16b,temp_addr_64b);
-                 packetfunctions_mac64bToIp128b(idmanager_getMyID(ADDR_PREFIX),temp_addr_64b,&ipv6_header->dest);
+                 packetfunctions_mac64bToIp128b(&destPrefix,temp_addr_64b,&ipv6_header->dest);
                  break;
               case IPHC_DAM_64B:
                  packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_header->header_length+previousLen)),ADDR_64B,temp_addr_64b,OW_BIG_ENDIAN);
                  ipv6_header->header_length += 8*sizeof(uint8_t);
-                 packetfunctions_mac64bToIp128b(idmanager_getMyID(ADDR_PREFIX),temp_addr_64b,&ipv6_header->dest);
+                 packetfunctions_mac64bToIp128b(&destPrefix,temp_addr_64b,&ipv6_header->dest);
                  break;
               case IPHC_DAM_128B:
+                 if (dac == IPHC_DAC_STATEFUL) {
+                    // reserved
+                    openserial_printError(
+                       COMPONENT_IPHC,
+                       ERR_6LOWPAN_UNSUPPORTED,
+                       (errorparameter_t)10,
+                       (errorparameter_t)(*dam)
+                    );
+                    break;
+                 }
                  packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_header->header_length+previousLen)),ADDR_128B,&ipv6_header->dest,OW_BIG_ENDIAN);
                  ipv6_header->header_length += 16*sizeof(uint8_t);
                  break;
@@ -976,37 +1370,13 @@ uint8_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
                     // update destination address if necessary after the processing
                     ipv6_header->dest.type = ADDR_NONE;
                     memset(&(ipv6_header->dest.addr_128b[0]),0,16);
-                    if (ipinip_length == 1){
-                        // source address is root
-                        memset(&(ipv6_header->src),0,sizeof(open_addr_t));
-                        ipv6_header->src.type = ADDR_128B;
-                        ipv6_header->src.addr_128b[0]  = 0xbb;
-                        ipv6_header->src.addr_128b[1]  = 0xbb;
-                        ipv6_header->src.addr_128b[15] = 0x01;
-                        // destination address is the first address in RH3 6LoRH OR dest adress in IPHC
-                    } else{
-                        switch(ipinip_length-1){
-                        case 16:
-                             // this is source address 
-                             packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_header->header_length+previousLen)),ADDR_128B,&ipv6_header->src,OW_BIG_ENDIAN);
-                             ipv6_header->header_length += 16*sizeof(uint8_t);
-                             break;
-                        case 8:
-                             // this is source address 
-                             packetfunctions_readAddress(((uint8_t*)(msg->payload+ipv6_header->header_length+previousLen)),ADDR_64B,temp_addr_64b,OW_BIG_ENDIAN);
-                             ipv6_header->header_length += 8*sizeof(uint8_t);
-                             packetfunctions_mac64bToIp128b(idmanager_getMyID(ADDR_PREFIX),temp_addr_64b,&ipv6_header->src);
-                             break;
-                        default:
-                             // do not support other length yet and destination address will be in RH3 or IPHC
-                             openserial_printError(
-                                COMPONENT_IPHC,
-                                ERR_6LOWPAN_UNSUPPORTED,
-                                (errorparameter_t)12,
-                                (errorparameter_t)(ipinip_length-1)
-                             );
-                        }
-                    }
+                    // source address, the root if elided
+                    // destination address is the first address in RH3 6LoRH OR dest adress in IPHC
+                    ipv6_header->header_length += iphc_retrieveEncapsulatorAddress(
+                        (uint8_t*)(msg->payload+ipv6_header->header_length+previousLen),
+                        ipinip_length,
+                        &(ipv6_header->src)
+                    );
                 }
 
             } else {
@@ -1015,11 +1385,85 @@ uint8_t iphc_retrieveIphcHeader(open_addr_t* temp_addr_16b,
             }
         }
     }
-    return page;
+    return E_SUCCESS;
+}
+
+//===== 6LoRH
+
+/**
+\brief Retrieve the address of the root, i.e. the DODAGID.
+
+It is the encapsulator address when the IP-in-IP 6LoRH elides it, and the
+reference the encapsulator address is compressed against otherwise.
+
+\param[out] root Where to write the address.
+*/
+void iphc_getRootAddress(open_addr_t* root) {
+    memset(root,0,sizeof(open_addr_t));
+    root->type = ADDR_128B;
+    icmpv6rpl_getRPLDODAGid(&(root->addr_128b[0]));
+}
+
+/**
+\brief Retrieve the encapsulator address of an IP-in-IP 6LoRH.
+
+\param[in]  address       Start of the compressed address, after the hop limit.
+\param[in]  ipinip_length The length field of the IP-in-IP 6LoRH.
+\param[out] src           Where to write the encapsulator address.
+
+\returns The number of bytes the compressed address takes.
+*/
+uint8_t iphc_retrieveEncapsulatorAddress(
+      uint8_t*          address,
+      uint8_t           ipinip_length,
+      open_addr_t*      src
+   ) {
+    uint8_t type;
+    
+    iphc_getRootAddress(src);
+    if (ipinip_length <= 1) {
+        // elided, this is the root
+        return 0;
+    }
+    for (type=RH3_6LOTH_TYPE_0;type<=RH3_6LOTH_TYPE_4;type++) {
+        if (ipinip_length-1 == RH3_6LOTH_ADDR_LEN(type)) {
+            iphc_uncompress6LoRHAddress(address,type,src,src);
+            return RH3_6LOTH_ADDR_LEN(type);
+        }
+    }
+    // skip it, destination address will be in RH3 or IPHC
+    openserial_printError(
+        COMPONENT_IPHC,
+        ERR_6LOWPAN_UNSUPPORTED,
+        (errorparameter_t)12,
+        (errorparameter_t)(ipinip_length-1)
+    );
+    return ipinip_length-1;
 }
 
 //===== IPv6 hop-by-hop header
 
+/**
+\brief Length of the RPI 6LoRH iphc_prependIPv6HopByHopHeader() writes.
+
+\param[in] rpl_option The RPL option to include.
+*/
+uint8_t iphc_getIPv6HopByHopHeaderLength(rpl_option_ht* rpl_option) {
+   uint8_t length;
+   
+   // 6LoRH flags and type
+   length = sizeof(uint16_t);
+   if ((rpl_option->flags & I_FLAG) == 0){
+      length += sizeof(uint8_t);
+   }
+   if ((rpl_option->flags & K_FLAG) == 0){
+      length += sizeof(uint16_t);
+   } else {
+      length += sizeof(uint8_t);
+   }
+   return length;
+}
+
 /**
 \brief Prepend an IPv6 hop-by-hop header to a message.
 
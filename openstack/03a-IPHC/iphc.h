@@ -16,6 +16,18 @@
 #define IPv6HOP_HDR_LEN           2  // tengfei: should be 2
 #define MAXNUM_RH3                3
 
+// the following can be overwritten in board_info.h
+
+// number of 6LoWPAN contexts (RFC6282 section 3.1.2), context 0 included.
+// Context 0 is the network prefix, known to all motes. The other ones are set
+// on the DAG root through the serial port (COMMAND_SET_6LOWPAN_CONTEXT) and
+// advertised in the DIOs, see icmpv6rpl_updateContexts().
+#ifndef IPHC_NUMCONTEXTS
+#define IPHC_NUMCONTEXTS          4
+#endif
+#define IPHC_MAXCONTEXTS          16 // 4-bit SCI/DCI
+#define IPHC_CONTEXT_NONE         0xff
+
 enum IPHC_enums {
    IPHC_DISPATCH             = 5,
    IPHC_TF                   = 3,
@@ -68,7 +80,7 @@ enum NHC_NH_enums {
 };
 
 enum NHC_UDP_enums {
-   NHC_UDP_C_MASK            = 0x40,
+   NHC_UDP_C_MASK            = 0x04,
    NHC_UDP_PORTS_MASK        = 0x03,
 };
 
@@ -146,6 +158,12 @@ enum IPINIP_LEN_6LORH_enums {
 //     |    3      |       8              |
 //     |    4      |      16              |
 //     +-----------+----------------------+
+//
+// The same lengths are used for the encapsulator address of the IP-in-IP
+// 6LoRH. A compressed address is the last bytes of the address, the others
+// are the ones of the compression reference.
+
+#define RH3_6LOTH_ADDR_LEN(type)  (1<<(type))
 
 enum TYPE_6LORH_enums{
     RH3_6LOTH_TYPE_0         = 0x00, 
@@ -224,8 +242,17 @@ typedef struct {
 } rpl_option_ht;
 END_PACK
 
+typedef struct {
+   bool        used;
+   uint8_t     prefix[8];
+} iphc_context_t;
+
 //=========================== variables =======================================
 
+typedef struct {
+   iphc_context_t contexts[IPHC_NUMCONTEXTS]; // contexts[0] unused, context 0 is the prefix of the mote
+} iphc_vars_t;
+
 //=========================== prototypes ======================================
 
 void          iphc_init(void);
@@ -235,13 +262,27 @@ owerror_t     iphc_sendFromForwarding(
    ipv6_header_iht*     ipv6_inner_header, 
    rpl_option_ht*       rpl_option, 
    uint32_t*            flow_label,
-   uint8_t*             rh3_copy,
+   uint8_t*             rh3,
    uint8_t              rh3_length,
    uint8_t              fw_SendOrfw_Rcv
 );
 owerror_t     iphc_sendFromBridge(OpenQueueEntry_t *msg);
 void          iphc_sendDone(OpenQueueEntry_t *msg, owerror_t error);
 void          iphc_receive(OpenQueueEntry_t *msg);
+// called by frag to convert fragment offsets
+uint8_t       iphc_getHeaderLength(uint8_t* header, uint8_t length, uint16_t* uncompressedLength);
+// 6LoWPAN contexts
+owerror_t     iphc_setContext(uint8_t cid, uint8_t* prefix);
+uint8_t       iphc_getContextId(open_addr_t* prefix);
+bool          iphc_getContextPrefix(uint8_t cid, open_addr_t* prefix);
+// called by forwarding for the addresses in RH3-6LoRHs
+uint8_t       iphc_get6LoRHAddressType(open_addr_t* address, open_addr_t* reference);
+void          iphc_uncompress6LoRHAddress(
+   uint8_t*             compressed,
+   uint8_t              type,
+   open_addr_t*         reference,
+   open_addr_t*         address
+);
 // called by forwarding when IPHC inner header required
 owerror_t iphc_prependIPv6Header(
    OpenQueueEntry_t*    msg,
@@ -252,6 +293,7 @@ owerror_t iphc_prependIPv6Header(
    uint8_t              hlim,
    uint8_t              value_hopLimit,
    bool                 cid,
+   uint8_t              value_cid,
    bool                 sac,
    uint8_t              sam,
    bool                 m,
@@ -5,6 +5,7 @@
 #include "iphc.h"
 #include "idmanager.h"
 #include "openqueue.h"
+#include "openhdlc.h"
 
 //=========================== variables =======================================
 
@@ -15,17 +16,15 @@ void openbridge_init() {
 }
 
 void openbridge_triggerData() {
-   uint8_t           input_buffer[136];//worst case: 8B of next hop + 128B of data
+   uint8_t           input_buffer[SERIAL_INPUT_BUFFER_SIZE];//8B of next hop + data
    OpenQueueEntry_t* pkt;
    uint8_t           numDataBytes;
   
    numDataBytes = openserial_getNumDataBytes();
   
-   //poipoi xv
-   //this is a temporal workaround as we are never supposed to get chunks of data
-   //longer than input buffer size.. I assume that HDLC will solve that.
-   // MAC header is 13B + 8 next hop so we cannot accept packets that are longer than 118B
-   if (numDataBytes>(136 - 10/*21*/) || numDataBytes<8){
+   // datagrams longer than a frame are sent in fragments, so the data is only
+   // bounded by the serial input buffer
+   if (numDataBytes>sizeof(input_buffer) || numDataBytes<8){
    //to prevent too short or too long serial frames to kill the stack  
        openserial_printError(COMPONENT_OPENBRIDGE,ERR_INPUTBUFFER_LENGTH,
                    (errorparameter_t)numDataBytes,
@@ -37,7 +36,7 @@ void openbridge_triggerData() {
    openserial_getInputBuffer(&(input_buffer[0]),numDataBytes);
   
    if (idmanager_getIsDAGroot()==TRUE && numDataBytes>0) {
-      pkt = openqueue_getFreePacketBuffer(COMPONENT_OPENBRIDGE);
+      pkt = openqueue_getFreePacketBufferForLength(COMPONENT_OPENBRIDGE,numDataBytes-8);
       if (pkt==NULL) {
          openserial_printError(COMPONENT_OPENBRIDGE,ERR_NO_FREE_PACKET_BUFFER,
                                (errorparameter_t)0,
@@ -81,6 +80,8 @@ void openbridge_sendDone(OpenQueueEntry_t* msg, owerror_t error) {
 \brief Receive a frame at the openbridge, which sends it out over serial.
 */
 void openbridge_receive(OpenQueueEntry_t* msg) {
+   uint16_t escapedLength;
+   uint8_t  i;
    
    // prepend previous hop
    packetfunctions_reserveHeaderSize(msg,LENGTH_ADDR64b);
@@ -90,6 +91,23 @@ void openbridge_receive(OpenQueueEntry_t* msg) {
    packetfunctions_reserveHeaderSize(msg,LENGTH_ADDR64b);
    memcpy(msg->payload,idmanager_getMyID(ADDR_64B)->addr_64b,LENGTH_ADDR64b);
    
+   // a reassembled datagram may not fit in the serial output buffer once escaped
+   escapedLength = OPENBRIDGE_SERIAL_OVERHEAD;
+   for (i=0;i<msg->length;i++) {
+      if (msg->payload[i]==HDLC_FLAG || msg->payload[i]==HDLC_ESCAPE) {
+         escapedLength += 2;
+      } else {
+         escapedLength += 1;
+      }
+   }
+   if (escapedLength>SERIAL_OUTPUT_BUFFER_SIZE) {
+      openserial_printError(COMPONENT_OPENBRIDGE,ERR_INPUTBUFFER_LENGTH,
+                            (errorparameter_t)msg->length,
+                            (errorparameter_t)1);
+      openqueue_freePacketBuffer(msg);
+      return;
+   }
+   
    // send packet over serial (will be memcopied into serial buffer)
    openserial_printData((uint8_t*)(msg->payload),msg->length);
    
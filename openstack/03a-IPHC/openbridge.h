@@ -10,6 +10,9 @@
 
 //=========================== define ==========================================
 
+// serial frame overhead around the data: flags, header and CRC, all escaped
+#define OPENBRIDGE_SERIAL_OVERHEAD     (2+2*(1+2+5)+2*2)
+
 //=========================== typedef =========================================
 
 //=========================== variables =======================================
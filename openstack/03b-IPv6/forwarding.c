@@ -15,6 +15,8 @@
 
 //=========================== variables =======================================
 
+forwarding_vars_t forwarding_vars;
+
 //=========================== prototypes ======================================
 
 void      forwarding_getNextHop(
@@ -42,9 +44,6 @@ void      forwarding_createRplOption(
 
 // Declaration of outer functions
 
-bool isRoute(open_addr_t* destinadd);
-uint8_t posRoute(open_addr_t* destinadd);
-
 uint8_t iphc_retrieveIPv6HopByHopHeader(
    OpenQueueEntry_t*    msg,
    rpl_option_ht*       rpl_option
@@ -57,6 +56,7 @@ uint8_t iphc_retrieveIPv6HopByHopHeader(
 \brief Initialize this module.
 */
 void forwarding_init() {
+   memset(&forwarding_vars,0,sizeof(forwarding_vars_t));
 }
 
 /**
@@ -84,11 +84,17 @@ owerror_t forwarding_send(OpenQueueEntry_t* msg) {
     uint8_t              sam;
     uint8_t              m;
     uint8_t              dam;
+    bool                 sac;
+    bool                 dac;
+    uint8_t              sci;
+    uint8_t              dci;
 
     // take ownership over the packet
     msg->owner                = COMPONENT_FORWARDING;
 
     m   = IPHC_M_NO;
+    sac = IPHC_SAC_STATELESS;
+    dac = IPHC_DAC_STATELESS;
 
     // retrieve my prefix and EUI64
     myprefix                  = idmanager_getMyID(ADDR_PREFIX);
@@ -119,6 +125,9 @@ owerror_t forwarding_send(OpenQueueEntry_t* msg) {
     packetfunctions_ip128bToMac64b(&(msg->l3_destinationAdd),&temp_dest_prefix,&temp_dest_mac64b);
     //xv poipoi -- get the src prefix as well
     packetfunctions_ip128bToMac64b(&(msg->l3_sourceAdd),&temp_src_prefix,&temp_src_mac64b);
+    // prefixes with a 6LoWPAN context are elided, context 0 being my prefix
+    sci = iphc_getContextId(&temp_src_prefix);
+    dci = iphc_getContextId(&temp_dest_prefix);
     //XV -poipoi we want to check if the source address prefix is the same as destination prefix
     if (packetfunctions_sameAddress(&temp_dest_prefix,&temp_src_prefix)) {
          // same prefix use 64B address
@@ -126,17 +135,33 @@ owerror_t forwarding_send(OpenQueueEntry_t* msg) {
          dam = IPHC_DAM_64B;
          p_dest = &temp_dest_mac64b;      
          p_src  = &temp_src_mac64b; 
+         if (sci!=IPHC_CONTEXT_NONE) {
+             sac = IPHC_SAC_STATEFUL;
+             dac = IPHC_DAC_STATEFUL;
+         }
     } else {
         //not the same prefix. so the packet travels to another network
         //check if this is a source routing pkt. in case it is then the DAM is elided as it is in the SrcRouting header.
         if (packetfunctions_isBroadcastMulticast(&(msg->l3_destinationAdd))==FALSE){
-            sam = IPHC_SAM_128B;
-            dam = IPHC_DAM_128B;
-            p_dest = &(msg->l3_destinationAdd);
-            p_src = &(msg->l3_sourceAdd);
+            if (sci!=IPHC_CONTEXT_NONE) {
+                sac    = IPHC_SAC_STATEFUL;
+                sam    = IPHC_SAM_64B;
+                p_src  = &temp_src_mac64b;
+            } else {
+                sam    = IPHC_SAM_128B;
+                p_src  = &(msg->l3_sourceAdd);
+            }
+            if (dci!=IPHC_CONTEXT_NONE) {
+                dac    = IPHC_DAC_STATEFUL;
+                dam    = IPHC_DAM_64B;
+                p_dest = &temp_dest_mac64b;
+            } else {
+                dam    = IPHC_DAM_128B;
+                p_dest = &(msg->l3_destinationAdd);
+            }
             
             ipv6_outer_header.src.type = ADDR_128B;
-            memcpy(&ipv6_outer_header.src,p_src,sizeof(open_addr_t));
+            memcpy(&ipv6_outer_header.src,&(msg->l3_sourceAdd),sizeof(open_addr_t));
             ipv6_outer_header.hop_limit = IPHC_DEFAULT_HOP_LIMIT;
         } else {
            // this is DIO, source address elided, multicast bit is set
@@ -147,6 +172,13 @@ owerror_t forwarding_send(OpenQueueEntry_t* msg) {
             p_src = &(msg->l3_sourceAdd);
         }
     }
+    // the context identifier extension is only needed for contexts other than 0
+    if (sac==IPHC_SAC_STATELESS) {
+        sci = 0;
+    }
+    if (dac==IPHC_DAC_STATELESS) {
+        dci = 0;
+    }
     //IPHC inner header and NHC IPv6 header will be added at here
     iphc_prependIPv6Header(msg,
                 IPHC_TF_ELIDED,
@@ -155,11 +187,12 @@ owerror_t forwarding_send(OpenQueueEntry_t* msg) {
                 msg->l4_protocol, 
                 IPHC_HLIM_64,
                 ipv6_outer_header.hop_limit,
-                IPHC_CID_NO,
-                IPHC_SAC_STATELESS,
+                (sci!=0 || dci!=0) ? IPHC_CID_YES : IPHC_CID_NO,
+                (sci<<4) | dci,
+                sac,
                 sam,
                 m,
-                IPHC_DAC_STATELESS,
+                dac,
                 dam,
                 p_dest,
                 p_src,            
@@ -284,15 +317,7 @@ void forwarding_receive(
     
     //printf ("** Packet -- ipv6_outer_header->next_header -- %X\n",ipv6_outer_header->next_header);
     
-    if (
-        (
-            idmanager_isMyAddress(&(msg->l3_destinationAdd))
-            ||
-            packetfunctions_isBroadcastMulticast(&(msg->l3_destinationAdd))
-        )
-        &&
-        ipv6_outer_header->next_header!=IANA_IPv6ROUTE
-    ) {
+    if (forwarding_isForMe(ipv6_outer_header,ipv6_inner_header)==TRUE) {
         //printf("** Forwarding -- THIS IS FOR ME!!!!\n");
         
         if (ipv6_outer_header->src.type != ADDR_NONE){
@@ -431,24 +456,83 @@ void forwarding_receive(
                     (errorparameter_t)0,
                     (errorparameter_t)0
                 );
+                openqueue_freePacketBuffer(msg);
             }
             
         }
     }
 }
 
+/**
+\brief Tell whether a received packet is for this mote, or is to be relayed.
+
+\param[in] ipv6_outer_header The outer IPv6 header of the packet.
+\param[in] ipv6_inner_header The inner IPv6 header of the packet.
+
+\returns TRUE if the packet is for this mote, FALSE if it is to be relayed.
+*/
+bool forwarding_isForMe(ipv6_header_iht* ipv6_outer_header, ipv6_header_iht* ipv6_inner_header) {
+   return (
+      (
+         idmanager_isMyAddress(&(ipv6_inner_header->dest))
+         ||
+         packetfunctions_isBroadcastMulticast(&(ipv6_inner_header->dest))
+      )
+      &&
+      ipv6_outer_header->next_header!=IANA_IPv6ROUTE
+   );
+}
+
+/**
+\brief Forget all cached next hops.
+
+Call this function whenever a change in the neighbor or routing table may
+change the next hop towards some destination, e.g. a new preferred parent or
+a route (re-)announced in a DAO.
+*/
+void forwarding_flushRouteCache() {
+   uint8_t i;
+   
+   for (i=0;i<FORWARDING_ROUTECACHE_SIZE;i++) {
+      forwarding_vars.routeCache[i].used = FALSE;
+   }
+   forwarding_vars.routeCacheStats.numFlushes++;
+}
+
+/**
+\brief Trigger this module to print status information, over serial.
+
+debugPrint_* functions are used by the openserial module to continuously print
+status information about several modules in the OpenWSN stack.
+
+\returns TRUE if this function printed something, FALSE otherwise.
+*/
+bool debugPrint_routeCache() {
+   openserial_printStatus(
+      STATUS_ROUTECACHE,
+      (uint8_t*)&forwarding_vars.routeCacheStats,
+      sizeof(forwarding_routeCacheStats_t)
+   );
+   return TRUE;
+}
+
 //=========================== private =========================================
 
 /**
 \brief Retrieve the next hop's address from routing table.
 
+The next hop of the last few unicast destinations is cached, so packets of the
+same flow skip the neighbor and routing table lookups.
+
 \param[in]  destination128b  Final IPv6 destination address.
 \param[out] addressToWrite64b Location to write the EUI64 of next hop to.
 */
 void forwarding_getNextHop(open_addr_t* destination128b, open_addr_t* addressToWrite64b) {
    uint8_t         i;
    open_addr_t     temp_prefix64btoWrite;
-   uint8_t         posi;
+   forwarding_routeCacheEntry_t* entry;
+   uint16_t        numFlushes;
+   INTERRUPT_DECLARATION();
    
    // Routing Table next hop //**
    if (packetfunctions_isBroadcastMulticast(destination128b)) {
@@ -457,34 +541,54 @@ void forwarding_getNextHop(open_addr_t* destination128b, open_addr_t* addressToW
       for (i=0;i<8;i++) {
          addressToWrite64b->addr_64b[i] = 0xff;
       }
-   } else if (neighbors_isStableNeighbor(destination128b)) {
+      return;
+   }
+   
+   // look the destination up in the cache
+   for (i=0;i<FORWARDING_ROUTECACHE_SIZE;i++) {
+      entry = &forwarding_vars.routeCache[i];
+      if (
+            entry->used==TRUE &&
+            memcmp(entry->destination,destination128b->addr_128b,LENGTH_ADDR128b)==0
+         ) {
+         addressToWrite64b->type = ADDR_64B;
+         memcpy(addressToWrite64b->addr_64b,entry->nextHop,LENGTH_ADDR64b);
+         forwarding_vars.routeCacheStats.numHits++;
+         return;
+      }
+   }
+   forwarding_vars.routeCacheStats.numMisses++;
+   numFlushes = forwarding_vars.routeCacheStats.numFlushes;
+   
+   if (neighbors_isStableNeighbor(destination128b)) {
       // IP destination is 1-hop neighbor, send directly
       //printf("** Forwarding -- FORWARDING-HEY-NEIGHBOR!!!\n");
       packetfunctions_ip128bToMac64b(destination128b,&temp_prefix64btoWrite,addressToWrite64b);
       
-   } else if ((isRoute(destination128b)) && (RPLMODE==1)) {
+   } else if ((RPLMODE==1) && routes_getNextHop(destination128b,addressToWrite64b)) {
      //printf("** Forwarding -- ROUTING-STORING-MODE!!!\n");
      // IP destination is more than 1-hop -- Routing Table -- Storing Mode
-     posi = posRoute(destination128b);
-     addressToWrite64b->type = ADDR_64B;
-     //printf("** Forwarding -- ROUTING-STORING-MODE -Next-Hop- ");
-     for (i=0;i<LENGTH_ADDR64b;i++) {
-        //printf(" %X",(&routes_vars.routes[posi].addr_64b)->addr_64b[i]);  
-        addressToWrite64b->addr_64b[i]=(&routes_vars.routes[posi].addr_64b)->addr_64b[i];
-     }
-     //printf ("\n");
-     //printf("** Forwarding -- ROUTING-STORING-MODE -Destination- ");
-     //for (i=0;i<LENGTH_ADDR128b;i++) {
-     //   printf(" %X",(&routes_vars.routes[posi].destination)->addr_128b[i]);  
-     //}
-     //printf ("\n");
-     //memcpy(addressToWrite64b,(&routes_vars.routes[posi].addr_64b),LENGTH_ADDR64b);
      
    } else {
       //printf("** Forwarding -- FORWARDING-COME-UP!!!\n");
       // destination is remote, send to preferred parent
       neighbors_getPreferredParentEui64(addressToWrite64b);
    }
+   
+   // cache the result, replacing entries in turn. The neighbor table is also
+   // updated from interrupt context, don't cache a result it flushed meanwhile.
+   DISABLE_INTERRUPTS();
+   if (
+         addressToWrite64b->type==ADDR_64B &&
+         numFlushes==forwarding_vars.routeCacheStats.numFlushes
+      ) {
+      entry = &forwarding_vars.routeCache[forwarding_vars.routeCacheVictim];
+      entry->used = TRUE;
+      memcpy(entry->destination,destination128b->addr_128b,LENGTH_ADDR128b);
+      memcpy(entry->nextHop,addressToWrite64b->addr_64b,LENGTH_ADDR64b);
+      forwarding_vars.routeCacheVictim = (forwarding_vars.routeCacheVictim+1)%FORWARDING_ROUTECACHE_SIZE;
+   }
+   ENABLE_INTERRUPTS();
 }
 
 /**
@@ -576,6 +680,8 @@ owerror_t forwarding_send_internal_SourceRouting(
     uint8_t              size;
     uint8_t              next_size;
     uint8_t              hlen;
+    uint8_t              new_type;
+    open_addr_t          reference;
     open_addr_t          firstAddr;
     open_addr_t          nextAddr;
     open_addr_t          temp_prefix;
@@ -585,26 +691,21 @@ owerror_t forwarding_send_internal_SourceRouting(
     uint8_t              flags;
     uint16_t             senderRank;
     
-    uint8_t              RH3_copy[127];
+    uint8_t*             RH3;
     uint8_t              RH3_length;
     
-    uint8_t              i,posi;
-    
     //printf ("** Forwarding -- forwarding_send_internal_SourceRouting\n");
     
-    memset(&RH3_copy[0],0,127);
+    RH3        = NULL;
     RH3_length = 0;     
     memcpy(&msg->l3_destinationAdd,&ipv6_inner_header->dest,sizeof(open_addr_t));
     memcpy(&msg->l3_sourceAdd,&ipv6_inner_header->src,sizeof(open_addr_t));
     
-    // initial first Address by compression reference
-    firstAddr.type = ADDR_128B;
+    // the first address is compressed against the encapsulator, i.e. the root
     if (ipv6_outer_header->src.type != ADDR_NONE){
-        if (rpl_option->rplInstanceID == 0){
-            icmpv6rpl_getRPLDODAGid(&firstAddr.addr_128b[0]);
-        }
+        memcpy(&reference,&ipv6_outer_header->src,sizeof(open_addr_t));
     } else {
-        memcpy(&firstAddr,&ipv6_inner_header->src,sizeof(open_addr_t));
+        memcpy(&reference,&ipv6_inner_header->src,sizeof(open_addr_t));
     }
     
     hlen = 0;
@@ -614,28 +715,8 @@ owerror_t forwarding_send_internal_SourceRouting(
     
     hlen += 2;
     // get the first address
-    switch(type){
-    case RH3_6LOTH_TYPE_0:
-        memcpy(&firstAddr.addr_128b[15],msg->payload+hlen,1);
-        hlen += 1;
-        break;
-    case RH3_6LOTH_TYPE_1:
-        memcpy(&firstAddr.addr_128b[14],msg->payload+hlen,2);
-        hlen += 2;
-        break;
-    case RH3_6LOTH_TYPE_2:
-        memcpy(&firstAddr.addr_128b[12],msg->payload+hlen,4);
-        hlen += 4;
-        break;
-    case RH3_6LOTH_TYPE_3:
-        memcpy(&firstAddr.addr_128b[8],msg->payload+hlen,8);
-        hlen += 8;
-        break;
-    case RH3_6LOTH_TYPE_4:
-        memcpy(&firstAddr.addr_128b[0],msg->payload+hlen,16);
-        hlen += 16;
-        break;
-    }
+    iphc_uncompress6LoRHAddress(msg->payload+hlen,type,&reference,&firstAddr);
+    hlen += RH3_6LOTH_ADDR_LEN(type);
     
     packetfunctions_ip128bToMac64b(&firstAddr,&temp_prefix,&temp_addr64);
     if (
@@ -646,37 +727,16 @@ owerror_t forwarding_send_internal_SourceRouting(
         if (size > 0){
             // there are at least 2 entries in the header, 
             // the router removes the first entry and decrements the Size (by 1) 
+            // the next entry is compressed against mine, with as many bytes as
+            // mine against the reference, so it can be kept as is
             size -= 1;
             packetfunctions_tossHeader(msg,hlen);
             packetfunctions_reserveHeaderSize(msg,2);
             msg->payload[0] = CRITICAL_6LORH | size;
             msg->payload[1] = type;
             // get next hop
-            memcpy(&nextAddr,&firstAddr,sizeof(open_addr_t));
-            switch(type){
-            case RH3_6LOTH_TYPE_0:
-                memcpy(&nextAddr.addr_128b[15],msg->payload+2,1);
-                break;
-            case RH3_6LOTH_TYPE_1:
-                memcpy(&nextAddr.addr_128b[14],msg->payload+2,2);
-                break;
-            case RH3_6LOTH_TYPE_2:
-                memcpy(&nextAddr.addr_128b[12],msg->payload+2,4);
-                break;
-            case RH3_6LOTH_TYPE_3:
-                memcpy(&nextAddr.addr_128b[8],msg->payload+2,8);
-                break;
-            case RH3_6LOTH_TYPE_4:
-                memcpy(&nextAddr.addr_128b[0],msg->payload+2,16);
-                break;
-            }
+            iphc_uncompress6LoRHAddress(msg->payload+2,type,&firstAddr,&nextAddr);
             
-            //printf("** Forwarding -- Next-Hop-Source-Routing---- ");
-            //for (i=0;i<LENGTH_ADDR64b;i++) {
-            //   printf(" %X",(&nextAddr)->addr_128b[8+i]);  
-            //}
-            //printf ("\n");
-                
             packetfunctions_ip128bToMac64b(
                 &nextAddr,
                 &temp_prefix,
@@ -689,94 +749,41 @@ owerror_t forwarding_send_internal_SourceRouting(
                 (temp_8b & FORMAT_6LORH_MASK) == CRITICAL_6LORH &&
                 next_type<=RH3_6LOTH_TYPE_4
             ) {
-                // there is another RH3-6LoRH following, check the type
-                if (next_type >= type){
+                // there is another RH3-6LoRH following, its first address is
+                // compressed against mine and becomes the first one, compressed
+                // against the reference: pick the smallest size that allows it
+                iphc_uncompress6LoRHAddress(msg->payload+hlen+2,next_type,&firstAddr,&nextAddr);
+                new_type  = iphc_get6LoRHAddressType(&nextAddr,&reference);
+                if (new_type == next_type){
+                    // the following RH3-6LoRH is fine as is
                     packetfunctions_tossHeader(msg,hlen);
-                    // get next hop
-                    memcpy(&nextAddr,&firstAddr,sizeof(open_addr_t));
-                    switch(next_type){
-                    case RH3_6LOTH_TYPE_0:
-                        memcpy(&nextAddr.addr_128b[15],msg->payload+2,1);
-                        break;
-                    case RH3_6LOTH_TYPE_1:
-                        memcpy(&nextAddr.addr_128b[14],msg->payload+2,2);
-                        break;
-                    case RH3_6LOTH_TYPE_2:
-                        memcpy(&nextAddr.addr_128b[12],msg->payload+2,4);
-                        break;
-                    case RH3_6LOTH_TYPE_3:
-                        memcpy(&nextAddr.addr_128b[8],msg->payload+2,8);
-                        break;
-                    case RH3_6LOTH_TYPE_4:
-                        memcpy(&nextAddr.addr_128b[0],msg->payload+2,16);
-                        break;
-                    }
-                    packetfunctions_ip128bToMac64b(
-                        &nextAddr,
-                        &temp_prefix,
-                        &msg->l2_nextORpreviousHop
-                    );
                 } else {
-                    hlen += 2;
-                    switch(next_type){
-                    case RH3_6LOTH_TYPE_0:
-                        memcpy(&firstAddr.addr_128b[15],msg->payload+hlen,1);
-                        hlen += 1;
-                        break;
-                    case RH3_6LOTH_TYPE_1:
-                        memcpy(&firstAddr.addr_128b[14],msg->payload+hlen,2);
-                        hlen += 2;
-                        break;
-                    case RH3_6LOTH_TYPE_2:
-                        memcpy(&firstAddr.addr_128b[12],msg->payload+hlen,4);
-                        hlen += 4;
-                        break;
-                    case RH3_6LOTH_TYPE_3:
-                        memcpy(&firstAddr.addr_128b[8],msg->payload+hlen,8);
-                        hlen += 8;
-                        break;
-                    }
+                    hlen     += 2+RH3_6LOTH_ADDR_LEN(next_type);
                     next_size = temp_8b & RH3_6LOTH_SIZE_MASK;
                     packetfunctions_tossHeader(msg,hlen);
                     if (next_size>0){
+                        // the other entries are compressed against the next one
                         next_size -= 1;
                         packetfunctions_reserveHeaderSize(msg,2);
                         msg->payload[0] = CRITICAL_6LORH | next_size;
                         msg->payload[1] = next_type;
                     }
-                    // add first address
-                    switch(type){
-                    case RH3_6LOTH_TYPE_0:
-                        packetfunctions_reserveHeaderSize(msg,1);
-                        msg->payload[0] = firstAddr.addr_128b[15];
-                        break;
-                    case RH3_6LOTH_TYPE_1:
-                        packetfunctions_reserveHeaderSize(msg,2);
-                        memcpy(&msg->payload[0],&firstAddr.addr_128b[14],2);
-                        break;
-                    case RH3_6LOTH_TYPE_2:
-                        packetfunctions_reserveHeaderSize(msg,4);
-                        memcpy(&msg->payload[0],&firstAddr.addr_128b[12],4);
-                        break;
-                    case RH3_6LOTH_TYPE_3:
-                        packetfunctions_reserveHeaderSize(msg,8);
-                        memcpy(&msg->payload[0],&firstAddr.addr_128b[8],8);
-                        break;
-                    case RH3_6LOTH_TYPE_4:
-                        packetfunctions_reserveHeaderSize(msg,16);
-                        memcpy(&msg->payload[0],&firstAddr.addr_128b[0],16);
-                        break;
-                    }
+                    // the next address, alone in its RH3-6LoRH
+                    packetfunctions_reserveHeaderSize(msg,RH3_6LOTH_ADDR_LEN(new_type));
+                    memcpy(
+                        &msg->payload[0],
+                        &nextAddr.addr_128b[16-RH3_6LOTH_ADDR_LEN(new_type)],
+                        RH3_6LOTH_ADDR_LEN(new_type)
+                    );
                     packetfunctions_reserveHeaderSize(msg,2);
                     msg->payload[0] = CRITICAL_6LORH | 0;
-                    msg->payload[1] = type;
-                    packetfunctions_ip128bToMac64b(
-                        &firstAddr,
-                        &temp_prefix,
-                        &msg->l2_nextORpreviousHop
-                
-                    );
+                    msg->payload[1] = new_type;
                 }
+                packetfunctions_ip128bToMac64b(
+                    &nextAddr,
+                    &temp_prefix,
+                    &msg->l2_nextORpreviousHop
+                );
                 //printf("** Forwarding -- Next-Hop-Source-Routing---- ");
                 //for (i=0;i<LENGTH_ADDR64b;i++) {
                 //    printf(" %X",(&nextAddr)->addr_128b[8+i]);  
@@ -788,25 +795,8 @@ owerror_t forwarding_send_internal_SourceRouting(
                 if (RPLMODE==1) {
                     //printf ("## Forwarding -- there is no next RH3-6loRH - Trying Adding Route\n");
                     
-                    if (neighbors_isStableNeighbor(&msg->l3_destinationAdd)) {
-                        // IP destination is 1-hop neighbor, send directly
-                         //printf("** Forwarding -- there is no next RH3-6loRH -- FORWARDING-HEY-NEIGHBOR!!!\n");
-                         packetfunctions_ip128bToMac64b(&msg->l3_destinationAdd,&temp_prefix,&msg->l2_nextORpreviousHop);
-                    } else if (isRoute(&msg->l3_destinationAdd)) {
-                        //printf("** Forwarding -- there is no next RH3-6loRH -- ROUTING-STORING-MODE!!!\n");
-                        // IP destination is more than 1-hop -- Routing Table -- Storing Mode
-                        posi = posRoute(&msg->l3_destinationAdd);
-                        //printf("** Forwarding -- there is no next RH3-6loRH -- ROUTING-STORING-MODE -Next-Hop- ");
-                        for (i=0;i<LENGTH_ADDR64b;i++) {
-                            //printf(" %X",(&routes_vars.routes[posi].addr_64b)->addr_64b[i]);  
-                            (&msg->l2_nextORpreviousHop)->addr_64b[i]=(&routes_vars.routes[posi].addr_64b)->addr_64b[i];
-                        }
-                        //printf ("\n");
-                    }else{
-                        //printf("** Forwarding -- there is no next RH3-6loRH -- FORWARDING-COME-UP!!!\n");
-                        // destination is remote, send to preferred parent
-                        neighbors_getPreferredParentEui64(&msg->l2_nextORpreviousHop);
-                    }
+                    // 1-hop neighbor, Routing Table -- Storing Mode, or preferred parent
+                    forwarding_getNextHop(&msg->l3_destinationAdd,&msg->l2_nextORpreviousHop);
                     
                     //printf ("## Forwarding -- there is no next RH3-6loRH, remove current one\n");
                     // there is no next RH3-6loRH, remove current one
@@ -835,14 +825,15 @@ owerror_t forwarding_send_internal_SourceRouting(
             (errorparameter_t)(temp_addr64.addr_64b[7])
         );
     }
-    // copy RH3s before toss them
+    // toss the RH3s, they stay in the packet buffer and are moved back in
+    // front of the rebuilt headers by iphc_sendFromForwarding()
     if (
         ipv6_outer_header->src.type != ADDR_NONE &&
         ipv6_outer_header->hopByhop_option != NULL
     ){
         // check the length of RH3s
         RH3_length = ipv6_outer_header->hopByhop_option-msg->payload;
-        memcpy(&RH3_copy[0],msg->payload,RH3_length);
+        RH3        = msg->payload;
         packetfunctions_tossHeader(msg,RH3_length);
         
         // retrieve hop-by-hop header (includes RPL option)
@@ -895,7 +886,7 @@ owerror_t forwarding_send_internal_SourceRouting(
         ipv6_inner_header,
         rpl_option,
         &ipv6_outer_header->flow_label,
-        &RH3_copy[0],
+        RH3,
         RH3_length,
         PCKTFORWARD
     );
@@ -14,6 +14,14 @@
 
 #define RPL_HOPBYHOP_HEADER_OPTION_TYPE  0x63
 
+/**
+\brief Number of destinations whose next hop is cached. Can be overwritten in
+   board_info.h.
+*/
+#ifndef FORWARDING_ROUTECACHE_SIZE
+#define FORWARDING_ROUTECACHE_SIZE       4
+#endif
+
 enum {
    PCKTFORWARD     = 1, // used by the node to indicate is forwarding a packet  -- either upstream or downstream
    PCKTSEND        = 2, // used by the node to indicate is sending a packet
@@ -51,8 +59,28 @@ typedef struct {
 } rpl_routing_ht;
 END_PACK
 
+typedef struct {
+   bool       used;
+   uint8_t    destination[LENGTH_ADDR128b]; ///< Final IPv6 destination.
+   uint8_t    nextHop[LENGTH_ADDR64b];      ///< EUI64 of the next hop towards it.
+} forwarding_routeCacheEntry_t;
+
+BEGIN_PACK
+typedef struct {
+   uint16_t   numHits;
+   uint16_t   numMisses;
+   uint16_t   numFlushes;
+} forwarding_routeCacheStats_t;
+END_PACK
+
 //=========================== variables =======================================
 
+typedef struct {
+   forwarding_routeCacheEntry_t routeCache[FORWARDING_ROUTECACHE_SIZE];
+   uint8_t                      routeCacheVictim;
+   forwarding_routeCacheStats_t routeCacheStats;
+} forwarding_vars_t;
+
 //=========================== prototypes ======================================
 
 void      forwarding_init(void);
@@ -64,6 +92,12 @@ void      forwarding_receive(
    ipv6_header_iht*     ipv6_inner_header,
    rpl_option_ht*       rpl_option
 );
+bool      forwarding_isForMe(
+   ipv6_header_iht*     ipv6_outer_header,
+   ipv6_header_iht*     ipv6_inner_header
+);
+void      forwarding_flushRouteCache(void);
+bool      debugPrint_routeCache(void);
 
 /**
 \}
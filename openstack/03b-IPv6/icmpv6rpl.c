@@ -10,6 +10,8 @@
 #include "idmanager.h"
 #include "opentimers.h"
 #include "IEEE802154E.h"
+#include "forwarding.h"
+#include "iphc.h"
 
 //=========================== variables =======================================
 
@@ -24,6 +26,7 @@ routes_vars_t               routes_vars;
 void icmpv6rpl_timer_DIO_cb(opentimer_id_t id);
 void icmpv6rpl_timer_DIO_task(void);
 void sendDIO(void);
+void icmpv6rpl_updateContexts(OpenQueueEntry_t* msg);
 // DAO-related
 void icmpv6rpl_timer_DAO_cb(opentimer_id_t id);
 void icmpv6rpl_timer_DAO_task(void);
@@ -38,14 +41,13 @@ void registerRoute(
         uint8_t         PathS,  
         uint8_t         PathL
      );
-bool isRoute(open_addr_t* destinadd);
-uint8_t posRoute(open_addr_t* destinadd);
-void removeRoute(uint8_t routeIndex);
-bool ThisRowMatch(
-        open_addr_t* address,
-        uint8_t      rowNumber
-     );
+routeIndex_t routes_find(open_addr_t* destination);
+void removeRoute(routeIndex_t routeIndex);
 uint8_t routes_getNumRoutes(uint8_t  TipRoutes);
+uint8_t routes_hash(uint8_t* iid);
+bool routes_inMyPrefix(open_addr_t* destination);
+uint8_t routes_takeNextHop(open_addr_t* MAC64b);
+void routes_releaseNextHop(uint8_t nextHop);
 
 void routetable_timer_cb(opentimer_id_t id);
 void routetable_timer_task(void);
@@ -160,10 +162,21 @@ void icmpv6rpl_init() {
 
 void routingtable_init() {    
    uint32_t        RTPeriod;
+   routeIndex_t    i;
    
    // clear module variables
    memset(&routes_vars,0,sizeof(routes_vars_t));
    
+   // all buckets are empty, all rows are in the free list
+   for (i=0;i<ROUTE_HASH_SIZE;i++) {
+      routes_vars.buckets[i]            = ROUTE_NONE;
+   }
+   for (i=0;i<MAX_ROUTE_NUM;i++) {
+      routes_vars.routes[i].next        = i+1;
+   }
+   routes_vars.routes[MAX_ROUTE_NUM-1].next = ROUTE_NONE;
+   routes_vars.freeRoutes               = 0;
+   
    routes_vars.RTPeriod                 = TIMER_RT_TIMEOUT;
    RTPeriod                             = routes_vars.RTPeriod - 0x80 + (openrandom_get16b()&0xff);
    routes_vars.timerIdRT                = opentimers_start(
@@ -299,7 +312,16 @@ void icmpv6rpl_receive(OpenQueueEntry_t* msg) {
             &((icmpv6rpl_dio_ht*)(msg->payload))->DODAGID[0],
             sizeof(myPrefix.prefix)
          );
+         if (memcmp(myPrefix.prefix,idmanager_getMyID(ADDR_PREFIX)->prefix,sizeof(myPrefix.prefix))!=0) {
+            // routes are only looked up within my prefix
+            forwarding_flushRouteCache();
+         }
          idmanager_setMyID(&myPrefix);
+         
+         // the 6LoWPAN contexts come down the DODAG from the DAG root
+         if (neighbors_isPreferredParent(&(msg->l2_nextORpreviousHop))==TRUE) {
+            icmpv6rpl_updateContexts(msg);
+         }
                   
          break;
       
@@ -529,7 +551,10 @@ void icmpv6rpl_timer_DIO_task() {
 \brief Prepare and a send a RPL DIO.
 */
 void sendDIO() {
-   OpenQueueEntry_t*    msg;
+   OpenQueueEntry_t*         msg;
+   icmpv6rpl_dio_context_ht* option;
+   open_addr_t               prefix;
+   uint8_t                   cid;
    
    // stop if I'm not sync'ed
    if (ieee154e_isSynch()==FALSE) {
@@ -581,6 +606,20 @@ void sendDIO() {
    // set DIO destination
    memcpy(&(msg->l3_destinationAdd),&icmpv6rpl_vars.dioDestination,sizeof(open_addr_t));
    
+   //===== 6LoWPAN context options, context 0 being the DODAGID prefix
+   for (cid=IPHC_NUMCONTEXTS-1;cid>0;cid--) {
+      if (iphc_getContextPrefix(cid,&prefix)==FALSE) {
+         continue;
+      }
+      packetfunctions_reserveHeaderSize(msg,sizeof(icmpv6rpl_dio_context_ht));
+      option                = (icmpv6rpl_dio_context_ht*)(msg->payload);
+      option->type          = OPTION_6LOWPAN_CONTEXT_TYPE;
+      option->optionLength  = sizeof(icmpv6rpl_dio_context_ht)-2;
+      option->contextLength = 64;
+      option->CID           = cid & DIO_CONTEXT_CID_MASK;
+      memcpy(option->prefix,prefix.prefix,sizeof(option->prefix));
+   }
+   
    //===== DIO payload
    // note: DIO is already mostly populated
    icmpv6rpl_vars.dio.rank                  = neighbors_getMyDAGrank();
@@ -610,6 +649,55 @@ void sendDIO() {
    }
 }
 
+/**
+\brief Take the 6LoWPAN contexts advertised in a DIO of my preferred parent.
+
+The contexts in the DIO replace the ones known so far, the ones it does not
+carry are removed. Since every mote advertises the contexts of its preferred
+parent, a mote and the motes on its path to the DAG root know the same
+contexts, and can decompress what the others compress against them.
+
+\param[in] msg The DIO, starting at its base object.
+*/
+void icmpv6rpl_updateContexts(OpenQueueEntry_t* msg) {
+   icmpv6rpl_dio_context_ht* option;
+   uint16_t                  index;
+   uint16_t                  present;
+   uint8_t                   cid;
+   
+   // walk the options after the base object
+   present = 0;
+   index   = sizeof(icmpv6rpl_dio_ht);
+   while (index<msg->length) {
+      if (msg->payload[index]==OPTION_PAD1_TYPE) {
+         index += 1;
+         continue;
+      }
+      if (index+2>msg->length || index+2+msg->payload[index+1]>msg->length) {
+         break;
+      }
+      option = (icmpv6rpl_dio_context_ht*)(&msg->payload[index]);
+      cid    = option->CID & DIO_CONTEXT_CID_MASK;
+      if (
+            option->type==OPTION_6LOWPAN_CONTEXT_TYPE                  &&
+            option->optionLength==sizeof(icmpv6rpl_dio_context_ht)-2   &&
+            option->contextLength==64                                  &&
+            cid>0 && cid<IPHC_NUMCONTEXTS
+         ) {
+         iphc_setContext(cid,option->prefix);
+         present |= (1<<cid);
+      }
+      index += 2+msg->payload[index+1];
+   }
+   
+   // remove the contexts my parent does not advertise anymore
+   for (cid=1;cid<IPHC_NUMCONTEXTS && cid<IPHC_MAXCONTEXTS;cid++) {
+      if ((present & (1<<cid))==0) {
+         iphc_setContext(cid,NULL);
+      }
+   }
+}
+
 //===== DAO-related
 
 /**
@@ -678,7 +766,7 @@ void icmpv6rpl_timer_DAO_task() {
 */
 void sendDAO() {
    OpenQueueEntry_t*    msg;                // pointer to DAO messages
-   uint8_t              nbrIdx;             // running neighbor index
+   routeIndex_t         nbrIdx;             // running neighbor or route index
    uint8_t              numTransitParents,numTargetParents;  // the number of parents indicated in transit option
    open_addr_t          address;
    open_addr_t*         prefix;
@@ -686,7 +774,7 @@ void sendDAO() {
    open_addr_t          rtpref;
    open_addr_t          rtadd;
    uint16_t             ccount;
-   uint8_t              posi;
+   routeIndex_t         posi;
    bool                 selected;
    bool                 onetarget;
    
@@ -786,16 +874,10 @@ void sendDAO() {
                     ccount=routes_vars.routes[nbrIdx].scount;
                 }
            
-                //printf ("+++ Type IPv6 registered - %u\n",routes_vars.routes[nbrIdx].destination.type);
                 //printf ("|-----Route(%u)------\n",nbrIdx);
-                //printf("|### Routing-IPv6-Destiny(Child) -- ");
-                //for (i=0;i<LENGTH_ADDR128b;i++) {
-                //    printf (" %X",routes_vars.routes[nbrIdx].destination.addr_128b[i]);  
-                //}
-                //printf ("\n"); 
-                //printf("|### Routing-IPv6-Publisher -- ");
-                //for (i=0;i<LENGTH_ADDR128b;i++) {
-                //    printf (" %X",routes_vars.routes[nbrIdx].addr_128b.addr_128b[i]);  
+                //printf("|### Routing-IID-Destiny(Child) -- ");
+                //for (i=0;i<LENGTH_ADDR64b;i++) {
+                //    printf (" %X",routes_vars.routes[nbrIdx].destination[i]);  
                 //}
                 //printf ("\n"); 
                 //printf ("|-------------------\n");
@@ -812,7 +894,9 @@ void sendDAO() {
             routes_vars.routes[posi].scount=routes_vars.routes[posi].scount+1;
             routes_vars.routes[posi].tosend=FALSE;
             
-            packetfunctions_ip128bToMac64b(&(routes_vars.routes[posi].destination),&rtpref,&rtadd);
+            memcpy(&rtpref,idmanager_getMyID(ADDR_PREFIX),sizeof(open_addr_t));
+            rtadd.type = ADDR_64B;
+            memcpy(rtadd.addr_64b,routes_vars.routes[posi].destination,LENGTH_ADDR64b);
             packetfunctions_writeAddress(msg,&rtadd,OW_BIG_ENDIAN);
             packetfunctions_writeAddress(msg,&rtpref,OW_BIG_ENDIAN);
             // target info fields 
@@ -985,124 +1069,157 @@ void registerRoute(open_addr_t*     destaddress,
                    uint8_t          DAOS,
                    uint8_t          PathS,
                    uint8_t          PathL) {
-   uint8_t  i,posi;
+   routeIndex_t posi;
+   uint8_t      nextHop;
+   uint8_t      bucket;
+   routeRow_t*  route;
+   
     printf ("\n");
     printf("## MOTE [%X] ---- Registering route process\n",(&idmanager_vars.my64bID)->addr_64b[7]);
-    // printf("IPv6 type....%u\n",IPv6->type); 
-   // add this Route
-   if (isRoute(destaddress)==FALSE) {
+   
+   // only destinations in the DODAG prefix are routed through the table
+   if (routes_inMyPrefix(destaddress)==FALSE) {
+      return;
+   }
+   
+   posi = routes_find(destaddress);
+   
+   if (posi==ROUTE_NONE) {
       printf("  The route is not on the table...\n");
-      i=0;
-      while(i<MAX_ROUTE_NUM) {
-         if (routes_vars.routes[i].used==FALSE) {
-             printf("    Adding route...\n");
-            // add this route
-            routes_vars.routes[i].used                      = TRUE;
-            routes_vars.routes[i].advertneighinf            = 0;
-            memcpy(&routes_vars.routes[i].addr_128b,IPv6,sizeof(open_addr_t));
-            (&routes_vars.routes[i].addr_128b)->type=ADDR_128B;
-            memcpy(&routes_vars.routes[i].addr_64b,MAC64b,sizeof(open_addr_t));
-            (&routes_vars.routes[i].addr_64b)->type=ADDR_64B;
-            routes_vars.routes[i].retcount                  = 0;
-            routes_vars.routes[i].DAOSequence               = DAOS;
-            routes_vars.routes[i].PathSequence              = PathS;
-            routes_vars.routes[i].PathLifetime              = PathL;
-            memcpy(&routes_vars.routes[i].destination,destaddress,sizeof(open_addr_t));
-            (&routes_vars.routes[i].destination)->type=ADDR_128B;
-            routes_vars.routes[i].tosend                    = TRUE;
-            routes_vars.routes[i].scount                    = 0;
-
-            break;
-         }
-         i++;
-      }
-      if (i==MAX_ROUTE_NUM) {
+      if (routes_vars.freeRoutes==ROUTE_NONE) {
          //openserial_printError(COMPONENT_NEIGHBORS,ERR_NEIGHBORS_FULL,
          //                      (errorparameter_t)MAX_ROUTE_NUM,
          //                      (errorparameter_t)0);
          return;
       }
-   }else{
-       printf(" The route is in the table already...\n");
-        // Obtain position of route
-        posi = posRoute(destaddress);
-        // Is new the address of publisher
-
-        // In case of error and no position is bigger than MAX_ROUTE_NUM
-        if (posi <= MAX_ROUTE_NUM){
-            // Looking for update in the info of routing, in case of new info updates route
-            if ((routes_vars.routes[posi].DAOSequence != DAOS) || (routes_vars.routes[posi].PathSequence != PathS) || !(packetfunctions_sameAddress(IPv6,&(routes_vars.routes[posi].addr_128b)))){
-				
-				
-		if (routes_vars.routes[posi].DAOSequence != DAOS){
-                    //printf("+++ New DAOSequence...\n");
-                }
-				
-                if (routes_vars.routes[posi].PathSequence != PathS){
-                    //printf("+++ New PathSequence...\n");
-                }
-				
-                if (!(packetfunctions_sameAddress(IPv6,&(routes_vars.routes[posi].addr_128b)))){
-                    //printf("+++ New Orig-Publisher...\n");
-                }
-				
-                printf("    Updating Route...\n");
-                // update this route
-                routes_vars.routes[posi].used                      = TRUE;
-                routes_vars.routes[posi].advertneighinf            = 0;
-                memcpy(&routes_vars.routes[posi].addr_128b,IPv6,sizeof(open_addr_t));
-                (&routes_vars.routes[posi].addr_128b)->type=ADDR_128B;
-                memcpy(&routes_vars.routes[posi].addr_64b,MAC64b,sizeof(open_addr_t));
-                (&routes_vars.routes[posi].addr_64b)->type=ADDR_64B;
-                routes_vars.routes[posi].retcount                  = 0;
-                routes_vars.routes[posi].DAOSequence               = DAOS;
-                routes_vars.routes[posi].PathSequence              = PathS;
-                routes_vars.routes[posi].PathLifetime              = PathL;
-                memcpy(&routes_vars.routes[posi].destination,destaddress,sizeof(open_addr_t));
-                (&routes_vars.routes[posi].destination)->type=ADDR_128B;
-                routes_vars.routes[posi].tosend                    = TRUE;
+      nextHop = routes_takeNextHop(MAC64b);
+      if (nextHop==MAX_ROUTE_NEXTHOPS) {
+         return;
+      }
+      printf("    Adding route...\n");
+      
+      // take a row from the free list
+      posi                                 = routes_vars.freeRoutes;
+      route                                = &routes_vars.routes[posi];
+      routes_vars.freeRoutes               = route->next;
+      
+      // add this route
+      route->used                          = TRUE;
+      memcpy(route->destination,&destaddress->addr_128b[8],LENGTH_ADDR64b);
+      route->nextHop                       = nextHop;
+      route->DAOSequence                   = DAOS;
+      route->PathSequence                  = PathS;
+      route->PathLifetime                  = PathL;
+      route->tosend                        = TRUE;
+      route->scount                        = 0;
+      
+      // link it at the head of its bucket
+      bucket                               = routes_hash(route->destination);
+      route->next                          = routes_vars.buckets[bucket];
+      routes_vars.buckets[bucket]          = posi;
+      
+      forwarding_flushRouteCache();
+   } else {
+      printf(" The route is in the table already...\n");
+      route = &routes_vars.routes[posi];
+      
+      // Looking for update in the info of routing, in case of new info updates route
+      if (
+            (route->DAOSequence != DAOS)                                         ||
+            (route->PathSequence != PathS)                                       ||
+            memcmp(routes_vars.nextHops[route->nextHop].addr_64b,MAC64b->addr_64b,LENGTH_ADDR64b)!=0
+         ) {
+         
+         if (memcmp(routes_vars.nextHops[route->nextHop].addr_64b,MAC64b->addr_64b,LENGTH_ADDR64b)!=0) {
+            //printf("+++ New Orig-Publisher...\n");
+            nextHop = routes_takeNextHop(MAC64b);
+            if (nextHop==MAX_ROUTE_NEXTHOPS) {
+               return;
             }
-        }  
-        return;
+            routes_releaseNextHop(route->nextHop);
+            route->nextHop                 = nextHop;
+            forwarding_flushRouteCache();
+         }
+         
+         printf("    Updating Route...\n");
+         // update this route
+         route->DAOSequence                = DAOS;
+         route->PathSequence               = PathS;
+         route->PathLifetime               = PathL;
+         route->tosend                     = TRUE;
+      }
    }
 }
 
-bool isRoute(open_addr_t* destroute) {
-   uint8_t i=0;
-   for (i=0;i<MAX_ROUTE_NUM;i++) {
-      if (ThisRowMatch(destroute,i)) {
-         return TRUE;
+/**
+\brief Look a destination up in the routing table.
+
+\param[in] destination The 128-bit address of the destination.
+
+\returns The index of its row, ROUTE_NONE if there is no route to it.
+*/
+routeIndex_t routes_find(open_addr_t* destination) {
+   routeIndex_t posi;
+   
+   if (routes_inMyPrefix(destination)==FALSE) {
+      return ROUTE_NONE;
+   }
+   
+   posi = routes_vars.buckets[routes_hash(&destination->addr_128b[8])];
+   while (posi!=ROUTE_NONE) {
+      if (memcmp(routes_vars.routes[posi].destination,&destination->addr_128b[8],LENGTH_ADDR64b)==0) {
+         break;
       }
+      posi = routes_vars.routes[posi].next;
    }
-   return FALSE;
+   return posi;
 }
 
-uint8_t posRoute(open_addr_t* destroute) {
-   uint8_t i=0;
-   for (i=0;i<MAX_ROUTE_NUM;i++) {
-      if (ThisRowMatch(destroute,i)) {
-         return i;
-      }
+/**
+\brief Retrieve the next hop towards a destination in my sub-DODAG.
+
+\param[in]  destination The 128-bit address of the destination.
+\param[out] nextHop     The 64-bit address of the child to forward to.
+
+\returns TRUE if there is a route to the destination, FALSE otherwise.
+*/
+bool routes_getNextHop(open_addr_t* destination, open_addr_t* nextHop) {
+   routeIndex_t posi;
+   
+   posi = routes_find(destination);
+   if (posi==ROUTE_NONE) {
+      return FALSE;
    }
-   return MAX_ROUTE_NUM+1;
+   nextHop->type = ADDR_64B;
+   memcpy(
+      nextHop->addr_64b,
+      routes_vars.nextHops[routes_vars.routes[posi].nextHop].addr_64b,
+      LENGTH_ADDR64b
+   );
+   return TRUE;
 }
 
-void removeRoute(uint8_t routeIndex) {
-   routes_vars.routes[routeIndex].used                      = FALSE;
-   routes_vars.routes[routeIndex].advertneighinf            = 0;
-   routes_vars.routes[routeIndex].addr_128b.type            = ADDR_NONE;
-   routes_vars.routes[routeIndex].addr_64b.type             = ADDR_NONE;
-   routes_vars.routes[routeIndex].retcount                  = 0;
-   routes_vars.routes[routeIndex].DAOSequence               = 0;
-   routes_vars.routes[routeIndex].PathSequence              = 0;
-   routes_vars.routes[routeIndex].PathLifetime              = 0;
-   routes_vars.routes[routeIndex].destination.type          = ADDR_NONE;
-   routes_vars.routes[routeIndex].tosend                    = TRUE;
-   routes_vars.routes[routeIndex].scount                    = 0;
+void removeRoute(routeIndex_t routeIndex) {
+   routeIndex_t* walker;
+   
+   // unlink the row from its bucket
+   walker = &routes_vars.buckets[routes_hash(routes_vars.routes[routeIndex].destination)];
+   while (*walker!=routeIndex) {
+      walker = &routes_vars.routes[*walker].next;
+   }
+   *walker = routes_vars.routes[routeIndex].next;
+   
+   routes_releaseNextHop(routes_vars.routes[routeIndex].nextHop);
+   forwarding_flushRouteCache();
+   
+   // give it back to the free list
+   memset(&routes_vars.routes[routeIndex],0,sizeof(routeRow_t));
+   routes_vars.routes[routeIndex].next                      = routes_vars.freeRoutes;
+   routes_vars.freeRoutes                                   = routeIndex;
 }
 
 uint8_t routes_getNumRoutes(uint8_t tiprt) {
-   uint8_t i;
+   routeIndex_t i;
    uint8_t returnVal;
    uint8_t totalrt;
    uint8_t sendrt;
@@ -1184,7 +1301,8 @@ void routetable_timer_task() {
 }
 
 void routetable_read(){
-   uint8_t  i,posi;
+   uint8_t      i;
+   routeIndex_t posi;
    
     printf ("\n");
     printf("## MOTE [%X] ---- Reading Routing-Table\n",(&idmanager_vars.my64bID)->addr_64b[7]);
@@ -1193,8 +1311,8 @@ void routetable_read(){
        if (routes_vars.routes[posi].used==TRUE) {
            printf(" PathLifetime = %X",routes_vars.routes[posi].PathLifetime);
            printf(" >>> Route-MOTE-Address = ");
-           for (i=0;i<LENGTH_ADDR128b;i++) {
-           printf(" %X",(&routes_vars.routes[posi].destination)->addr_128b[i]);  
+           for (i=0;i<LENGTH_ADDR64b;i++) {
+           printf(" %X",routes_vars.routes[posi].destination[i]);  
            }
            printf ("\n");
 
@@ -1217,10 +1335,61 @@ void routetable_read(){
 
 //=========================== helpers =========================================
 
-bool ThisRowMatch(open_addr_t* address, uint8_t rowNumber) {
+/**
+\brief Hash an Interface ID into a bucket of the routing table.
+*/
+uint8_t routes_hash(uint8_t* iid) {
+   uint8_t i;
+   uint8_t hash;
+   
+   hash = 0;
+   for (i=0;i<LENGTH_ADDR64b;i++) {
+      hash = (hash<<1) ^ (hash>>7) ^ iid[i];
+   }
+   return hash & (ROUTE_HASH_SIZE-1);
+}
+
+/**
+\brief Check that a 128-bit address belongs to the DODAG prefix.
+
+Only the Interface ID of the destinations is stored, so other addresses can
+neither be registered nor looked up.
+*/
+bool routes_inMyPrefix(open_addr_t* destination) {
+   return destination->type==ADDR_128B &&
+          memcmp(destination->addr_128b,idmanager_getMyID(ADDR_PREFIX)->prefix,LENGTH_ADDR64b)==0;
+}
+
+/**
+\brief Take a reference on the next hop entry of a child, creating it if needed.
 
-    return routes_vars.routes[rowNumber].used &&
-		   packetfunctions_sameAddress(address,&routes_vars.routes[rowNumber].destination);
-		   //packetfunctions_equalAddress(address,&routes_vars.routes[rowNumber].destination);
+\returns Its index, MAX_ROUTE_NEXTHOPS if the next hop table is full.
+*/
+uint8_t routes_takeNextHop(open_addr_t* MAC64b) {
+   uint8_t i;
+   uint8_t freeEntry;
+   
+   freeEntry = MAX_ROUTE_NEXTHOPS;
+   for (i=0;i<MAX_ROUTE_NEXTHOPS;i++) {
+      if (routes_vars.nextHops[i].numRoutes==0) {
+         if (freeEntry==MAX_ROUTE_NEXTHOPS) {
+            freeEntry = i;
+         }
+      } else if (memcmp(routes_vars.nextHops[i].addr_64b,MAC64b->addr_64b,LENGTH_ADDR64b)==0) {
+         routes_vars.nextHops[i].numRoutes++;
+         return i;
+      }
+   }
+   if (freeEntry!=MAX_ROUTE_NEXTHOPS) {
+      memcpy(routes_vars.nextHops[freeEntry].addr_64b,MAC64b->addr_64b,LENGTH_ADDR64b);
+      routes_vars.nextHops[freeEntry].numRoutes = 1;
+   }
+   return freeEntry;
+}
 
-}
\ No newline at end of file
+/**
+\brief Drop a reference on a next hop entry, freeing it with its last route.
+*/
+void routes_releaseNextHop(uint8_t nextHop) {
+   routes_vars.nextHops[nextHop].numRoutes--;
+}
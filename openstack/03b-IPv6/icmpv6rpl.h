@@ -73,8 +73,31 @@
 //#define MAX_TARGET_PARENTS        0x01
 #define MAX_TARGET_PARENTS          0x01
 
-// max number of routes in a Mote 
-#define MAX_ROUTE_NUM               0x10
+// max number of routes in a Mote. Can be overwritten in board_info.h.
+#ifndef MAX_ROUTE_NUM
+#define MAX_ROUTE_NUM               0x20
+#endif
+
+// number of buckets of the route hash table, a power of 2. Can be overwritten
+// in board_info.h.
+#ifndef ROUTE_HASH_SIZE
+#define ROUTE_HASH_SIZE             0x10
+#endif
+
+// max number of distinct next hops, i.e. children, the routes go through. The
+// children are neighbors, so there is no point in exceeding MAXNUMNEIGHBORS.
+// Can be overwritten in board_info.h.
+#ifndef MAX_ROUTE_NEXTHOPS
+#define MAX_ROUTE_NEXTHOPS          10
+#endif
+
+#if MAX_ROUTE_NUM<0xff
+typedef uint8_t routeIndex_t;
+#define ROUTE_NONE                  0xff
+#else
+typedef uint16_t routeIndex_t;
+#define ROUTE_NONE                  0xffff
+#endif
 
 // max number of routes sended in DAO message
 #define MAX_ROUTE_SEND              0x01
@@ -84,12 +107,16 @@
 
 
 enum{
+  OPTION_PAD1_TYPE                = 0x00,
   OPTION_ROUTE_INFORMATION_TYPE   = 0x03,
   OPTION_DODAG_CONFIGURATION_TYPE = 0x04,
   OPTION_TARGET_INFORMATION_TYPE  = 0x05,
   OPTION_TRANSIT_INFORMATION_TYPE = 0x06,
+  OPTION_6LOWPAN_CONTEXT_TYPE     = 0x22, // not assigned by IANA for RPL, the ND 6CO type
 };
 
+#define DIO_CONTEXT_CID_MASK        0x0f
+
 //=========================== static ==========================================
 
 /**
@@ -120,6 +147,22 @@ typedef struct {
 } icmpv6rpl_dio_ht;
 END_PACK
 
+/**
+\brief Header format of a RPL DIO "6LoWPAN Context" option.
+
+Carries a 6LoWPAN context of the DODAG other than context 0, like the 6LoWPAN
+Context Option of RFC6775 section 4.2 does in Router Advertisements.
+*/
+BEGIN_PACK
+typedef struct {
+   uint8_t         type;
+   uint8_t         optionLength;
+   uint8_t         contextLength;      ///< in bits, always 64
+   uint8_t         CID;                ///< 0000CCCC
+   uint8_t         prefix[8];
+} icmpv6rpl_dio_context_ht;
+END_PACK
+
 //===== DAO
 
 /**
@@ -163,23 +206,32 @@ END_PACK
         
 /**
 \Routing Table for RPL Storing mode
+
+Destinations are all in the DODAG prefix, so a row only holds their Interface
+ID. Rows are chained per hash bucket of that Interface ID.
 */       
 BEGIN_PACK
 typedef struct {
    bool             used;
-   uint8_t          advertneighinf; // Advertising Neighbor Information
-   open_addr_t      addr_128b; // IPv6 from the announcer
-   open_addr_t      addr_64b; // Interface ID to which DAO parents has this entry been reported
-   uint8_t          retcount; // Retry counter
+   uint8_t          destination[8]; // Interface ID of the destination
+   uint8_t          nextHop; // Index of the announcer, i.e. next hop, in routes_vars.nextHops
    uint8_t          DAOSequence; // DAO-Sequence
    uint8_t          PathSequence;  // Path-Sequence 
    uint8_t          PathLifetime; // Path-Lifetime 
-   open_addr_t      destination; // Destination Prefix (or address or Mcast Group) 
    bool             tosend; // Record if send this route
-   uint16_t          scount; // Counting how many times sended
+   uint16_t         scount; // Counting how many times sended
+   routeIndex_t     next; // Next row in the same bucket, or in the free list
 } routeRow_t;
 END_PACK
 
+/**
+\Next hop of routes, shared by all the routes announced by the same child
+*/
+typedef struct {
+   uint8_t          addr_64b[8]; // EUI64 of the next hop
+   routeIndex_t     numRoutes; // Number of routes through it, 0 if the entry is free
+} routeNextHop_t;
+
 //=========================== module variables ================================
 
 typedef struct {
@@ -205,6 +257,9 @@ typedef struct {
 
 typedef struct {
    routeRow_t               routes[MAX_ROUTE_NUM];
+   routeIndex_t             buckets[ROUTE_HASH_SIZE]; // first row of each hash bucket
+   routeIndex_t             freeRoutes;             // first row of the free list
+   routeNextHop_t           nextHops[MAX_ROUTE_NEXTHOPS];
    bool                     tosend; // To control if we have to send a Route Table row
    // Timers for reading the Routing Table and expire routes
    opentimer_id_t           timerIdRT;              ///< ID of the timer used to read Routing Table.
@@ -229,5 +284,6 @@ void     icmpv6rpl_setDAOPeriod(uint16_t daoPeriod);
 */
 void     routingtable_init(void);
 void     routetable_setRTPeriod(uint16_t RTPeriod);
+bool     routes_getNextHop(open_addr_t* destination, open_addr_t* nextHop);
 
 #endif
@@ -17,6 +17,20 @@ opencoap_vars_t opencoap_vars;
 
 //=========================== prototype =======================================
 
+owerror_t           opencoap_startTransaction(OpenQueueEntry_t* msg, coap_header_iht* request, coap_resource_desc_t* descSender);
+owerror_t           opencoap_transmit(coap_transaction_t* transaction);
+void                opencoap_endTransaction(coap_transaction_t* transaction, owerror_t error);
+void                opencoap_startWaiting(void);
+coap_transaction_t* opencoap_getTransaction(open_addr_t* sender, uint16_t messageID);
+coap_transaction_t* opencoap_getTransactionForMsg(OpenQueueEntry_t* msg);
+uint8_t             opencoap_getNumOutstanding(open_addr_t* destination);
+void                opencoap_timer_cb(opentimer_id_t id);
+void                opencoap_timeout_task(void);
+coap_dedup_t*       opencoap_getDuplicate(open_addr_t* sender, uint16_t messageID);
+void                opencoap_recordReceived(open_addr_t* sender, uint16_t messageID, coap_code_t code);
+void                opencoap_sendAck(OpenQueueEntry_t* msg, coap_header_iht* coap_header, uint8_t creator);
+void                opencoap_notifySendDone(OpenQueueEntry_t* msg, owerror_t error);
+
 //=========================== public ==========================================
 
 //===== from stack
@@ -30,6 +44,13 @@ void opencoap_init() {
    
    // initialize the messageID
    opencoap_vars.messageID     = openrandom_get16b();
+   
+   // no confirmable message sent, no message received yet
+   memset(&opencoap_vars.transactions[0],0,sizeof(opencoap_vars.transactions));
+   memset(&opencoap_vars.dedup[0],0,sizeof(opencoap_vars.dedup));
+   opencoap_vars.dedupNext     = 0;
+   
+   opentimers_tickerInit(&opencoap_vars.retransmitTicker,COAP_TIMEOUT_TICK_MS,opencoap_timer_cb);
 }
 
 /**
@@ -40,16 +61,25 @@ A "CoAP message" is simply a UDP datagram received on the CoAP UDP port.
 This function will call the appropriate resource, and send back its answer. The
 received packetbuffer is reused to contain the response (or error code).
 
+The last COAP_NUMDEDUP POST requests and separate responses received are
+remembered: such a message received again is not handed to the resources, a
+confirmable one is only acknowledged again, with the code of the first
+acknowledgement but without its payload. GET, PUT and DELETE requests are
+idempotent (RFC7252 section 4.5), a duplicate one is handled again so its
+sender gets the full response.
+
 \param[in] msg The received CoAP message.
 */
 void opencoap_receive(OpenQueueEntry_t* msg) {
-   uint16_t                  temp_l4_destination_port;
    uint8_t                   i;
    uint8_t                   index;
    coap_option_t             last_option;
    coap_resource_desc_t*     temp_desc;
    bool                      found;
    owerror_t                 outcome = 0;
+   coap_transaction_t*       transaction;
+   coap_dedup_t*             duplicate;
+   coap_code_t               requestCode;
    // local variables passed to the handlers (with msg)
    coap_header_iht           coap_header;
    coap_option_iht           coap_options[MAX_COAP_OPTIONS];
@@ -85,6 +115,31 @@ void opencoap_receive(OpenQueueEntry_t* msg) {
    memcpy(&coap_header.token[0], &msg->payload[index], coap_header.TKL);
    index += coap_header.TKL;
    
+   // drop a message received again, e.g. because our acknowledgement was lost
+   if (
+         (coap_header.T==COAP_TYPE_CON || coap_header.T==COAP_TYPE_NON) &&
+         coap_header.Code!=COAP_CODE_REQ_GET                            &&
+         coap_header.Code!=COAP_CODE_REQ_PUT                            &&
+         coap_header.Code!=COAP_CODE_REQ_DELETE
+      ) {
+      duplicate = opencoap_getDuplicate(&msg->l3_sourceAdd,coap_header.messageID);
+      if (duplicate!=NULL) {
+         if (coap_header.T==COAP_TYPE_CON) {
+            // reset packet payload (DO NOT DELETE, we will reuse same buffer for the acknowledgement)
+            msg->payload               = &(msg->packet[127]);
+            msg->length                = 0;
+            coap_header.Code           = duplicate->code;
+            if (coap_header.Code==COAP_CODE_EMPTY) {
+               coap_header.TKL         = 0;
+            }
+            opencoap_sendAck(msg,&coap_header,COMPONENT_OPENCOAP);
+         } else {
+            openqueue_freePacketBuffer(msg);
+         }
+         return;
+      }
+   }
+   
    // initialize the coap_options
    for (i=0;i<MAX_COAP_OPTIONS;i++) {
       coap_options[i].type = COAP_OPTION_NONE;
@@ -179,8 +234,36 @@ void opencoap_receive(OpenQueueEntry_t* msg) {
       }
    
    } else {
-      // this is a response: target resource is indicated by token, and message ID
-      // if an ack for a confirmable message, or a reset
+      // this is a response
+      
+      if (coap_header.T==COAP_TYPE_ACK || coap_header.T==COAP_TYPE_RES) {
+         // an ack or a reset: target resource is the one of the confirmable
+         // message it answers, indicated by sender and message ID
+         transaction = opencoap_getTransaction(&msg->l3_sourceAdd,coap_header.messageID);
+         if (transaction!=NULL) {
+            // a piggybacked response carries the token of the request
+            if (
+                  coap_header.Code!=COAP_CODE_EMPTY                                           &&
+                  coap_header.TKL==transaction->TKL                                           &&
+                  memcmp(&coap_header.token[0],&transaction->token[0],coap_header.TKL)==0     &&
+                  transaction->resource->callbackRx!=NULL
+               ) {
+               transaction->resource->callbackRx(msg,&coap_header,&coap_options[0]);
+            }
+            if (coap_header.T==COAP_TYPE_ACK) {
+               opencoap_endTransaction(transaction,E_SUCCESS);
+            } else {
+               opencoap_endTransaction(transaction,E_FAIL);
+            }
+         }
+         // else: not waiting for it, e.g. acknowledged already
+         
+         // free the received packet
+         openqueue_freePacketBuffer(msg);
+         return;
+      }
+      
+      // a separate response: target resource is indicated by token
       // find the resource which matches
       
       // start with the first resource in the linked list
@@ -193,17 +276,10 @@ void opencoap_receive(OpenQueueEntry_t* msg) {
                 coap_header.TKL==temp_desc->last_request.TKL                                       &&
                 memcmp(&coap_header.token[0],&temp_desc->last_request.token[0],coap_header.TKL)==0
             ) {
-                
-            if (coap_header.T==COAP_TYPE_ACK || coap_header.T==COAP_TYPE_RES) {
-                if (coap_header.messageID==temp_desc->last_request.messageID) {
-                    found=TRUE;
-                }
-            } else {
-                found=TRUE;
-            }
+            found=TRUE;
             
             // call the resource's callback
-            if (found==TRUE && temp_desc->callbackRx!=NULL) {
+            if (temp_desc->callbackRx!=NULL) {
                temp_desc->callbackRx(msg,&coap_header,&coap_options[0]);
             }
          }
@@ -218,6 +294,20 @@ void opencoap_receive(OpenQueueEntry_t* msg) {
          }
       };
       
+      if (coap_header.T==COAP_TYPE_CON) {
+         // a separate response: acknowledge it with an empty message
+         opencoap_recordReceived(&msg->l3_sourceAdd,coap_header.messageID,COAP_CODE_EMPTY);
+         msg->payload                  = &(msg->packet[127]);
+         msg->length                   = 0;
+         coap_header.TKL               = 0;
+         coap_header.Code              = COAP_CODE_EMPTY;
+         opencoap_sendAck(msg,&coap_header,COMPONENT_OPENCOAP);
+         return;
+      }
+      if (coap_header.T==COAP_TYPE_NON) {
+         opencoap_recordReceived(&msg->l3_sourceAdd,coap_header.messageID,COAP_CODE_EMPTY);
+      }
+      
       // free the received packet
       openqueue_freePacketBuffer(msg);
       
@@ -227,6 +317,9 @@ void opencoap_receive(OpenQueueEntry_t* msg) {
    
    //=== step 3. ask the resource to prepare response
    
+   // the code of the response replaces the one of the request
+   requestCode = coap_header.Code;
+   
    if (found==TRUE) {
       
       // call the resource's callback
@@ -251,33 +344,15 @@ void opencoap_receive(OpenQueueEntry_t* msg) {
    
    //=== step 4. send that packet back
    
-   // fill in packet metadata
-   if (found==TRUE) {
-      msg->creator                     = temp_desc->componentID;
-   } else {
-      msg->creator                     = COMPONENT_OPENCOAP;
+   // remember a POST, which must not be handled twice, in case it is received again
+   if (requestCode==COAP_CODE_REQ_POST) {
+      opencoap_recordReceived(&msg->l3_sourceAdd,coap_header.messageID,coap_header.Code);
    }
-   msg->l4_protocol                    = IANA_UDP;
-   temp_l4_destination_port            = msg->l4_destination_port;
-   msg->l4_destination_port            = msg->l4_sourcePortORicmpv6Type;
-   msg->l4_sourcePortORicmpv6Type      = temp_l4_destination_port;
    
-   // set destination address as the current source
-   msg->l3_destinationAdd.type         = ADDR_128B;
-   memcpy(&msg->l3_destinationAdd.addr_128b[0],&msg->l3_sourceAdd.addr_128b[0],LENGTH_ADDR128b);
-   
-   // fill in CoAP header
-   packetfunctions_reserveHeaderSize(msg,4+coap_header.TKL);
-   msg->payload[0]                  = (COAP_VERSION    << 6) |
-                                      (COAP_TYPE_ACK   << 4) |
-                                      (coap_header.TKL << 0);
-   msg->payload[1]                  = coap_header.Code;
-   msg->payload[2]                  = coap_header.messageID/256;
-   msg->payload[3]                  = coap_header.messageID%256;
-   memcpy(&msg->payload[4], &coap_header.token[0], coap_header.TKL);
-   
-   if ((openudp_send(msg))==E_FAIL) {
-      openqueue_freePacketBuffer(msg);
+   if (found==TRUE) {
+      opencoap_sendAck(msg,&coap_header,temp_desc->componentID);
+   } else {
+      opencoap_sendAck(msg,&coap_header,COMPONENT_OPENCOAP);
    }
 }
 
@@ -288,11 +363,21 @@ void opencoap_receive(OpenQueueEntry_t* msg) {
 \param[in] error The outcome of the send function.
 */
 void opencoap_sendDone(OpenQueueEntry_t* msg, owerror_t error) {
-   coap_resource_desc_t* temp_resource;
+   coap_transaction_t* transaction;
    
    // take ownership over that packet
    msg->owner = COMPONENT_OPENCOAP;
    
+   // a confirmable message is kept until acknowledged
+   transaction = opencoap_getTransactionForMsg(msg);
+   if (transaction!=NULL) {
+      transaction->inFlight = FALSE;
+      if (transaction->state==COAP_TRANSACTION_DONE) {
+         opencoap_endTransaction(transaction,transaction->outcome);
+      }
+      return;
+   }
+   
    // indicate sendDone to creator of that packet
    //=== mine
    if (msg->creator==COMPONENT_OPENCOAP) {
@@ -300,26 +385,7 @@ void opencoap_sendDone(OpenQueueEntry_t* msg, owerror_t error) {
       return;
    }
    //=== someone else's
-   temp_resource = opencoap_vars.resources;
-   while (temp_resource!=NULL) {
-      if (
-         temp_resource->componentID==msg->creator &&
-         temp_resource->callbackSendDone!=NULL
-         ) {
-         temp_resource->callbackSendDone(msg,error);
-         return;
-      }
-      temp_resource = temp_resource->next;
-   }
-   
-   // if you get here, no valid creator was found
-   
-   openserial_printError(
-      COMPONENT_OPENCOAP,ERR_UNEXPECTED_SENDDONE,
-      (errorparameter_t)0,
-      (errorparameter_t)0
-   );
-   openqueue_freePacketBuffer(msg);
+   opencoap_notifySendDone(msg,error);
 }
 
 //===== from CoAP resources
@@ -414,12 +480,43 @@ void opencoap_register(coap_resource_desc_t* desc) {
    last_elem->next = desc;
 }
 
+/**
+\brief Request a packet buffer for a CoAP request of known maximum size.
+
+A CoAP resource calls this function instead of openqueue_getFreePacketBuffer()
+when its request may not fit in a single frame. The buffer returned then holds
+the whole datagram, which is sent in several fragments.
+
+\param[in] creator The identifier of the calling component.
+\param[in] length The maximum number of bytes the resource writes in the
+   message, i.e. its options and payload. The CoAP header and the headers of the
+   layers below are accounted for by this function.
+
+\returns A pointer to the packet buffer, or NULL when none could be allocated.
+*/
+OpenQueueEntry_t* opencoap_getFreePacketBuffer(uint8_t creator, uint8_t length) {
+   uint16_t size;
+   
+   size = length+4+COAP_MAX_TKL+COAP_LOWERHEADERS_MAXLEN;
+   if (size>0xff) {
+      return NULL;
+   }
+   return openqueue_getFreePacketBufferForLength(creator,(uint8_t)size);
+}
+
 /**
 \brief Send a CoAP request.
 
 This function is called by a CoAP resource when it wants to send some data.
 This function is NOT called for a response.
 
+A confirmable message is kept until it is acknowledged, and retransmitted with
+an exponential back-off meanwhile (RFC7252 section 4.2). The resource's
+callbackSendDone is only called then, with E_SUCCESS when acknowledged, E_FAIL
+when reset or never acknowledged. At most COAP_NSTART confirmable messages are
+outstanding to a same destination, the following ones are sent as soon as one
+of them is acknowledged.
+
 \param[in] msg The message to be sent. This messages should not contain the
    CoAP header.
 \param[in] type The CoAP type of the message.
@@ -477,9 +574,364 @@ owerror_t opencoap_send(
    msg->payload[2]                  = (request->messageID>>8) & 0xff;
    msg->payload[3]                  = (request->messageID>>0) & 0xff;
 
-   memcpy(&msg->payload[4],&token,request->TKL);
+   memcpy(&msg->payload[4],&request->token[0],request->TKL);
    
+   if (type==COAP_TYPE_CON) {
+      return opencoap_startTransaction(msg,request,descSender);
+   }
    return openudp_send(msg);
 }
 
 //=========================== private =========================================
+
+//===== transactions
+
+/**
+\brief Send a confirmable message and keep it until acknowledged.
+
+\param[in] msg The confirmable message, with its CoAP header.
+\param[in] request The CoAP header written in msg.
+\param[in] descSender The CoAP resource sending msg.
+
+\return E_FAIL if it could not be sent, in which case the caller frees msg.
+*/
+owerror_t opencoap_startTransaction(OpenQueueEntry_t* msg, coap_header_iht* request, coap_resource_desc_t* descSender) {
+   uint8_t             i;
+   coap_transaction_t* transaction;
+   
+   // find a free transaction
+   transaction = NULL;
+   for (i=0;i<COAP_NUMTRANSACTIONS;i++) {
+      if (opencoap_vars.transactions[i].state==COAP_TRANSACTION_FREE) {
+         transaction = &opencoap_vars.transactions[i];
+         break;
+      }
+   }
+   if (transaction==NULL) {
+      openserial_printError(
+         COMPONENT_OPENCOAP,ERR_BUSY_SENDING,
+         (errorparameter_t)request->messageID,
+         (errorparameter_t)0
+      );
+      return E_FAIL;
+   }
+   
+   memset(transaction,0,sizeof(coap_transaction_t));
+   transaction->msg             = msg;
+   transaction->creator         = msg->creator;
+   transaction->resource        = descSender;
+   transaction->messageID       = request->messageID;
+   transaction->TKL             = request->TKL;
+   memcpy(&transaction->token[0],&request->token[0],request->TKL);
+   memcpy(&transaction->destination,&msg->l3_destinationAdd,sizeof(open_addr_t));
+   
+   if (opencoap_getNumOutstanding(&transaction->destination)>=COAP_NSTART) {
+      // sent once an outstanding message to that destination is acknowledged
+      transaction->state        = COAP_TRANSACTION_WAITING;
+      return E_SUCCESS;
+   }
+   
+   if (opencoap_transmit(transaction)==E_FAIL) {
+      transaction->state        = COAP_TRANSACTION_FREE;
+      return E_FAIL;
+   }
+   return E_SUCCESS;
+}
+
+/**
+\brief Send the message of a transaction, for the first time or again.
+
+The packet buffer is not freed after a transmission, so a retransmission only
+goes back to the CoAP message, recorded by openudp_send() in l4_payload and
+l4_length, and has the UDP and lower headers written again.
+*/
+owerror_t opencoap_transmit(coap_transaction_t* transaction) {
+   OpenQueueEntry_t* msg;
+   
+   msg = transaction->msg;
+   
+   if (transaction->state==COAP_TRANSACTION_SENT) {
+      msg->owner                   = COMPONENT_OPENCOAP;
+      msg->payload                 = msg->l4_payload;
+      msg->length                  = msg->l4_length;
+      transaction->retransmissions++;
+      transaction->backoffTicks   *= 2;
+   } else {
+      // the first timeout is random between ACK_TIMEOUT and 1.5 times ACK_TIMEOUT
+      transaction->state           = COAP_TRANSACTION_SENT;
+      transaction->backoffTicks    = (
+         COAP_ACK_TIMEOUT_MS+openrandom_get16b()%(COAP_ACK_TIMEOUT_MS/2)
+      )/COAP_TIMEOUT_TICK_MS;
+   }
+   transaction->timeoutTicks       = transaction->backoffTicks+1;
+   opentimers_tickerStart(&opencoap_vars.retransmitTicker);
+   
+   transaction->inFlight           = TRUE;
+   if (openudp_send(msg)==E_FAIL) {
+      // tried again at the next timeout
+      transaction->inFlight        = FALSE;
+      return E_FAIL;
+   }
+   return E_SUCCESS;
+}
+
+/**
+\brief End a transaction and hand its message back to the resource.
+
+If the message is still in the lower layers (e.g. the acknowledgement came
+while it was retransmitted), this happens once it is returned.
+*/
+void opencoap_endTransaction(coap_transaction_t* transaction, owerror_t error) {
+   OpenQueueEntry_t* msg;
+   
+   if (transaction->inFlight==TRUE) {
+      transaction->state           = COAP_TRANSACTION_DONE;
+      transaction->outcome         = error;
+      return;
+   }
+   
+   msg                             = transaction->msg;
+   transaction->state              = COAP_TRANSACTION_FREE;
+   
+   opencoap_startWaiting();
+   opencoap_notifySendDone(msg,error);
+}
+
+/**
+\brief Send the messages held back by COAP_NSTART, which now can be.
+*/
+void opencoap_startWaiting() {
+   uint8_t             i;
+   coap_transaction_t* transaction;
+   
+   for (i=0;i<COAP_NUMTRANSACTIONS;i++) {
+      transaction = &opencoap_vars.transactions[i];
+      if (
+            transaction->state!=COAP_TRANSACTION_WAITING ||
+            opencoap_getNumOutstanding(&transaction->destination)>=COAP_NSTART
+         ) {
+         continue;
+      }
+      if (opencoap_transmit(transaction)==E_FAIL) {
+         // the resource was told the message was sent, tell it otherwise
+         transaction->state        = COAP_TRANSACTION_FREE;
+         opencoap_notifySendDone(transaction->msg,E_FAIL);
+      }
+   }
+}
+
+coap_transaction_t* opencoap_getTransaction(open_addr_t* sender, uint16_t messageID) {
+   uint8_t i;
+   
+   for (i=0;i<COAP_NUMTRANSACTIONS;i++) {
+      if (
+            opencoap_vars.transactions[i].state==COAP_TRANSACTION_SENT &&
+            opencoap_vars.transactions[i].messageID==messageID         &&
+            packetfunctions_sameAddress(&opencoap_vars.transactions[i].destination,sender)
+         ) {
+         return &opencoap_vars.transactions[i];
+      }
+   }
+   return NULL;
+}
+
+coap_transaction_t* opencoap_getTransactionForMsg(OpenQueueEntry_t* msg) {
+   uint8_t i;
+   
+   for (i=0;i<COAP_NUMTRANSACTIONS;i++) {
+      if (
+            opencoap_vars.transactions[i].inFlight==TRUE &&
+            opencoap_vars.transactions[i].msg==msg
+         ) {
+         return &opencoap_vars.transactions[i];
+      }
+   }
+   return NULL;
+}
+
+/**
+\brief Number of confirmable messages sent to a destination and not yet
+   acknowledged.
+*/
+uint8_t opencoap_getNumOutstanding(open_addr_t* destination) {
+   uint8_t i;
+   uint8_t numOutstanding;
+   
+   numOutstanding = 0;
+   for (i=0;i<COAP_NUMTRANSACTIONS;i++) {
+      if (
+            (
+               opencoap_vars.transactions[i].state==COAP_TRANSACTION_SENT ||
+               opencoap_vars.transactions[i].state==COAP_TRANSACTION_DONE
+            ) &&
+            packetfunctions_sameAddress(&opencoap_vars.transactions[i].destination,destination)
+         ) {
+         numOutstanding++;
+      }
+   }
+   return numOutstanding;
+}
+
+//===== retransmission timer
+
+void opencoap_timer_cb(opentimer_id_t id) {
+   scheduler_push_task(opencoap_timeout_task,TASKPRIO_COAP);
+}
+
+/**
+\brief Retransmit the messages whose back-off has elapsed, or give up on them.
+*/
+void opencoap_timeout_task() {
+   uint8_t             i;
+   bool                isOngoing;
+   coap_transaction_t* transaction;
+   
+   for (i=0;i<COAP_NUMTRANSACTIONS;i++) {
+      transaction = &opencoap_vars.transactions[i];
+      if (transaction->state!=COAP_TRANSACTION_SENT) {
+         continue;
+      }
+      if (transaction->timeoutTicks>0) {
+         transaction->timeoutTicks--;
+      }
+      if (transaction->timeoutTicks>0) {
+         continue;
+      }
+      
+      if (transaction->inFlight==TRUE) {
+         if (
+               transaction->msg->owner==COMPONENT_NULL ||
+               transaction->msg->creator!=transaction->creator
+            ) {
+            // the lower layers dropped the message, there is nothing to return
+            transaction->state     = COAP_TRANSACTION_FREE;
+            opencoap_startWaiting();
+         } else {
+            // not sent yet, look again at the next tick
+            transaction->timeoutTicks = 1;
+         }
+         continue;
+      }
+      
+      if (transaction->retransmissions==COAP_MAX_RETRANSMIT) {
+         openserial_printError(
+            COMPONENT_OPENCOAP,ERR_COAP_NOT_ACKNOWLEDGED,
+            (errorparameter_t)transaction->messageID,
+            (errorparameter_t)transaction->retransmissions
+         );
+         opencoap_endTransaction(transaction,E_FAIL);
+         continue;
+      }
+      
+      opencoap_transmit(transaction);
+   }
+   
+   // messages sent while ending a transaction above wait for an ack as well
+   isOngoing = FALSE;
+   for (i=0;i<COAP_NUMTRANSACTIONS;i++) {
+      if (opencoap_vars.transactions[i].state==COAP_TRANSACTION_SENT) {
+         isOngoing = TRUE;
+      }
+   }
+   opentimers_tickerContinue(&opencoap_vars.retransmitTicker,isOngoing);
+}
+
+//===== received messages
+
+coap_dedup_t* opencoap_getDuplicate(open_addr_t* sender, uint16_t messageID) {
+   uint8_t i;
+   
+   for (i=0;i<COAP_NUMDEDUP;i++) {
+      if (
+            opencoap_vars.dedup[i].used==TRUE                  &&
+            opencoap_vars.dedup[i].messageID==messageID        &&
+            packetfunctions_sameAddress(&opencoap_vars.dedup[i].sender,sender)
+         ) {
+         return &opencoap_vars.dedup[i];
+      }
+   }
+   return NULL;
+}
+
+/**
+\brief Remember a received message, overwriting the oldest one remembered.
+*/
+void opencoap_recordReceived(open_addr_t* sender, uint16_t messageID, coap_code_t code) {
+   coap_dedup_t* entry;
+   
+   entry                   = &opencoap_vars.dedup[opencoap_vars.dedupNext];
+   entry->used             = TRUE;
+   memcpy(&entry->sender,sender,sizeof(open_addr_t));
+   entry->messageID        = messageID;
+   entry->code             = code;
+   
+   opencoap_vars.dedupNext = (opencoap_vars.dedupNext+1)%COAP_NUMDEDUP;
+}
+
+/**
+\brief Send an acknowledgement back to the sender of a received message.
+
+\param[in] msg The received message, its payload already replaced by the one
+   of the acknowledgement.
+\param[in] coap_header The CoAP header of the received message, its code and
+   token replaced by the ones of the acknowledgement.
+\param[in] creator The component the acknowledgement is sent for.
+*/
+void opencoap_sendAck(OpenQueueEntry_t* msg, coap_header_iht* coap_header, uint8_t creator) {
+   uint16_t temp_l4_destination_port;
+   
+   // fill in packet metadata
+   msg->creator                        = creator;
+   msg->l4_protocol                    = IANA_UDP;
+   temp_l4_destination_port            = msg->l4_destination_port;
+   msg->l4_destination_port            = msg->l4_sourcePortORicmpv6Type;
+   msg->l4_sourcePortORicmpv6Type      = temp_l4_destination_port;
+   
+   // set destination address as the current source
+   msg->l3_destinationAdd.type         = ADDR_128B;
+   memcpy(&msg->l3_destinationAdd.addr_128b[0],&msg->l3_sourceAdd.addr_128b[0],LENGTH_ADDR128b);
+   
+   // fill in CoAP header
+   packetfunctions_reserveHeaderSize(msg,4+coap_header->TKL);
+   msg->payload[0]                  = (COAP_VERSION     << 6) |
+                                      (COAP_TYPE_ACK    << 4) |
+                                      (coap_header->TKL << 0);
+   msg->payload[1]                  = coap_header->Code;
+   msg->payload[2]                  = coap_header->messageID/256;
+   msg->payload[3]                  = coap_header->messageID%256;
+   memcpy(&msg->payload[4], &coap_header->token[0], coap_header->TKL);
+   
+   if ((openudp_send(msg))==E_FAIL) {
+      openqueue_freePacketBuffer(msg);
+   }
+}
+
+/**
+\brief Hand a message sent by a CoAP resource back to it.
+*/
+void opencoap_notifySendDone(OpenQueueEntry_t* msg, owerror_t error) {
+   coap_resource_desc_t* temp_resource;
+   
+   msg->owner = COMPONENT_OPENCOAP;
+   
+   temp_resource = opencoap_vars.resources;
+   while (temp_resource!=NULL) {
+      if (
+         temp_resource->componentID==msg->creator &&
+         temp_resource->callbackSendDone!=NULL
+         ) {
+         temp_resource->callbackSendDone(msg,error);
+         return;
+      }
+      temp_resource = temp_resource->next;
+   }
+   
+   // if you get here, no valid creator was found
+   
+   openserial_printError(
+      COMPONENT_OPENCOAP,ERR_UNEXPECTED_SENDDONE,
+      (errorparameter_t)0,
+      (errorparameter_t)0
+   );
+   openqueue_freePacketBuffer(msg);
+}
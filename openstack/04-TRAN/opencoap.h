@@ -35,8 +35,31 @@ static const uint8_t ipAddr_ringmaster[] = {0xbb, 0xbb, 0x00, 0x00, 0x00, 0x00,
 
 #define COAP_PAYLOAD_MARKER            0xFF
 
+// worst case of the IPv6 (IPHC, 6LoRH) and UDP headers below a CoAP message
+#define COAP_LOWERHEADERS_MAXLEN       56
+
 #define COAP_VERSION                   1
 
+// the following can be overwritten in board_info.h
+
+// confirmable messages waiting for an acknowledgement, all resources together
+#ifndef COAP_NUMTRANSACTIONS
+#define COAP_NUMTRANSACTIONS           3
+#endif
+// outstanding confirmable messages to a same destination (NSTART, RFC7252 section 4.7)
+#ifndef COAP_NSTART
+#define COAP_NSTART                    1
+#endif
+// received message IDs remembered to detect duplicates
+#ifndef COAP_NUMDEDUP
+#define COAP_NUMDEDUP                  4
+#endif
+
+// transmission parameters (RFC7252 section 4.8)
+#define COAP_ACK_TIMEOUT_MS            2000 // the first timeout is 1 to 1.5 times this
+#define COAP_MAX_RETRANSMIT            4
+#define COAP_TIMEOUT_TICK_MS           250
+
 typedef enum {
    COAP_TYPE_CON                       = 0,
    COAP_TYPE_NON                       = 1,
@@ -104,6 +127,13 @@ typedef enum {
    COAP_MEDTYPE_APPJSON                = 50,
 } coap_media_type_t;
 
+typedef enum {
+   COAP_TRANSACTION_FREE               = 0,
+   COAP_TRANSACTION_WAITING            = 1, // held back by COAP_NSTART
+   COAP_TRANSACTION_SENT               = 2, // waiting for an acknowledgement
+   COAP_TRANSACTION_DONE               = 3, // ended while the message is being sent
+} coap_transaction_state_t;
+
 //=========================== typedef =========================================
 
 typedef struct {
@@ -142,6 +172,29 @@ struct coap_resource_desc_t {
    coap_resource_desc_t* next;
 };
 
+typedef struct {
+   coap_transaction_state_t state;
+   OpenQueueEntry_t*     msg;                    // the confirmable message, kept until the transaction ends
+   uint8_t               creator;
+   coap_resource_desc_t* resource;               // which sent the message
+   open_addr_t           destination;
+   uint16_t              messageID;
+   uint8_t               TKL;
+   uint8_t               token[COAP_MAX_TKL];
+   uint8_t               retransmissions;
+   uint16_t              backoffTicks;           // current retransmission timeout
+   uint16_t              timeoutTicks;           // left until the next retransmission
+   bool                  inFlight;               // msg is in the lower layers
+   owerror_t             outcome;                // when COAP_TRANSACTION_DONE
+} coap_transaction_t;
+
+typedef struct {
+   bool                  used;
+   open_addr_t           sender;
+   uint16_t              messageID;
+   coap_code_t           code;                   // of the acknowledgement sent, COAP_CODE_EMPTY if empty
+} coap_dedup_t;
+
 //=========================== module variables ================================
 
 typedef struct {
@@ -149,6 +202,10 @@ typedef struct {
    bool                  busySending;
    uint8_t               delayCounter;
    uint16_t              messageID;
+   coap_transaction_t    transactions[COAP_NUMTRANSACTIONS];
+   coap_dedup_t          dedup[COAP_NUMDEDUP];
+   uint8_t               dedupNext;              // entry overwritten next
+   opentimers_ticker_t   retransmitTicker;       // for all transactions
 } opencoap_vars_t;
 
 //=========================== prototypes ======================================
@@ -161,6 +218,7 @@ void          opencoap_sendDone(OpenQueueEntry_t* msg, owerror_t error);
 // from CoAP resources
 void          opencoap_writeLinks(OpenQueueEntry_t* msg, uint8_t componentID);
 void          opencoap_register(coap_resource_desc_t* desc);
+OpenQueueEntry_t* opencoap_getFreePacketBuffer(uint8_t creator, uint8_t length);
 owerror_t     opencoap_send(
     OpenQueueEntry_t*     msg,
     coap_type_t           type,
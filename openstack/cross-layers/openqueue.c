@@ -11,7 +11,17 @@ openqueue_vars_t openqueue_vars;
 
 //=========================== prototypes ======================================
 
-void openqueue_reset_entry(OpenQueueEntry_t* entry);
+void    openqueue_reset_entry(OpenQueueEntry_t* entry);
+OpenQueueEntry_t* openqueue_allocateEntry(uint8_t creator, uint8_t sizeClass);
+uint8_t openqueue_entryIndex(OpenQueueEntry_t* entry);
+uint8_t openqueue_entryClass(uint8_t index);
+bool    openqueue_isFree(uint8_t index);
+bool    openqueue_isControl(OpenQueueEntry_t* entry);
+uint8_t openqueue_countInBucket(open_addr_t* toNeighbor, uint8_t list);
+uint8_t openqueue_roundRobinEntry(void);
+void    openqueue_linkEntry(uint8_t index, uint8_t list, bool atHead);
+void    openqueue_unlinkEntry(uint8_t index);
+void    openqueue_releaseEntry(uint8_t index);
 
 //=========================== public ==========================================
 
@@ -22,8 +32,36 @@ void openqueue_reset_entry(OpenQueueEntry_t* entry);
 */
 void openqueue_init() {
    uint8_t i;
+   
+   memset(&openqueue_vars.listHead[0],  OPENQUEUE_NONE,sizeof(openqueue_vars.listHead));
+   memset(&openqueue_vars.listTail[0],  OPENQUEUE_NONE,sizeof(openqueue_vars.listTail));
+   memset(&openqueue_vars.bucketHead[0],OPENQUEUE_NONE,sizeof(openqueue_vars.bucketHead));
+   memset(&openqueue_vars.bucketTail[0],OPENQUEUE_NONE,sizeof(openqueue_vars.bucketTail));
+   memset(&openqueue_vars.stats[0],0,sizeof(openqueue_vars.stats));
+   memset(&openqueue_vars.deficit[0],0,sizeof(openqueue_vars.deficit));
+   openqueue_vars.rrBucket = 0;
+   
    for (i=0;i<QUEUELENGTH;i++){
+      // attach the entry to its buffer
+      if (openqueue_entryClass(i)==OPENQUEUE_CLASS_LARGE) {
+         openqueue_vars.queue[i].packet     = &openqueue_vars.largePacket[i][0];
+         openqueue_vars.queue[i].packetSize = PACKETBUFFER_LARGE_SIZE;
+#if QUEUELENGTH_SMALL>0
+      } else if (openqueue_entryClass(i)==OPENQUEUE_CLASS_SMALL) {
+         openqueue_vars.queue[i].packet     = &openqueue_vars.smallPacket[i-QUEUELENGTH_LARGE][0];
+         openqueue_vars.queue[i].packetSize = PACKETBUFFER_SMALL_SIZE;
+#endif
+#if QUEUELENGTH_DATAGRAM>0
+      } else {
+         openqueue_vars.queue[i].packet     = &openqueue_vars.datagramPacket[i-QUEUELENGTH_LARGE-QUEUELENGTH_SMALL][0];
+         openqueue_vars.queue[i].packetSize = PACKETBUFFER_DATAGRAM_SIZE;
+#endif
+      }
+      openqueue_vars.link[i].list   = OPENQUEUE_LIST_NONE;
+      openqueue_vars.link[i].bucket = OPENQUEUE_NONE;
       openqueue_reset_entry(&(openqueue_vars.queue[i]));
+      // the free lists are indexed by size class
+      openqueue_linkEntry(i,openqueue_entryClass(i),FALSE);
    }
 }
 
@@ -33,16 +71,20 @@ void openqueue_init() {
 debugPrint_* functions are used by the openserial module to continuously print
 status information about several modules in the OpenWSN stack.
 
+The creator/owner of each entry is followed by the occupancy statistics of
+each size class (large, small, then datagram).
+
 \returns TRUE if this function printed something, FALSE otherwise.
 */
 bool debugPrint_queue() {
-   debugOpenQueueEntry_t output[QUEUELENGTH];
+   debugOpenQueue_t output;
    uint8_t i;
    for (i=0;i<QUEUELENGTH;i++) {
-      output[i].creator = openqueue_vars.queue[i].creator;
-      output[i].owner   = openqueue_vars.queue[i].owner;
+      output.entry[i].creator = openqueue_vars.queue[i].creator;
+      output.entry[i].owner   = openqueue_vars.queue[i].owner;
    }
-   openserial_printStatus(STATUS_QUEUE,(uint8_t*)&output,QUEUELENGTH*sizeof(debugOpenQueueEntry_t));
+   memcpy(&output.stats[0],&openqueue_vars.stats[0],sizeof(output.stats));
+   openserial_printStatus(STATUS_QUEUE,(uint8_t*)&output,sizeof(debugOpenQueue_t));
    return TRUE;
 }
 
@@ -57,32 +99,48 @@ get a new packet buffer to start creating a new packet.
 \note Once a packet has been allocated, it is up to the creator of the packet
       to free it using the openqueue_freePacketBuffer() function.
 
+The returned buffer is a large one, which fits any frame.
+
 \returns A pointer to the queue entry when it could be allocated, or NULL when
          it could not be allocated (buffer full or not synchronized).
 */
 OpenQueueEntry_t* openqueue_getFreePacketBuffer(uint8_t creator) {
-   uint8_t i;
-   INTERRUPT_DECLARATION();
-   DISABLE_INTERRUPTS();
+   return openqueue_allocateEntry(creator,OPENQUEUE_CLASS_LARGE);
+}
+
+/**
+\brief Request a new (free) packet buffer for a frame of known maximum size.
+
+Same as openqueue_getFreePacketBuffer(), but a small buffer is returned when
+the frame fits in it. When no small buffer is free, a large one is returned.
+
+A datagram buffer is returned when the frame does not fit in a large buffer.
+Such a packet is sent in several fragments by the frag module, the MAC never
+gets the buffer itself.
+
+\param creator The identifier of the component, taken in COMPONENT_*.
+\param length  The maximum number of bytes the frame carries above the
+   IEEE802.15.4 MAC header, i.e. the (header and payload) IEs and MAC payload.
+   The MAC header, security overhead and CRC are accounted for by this function.
+
+\returns A pointer to the queue entry when it could be allocated, or NULL when
+         it could not be allocated (buffer full or not synchronized).
+*/
+OpenQueueEntry_t* openqueue_getFreePacketBufferForLength(uint8_t creator, uint8_t length) {
+   uint16_t room;
    
-   // refuse to allocate if we're not in sync
-   if (ieee154e_isSynch()==FALSE && creator > COMPONENT_IEEE802154E){
-     ENABLE_INTERRUPTS();
-     return NULL;
+   // the frame is built downwards from the initial payload pointer (see
+   // openqueue_reset_entry()), the MIC and CRC go above it
+   room = length+OPENQUEUE_MAXMACHEADER_LEN+IEEE802154_SECURITY_HEADER_LEN;
+   if (room<=PACKETBUFFER_SMALL_SIZE-3-IEEE802154_SECURITY_TAG_LEN) {
+      return openqueue_allocateEntry(creator,OPENQUEUE_CLASS_SMALL);
    }
-   
-   // if you get here, I will try to allocate a buffer for you
-   
-   // walk through queue and find free entry
-   for (i=0;i<QUEUELENGTH;i++) {
-      if (openqueue_vars.queue[i].owner==COMPONENT_NULL) {
-         openqueue_vars.queue[i].creator=creator;
-         openqueue_vars.queue[i].owner=COMPONENT_OPENQUEUE;
-         ENABLE_INTERRUPTS(); 
-         return &openqueue_vars.queue[i];
-      }
+   if (room<=PACKETBUFFER_LARGE_SIZE-3-IEEE802154_SECURITY_TAG_LEN) {
+      return openqueue_allocateEntry(creator,OPENQUEUE_CLASS_LARGE);
+   }
+   if (room<=PACKETBUFFER_DATAGRAM_SIZE-3-IEEE802154_SECURITY_TAG_LEN) {
+      return openqueue_allocateEntry(creator,OPENQUEUE_CLASS_DATAGRAM);
    }
-   ENABLE_INTERRUPTS();
    return NULL;
 }
 
@@ -99,18 +157,18 @@ owerror_t openqueue_freePacketBuffer(OpenQueueEntry_t* pkt) {
    uint8_t i;
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
-   for (i=0;i<QUEUELENGTH;i++) {
-      if (&openqueue_vars.queue[i]==pkt) {
-         if (openqueue_vars.queue[i].owner==COMPONENT_NULL) {
-            // log the error
-            openserial_printCritical(COMPONENT_OPENQUEUE,ERR_FREEING_UNUSED,
-                                  (errorparameter_t)0,
-                                  (errorparameter_t)0);
-         }
-         openqueue_reset_entry(&(openqueue_vars.queue[i]));
-         ENABLE_INTERRUPTS();
-         return E_SUCCESS;
+   i = openqueue_entryIndex(pkt);
+   if (i!=OPENQUEUE_NONE) {
+      if (openqueue_isFree(i)==TRUE) {
+         // log the error
+         openserial_printCritical(COMPONENT_OPENQUEUE,ERR_FREEING_UNUSED,
+                               (errorparameter_t)0,
+                               (errorparameter_t)0);
+      } else {
+         openqueue_releaseEntry(i);
       }
+      ENABLE_INTERRUPTS();
+      return E_SUCCESS;
    }
    // log the error
    openserial_printCritical(COMPONENT_OPENQUEUE,ERR_FREEING_ERROR,
@@ -130,8 +188,11 @@ void openqueue_removeAllCreatedBy(uint8_t creator) {
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    for (i=0;i<QUEUELENGTH;i++){
-      if (openqueue_vars.queue[i].creator==creator) {
-         openqueue_reset_entry(&(openqueue_vars.queue[i]));
+      if (
+            openqueue_vars.queue[i].creator==creator &&
+            openqueue_isFree(i)==FALSE
+         ) {
+         openqueue_releaseEntry(i);
       }
    }
    ENABLE_INTERRUPTS();
@@ -147,95 +208,274 @@ void openqueue_removeAllOwnedBy(uint8_t owner) {
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
    for (i=0;i<QUEUELENGTH;i++){
-      if (openqueue_vars.queue[i].owner==owner) {
-         openqueue_reset_entry(&(openqueue_vars.queue[i]));
+      if (
+            openqueue_vars.queue[i].owner==owner &&
+            openqueue_isFree(i)==FALSE
+         ) {
+         openqueue_releaseEntry(i);
       }
    }
    ENABLE_INTERRUPTS();
 }
 
+/**
+\brief Hand a packet buffer over to another component.
+
+Any change of owner from or to one of the virtual components
+COMPONENT_SIXTOP_TO_IEEE802154E and COMPONENT_IEEE802154E_TO_SIXTOP MUST go
+through this function, so the packet is (un)linked from the list those
+components are served from. Other changes of owner can be done by writing
+pkt->owner directly.
+
+A packet returned to COMPONENT_SIXTOP_TO_IEEE802154E by the MAC (i.e. to be
+retransmitted) goes back to the head of the list, so it is sent before
+packets queued after it. It keeps the time it was first queued at, which
+openqueue_sixtopDropStale() looks at.
+
+Packets handed to the MAC are queued in one of three classes: EBs, control
+packets (KAs, 6P and RPL) and data packets.
+
+\param pkt   The packet buffer to hand over.
+\param owner The identifier of the new owner, taken in COMPONENT_*.
+*/
+void openqueue_changeOwner(OpenQueueEntry_t* pkt, uint8_t owner) {
+   uint8_t i;
+   bool    atHead;
+   uint8_t list;
+   uint8_t asn[5];
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   i = openqueue_entryIndex(pkt);
+   if (i==OPENQUEUE_NONE || openqueue_isFree(i)==TRUE) {
+      openserial_printCritical(COMPONENT_OPENQUEUE,ERR_UNKNOWN_PACKET_BUFFER,
+                            (errorparameter_t)owner,
+                            (errorparameter_t)0);
+      ENABLE_INTERRUPTS();
+      return;
+   }
+   
+   // unlink from the list of the previous owner (if any)
+   openqueue_unlinkEntry(i);
+   atHead     = (pkt->owner==COMPONENT_IEEE802154E);
+   pkt->owner = owner;
+   
+   // link into the list of the new owner (if any)
+   switch (owner) {
+      case COMPONENT_SIXTOP_TO_IEEE802154E:
+         if (
+               pkt->creator==COMPONENT_SIXTOP &&
+               packetfunctions_isBroadcastMulticast(&(pkt->l2_nextORpreviousHop))==TRUE
+            ) {
+            list = OPENQUEUE_LIST_MACTXEB;
+         } else if (openqueue_isControl(pkt)==TRUE) {
+            list = OPENQUEUE_LIST_MACTXCTRL;
+         } else {
+            list = OPENQUEUE_LIST_MACTX;
+         }
+         if (atHead==FALSE) {
+            // record when the packet was queued
+            ieee154e_getAsn(asn);
+            openqueue_vars.link[i].enqueued.bytes0and1 = ((uint16_t) asn[1] << 8) | ((uint16_t) asn[0]);
+            openqueue_vars.link[i].enqueued.bytes2and3 = ((uint16_t) asn[3] << 8) | ((uint16_t) asn[2]);
+            openqueue_vars.link[i].enqueued.byte4      = asn[4];
+         }
+         openqueue_linkEntry(i,list,atHead);
+         break;
+      case COMPONENT_IEEE802154E_TO_SIXTOP:
+         if (pkt->creator==COMPONENT_IEEE802154E) {
+            openqueue_linkEntry(i,OPENQUEUE_LIST_RECEIVED,FALSE);
+         } else {
+            openqueue_linkEntry(i,OPENQUEUE_LIST_SENT,FALSE);
+         }
+         break;
+      default:
+         break;
+   }
+   
+   ENABLE_INTERRUPTS();
+}
+
 //======= called by RES
 
 OpenQueueEntry_t* openqueue_sixtopGetSentPacket() {
    uint8_t i;
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
-   for (i=0;i<QUEUELENGTH;i++) {
-      if (openqueue_vars.queue[i].owner==COMPONENT_IEEE802154E_TO_SIXTOP &&
-          openqueue_vars.queue[i].creator!=COMPONENT_IEEE802154E) {
-         ENABLE_INTERRUPTS();
-         return &openqueue_vars.queue[i];
-      }
-   }
+   i = openqueue_vars.listHead[OPENQUEUE_LIST_SENT];
    ENABLE_INTERRUPTS();
-   return NULL;
+   if (i==OPENQUEUE_NONE) {
+      return NULL;
+   }
+   return &openqueue_vars.queue[i];
 }
 
 OpenQueueEntry_t* openqueue_sixtopGetReceivedPacket() {
    uint8_t i;
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
+   i = openqueue_vars.listHead[OPENQUEUE_LIST_RECEIVED];
+   ENABLE_INTERRUPTS();
+   if (i==OPENQUEUE_NONE) {
+      return NULL;
+   }
+   return &openqueue_vars.queue[i];
+}
+
+/**
+\brief Count the packets waiting for the MAC to send them to a neighbor.
+
+\param[in] toNeighbor The EUI64 address of that neighbor.
+
+\returns The number of packets unicast to that neighbor in the queue.
+*/
+uint8_t openqueue_getNumPacketsTo(open_addr_t* toNeighbor) {
+   uint8_t numPackets;
+   INTERRUPT_DECLARATION();
+   
+   DISABLE_INTERRUPTS();
+   numPackets = openqueue_countInBucket(toNeighbor,OPENQUEUE_LIST_NONE);
+   ENABLE_INTERRUPTS();
+   return numPackets;
+}
+
+/**
+\brief Check whether a packet can be handed to the MAC.
+
+A data packet is refused when OPENQUEUE_MAXPERNEIGHBOR data packets already
+wait for the MAC to send them to its next hop, so a neighbor which does not
+acknowledge can not hold all the buffers. Control packets and packets not
+unicast to an EUI64 address are always accepted.
+
+\param[in] pkt The packet about to be handed to the MAC, its next hop filled in.
+
+\returns TRUE if the packet can be queued, FALSE otherwise.
+*/
+bool openqueue_sixtopCanEnqueue(OpenQueueEntry_t* pkt) {
+   uint8_t numPackets;
+   INTERRUPT_DECLARATION();
+   
+   if (
+         pkt->l2_nextORpreviousHop.type!=ADDR_64B ||
+         openqueue_isControl(pkt)==TRUE
+      ) {
+      return TRUE;
+   }
+   
+   DISABLE_INTERRUPTS();
+   numPackets = openqueue_countInBucket(&(pkt->l2_nextORpreviousHop),OPENQUEUE_LIST_MACTX);
+   ENABLE_INTERRUPTS();
+   return (numPackets<OPENQUEUE_MAXPERNEIGHBOR);
+}
+
+/**
+\brief Hand back to sixtop the packets which waited too long for the MAC.
+
+A packet queued for more than OPENQUEUE_STALE_SLOTS slots, e.g. to a parent
+which went away, is moved to the list of sent packets with l2_sendDoneError set
+to E_FAIL, so it gets back to its creator as if the MAC had given up on it.
+Packets the MAC is busy sending are not in the queues looked at.
+
+\returns The number of packets dropped, i.e. how many times the caller has to
+   run task_sixtopNotifSendDone().
+*/
+uint8_t openqueue_sixtopDropStale() {
+   uint8_t i;
+   uint8_t list;
+   uint8_t numDropped;
+   INTERRUPT_DECLARATION();
+   
+   numDropped = 0;
+   DISABLE_INTERRUPTS();
    for (i=0;i<QUEUELENGTH;i++) {
-      if (openqueue_vars.queue[i].owner==COMPONENT_IEEE802154E_TO_SIXTOP &&
-          openqueue_vars.queue[i].creator==COMPONENT_IEEE802154E) {
-         ENABLE_INTERRUPTS();
-         return &openqueue_vars.queue[i];
+      list = openqueue_vars.link[i].list;
+      if (
+            (
+               list==OPENQUEUE_LIST_MACTX      ||
+               list==OPENQUEUE_LIST_MACTXCTRL  ||
+               list==OPENQUEUE_LIST_MACTXEB
+            )                                                                 &&
+            ieee154e_asnDiff(&openqueue_vars.link[i].enqueued)>=OPENQUEUE_STALE_SLOTS
+         ) {
+         openserial_printError(COMPONENT_OPENQUEUE,ERR_STALE_PACKET,
+                               (errorparameter_t)openqueue_vars.queue[i].creator,
+                               (errorparameter_t)OPENQUEUE_STALE_SLOTS);
+         openqueue_unlinkEntry(i);
+         openqueue_vars.queue[i].owner            = COMPONENT_IEEE802154E_TO_SIXTOP;
+         openqueue_vars.queue[i].l2_sendDoneError = E_FAIL;
+         openqueue_linkEntry(i,OPENQUEUE_LIST_SENT,FALSE);
+         numDropped++;
       }
    }
    ENABLE_INTERRUPTS();
-   return NULL;
+   return numDropped;
 }
 
 //======= called by IEEE80215E
 
+/**
+\brief Get the next packet to send in a cell.
+
+In a cell to a given neighbor, control packets to that neighbor are sent before
+data packets to it.
+
+In an anycast cell, control packets are sent first. Data packets are then taken
+from the neighbor buckets in turn (see openqueue_roundRobinEntry()), so a
+neighbor with many packets queued does not hold back the packets to the others.
+
+\param[in] toNeighbor The neighbor of the cell, or an anycast address.
+
+\returns The packet to send, or NULL if there is none.
+*/
 OpenQueueEntry_t* openqueue_macGetDataPacket(open_addr_t* toNeighbor) {
    uint8_t i;
+   uint8_t found;
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
+   found = OPENQUEUE_NONE;
    if (toNeighbor->type==ADDR_64B) {
       // a neighbor is specified, look for a packet unicast to that neigbhbor
-      for (i=0;i<QUEUELENGTH;i++) {
-         if (openqueue_vars.queue[i].owner==COMPONENT_SIXTOP_TO_IEEE802154E &&
-            packetfunctions_sameAddress(toNeighbor,&openqueue_vars.queue[i].l2_nextORpreviousHop)) {
-            ENABLE_INTERRUPTS();
-            return &openqueue_vars.queue[i];
+      i = openqueue_vars.bucketHead[toNeighbor->addr_64b[7] & (OPENQUEUE_NUMNEIGHBORBUCKETS-1)];
+      while (i!=OPENQUEUE_NONE) {
+         if (packetfunctions_sameAddress(toNeighbor,&openqueue_vars.queue[i].l2_nextORpreviousHop)) {
+            if (openqueue_vars.link[i].list==OPENQUEUE_LIST_MACTXCTRL) {
+               found = i;
+               break;
+            }
+            if (found==OPENQUEUE_NONE) {
+               found = i;
+            }
          }
+         i = openqueue_vars.link[i].bucketNext;
       }
    } else if (toNeighbor->type==ADDR_ANYCAST) {
-      // anycast case: look for a packet which is either not created by RES
-      // or an KA (created by RES, but not broadcast)
-      for (i=0;i<QUEUELENGTH;i++) {
-         if (openqueue_vars.queue[i].owner==COMPONENT_SIXTOP_TO_IEEE802154E &&
-             ( openqueue_vars.queue[i].creator!=COMPONENT_SIXTOP ||
-                (
-                   openqueue_vars.queue[i].creator==COMPONENT_SIXTOP &&
-                   packetfunctions_isBroadcastMulticast(&(openqueue_vars.queue[i].l2_nextORpreviousHop))==FALSE
-                )
-             )
-            ) {
-            ENABLE_INTERRUPTS();
-            return &openqueue_vars.queue[i];
-         }
+      // anycast case: anything but an EB, control packets first
+      found = openqueue_vars.listHead[OPENQUEUE_LIST_MACTXCTRL];
+      if (found==OPENQUEUE_NONE) {
+         found = openqueue_roundRobinEntry();
+      }
+      if (found==OPENQUEUE_NONE) {
+         // all buckets are empty, send the data packets not unicast to an EUI64
+         found = openqueue_vars.listHead[OPENQUEUE_LIST_MACTX];
       }
    }
    ENABLE_INTERRUPTS();
-   return NULL;
+   if (found==OPENQUEUE_NONE) {
+      return NULL;
+   }
+   return &openqueue_vars.queue[found];
 }
 
 OpenQueueEntry_t* openqueue_macGetEBPacket() {
    uint8_t i;
    INTERRUPT_DECLARATION();
    DISABLE_INTERRUPTS();
-   for (i=0;i<QUEUELENGTH;i++) {
-      if (openqueue_vars.queue[i].owner==COMPONENT_SIXTOP_TO_IEEE802154E &&
-          openqueue_vars.queue[i].creator==COMPONENT_SIXTOP              &&
-          packetfunctions_isBroadcastMulticast(&(openqueue_vars.queue[i].l2_nextORpreviousHop))) {
-         ENABLE_INTERRUPTS();
-         return &openqueue_vars.queue[i];
-      }
-   }
+   i = openqueue_vars.listHead[OPENQUEUE_LIST_MACTXEB];
    ENABLE_INTERRUPTS();
-   return NULL;
+   if (i==OPENQUEUE_NONE) {
+      return NULL;
+   }
+   return &openqueue_vars.queue[i];
 }
 
 //=========================== private =========================================
@@ -244,7 +484,7 @@ void openqueue_reset_entry(OpenQueueEntry_t* entry) {
    //admin
    entry->creator                      = COMPONENT_NULL;
    entry->owner                        = COMPONENT_NULL;
-   entry->payload                      = &(entry->packet[127 - IEEE802154_SECURITY_TAG_LEN]); // Footer is longer if security is used
+   entry->payload                      = &(entry->packet[entry->packetSize-3 - IEEE802154_SECURITY_TAG_LEN]); // Footer is longer if security is used
    entry->length                       = 0;
    //l4
    entry->l4_protocol                  = IANA_UNDEFINED;
@@ -260,3 +500,299 @@ void openqueue_reset_entry(OpenQueueEntry_t* entry) {
    //l2-security
    entry->l2_securityLevel             = 0;
 }
+
+/**
+\brief Allocate an entry of a given size class.
+
+Falls back to a large entry when no small one is free. Datagram entries are
+only handed out when asked for.
+
+\returns The entry, or NULL when none could be allocated.
+*/
+OpenQueueEntry_t* openqueue_allocateEntry(uint8_t creator, uint8_t sizeClass) {
+   openqueue_classStats_t* stats;
+   uint8_t i;
+   INTERRUPT_DECLARATION();
+   DISABLE_INTERRUPTS();
+   
+   // refuse to allocate if we're not in sync
+   if (ieee154e_isSynch()==FALSE && creator > COMPONENT_IEEE802154E){
+     ENABLE_INTERRUPTS();
+     return NULL;
+   }
+   
+   // if you get here, I will try to allocate a buffer for you
+   
+   // take the first entry of the free list of that class
+   i = openqueue_vars.listHead[sizeClass];
+   if (i==OPENQUEUE_NONE && sizeClass==OPENQUEUE_CLASS_SMALL) {
+      // no buffer of that class left, use a large one
+      stats = &openqueue_vars.stats[sizeClass];
+      i     = openqueue_vars.listHead[OPENQUEUE_CLASS_LARGE];
+      if (i!=OPENQUEUE_NONE && stats->numSpilled<0xff) {
+         stats->numSpilled++;
+      }
+   }
+   if (i==OPENQUEUE_NONE) {
+      stats = &openqueue_vars.stats[sizeClass];
+      if (stats->numFailed<0xff) {
+         stats->numFailed++;
+      }
+      ENABLE_INTERRUPTS();
+      return NULL;
+   }
+   
+   openqueue_unlinkEntry(i);
+   openqueue_vars.queue[i].creator=creator;
+   openqueue_vars.queue[i].owner=COMPONENT_OPENQUEUE;
+   
+   // maintain the occupancy statistics of the class of the buffer handed out
+   stats = &openqueue_vars.stats[openqueue_entryClass(i)];
+   stats->numInUse++;
+   if (stats->numInUse>stats->maxInUse) {
+      stats->maxInUse = stats->numInUse;
+   }
+   
+   ENABLE_INTERRUPTS();
+   return &openqueue_vars.queue[i];
+}
+
+/**
+\brief Get the index of a packet buffer in the queue.
+
+\returns The index, or OPENQUEUE_NONE if the pointer is not a packet buffer.
+*/
+uint8_t openqueue_entryIndex(OpenQueueEntry_t* entry) {
+   uint8_t i;
+   
+   if (entry<&openqueue_vars.queue[0] || entry>&openqueue_vars.queue[QUEUELENGTH-1]) {
+      return OPENQUEUE_NONE;
+   }
+   i = (uint8_t)(entry-&openqueue_vars.queue[0]);
+   if (&openqueue_vars.queue[i]!=entry) {
+      return OPENQUEUE_NONE;
+   }
+   return i;
+}
+
+/**
+\brief Get the size class of an entry, i.e. OPENQUEUE_CLASS_*.
+*/
+uint8_t openqueue_entryClass(uint8_t index) {
+   if (index<QUEUELENGTH_LARGE) {
+      return OPENQUEUE_CLASS_LARGE;
+   }
+   if (index<QUEUELENGTH_LARGE+QUEUELENGTH_SMALL) {
+      return OPENQUEUE_CLASS_SMALL;
+   }
+   return OPENQUEUE_CLASS_DATAGRAM;
+}
+
+/**
+\brief Check whether an entry is linked in one of the free lists.
+*/
+bool openqueue_isFree(uint8_t index) {
+   return (
+      openqueue_vars.link[index].list==OPENQUEUE_LIST_FREE      ||
+      openqueue_vars.link[index].list==OPENQUEUE_LIST_FREESMALL ||
+      openqueue_vars.link[index].list==OPENQUEUE_LIST_FREEDATAGRAM
+   );
+}
+
+/**
+\brief Check whether a packet belongs to the control class, i.e. is a KA, a 6P
+   or an RPL packet.
+*/
+bool openqueue_isControl(OpenQueueEntry_t* entry) {
+   return (
+      entry->creator==COMPONENT_SIXTOP     ||
+      entry->creator==COMPONENT_SIXTOP_RES ||
+      entry->creator==COMPONENT_ICMPv6RPL
+   );
+}
+
+/**
+\brief Count the entries of a list unicast to a neighbor.
+
+Must be called with interrupts disabled.
+
+\param[in] toNeighbor The EUI64 address of that neighbor.
+\param[in] list       OPENQUEUE_LIST_MACTX or OPENQUEUE_LIST_MACTXCTRL, or
+   OPENQUEUE_LIST_NONE to count the entries of both.
+*/
+uint8_t openqueue_countInBucket(open_addr_t* toNeighbor, uint8_t list) {
+   uint8_t i;
+   uint8_t numPackets;
+   
+   numPackets = 0;
+   if (toNeighbor->type!=ADDR_64B) {
+      return numPackets;
+   }
+   
+   i = openqueue_vars.bucketHead[toNeighbor->addr_64b[7] & (OPENQUEUE_NUMNEIGHBORBUCKETS-1)];
+   while (i!=OPENQUEUE_NONE) {
+      if (
+            (list==OPENQUEUE_LIST_NONE || openqueue_vars.link[i].list==list) &&
+            packetfunctions_sameAddress(toNeighbor,&openqueue_vars.queue[i].l2_nextORpreviousHop)
+         ) {
+         numPackets++;
+      }
+      i = openqueue_vars.link[i].bucketNext;
+   }
+   return numPackets;
+}
+
+/**
+\brief Pick the data packet to send in an anycast cell.
+
+Deficit round robin between the neighbor buckets: each time its turn comes, a
+non-empty bucket is credited OPENQUEUE_DRR_QUANTUM bytes, and keeps the turn
+while its next packet fits in its credit. A bucket gets the same share of the
+anycast cells whether it holds one packet or many. The buckets are hashed on the
+next hop, neighbors sharing a bucket share its turn.
+
+Must be called with interrupts disabled, and only when no control packet is
+queued, so the bucket heads are data packets.
+
+\returns The index of the entry, or OPENQUEUE_NONE if all buckets are empty.
+*/
+uint8_t openqueue_roundRobinEntry() {
+   uint8_t bucket;
+   uint8_t i;
+   uint8_t n;
+   
+   for (n=0;n<=OPENQUEUE_NUMNEIGHBORBUCKETS;n++) {
+      bucket = openqueue_vars.rrBucket;
+      i      = openqueue_vars.bucketHead[bucket];
+      if (i==OPENQUEUE_NONE) {
+         // an empty bucket does not save up credit
+         openqueue_vars.deficit[bucket] = 0;
+      } else if (openqueue_vars.deficit[bucket]>=openqueue_vars.queue[i].length) {
+         openqueue_vars.deficit[bucket] -= openqueue_vars.queue[i].length;
+         return i;
+      }
+      // give the turn to the next bucket
+      bucket                  = (bucket+1) & (OPENQUEUE_NUMNEIGHBORBUCKETS-1);
+      openqueue_vars.rrBucket = bucket;
+      if (openqueue_vars.bucketHead[bucket]!=OPENQUEUE_NONE) {
+         openqueue_vars.deficit[bucket] += OPENQUEUE_DRR_QUANTUM;
+      }
+   }
+   return OPENQUEUE_NONE;
+}
+
+/**
+\brief Append (or prepend) an entry to a list.
+
+Unicast MAC TX entries (data and control) are also linked in the bucket of
+their next hop.
+*/
+void openqueue_linkEntry(uint8_t index, uint8_t list, bool atHead) {
+   openqueue_link_t* link;
+   open_addr_t*      nextHop;
+   uint8_t           bucket;
+   
+   link       = &openqueue_vars.link[index];
+   link->list = list;
+   
+   if (atHead==TRUE) {
+      link->prev = OPENQUEUE_NONE;
+      link->next = openqueue_vars.listHead[list];
+      if (link->next==OPENQUEUE_NONE) {
+         openqueue_vars.listTail[list]                = index;
+      } else {
+         openqueue_vars.link[link->next].prev         = index;
+      }
+      openqueue_vars.listHead[list]                   = index;
+   } else {
+      link->next = OPENQUEUE_NONE;
+      link->prev = openqueue_vars.listTail[list];
+      if (link->prev==OPENQUEUE_NONE) {
+         openqueue_vars.listHead[list]                = index;
+      } else {
+         openqueue_vars.link[link->prev].next         = index;
+      }
+      openqueue_vars.listTail[list]                   = index;
+   }
+   
+   nextHop = &openqueue_vars.queue[index].l2_nextORpreviousHop;
+   if (
+         (list!=OPENQUEUE_LIST_MACTX && list!=OPENQUEUE_LIST_MACTXCTRL) ||
+         nextHop->type!=ADDR_64B
+      ) {
+      return;
+   }
+   
+   bucket       = nextHop->addr_64b[7] & (OPENQUEUE_NUMNEIGHBORBUCKETS-1);
+   link->bucket = bucket;
+   if (atHead==TRUE) {
+      link->bucketPrev = OPENQUEUE_NONE;
+      link->bucketNext = openqueue_vars.bucketHead[bucket];
+      if (link->bucketNext==OPENQUEUE_NONE) {
+         openqueue_vars.bucketTail[bucket]            = index;
+      } else {
+         openqueue_vars.link[link->bucketNext].bucketPrev = index;
+      }
+      openqueue_vars.bucketHead[bucket]               = index;
+   } else {
+      link->bucketNext = OPENQUEUE_NONE;
+      link->bucketPrev = openqueue_vars.bucketTail[bucket];
+      if (link->bucketPrev==OPENQUEUE_NONE) {
+         openqueue_vars.bucketHead[bucket]            = index;
+      } else {
+         openqueue_vars.link[link->bucketPrev].bucketNext = index;
+      }
+      openqueue_vars.bucketTail[bucket]               = index;
+   }
+}
+
+/**
+\brief Remove an entry from the list (and bucket) it is linked in, if any.
+*/
+void openqueue_unlinkEntry(uint8_t index) {
+   openqueue_link_t* link;
+   
+   link = &openqueue_vars.link[index];
+   
+   if (link->list!=OPENQUEUE_LIST_NONE) {
+      if (link->prev==OPENQUEUE_NONE) {
+         openqueue_vars.listHead[link->list]          = link->next;
+      } else {
+         openqueue_vars.link[link->prev].next         = link->next;
+      }
+      if (link->next==OPENQUEUE_NONE) {
+         openqueue_vars.listTail[link->list]          = link->prev;
+      } else {
+         openqueue_vars.link[link->next].prev         = link->prev;
+      }
+      link->list = OPENQUEUE_LIST_NONE;
+   }
+   
+   if (link->bucket!=OPENQUEUE_NONE) {
+      if (link->bucketPrev==OPENQUEUE_NONE) {
+         openqueue_vars.bucketHead[link->bucket]      = link->bucketNext;
+      } else {
+         openqueue_vars.link[link->bucketPrev].bucketNext = link->bucketNext;
+      }
+      if (link->bucketNext==OPENQUEUE_NONE) {
+         openqueue_vars.bucketTail[link->bucket]      = link->bucketPrev;
+      } else {
+         openqueue_vars.link[link->bucketNext].bucketPrev = link->bucketPrev;
+      }
+      link->bucket = OPENQUEUE_NONE;
+   }
+}
+
+/**
+\brief Reset an allocated entry and give it back to the free list.
+*/
+void openqueue_releaseEntry(uint8_t index) {
+   uint8_t sizeClass;
+   
+   sizeClass = openqueue_entryClass(index);
+   openqueue_unlinkEntry(index);
+   openqueue_reset_entry(&(openqueue_vars.queue[index]));
+   // the free lists are indexed by size class
+   openqueue_linkEntry(index,sizeClass,FALSE);
+   openqueue_vars.stats[sizeClass].numInUse--;
+}
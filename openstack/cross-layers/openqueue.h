@@ -13,7 +13,67 @@
 
 //=========================== define ==========================================
 
-#define QUEUELENGTH  10
+#ifndef QUEUELENGTH
+#define QUEUELENGTH  10                     // can be overwritten in board_info.h, max. 254
+#endif
+#ifndef QUEUELENGTH_SMALL
+#define QUEUELENGTH_SMALL  3                // how many of the QUEUELENGTH entries have a small buffer, can be overwritten in board_info.h
+#endif
+#ifndef QUEUELENGTH_DATAGRAM
+#define QUEUELENGTH_DATAGRAM  2             // how many of the QUEUELENGTH entries have a datagram buffer, can be overwritten in board_info.h
+#endif
+#define QUEUELENGTH_LARGE  (QUEUELENGTH-QUEUELENGTH_SMALL-QUEUELENGTH_DATAGRAM)
+
+// largest IEEE802.15.4 MAC header: FCF, DSN, dest PANID, 64b dest and source addresses
+#define OPENQUEUE_MAXMACHEADER_LEN    (2+1+2+8+8)
+
+#define OPENQUEUE_NONE                0xff  // "no entry" list index
+#define OPENQUEUE_NUMNEIGHBORBUCKETS  8     // must be a power of 2
+#define OPENQUEUE_DRR_QUANTUM         127   // bytes credited to a bucket per round, at least the largest frame
+
+/**
+\brief Number of slots a packet can wait for the MAC before it is dropped. Can
+   be overwritten in board_info.h.
+
+The default is 30s with 10ms slots. Packets the MAC already tried to send are
+dropped after the same time, counted from when they were first queued.
+*/
+#ifndef OPENQUEUE_STALE_SLOTS
+#define OPENQUEUE_STALE_SLOTS         3000
+#endif
+
+/**
+\brief Number of data packets which can wait for the MAC to send them to the
+   same neighbor. Can be overwritten in board_info.h.
+
+Keeps a neighbor which does not acknowledge from taking all the buffers. Control
+packets (EB, KA, 6P, RPL) are not limited.
+*/
+#ifndef OPENQUEUE_MAXPERNEIGHBOR
+#define OPENQUEUE_MAXPERNEIGHBOR      (QUEUELENGTH/2)
+#endif
+
+// size classes of the packet buffers
+enum {
+   OPENQUEUE_CLASS_LARGE               = 0, // PACKETBUFFER_LARGE_SIZE bytes, fits any frame
+   OPENQUEUE_CLASS_SMALL               = 1, // PACKETBUFFER_SMALL_SIZE bytes, for short frames (ACKs, KAs, 6P)
+   OPENQUEUE_CLASS_DATAGRAM            = 2, // PACKETBUFFER_DATAGRAM_SIZE bytes, for datagrams larger than a frame (never handed to the MAC)
+   OPENQUEUE_CLASS_MAX                 = 3,
+};
+
+// lists an entry can be linked in, depending on its (virtual) owner
+enum {
+   OPENQUEUE_LIST_FREE                 = 0, // not allocated, large buffer (same value as OPENQUEUE_CLASS_LARGE)
+   OPENQUEUE_LIST_FREESMALL            = 1, // not allocated, small buffer (same value as OPENQUEUE_CLASS_SMALL)
+   OPENQUEUE_LIST_FREEDATAGRAM         = 2, // not allocated, datagram buffer (same value as OPENQUEUE_CLASS_DATAGRAM)
+   OPENQUEUE_LIST_MACTX                = 3, // COMPONENT_SIXTOP_TO_IEEE802154E, data
+   OPENQUEUE_LIST_MACTXEB              = 4, // COMPONENT_SIXTOP_TO_IEEE802154E, EBs
+   OPENQUEUE_LIST_SENT                 = 5, // COMPONENT_IEEE802154E_TO_SIXTOP, sent by the MAC
+   OPENQUEUE_LIST_RECEIVED             = 6, // COMPONENT_IEEE802154E_TO_SIXTOP, received by the MAC
+   OPENQUEUE_LIST_MACTXCTRL            = 7, // COMPONENT_SIXTOP_TO_IEEE802154E, KAs, 6P and RPL
+   OPENQUEUE_LIST_MAX                  = 8,
+   OPENQUEUE_LIST_NONE                 = OPENQUEUE_NONE, // owned by a regular component
+};
 
 //=========================== typedef =========================================
 
@@ -22,10 +82,47 @@ typedef struct {
    uint8_t  owner;
 } debugOpenQueueEntry_t;
 
+typedef struct {
+   uint8_t  list;                           // OPENQUEUE_LIST_* this entry is linked in
+   uint8_t  next;                           // next entry in that list
+   uint8_t  prev;                           // previous entry in that list
+   uint8_t  bucket;                         // neighbor bucket this entry is linked in
+   uint8_t  bucketNext;                     // next entry in that bucket
+   uint8_t  bucketPrev;                     // previous entry in that bucket
+   asn_t    enqueued;                       // when handed to the MAC for the first time
+} openqueue_link_t;
+
+typedef struct {
+   uint8_t  numInUse;                       // buffers of this class currently allocated
+   uint8_t  maxInUse;                       // highest numInUse since boot
+   uint8_t  numSpilled;                     // requests served from the large class for lack of a buffer of this class
+   uint8_t  numFailed;                      // requests which could not be served at all
+} openqueue_classStats_t;
+
+typedef struct {
+   debugOpenQueueEntry_t  entry[QUEUELENGTH];
+   openqueue_classStats_t stats[OPENQUEUE_CLASS_MAX];
+} debugOpenQueue_t;
+
 //=========================== module variables ================================
 
 typedef struct {
-   OpenQueueEntry_t queue[QUEUELENGTH];
+   OpenQueueEntry_t queue[QUEUELENGTH];                     // QUEUELENGTH_LARGE large entries, then the small ones, then the datagram ones
+   uint8_t          largePacket[QUEUELENGTH_LARGE][PACKETBUFFER_LARGE_SIZE];
+#if QUEUELENGTH_SMALL>0
+   uint8_t          smallPacket[QUEUELENGTH_SMALL][PACKETBUFFER_SMALL_SIZE];
+#endif
+#if QUEUELENGTH_DATAGRAM>0
+   uint8_t          datagramPacket[QUEUELENGTH_DATAGRAM][PACKETBUFFER_DATAGRAM_SIZE];
+#endif
+   openqueue_link_t link[QUEUELENGTH];                      // one per entry in queue
+   uint8_t          listHead[OPENQUEUE_LIST_MAX];
+   uint8_t          listTail[OPENQUEUE_LIST_MAX];
+   uint8_t          bucketHead[OPENQUEUE_NUMNEIGHBORBUCKETS]; // unicast MACTX(CTRL) entries, by next hop
+   uint8_t          bucketTail[OPENQUEUE_NUMNEIGHBORBUCKETS];
+   uint16_t         deficit[OPENQUEUE_NUMNEIGHBORBUCKETS];    // bytes each bucket can still send in anycast cells
+   uint8_t          rrBucket;                                 // bucket served by the round robin
+   openqueue_classStats_t stats[OPENQUEUE_CLASS_MAX];
 } openqueue_vars_t;
 
 //=========================== prototypes ======================================
@@ -35,12 +132,17 @@ void               openqueue_init(void);
 bool               debugPrint_queue(void);
 // called by any component
 OpenQueueEntry_t*  openqueue_getFreePacketBuffer(uint8_t creator);
+OpenQueueEntry_t*  openqueue_getFreePacketBufferForLength(uint8_t creator, uint8_t length);
 owerror_t         openqueue_freePacketBuffer(OpenQueueEntry_t* pkt);
 void               openqueue_removeAllCreatedBy(uint8_t creator);
 void               openqueue_removeAllOwnedBy(uint8_t owner);
+void               openqueue_changeOwner(OpenQueueEntry_t* pkt, uint8_t owner);
 // called by res
 OpenQueueEntry_t*  openqueue_sixtopGetSentPacket(void);
 OpenQueueEntry_t*  openqueue_sixtopGetReceivedPacket(void);
+uint8_t            openqueue_getNumPacketsTo(open_addr_t* toNeighbor);
+bool               openqueue_sixtopCanEnqueue(OpenQueueEntry_t* pkt);
+uint8_t            openqueue_sixtopDropStale(void);
 // called by IEEE80215E
 OpenQueueEntry_t*  openqueue_macGetDataPacket(open_addr_t* toNeighbor);
 OpenQueueEntry_t*  openqueue_macGetEBPacket(void);
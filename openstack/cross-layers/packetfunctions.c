@@ -1,12 +1,14 @@
 #include "packetfunctions.h"
 #include "openserial.h"
 #include "idmanager.h"
+#include "openhdlc.h"
 
 //=========================== variables =======================================
 
 //=========================== prototypes ======================================
 
-void onesComplementSum(uint8_t* global_sum, uint8_t* ptr, int length);
+uint32_t onesComplementSum(uint8_t* ptr, uint16_t length);
+uint16_t onesComplementFold(uint32_t sum);
 
 //=========================== public ==========================================
 
@@ -289,7 +291,7 @@ void packetfunctions_tossHeader(OpenQueueEntry_t* pkt, uint8_t header_length) {
    pkt->payload += header_length;
    pkt->length  -= header_length;
    //printf ("!!! tossHeader -- pkt->payload %X || pkt->packet %X\n",(uint8_t*)(pkt->payload),(uint8_t*)(pkt->packet));
-   if ( (uint8_t*)(pkt->payload) > (uint8_t*)(pkt->packet+126) ) {
+   if ( (uint8_t*)(pkt->payload) > (uint8_t*)(pkt->packet+pkt->packetSize-4) ) {
       //printf ("!!! Error packetfunctions_tossHeader!!!\n");
       openserial_printError(COMPONENT_PACKETFUNCTIONS,ERR_HEADER_TOO_LONG,
                             (errorparameter_t)1,
@@ -299,7 +301,10 @@ void packetfunctions_tossHeader(OpenQueueEntry_t* pkt, uint8_t header_length) {
 
 void packetfunctions_reserveFooterSize(OpenQueueEntry_t* pkt, uint8_t header_length) {
    pkt->length  += header_length;
-   if (pkt->length>127) {
+   if (
+         pkt->length>127 ||
+         (uint8_t*)(pkt->payload+pkt->length) > (uint8_t*)(pkt->packet+pkt->packetSize-1)
+      ) {
       openserial_printError(COMPONENT_PACKETFUNCTIONS,ERR_HEADER_TOO_LONG,
                             (errorparameter_t)2,
                             (errorparameter_t)pkt->length);
@@ -320,8 +325,16 @@ void packetfunctions_tossFooter(OpenQueueEntry_t* pkt, uint8_t header_length) {
 // updating pointers to the new memory location. Used to make a local copy of
 // the frame before transmission (where it can possibly be encrypted). 
 void packetfunctions_duplicatePacket(OpenQueueEntry_t* dst, OpenQueueEntry_t* src) {
-   // make a copy of the frame
+   uint8_t* dstPacket;
+   uint8_t  dstPacketSize;
+   
+   // make a copy of the frame, into dst's own buffer (at least src->packetSize bytes)
+   dstPacket     = dst->packet;
+   dstPacketSize = dst->packetSize;
    memcpy(dst, src, sizeof(OpenQueueEntry_t));
+   dst->packet     = dstPacket;
+   dst->packetSize = dstPacketSize;
+   memcpy(dst->packet, src->packet, src->packetSize);
 
    // Calculate where payload starts in the buffer
    dst->payload = &dst->packet[src->payload - src->packet]; // update pointers
@@ -346,19 +359,11 @@ void packetfunctions_duplicatePacket(OpenQueueEntry_t* dst, OpenQueueEntry_t* sr
 
 void packetfunctions_calculateCRC(OpenQueueEntry_t* msg) {
    uint16_t crc;
-   uint8_t  i;
-   uint8_t  count;
+   
    crc = 0;
-   for (count=1;count<msg->length-2;count++) {
-      crc = crc ^ (uint8_t)*(msg->payload+count);
-      //crc = crc ^ (uint16_t)*ptr++ << 8;
-      for (i=0;i<8;i++) {
-         if (crc & 0x1) {
-            crc = crc >> 1 ^ 0x8408;
-         } else {
-            crc = crc >> 1;
-         }
-      }
+   if (msg->length>3) {
+      // the first byte (the length) is not covered
+      crc = crcUpdate(crc,msg->payload+1,msg->length-3);
    }
    *(msg->payload+(msg->length-2)) = crc%256;
    *(msg->payload+(msg->length-1)) = crc/256;
@@ -366,19 +371,10 @@ void packetfunctions_calculateCRC(OpenQueueEntry_t* msg) {
 
 bool packetfunctions_checkCRC(OpenQueueEntry_t* msg) {
    uint16_t crc;
-   uint8_t  i;
-   uint8_t  count;
+   
    crc = 0;
-   for (count=0;count<msg->length-2;count++) {
-      crc = crc ^ (uint8_t)*(msg->payload+count);
-      //crc = crc ^ (uint16_t)*ptr++ << 8;
-      for (i=0;i<8;i++) {
-         if (crc & 0x1) {
-            crc = crc >> 1 ^ 0x8408;
-         } else {
-            crc = crc >> 1;
-         }
-      }
+   if (msg->length>2) {
+      crc = crcUpdate(crc,msg->payload,msg->length-2);
    }
    if (*(msg->payload+(msg->length-2))==crc%256 &&
        *(msg->payload+(msg->length-1))==crc/256) {
@@ -393,31 +389,23 @@ bool packetfunctions_checkCRC(OpenQueueEntry_t* msg) {
 //see http://www-net.cs.umass.edu/kurose/transport/UDP.html, or http://tools.ietf.org/html/rfc1071
 //see http://en.wikipedia.org/wiki/User_Datagram_Protocol#IPv6_PSEUDO-HEADER
 void packetfunctions_calculateChecksum(OpenQueueEntry_t* msg, uint8_t* checksum_ptr) {
-   uint8_t temp_checksum[2];
-   uint8_t little_helper[2];
-   
-   // initialize running checksum
-   temp_checksum[0]  = 0;
-   temp_checksum[1]  = 0;
+   uint32_t sum;
+   uint16_t checksum;
    
    //===== IPv6 pseudo header
    
    // source address (prefix and EUI64)
-   onesComplementSum(temp_checksum,(idmanager_getMyID(ADDR_PREFIX))->prefix,8);
-   onesComplementSum(temp_checksum,(idmanager_getMyID(ADDR_64B))->addr_64b,8);
+   sum  = onesComplementSum((idmanager_getMyID(ADDR_PREFIX))->prefix,8);
+   sum += onesComplementSum((idmanager_getMyID(ADDR_64B))->addr_64b,8);
    
    // destination address
-   onesComplementSum(temp_checksum,msg->l3_destinationAdd.addr_128b,16);
+   sum += onesComplementSum(msg->l3_destinationAdd.addr_128b,16);
    
    // length
-   little_helper[0] = 0;
-   little_helper[1] = msg->length;
-   onesComplementSum(temp_checksum,little_helper,2);
+   sum += msg->length;
    
    // next header
-   little_helper[0] = 0;
-   little_helper[1] = msg->l4_protocol;
-   onesComplementSum(temp_checksum,little_helper,2);
+   sum += msg->l4_protocol;
    
    //===== payload
    
@@ -425,31 +413,37 @@ void packetfunctions_calculateChecksum(OpenQueueEntry_t* msg, uint8_t* checksum_
    *checksum_ptr     = 0;
    *(checksum_ptr+1) = 0;
    
-   onesComplementSum(temp_checksum,msg->payload,msg->length);
-   temp_checksum[0] ^= 0xFF;
-   temp_checksum[1] ^= 0xFF;
+   sum += onesComplementSum(msg->payload,msg->length);
+   checksum = ~onesComplementFold(sum);
    
    //write in packet
-   *checksum_ptr     = temp_checksum[0];
-   *(checksum_ptr+1) = temp_checksum[1];
+   *checksum_ptr     = (checksum>>8) & 0xFF;
+   *(checksum_ptr+1) = checksum & 0xFF;
 }
 
+/**
+\brief Update a checksum after a 16-bit word of the data it covers changed.
 
-void onesComplementSum(uint8_t* global_sum, uint8_t* ptr, int length) {
-   uint32_t sum = 0xFFFF & (global_sum[0]<<8 | global_sum[1]);
-   while (length>1) {
-      sum     += 0xFFFF & (*ptr<<8 | *(ptr+1));
-      ptr     += 2;
-      length  -= 2;
-   }
-   if (length) {
-      sum     += (0xFF & *ptr)<<8;
-   }
-   while (sum>>16) {
-      sum      = (sum & 0xFFFF)+(sum >> 16);
-   }
-   global_sum[0] = (sum>>8) & 0xFF;
-   global_sum[1] = sum & 0xFF;
+This avoids going over the whole packet again when only a header field is
+rewritten (RFC1624). A field at an odd offset in the checksummed data is
+passed shifted left by 8 bits.
+
+\param checksum_ptr Where the checksum is in the packet, in network order.
+\param oldValue     The previous value of the word.
+\param newValue     The new value of the word.
+*/
+void packetfunctions_updateChecksum(uint8_t* checksum_ptr, uint16_t oldValue, uint16_t newValue) {
+   uint32_t sum;
+   uint16_t checksum;
+   
+   // HC' = ~(~HC + ~m + m')
+   checksum = packetfunctions_ntohs(checksum_ptr);
+   sum      = (uint16_t)~checksum;
+   sum     += (uint16_t)~oldValue;
+   sum     += newValue;
+   checksum = ~onesComplementFold(sum);
+   
+   packetfunctions_htons(checksum,checksum_ptr);
 }
 
 //======= endianness
@@ -481,3 +475,43 @@ uint32_t packetfunctions_ntohl( uint8_t* src ) {
 }
 
 //=========================== private =========================================
+
+/**
+\brief Sum a buffer as 16-bit big-endian words, padded with a zero byte if
+   needed.
+
+The high and low bytes of the words are summed separately, one byte at a time,
+so neither alignment nor carry handling is needed in the loop.
+
+\param ptr    The buffer.
+\param length Its length, at most 512 bytes.
+
+\returns The sum, to be folded with onesComplementFold().
+*/
+uint32_t onesComplementSum(uint8_t* ptr, uint16_t length) {
+   uint16_t sumHigh;
+   uint16_t sumLow;
+   
+   sumHigh = 0;
+   sumLow  = 0;
+   while (length>1) {
+      sumHigh += *ptr;
+      sumLow  += *(ptr+1);
+      ptr     += 2;
+      length  -= 2;
+   }
+   if (length) {
+      sumHigh += *ptr;
+   }
+   return (((uint32_t)sumHigh)<<8) + sumLow;
+}
+
+/**
+\brief Fold the carries of a sum into its 16 low bits.
+*/
+uint16_t onesComplementFold(uint32_t sum) {
+   while (sum>>16) {
+      sum      = (sum & 0xFFFF)+(sum >> 16);
+   }
+   return (uint16_t)sum;
+}
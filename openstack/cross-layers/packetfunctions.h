@@ -49,6 +49,7 @@ bool     packetfunctions_checkCRC(OpenQueueEntry_t* msg);
 
 // calculate checksum
 void     packetfunctions_calculateChecksum(OpenQueueEntry_t* msg, uint8_t* checksum_ptr);
+void     packetfunctions_updateChecksum(uint8_t* checksum_ptr, uint16_t oldValue, uint16_t newValue);
 
 // endianness
 void     packetfunctions_htons( uint16_t val, uint8_t* dest );
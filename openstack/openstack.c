@@ -22,9 +22,11 @@
 #include "schedule.h"
 #include "sixtop.h"
 #include "neighbors.h"
+#include "otf.h"
 //-- 03a-IPHC
 #include "openbridge.h"
 #include "iphc.h"
+#include "frag.h"
 //-- 03b-IPv6
 #include "forwarding.h"
 #include "icmpv6.h"
@@ -64,9 +66,11 @@ void openstack_init(void) {
    schedule_init();
    sixtop_init();
    neighbors_init();
+   otf_init();
    //-- 03a-IPHC
    openbridge_init();
    iphc_init();
+   frag_init();
    //-- 03b-IPv6
    forwarding_init();
    icmpv6_init();
@@ -8,16 +8,23 @@
 Load this program on your boards. Radio LED will stay on indefinitely if all
 tests passed. If there was an error, we use the Error LED to signal.
 
+The benchmarks leave the CPU cycles spent per 127-byte frame in benchmark_vars,
+to be read with a debugger. They are derived from the 32kHz bsp_timer, so set
+BENCHMARK_CPU_FREQ_HZ to the core clock of the board.
+
 \author Malisa Vucinic <malishav@gmail.com>, March 2015.
 */
 
 #include "stdint.h"
 #include "stdio.h"
+#include "string.h"
 // bsp modules required
 #include "board.h"
 #include "crypto_engine.h"
 #include "leds.h"
 #include "bsp_timer.h"
+#include "aes_ecb.h"
+#include "aes_ttable.h"
 
 #define TEST_AES_ECB                   1
 #define TEST_AES_CCMS_ENC              1
@@ -27,6 +34,19 @@ tests passed. If there was an error, we use the Error LED to signal.
 #define TEST_AES_CTR                   1
 #define TEST_AES_CBC                   1
 #define TEST_BENCHMARK_CCMS            1
+#define TEST_BENCHMARK_AES_ECB         1
+
+#define BENCHMARK_NUM_FRAMES           16
+#define BENCHMARK_FRAME_LEN            127
+#define BENCHMARK_CCMS_A_LEN           30
+#define BENCHMARK_CCMS_TAG_LEN         4
+#define BENCHMARK_CCMS_M_LEN           (BENCHMARK_FRAME_LEN-BENCHMARK_CCMS_A_LEN-BENCHMARK_CCMS_TAG_LEN)
+#define BENCHMARK_CCMS_L               2
+#define BENCHMARK_ECB_NUM_BLOCKS       ((BENCHMARK_FRAME_LEN+15)/16)
+
+#ifndef BENCHMARK_CPU_FREQ_HZ
+#define BENCHMARK_CPU_FREQ_HZ          32000000
+#endif
 
 typedef struct {
    uint8_t key[16];
@@ -91,6 +111,15 @@ typedef struct
    uint8_t expected_ciphertext[16];
 } aes_cbc_suite_t;
 
+typedef struct {
+   uint32_t ccms_enc_cycles;     // CCM* forward transformation of a frame
+   uint32_t ccms_dec_cycles;     // CCM* inverse transformation of a frame
+   uint32_t ecb_bytewise_cycles; // aes_ecb_enc() over a frame, block by block
+   uint32_t ecb_ttable_cycles;   // aes_ttable_enc() over a frame, block by block
+} benchmark_vars_t;
+
+benchmark_vars_t benchmark_vars;
+
 static int hang(uint8_t error_code) {
 
    error_code ? leds_error_on() : leds_radio_on();
@@ -257,6 +286,109 @@ static owerror_t run_aes_cbc_suite(aes_cbc_suite_t* suite, uint8_t test_suite_le
 }
 #endif /* TEST_AES_CBC */
 
+#if TEST_BENCHMARK_CCMS || TEST_BENCHMARK_AES_ECB
+/**
+\brief Convert the bsp_timer ticks spent on BENCHMARK_NUM_FRAMES frames into
+   CPU cycles per frame.
+*/
+static uint32_t benchmark_cyclesPerFrame(uint32_t ticks) {
+   // the bsp_timer runs at 32768Hz; split the division to stay within 32 bits
+   return (ticks * (BENCHMARK_CPU_FREQ_HZ / 1024)) / (32 * BENCHMARK_NUM_FRAMES);
+}
+#endif /* TEST_BENCHMARK_CCMS || TEST_BENCHMARK_AES_ECB */
+
+#if TEST_BENCHMARK_CCMS
+static owerror_t run_benchmark_ccms(void) {
+   uint8_t a[BENCHMARK_CCMS_A_LEN];
+   uint8_t m[BENCHMARK_CCMS_M_LEN + BENCHMARK_CCMS_TAG_LEN];
+   uint8_t c[BENCHMARK_CCMS_M_LEN + BENCHMARK_CCMS_TAG_LEN];
+   uint8_t nonce[] = { 0x00, 0x00, 0xf0, 0xe0, 0xd0, 0xc0, 0xb0, 0xa0, 0x00, 0x00, 0x00, 0x00, 0x05 };
+   uint8_t key[16] = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+   uint8_t len_m;
+   uint8_t i;
+   uint8_t fail = 0;
+   PORT_TIMER_WIDTH time1;
+   PORT_TIMER_WIDTH time2;
+   
+   memset(a, 0xfe, BENCHMARK_CCMS_A_LEN);
+   
+   // forward transformation, keeping the last ciphertext for the inverse one
+   time1 = bsp_timer_get_currentValue();
+   for (i = 0; i < BENCHMARK_NUM_FRAMES; i++) {
+      memset(c, 0xab, BENCHMARK_CCMS_M_LEN);
+      len_m = BENCHMARK_CCMS_M_LEN;
+      if (CRYPTO_ENGINE.aes_ccms_enc(a,
+                                       BENCHMARK_CCMS_A_LEN,
+                                       c,
+                                       &len_m,
+                                       nonce,
+                                       BENCHMARK_CCMS_L,
+                                       key,
+                                       BENCHMARK_CCMS_TAG_LEN) != E_SUCCESS) {
+         fail++;
+      }
+   }
+   time2 = bsp_timer_get_currentValue();
+   benchmark_vars.ccms_enc_cycles = benchmark_cyclesPerFrame((PORT_TIMER_WIDTH)(time2 - time1));
+   
+   // inverse transformation
+   time1 = bsp_timer_get_currentValue();
+   for (i = 0; i < BENCHMARK_NUM_FRAMES; i++) {
+      memcpy(m, c, BENCHMARK_CCMS_M_LEN + BENCHMARK_CCMS_TAG_LEN);
+      len_m = BENCHMARK_CCMS_M_LEN + BENCHMARK_CCMS_TAG_LEN;
+      if (CRYPTO_ENGINE.aes_ccms_dec(a,
+                                       BENCHMARK_CCMS_A_LEN,
+                                       m,
+                                       &len_m,
+                                       nonce,
+                                       BENCHMARK_CCMS_L,
+                                       key,
+                                       BENCHMARK_CCMS_TAG_LEN) != E_SUCCESS) {
+         fail++;
+      }
+   }
+   time2 = bsp_timer_get_currentValue();
+   benchmark_vars.ccms_dec_cycles = benchmark_cyclesPerFrame((PORT_TIMER_WIDTH)(time2 - time1));
+   
+   return fail == 0 ? E_SUCCESS : E_FAIL;
+}
+#endif /* TEST_BENCHMARK_CCMS */
+
+#if TEST_BENCHMARK_AES_ECB
+/**
+\brief Compare the two software block ciphers, independently of the crypto
+   engine in use.
+*/
+static void run_benchmark_aes_ecb(void) {
+   uint8_t buffer[16];
+   uint8_t key[16] = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+   uint8_t i;
+   uint8_t j;
+   PORT_TIMER_WIDTH time1;
+   PORT_TIMER_WIDTH time2;
+   
+   memset(buffer, 0xab, 16);
+   
+   time1 = bsp_timer_get_currentValue();
+   for (i = 0; i < BENCHMARK_NUM_FRAMES; i++) {
+      for (j = 0; j < BENCHMARK_ECB_NUM_BLOCKS; j++) {
+         aes_ecb_enc(buffer, key);
+      }
+   }
+   time2 = bsp_timer_get_currentValue();
+   benchmark_vars.ecb_bytewise_cycles = benchmark_cyclesPerFrame((PORT_TIMER_WIDTH)(time2 - time1));
+   
+   time1 = bsp_timer_get_currentValue();
+   for (i = 0; i < BENCHMARK_NUM_FRAMES; i++) {
+      for (j = 0; j < BENCHMARK_ECB_NUM_BLOCKS; j++) {
+         aes_ttable_enc(buffer, key);
+      }
+   }
+   time2 = bsp_timer_get_currentValue();
+   benchmark_vars.ecb_ttable_cycles = benchmark_cyclesPerFrame((PORT_TIMER_WIDTH)(time2 - time1));
+}
+#endif /* TEST_BENCHMARK_AES_ECB */
+
 /**
 \brief The program starts executing here.
 */
@@ -495,66 +627,15 @@ int mote_main(void) {
 #endif /* TEST_AES_CBC */
 
 #if TEST_BENCHMARK_CCMS
-
-#define A_LEN 30
-#define M_LEN 91
-#define TAG_LEN 4
-#define L 2
-
-   uint8_t a[A_LEN];
-   uint8_t m[M_LEN + TAG_LEN];
-   uint8_t nonce[] = { 0x00, 0x00, 0xf0, 0xe0, 0xd0, 0xc0, 0xb0, 0xa0, 0x00, 0x00, 0x00, 0x00, 0x05 };
-   uint8_t key[16] = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-   uint8_t len_m = M_LEN;
-   uint8_t ret;
-
-   memset(a, 0xfe, A_LEN);
-   memset(m, 0xab, M_LEN);
-   
-   PORT_TIMER_WIDTH time1 = 0;
-   PORT_TIMER_WIDTH time2 = 0;
-   PORT_TIMER_WIDTH enc = 0;
-   PORT_TIMER_WIDTH dec = 0;
-
-   time1 = bsp_timer_get_currentValue();
-   ret = CRYPTO_ENGINE.aes_ccms_enc(a,
-                                       A_LEN,
-                                       m,
-                                       &len_m,
-                                       nonce,
-                                       L,
-                                       key,
-                                       TAG_LEN);
-   time2 = bsp_timer_get_currentValue();
-
-   if (ret == E_SUCCESS) {
-      enc = time2 - time1;
-   }
-   else {
-      fail++;
-   }
-
-   time1 = bsp_timer_get_currentValue();
-   ret = CRYPTO_ENGINE.aes_ccms_dec(a,
-                                       A_LEN,
-                                       m,
-                                       &len_m,
-                                       nonce,
-                                       L,
-                                       key,
-                                       TAG_LEN);
-   time2 = bsp_timer_get_currentValue();
-
-   if (ret == E_SUCCESS) {
-      dec = time2 - time1;
-   }
-   else {
+   if (run_benchmark_ccms() == E_FAIL) {
       fail++;
    }
-
-   time1 = enc + dec; // to avoid compiler warnings
 #endif /* TEST_BENCHMARK_CCMS */
 
+#if TEST_BENCHMARK_AES_ECB
+   run_benchmark_aes_ecb();
+#endif /* TEST_BENCHMARK_AES_ECB */
+
    return hang(fail);
 }
 
@@ -163,8 +163,8 @@ void task_uploadPacket(){
 void openbridge_triggerData(void){return;}
 
 void sixtop_setEBPeriod(uint8_t ebPeriod){return;}
-void sixtop_addORremoveCellByInfo(uint8_t code,open_addr_t* neighbor,cellInfo_ht* cellInfo){return;}
-void sixtop_request(uint8_t code,open_addr_t* neighbor, uint8_t numCells){return;}
+owerror_t sixtop_addORremoveCellByInfo(uint8_t code,open_addr_t* neighbor,cellInfo_ht* cellInfo){return E_FAIL;}
+owerror_t sixtop_request(uint8_t code,open_addr_t* neighbor, uint8_t numCells){return E_FAIL;}
 void sixtop_setHandler(six2six_handler_t handler){return;}
 void sixtop_setIsResponseEnabled(bool isEnabled){return;}
 void ieee154e_setSingleChannel(uint8_t channel){return;}